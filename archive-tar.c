@@ -4,6 +4,7 @@
 #include "cache.h"
 #include "tar.h"
 #include "archive.h"
+#include "streaming.h"
 
 #define RECORDSIZE	(512)
 #define BLOCKSIZE	(RECORDSIZE * 20)
@@ -24,12 +25,11 @@ static void write_if_needed(void)
 
 /*
  * queues up writes, so that all our write(2) calls write exactly one
- * full block; pads writes to RECORDSIZE
+ * full block
  */
-static void write_blocked(const void *data, unsigned long size)
+static void do_write_blocked(const void *data, unsigned long size)
 {
 	const char *buf = data;
-	unsigned long tail;
 
 	if (offset) {
 		unsigned long chunk = BLOCKSIZE - offset;
@@ -50,6 +50,11 @@ static void write_blocked(const void *data, unsigned long size)
 		memcpy(block + offset, buf, size);
 		offset += size;
 	}
+}
+
+static void finish_record(void)
+{
+	unsigned long tail;
 	tail = offset % RECORDSIZE;
 	if (tail)  {
 		memset(block + offset, 0, RECORDSIZE - tail);
@@ -58,6 +63,36 @@ static void write_blocked(const void *data, unsigned long size)
 	write_if_needed();
 }
 
+/* like do_write_blocked(), but pads the write to RECORDSIZE */
+static void write_blocked(const void *data, unsigned long size)
+{
+	do_write_blocked(data, size);
+	finish_record();
+}
+
+/*
+ * Like write_blocked(), but with the contents of the blob "sha1", read
+ * a piece at a time.
+ */
+static int stream_blocked(const unsigned char *sha1)
+{
+	struct git_istream *st;
+	enum object_type type;
+	unsigned long sz;
+	char buf[BLOCKSIZE];
+	ssize_t readlen;
+
+	st = open_istream(sha1, &type, &sz);
+	if (!st)
+		return error("cannot stream blob %s", sha1_to_hex(sha1));
+	while ((readlen = read_istream(st, buf, sizeof(buf))) > 0)
+		do_write_blocked(buf, readlen);
+	close_istream(st);
+	if (!readlen)
+		finish_record();
+	return readlen;
+}
+
 /*
  * The end of tar archives is marked by 2*512 nul bytes and after that
  * follows the rest of the block (if any).
@@ -202,8 +237,12 @@ static int write_tar_entry(struct archiver_args *args,
 	}
 	strbuf_release(&ext_header);
 	write_blocked(&header, sizeof(header));
-	if (S_ISREG(mode) && buffer && size > 0)
-		write_blocked(buffer, size);
+	if (S_ISREG(mode) && size > 0) {
+		if (buffer)
+			write_blocked(buffer, size);
+		else
+			err = stream_blocked(sha1);
+	}
 	return err;
 }
 
@@ -134,6 +134,7 @@ static int write_zip_entry(struct archiver_args *args,
 	int method;
 	unsigned char *out;
 	void *deflated = NULL;
+	void *to_free = NULL;
 
 	crc = crc32(0, NULL, 0);
 
@@ -149,6 +150,17 @@ static int write_zip_entry(struct archiver_args *args,
 		uncompressed_size = 0;
 		compressed_size = 0;
 	} else if (S_ISREG(mode) || S_ISLNK(mode)) {
+		/*
+		 * The CRC and the compressed size go in front of the
+		 * data, so a blob handed to us unread is read whole.
+		 */
+		if (!buffer && size) {
+			enum object_type type;
+			buffer = to_free = read_sha1_file(sha1, &type, &size);
+			if (!buffer)
+				return error("cannot read %s",
+					     sha1_to_hex(sha1));
+		}
 		method = 0;
 		attr2 = S_ISLNK(mode) ? ((mode | 0777) << 16) :
 			(mode & 0111) ? ((mode) << 16) : 0;
@@ -229,6 +241,7 @@ static int write_zip_entry(struct archiver_args *args,
 	}
 
 	free(deflated);
+	free(to_free);
 
 	return 0;
 }
@@ -136,6 +136,20 @@ static int write_archive_entry(const unsigned char *sha1, const char *base,
 		return (S_ISDIR(mode) ? READ_TREE_RECURSIVE : 0);
 	}
 
+	/*
+	 * A large blob that needs no conversion is handed to the
+	 * backend unread, with its size, so that it can be streamed.
+	 */
+	if (S_ISREG(mode) && !convert &&
+	    sha1_object_info(sha1, &size) == OBJ_BLOB &&
+	    size >= big_file_threshold &&
+	    !would_convert_to_working_tree(path_without_prefix)) {
+		if (args->verbose)
+			fprintf(stderr, "%.*s\n", (int)path.len, path.buf);
+		return write_entry(args, sha1, path.buf, path.len, mode,
+				   NULL, size);
+	}
+
 	buffer = sha1_file_to_archive(path_without_prefix, sha1, mode,
 			&type, &size, convert ? args->commit : NULL);
 	if (!buffer)
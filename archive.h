@@ -16,6 +16,10 @@ struct archiver_args {
 
 typedef int (*write_archive_fn_t)(struct archiver_args *);
 
+/*
+ * For a regular file, "buffer" may be NULL while "size" is not zero;
+ * the backend then reads the blob "sha1" itself.
+ */
 typedef int (*write_archive_entry_fn_t)(struct archiver_args *args, const unsigned char *sha1, const char *path, size_t pathlen, unsigned int mode, void *buffer, unsigned long size);
 
 /*
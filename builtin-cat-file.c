@@ -9,6 +9,7 @@
 #include "tree.h"
 #include "builtin.h"
 #include "parse-options.h"
+#include "streaming.h"
 
 #define BATCH 1
 #define BATCH_CHECK 2
@@ -112,7 +113,7 @@ static int cat_one_file(int opt, const char *exp_type, const char *obj_name)
 		return !has_sha1_file(sha1);
 
 	case 'p':
-		type = sha1_object_info(sha1, NULL);
+		type = sha1_object_info(sha1, &size);
 		if (type < 0)
 			die("Not a valid object name %s", obj_name);
 
@@ -122,6 +123,12 @@ static int cat_one_file(int opt, const char *exp_type, const char *obj_name)
 			return cmd_ls_tree(2, ls_args, NULL);
 		}
 
+		if (type == OBJ_BLOB && size >= big_file_threshold) {
+			if (stream_blob_to_fd(1, sha1))
+				die("Cannot read object %s", obj_name);
+			return 0;
+		}
+
 		buf = read_sha1_file(sha1, &type, &size);
 		if (!buf)
 			die("Cannot read object %s", obj_name);
@@ -133,6 +140,13 @@ static int cat_one_file(int opt, const char *exp_type, const char *obj_name)
 		/* otherwise just spit out the data */
 		break;
 	case 0:
+		if (type_from_string(exp_type) == OBJ_BLOB &&
+		    sha1_object_info(sha1, &size) == OBJ_BLOB &&
+		    size >= big_file_threshold) {
+			if (stream_blob_to_fd(1, sha1))
+				die("git cat-file %s: bad file", obj_name);
+			return 0;
+		}
 		buf = read_object_with_reference(sha1, exp_type, &size, NULL);
 		break;
 
@@ -163,10 +177,13 @@ static int batch_one_object(const char *obj_name, int print_contents)
 		return 0;
 	}
 
-	if (print_contents == BATCH)
+	type = sha1_object_info(sha1, &size);
+	if (print_contents == BATCH && type > 0 &&
+	    (type != OBJ_BLOB || size < big_file_threshold)) {
 		contents = read_sha1_file(sha1, &type, &size);
-	else
-		type = sha1_object_info(sha1, &size);
+		if (!contents)
+			type = OBJ_BAD;
+	}
 
 	if (type <= 0) {
 		printf("%s missing\n", obj_name);
@@ -178,10 +195,15 @@ static int batch_one_object(const char *obj_name, int print_contents)
 	fflush(stdout);
 
 	if (print_contents == BATCH) {
-		write_or_die(1, contents, size);
+		if (type == OBJ_BLOB && size >= big_file_threshold) {
+			if (stream_blob_to_fd(1, sha1))
+				die("unable to stream %s", sha1_to_hex(sha1));
+		} else {
+			write_or_die(1, contents, size);
+			free(contents);
+		}
 		printf("\n");
 		fflush(stdout);
-		free(contents);
 	}
 
 	return 0;
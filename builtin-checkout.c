@@ -410,7 +410,9 @@ static int merge_working_tree(struct checkout_opts *opts,
 		tree = parse_tree_indirect(new->commit->object.sha1);
 		init_tree_desc(&trees[1], tree->buffer, tree->size);
 
+		trace_region_enter("checkout", "unpack_trees");
 		ret = unpack_trees(2, trees, &topts);
+		trace_region_leave("checkout", "unpack_trees");
 		if (ret != -1) {
 			reprime_cache_tree = 1;
 		} else {
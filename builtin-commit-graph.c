@@ -0,0 +1,38 @@
+/*
+ * git commit-graph builtin command
+ *
+ * Write and check $GIT_OBJECT_DIRECTORY/info/commit-graph.
+ */
+#include "builtin.h"
+#include "cache.h"
+#include "commit.h"
+#include "commit-graph.h"
+#include "parse-options.h"
+
+static const char * const builtin_commit_graph_usage[] = {
+	"git commit-graph write [-q]",
+	"git commit-graph verify [-v]",
+	NULL
+};
+
+int cmd_commit_graph(int argc, const char **argv, const char *prefix)
+{
+	int quiet = 0, verbose = 0;
+	struct option options[] = {
+		OPT__QUIET(&quiet),
+		OPT__VERBOSE(&verbose),
+		OPT_END()
+	};
+
+	git_config(git_default_config, NULL);
+	argc = parse_options(argc, argv, options, builtin_commit_graph_usage, 0);
+	if (argc != 1)
+		usage_with_options(builtin_commit_graph_usage, options);
+
+	save_commit_buffer = 0;
+	if (!strcmp(argv[0], "write"))
+		return !!write_commit_graph(quiet);
+	if (!strcmp(argv[0], "verify"))
+		return !!verify_commit_graph(verbose);
+	usage_with_options(builtin_commit_graph_usage, options);
+}
@@ -828,10 +828,25 @@ int cmd_status(int argc, const char **argv, const char *prefix)
 
 	argc = parse_and_validate_options(argc, argv, builtin_status_usage, prefix);
 
+	trace_region_enter("status", "prepare_index");
 	index_file = prepare_index(argc, argv, prefix);
+	trace_region_leave("status", "prepare_index");
 
 	commitable = run_status(stdout, index_file, prefix, 0);
 
+	/*
+	 * Save what we learned about untracked files for next time,
+	 * if nobody else is writing the index.
+	 */
+	if (commit_style == COMMIT_AS_IS &&
+	    the_index.untracked && the_index.untracked->changed) {
+		int fd = hold_locked_index(&index_lock, 0);
+		if (0 <= fd &&
+		    (write_cache(fd, active_cache, active_nr) ||
+		     commit_locked_index(&index_lock)))
+			rollback_lock_file(&index_lock);
+	}
+
 	rollback_index_files();
 
 	return commitable ? 0 : 1;
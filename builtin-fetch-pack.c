@@ -600,15 +600,19 @@ static struct ref *do_fetch_pack(int fd[2],
 		packet_flush(fd[1]);
 		goto all_done;
 	}
+	trace_region_enter("fetch-pack", "negotiate");
 	if (find_common(fd, sha1, ref) < 0)
 		if (!args.keep_pack)
 			/* When cloning, it is not unusual to have
 			 * no common commit.
 			 */
 			warning("no common commits");
+	trace_region_leave("fetch-pack", "negotiate");
 
+	trace_region_enter("fetch-pack", "get_pack");
 	if (get_pack(fd, pack_lockfile))
 		die("git fetch-pack: fetch failed.");
+	trace_region_leave("fetch-pack", "get_pack");
 
  all_done:
 	return ref;
@@ -447,13 +447,20 @@ static int quickfetch(struct ref *ref_map)
 
 static int fetch_refs(struct transport *transport, struct ref *ref_map)
 {
-	int ret = quickfetch(ref_map);
+	int ret;
+
+	trace_region_enter("fetch", "fetch_refs");
+	ret = quickfetch(ref_map);
 	if (ret)
 		ret = transport_fetch_refs(transport, ref_map);
-	if (!ret)
+	trace_region_leave("fetch", "fetch_refs");
+	if (!ret) {
+		trace_region_enter("fetch", "store_updated_refs");
 		ret |= store_updated_refs(transport->url,
 				transport->remote->name,
 				ref_map);
+		trace_region_leave("fetch", "store_updated_refs");
+	}
 	transport_unlock_pack(transport);
 	return ret;
 }
@@ -23,9 +23,11 @@ static const char * const builtin_gc_usage[] = {
 };
 
 static int pack_refs = 1;
+static int gc_commit_graph = 1;
 static int aggressive_window = 250;
 static int gc_auto_threshold = 6700;
 static int gc_auto_pack_limit = 50;
+static int gc_auto_geometric;
 static const char *prune_expire = "2.weeks.ago";
 
 #define MAX_ADD 10
@@ -34,6 +36,7 @@ static const char *argv_reflog[] = {"reflog", "expire", "--all", NULL};
 static const char *argv_repack[MAX_ADD] = {"repack", "-d", "-l", NULL};
 static const char *argv_prune[] = {"prune", "--expire", NULL, NULL};
 static const char *argv_rerere[] = {"rerere", "gc", NULL};
+static const char *argv_commit_graph[] = {"commit-graph", "write", NULL, NULL};
 
 static int gc_config(const char *var, const char *value, void *cb)
 {
@@ -44,6 +47,10 @@ static int gc_config(const char *var, const char *value, void *cb)
 			pack_refs = git_config_bool(var, value);
 		return 0;
 	}
+	if (!strcmp(var, "gc.commitgraph")) {
+		gc_commit_graph = git_config_bool(var, value);
+		return 0;
+	}
 	if (!strcmp(var, "gc.aggressivewindow")) {
 		aggressive_window = git_config_int(var, value);
 		return 0;
@@ -56,6 +63,12 @@ static int gc_config(const char *var, const char *value, void *cb)
 		gc_auto_pack_limit = git_config_int(var, value);
 		return 0;
 	}
+	if (!strcmp(var, "gc.autogeometric")) {
+		gc_auto_geometric = git_config_int(var, value);
+		if (gc_auto_geometric == 1 || gc_auto_geometric < 0)
+			return error("Invalid %s: '%s'", var, value);
+		return 0;
+	}
 	if (!strcmp(var, "gc.pruneexpire")) {
 		if (value && strcmp(value, "now")) {
 			unsigned long now = approxidate("now");
@@ -158,8 +171,18 @@ static int need_to_gc(void)
 	 * packs, we run "repack -d -l".  If there are too many packs,
 	 * we run "repack -A -d -l".  Otherwise we tell the caller
 	 * there is no need.
+	 *
+	 * With gc.autogeometric, both cases run a geometric repack
+	 * instead, which only packs the loose objects together with
+	 * the smallest packs.
 	 */
-	if (too_many_packs())
+	if (gc_auto_geometric) {
+		static char buf[40];
+		if (!too_many_packs() && !too_many_loose_objects())
+			return 0;
+		sprintf(buf, "--geometric=%d", gc_auto_geometric);
+		append_option(argv_repack, buf, MAX_ADD);
+	} else if (too_many_packs())
 		append_option(argv_repack,
 			      prune_expire && !strcmp(prune_expire, "now") ?
 			      "-a" : "-A",
@@ -206,8 +229,10 @@ int cmd_gc(int argc, const char **argv, const char *prefix)
 			append_option(argv_repack, buf, MAX_ADD);
 		}
 	}
-	if (quiet)
+	if (quiet) {
 		append_option(argv_repack, "-q", MAX_ADD);
+		argv_commit_graph[2] = "-q";
+	}
 
 	if (auto_gc) {
 		/*
@@ -243,6 +268,11 @@ int cmd_gc(int argc, const char **argv, const char *prefix)
 	if (run_command_v_opt(argv_rerere, RUN_GIT_CMD))
 		return error(FAILED_RUN, argv_rerere[0]);
 
+	/* after prune, so that the graph never names a pruned commit */
+	if (gc_commit_graph &&
+	    run_command_v_opt(argv_commit_graph, RUN_GIT_CMD))
+		return error(FAILED_RUN, argv_commit_graph[0]);
+
 	if (auto_gc && too_many_loose_objects())
 		warning("There are too many unreachable loose objects; "
 			"run 'git prune' to remove them.");
@@ -184,12 +184,15 @@ static void finish_early_output(struct rev_info *rev)
 static int cmd_log_walk(struct rev_info *rev)
 {
 	struct commit *commit;
+	unsigned long nr = 0;
 
 	if (rev->early_output)
 		setup_early_output(rev);
 
+	trace_region_enter("log", "prepare_revision_walk");
 	if (prepare_revision_walk(rev))
 		die("revision walk setup failed");
+	trace_region_leave("log", "prepare_revision_walk");
 
 	if (rev->early_output)
 		finish_early_output(rev);
@@ -199,6 +202,7 @@ static int cmd_log_walk(struct rev_info *rev)
 	 * and HAS_CHANGES being accumulated in rev->diffopt, so be careful to
 	 * retain that state information if replacing rev->diffopt in this loop
 	 */
+	trace_region_enter("log", "walk");
 	while ((commit = get_revision(rev)) != NULL) {
 		log_tree_commit(rev, commit);
 		if (!rev->reflog_info) {
@@ -208,7 +212,10 @@ static int cmd_log_walk(struct rev_info *rev)
 		}
 		free_commit_list(commit->parents);
 		commit->parents = NULL;
+		nr++;
 	}
+	trace_counter("log", "commits", nr);
+	trace_region_leave("log", "walk");
 	if (rev->diffopt.output_format & DIFF_FORMAT_CHECKDIFF &&
 	    DIFF_OPT_TST(&rev->diffopt, CHECK_FAILED)) {
 		return 02;
@@ -514,6 +514,7 @@ int cmd_ls_files(int argc, const char **argv, const char *prefix)
 
 	/* be nice with submodule paths ending in a slash */
 	read_cache();
+	use_untracked_cache(&dir);
 	if (pathspec)
 		strip_trailing_slash_from_submodules();
 
@@ -0,0 +1,37 @@
+/*
+ * git multi-pack-index builtin command
+ *
+ * Write and check $GIT_OBJECT_DIRECTORY/pack/multi-pack-index.
+ */
+#include "builtin.h"
+#include "cache.h"
+#include "multi-pack-index.h"
+#include "parse-options.h"
+
+static const char * const builtin_multi_pack_index_usage[] = {
+	"git multi-pack-index write [-q]",
+	"git multi-pack-index verify [-v]",
+	NULL
+};
+
+int cmd_multi_pack_index(int argc, const char **argv, const char *prefix)
+{
+	int quiet = 0, verbose = 0;
+	struct option options[] = {
+		OPT__QUIET(&quiet),
+		OPT__VERBOSE(&verbose),
+		OPT_END()
+	};
+
+	git_config(git_default_config, NULL);
+	argc = parse_options(argc, argv, options,
+			     builtin_multi_pack_index_usage, 0);
+	if (argc != 1)
+		usage_with_options(builtin_multi_pack_index_usage, options);
+
+	if (!strcmp(argv[0], "write"))
+		return !!write_multi_pack_index(quiet);
+	if (!strcmp(argv[0], "verify"))
+		return !!verify_multi_pack_index(verbose);
+	usage_with_options(builtin_multi_pack_index_usage, options);
+}
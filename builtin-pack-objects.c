@@ -16,6 +16,7 @@
 #include "list-objects.h"
 #include "progress.h"
 #include "refs.h"
+#include "pack-bitmap.h"
 
 #ifdef THREADED_DELTA_SEARCH
 #include "thread-utils.h"
@@ -28,8 +29,10 @@ git pack-objects [{ -q | --progress | --all-progress }] \n\
 	[--window=N] [--window-memory=N] [--depth=N] \n\
 	[--no-reuse-delta] [--no-reuse-object] [--delta-base-offset] \n\
 	[--threads=N] [--non-empty] [--revs [--unpacked | --all]*] [--reflog] \n\
+	[--stdin-packs] \n\
 	[--stdout | base-name] [--include-tag] \n\
 	[--keep-unreachable | --unpack-unreachable] \n\
+	[--write-bitmap-index] \n\
 	[<ref-list | <object-list]";
 
 struct object_entry {
@@ -54,6 +57,7 @@ struct object_entry {
 				       * objects against.
 				       */
 	unsigned char no_try_delta;
+	unsigned char compress_state; /* who deflates it, see below */
 };
 
 /*
@@ -72,6 +76,7 @@ static int keep_unreachable, unpack_unreachable, include_tag;
 static int local;
 static int incremental;
 static int ignore_packed_keep;
+static int stdin_packs;
 static int allow_ofs_delta;
 static const char *base_name;
 static int progress = 1;
@@ -84,6 +89,8 @@ static int num_preferred_base;
 static struct progress *progress_state;
 static int pack_compression_level = Z_DEFAULT_COMPRESSION;
 static int pack_compression_seen;
+static int use_bitmap_index = 1;
+static int write_bitmap_index;
 
 static unsigned long delta_cache_size = 0;
 static unsigned long max_delta_cache_size = 0;
@@ -106,24 +113,221 @@ static uint32_t written, written_delta;
 static uint32_t reused, reused_delta;
 
 
+/*
+ * Delta indexes, together with the buffer they were made from, are
+ * kept in a cache keyed by object name: the writer (or the threads
+ * deflating for it) needs the index of a base again for each delta
+ * against it that was not kept in the delta cache, and several
+ * threads may consider the same base.  Indexes in use by a window
+ * are counted there as before; the others stay around, least
+ * recently used first to go, while all of them fit in
+ * pack.deltaIndexCacheSize (and pack.windowMemory, if set).
+ */
+struct cached_index {
+	struct cached_index *next;	/* in its hash slot */
+	struct cached_index *lru_prev, *lru_next; /* if not in use */
+	unsigned char sha1[20];
+	void *data;
+	unsigned long size, mem;
+	struct delta_index *index;
+	unsigned long build_usec;	/* how long indexing took */
+	int refcnt;
+};
+
+#define DELTA_INDEX_CACHE_SLOTS	1024
+#define DELTA_INDEX_CACHE_TRACE	"GIT_TRACE_DELTA_INDEX_CACHE"
+
+static struct cached_index *delta_index_cache[DELTA_INDEX_CACHE_SLOTS];
+static struct cached_index delta_index_lru = {
+	NULL, &delta_index_lru, &delta_index_lru
+};
+static unsigned long delta_index_cache_size = 32 * 1024 * 1024;
+static unsigned long delta_index_cached;
+
+static struct delta_index_cache_stats {
+	unsigned long hits, misses, evictions;
+	unsigned long max_cached;
+	unsigned long build_usec, saved_usec;
+} delta_index_cache_stats;
+
+#ifdef THREADED_DELTA_SEARCH
+static pthread_mutex_t delta_index_mutex = PTHREAD_MUTEX_INITIALIZER;
+#define delta_index_lock()	pthread_mutex_lock(&delta_index_mutex)
+#define delta_index_unlock()	pthread_mutex_unlock(&delta_index_mutex)
+#else
+#define delta_index_lock()	(void)0
+#define delta_index_unlock()	(void)0
+#endif
+
+static void report_delta_index_cache(void)
+{
+	struct delta_index_cache_stats *s = &delta_index_cache_stats;
+
+	trace_printf_key(DELTA_INDEX_CACHE_TRACE,
+			 "delta index cache: %lu hits, %lu misses, "
+			 "%lu evictions, %lu bytes (max %lu), "
+			 "%lu ms indexing, %lu ms saved\n",
+			 s->hits, s->misses, s->evictions,
+			 delta_index_cached, s->max_cached,
+			 s->build_usec / 1000, s->saved_usec / 1000);
+}
+
+static struct cached_index **delta_index_slot(const unsigned char *sha1)
+{
+	unsigned int hash;
+
+	memcpy(&hash, sha1, sizeof(hash));
+	return delta_index_cache + hash % DELTA_INDEX_CACHE_SLOTS;
+}
+
+static void lru_unlink(struct cached_index *ci)
+{
+	ci->lru_prev->lru_next = ci->lru_next;
+	ci->lru_next->lru_prev = ci->lru_prev;
+}
+
+static void prune_delta_index_cache(void)
+{
+	unsigned long limit = delta_index_cache_size;
+
+	if (window_memory_limit && window_memory_limit < limit)
+		limit = window_memory_limit;
+	while (delta_index_cached > limit &&
+	       delta_index_lru.lru_next != &delta_index_lru) {
+		struct cached_index *ci = delta_index_lru.lru_next;
+		struct cached_index **pp = delta_index_slot(ci->sha1);
+
+		while (*pp != ci)
+			pp = &(*pp)->next;
+		*pp = ci->next;
+		lru_unlink(ci);
+		delta_index_cached -= ci->mem;
+		free_delta_index(ci->index);
+		free(ci->data);
+		free(ci);
+		delta_index_cache_stats.evictions++;
+	}
+}
+
+/* Like find_delta_index(), with delta_index_lock() held */
+static struct cached_index *lookup_delta_index(const unsigned char *sha1)
+{
+	struct cached_index *ci;
+
+	for (ci = *delta_index_slot(sha1); ci; ci = ci->next)
+		if (!hashcmp(ci->sha1, sha1))
+			break;
+	if (ci && !ci->refcnt++)
+		lru_unlink(ci);
+	return ci;
+}
+
+/* Returns the index made from "sha1" if it is cached, for release_delta_index() */
+static struct cached_index *find_delta_index(const unsigned char *sha1)
+{
+	struct cached_index *ci;
+
+	delta_index_lock();
+	ci = lookup_delta_index(sha1);
+	if (ci) {
+		delta_index_cache_stats.hits++;
+		delta_index_cache_stats.saved_usec += ci->build_usec;
+	}
+	delta_index_unlock();
+	return ci;
+}
+
+/*
+ * Indexes "data" (of object "sha1") and caches the result, which then
+ * owns "data"; NULL if there was not enough memory for the index.
+ * When another thread cached "sha1" in the meantime, its entry is
+ * returned instead and "data" is freed.
+ */
+static struct cached_index *add_delta_index(const unsigned char *sha1,
+					    void *data, unsigned long size)
+{
+	struct cached_index *ci, **slot;
+	struct delta_index *index;
+	struct timeval start, end;
+	unsigned long build_usec;
+
+	gettimeofday(&start, NULL);
+	index = create_delta_index(data, size);
+	if (!index)
+		return NULL;
+	gettimeofday(&end, NULL);
+	build_usec = (end.tv_sec - start.tv_sec) * 1000000 +
+		end.tv_usec - start.tv_usec;
+
+	delta_index_lock();
+	delta_index_cache_stats.misses++;
+	delta_index_cache_stats.build_usec += build_usec;
+	ci = lookup_delta_index(sha1);
+	if (ci) {
+		delta_index_unlock();
+		free_delta_index(index);
+		free(data);
+		return ci;
+	}
+	ci = xmalloc(sizeof(*ci));
+	hashcpy(ci->sha1, sha1);
+	ci->data = data;
+	ci->size = size;
+	ci->index = index;
+	ci->mem = size + sizeof_delta_index(index);
+	ci->build_usec = build_usec;
+	ci->refcnt = 1;
+	slot = delta_index_slot(sha1);
+	ci->next = *slot;
+	*slot = ci;
+	delta_index_cached += ci->mem;
+	if (delta_index_cache_stats.max_cached < delta_index_cached)
+		delta_index_cache_stats.max_cached = delta_index_cached;
+	delta_index_unlock();
+	return ci;
+}
+
+static void release_delta_index(struct cached_index *ci)
+{
+	delta_index_lock();
+	if (!--ci->refcnt) {
+		ci->lru_prev = delta_index_lru.lru_prev;
+		ci->lru_next = &delta_index_lru;
+		ci->lru_prev->lru_next = ci;
+		delta_index_lru.lru_prev = ci;
+		prune_delta_index_cache();
+	}
+	delta_index_unlock();
+}
+
 static void *get_delta(struct object_entry *entry)
 {
 	unsigned long size, base_size, delta_size;
 	void *buf, *base_buf, *delta_buf;
 	enum object_type type;
+	struct cached_index *base;
 
 	buf = read_sha1_file(entry->idx.sha1, &type, &size);
 	if (!buf)
 		die("unable to read %s", sha1_to_hex(entry->idx.sha1));
-	base_buf = read_sha1_file(entry->delta->idx.sha1, &type, &base_size);
-	if (!base_buf)
-		die("unable to read %s", sha1_to_hex(entry->delta->idx.sha1));
-	delta_buf = diff_delta(base_buf, base_size,
-			       buf, size, &delta_size, 0);
+	base = find_delta_index(entry->delta->idx.sha1);
+	if (!base) {
+		base_buf = read_sha1_file(entry->delta->idx.sha1, &type,
+					  &base_size);
+		if (!base_buf)
+			die("unable to read %s",
+			    sha1_to_hex(entry->delta->idx.sha1));
+		base = add_delta_index(entry->delta->idx.sha1,
+				       base_buf, base_size);
+		if (!base)
+			die("out of memory indexing %s",
+			    sha1_to_hex(entry->delta->idx.sha1));
+	}
+	delta_buf = create_delta(base->index, buf, size, &delta_size, 0);
 	if (!delta_buf || delta_size != entry->delta_size)
 		die("delta size changed");
+	release_delta_index(base);
 	free(buf);
-	free(base_buf);
 	return delta_buf;
 }
 
@@ -229,6 +433,220 @@ static void copy_pack_data(struct sha1file *f,
 	}
 }
 
+/*
+ * Objects that cannot be copied from an existing pack have to be
+ * deflated (and deltas maybe computed) while the pack is written.
+ * With several threads, workers do that ahead of the writer: they
+ * walk the objects array in the order write_pack_file() does, at
+ * most COMPRESS_WINDOW entries and about COMPRESS_MEMORY bytes of
+ * deflated data ahead of it, and write_object() only picks up the
+ * result.  It is what do_compress() would have produced there, so
+ * the pack does not change.  An entry's compress_state says who
+ * deflates it, and changes under compress_mutex only.
+ *
+ * This is only done when the pack cannot be split, as whether a
+ * delta is usable otherwise depends on what has been written.
+ */
+enum compress_state {
+	COMPRESS_NONE = 0,	/* nobody yet */
+	COMPRESS_WORKER,	/* a worker, result in compressed[] */
+	COMPRESS_WRITER		/* the writer itself */
+};
+
+#ifdef THREADED_DELTA_SEARCH
+
+#define COMPRESS_WINDOW		256
+#define COMPRESS_MEMORY		(32 * 1024 * 1024)
+
+struct compressed_object {
+	struct object_entry *entry;
+	void *buf;
+	unsigned long size, datalen;
+	enum object_type type;
+	int done;
+};
+
+static struct compressed_object compressed[COMPRESS_WINDOW];
+static uint32_t compress_next;	/* next entry a worker looks at */
+static uint32_t compress_pos;	/* entries before it have been written */
+static unsigned long compressed_memory;
+static int compress_threads, compress_stop;
+static pthread_t *compress_thread;
+
+static pthread_mutex_t compress_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t compress_cond = PTHREAD_COND_INITIALIZER;
+#define compress_lock()		pthread_mutex_lock(&compress_mutex)
+#define compress_unlock()	pthread_mutex_unlock(&compress_mutex)
+
+/* Does write_object() deflate this one itself, given an unlimited pack? */
+static int needs_compression(struct object_entry *e)
+{
+	if (e->preferred_base)
+		return 0;
+	if (e->delta && e->z_delta_size)
+		return 0;	/* the delta cache has it deflated already */
+	if (!reuse_object || !e->in_pack)
+		return 1;
+	if (e->type == OBJ_REF_DELTA || e->type == OBJ_OFS_DELTA)
+		return 0;	/* reused as is */
+	if (e->type != e->in_pack_type)
+		return 1;
+	return e->delta != NULL;
+}
+
+static void *compress_worker(void *unused)
+{
+	compress_lock();
+	for (;;) {
+		struct object_entry *e;
+		struct compressed_object *c;
+		void *buf;
+		unsigned long size, datalen;
+		enum object_type type;
+
+		if (compress_next < compress_pos)
+			compress_next = compress_pos;
+		if (compress_stop || compress_next >= nr_objects)
+			break;
+		if (compress_next >= compress_pos + COMPRESS_WINDOW ||
+		    compressed_memory >= COMPRESS_MEMORY) {
+			pthread_cond_wait(&compress_cond, &compress_mutex);
+			continue;
+		}
+		e = objects + compress_next++;
+		if (e->compress_state || !needs_compression(e))
+			continue;
+		e->compress_state = COMPRESS_WORKER;
+		c = compressed + (e - objects) % COMPRESS_WINDOW;
+		c->entry = e;
+		c->done = 0;
+		buf = e->delta_data;
+		e->delta_data = NULL;
+		compress_unlock();
+
+		if (!e->delta) {
+			buf = read_sha1_file(e->idx.sha1, &type, &size);
+			if (!buf)
+				die("unable to read %s", sha1_to_hex(e->idx.sha1));
+		} else {
+			if (!buf)
+				buf = get_delta(e);
+			size = e->delta_size;
+			/* write_object() tells it from OBJ_OFS_DELTA */
+			type = OBJ_REF_DELTA;
+		}
+		datalen = do_compress(&buf, size);
+
+		compress_lock();
+		c->buf = buf;
+		c->size = size;
+		c->datalen = datalen;
+		c->type = type;
+		c->done = 1;
+		compressed_memory += datalen;
+		pthread_cond_broadcast(&compress_cond);
+	}
+	compress_unlock();
+	return NULL;
+}
+
+static int take_compressed(struct object_entry *e, void **buf,
+			   unsigned long *size, enum object_type *type,
+			   unsigned long *datalen)
+{
+	struct compressed_object *c;
+
+	if (!compress_threads)
+		return 0;
+	compress_lock();
+	if (e->compress_state != COMPRESS_WORKER) {
+		e->compress_state = COMPRESS_WRITER;
+		compress_unlock();
+		return 0;
+	}
+	c = compressed + (e - objects) % COMPRESS_WINDOW;
+	while (!c->done)
+		pthread_cond_wait(&compress_cond, &compress_mutex);
+	*buf = c->buf;
+	*size = c->size;
+	*type = c->type;
+	*datalen = c->datalen;
+	compressed_memory -= c->datalen;
+	c->entry = NULL;
+	pthread_cond_broadcast(&compress_cond);
+	compress_unlock();
+	return 1;
+}
+
+/* The writer is done with the entries before "pos" */
+static void compress_advance(uint32_t pos)
+{
+	if (!compress_threads)
+		return;
+	compress_lock();
+	for (; compress_pos < pos; compress_pos++) {
+		struct compressed_object *c;
+		c = compressed + compress_pos % COMPRESS_WINDOW;
+		if (c->entry != objects + compress_pos)
+			continue;
+		/* deflated, but not written by write_object() after all */
+		while (!c->done)
+			pthread_cond_wait(&compress_cond, &compress_mutex);
+		free(c->buf);
+		compressed_memory -= c->datalen;
+		c->entry = NULL;
+	}
+	pthread_cond_broadcast(&compress_cond);
+	compress_unlock();
+}
+
+static void start_compress_threads(void)
+{
+	int i, ret;
+
+	if (delta_search_threads <= 1 || pack_size_limit)
+		return;
+	compress_threads = delta_search_threads;
+	compress_thread = xmalloc(compress_threads * sizeof(*compress_thread));
+	compress_next = compress_pos = 0;
+	compress_stop = 0;
+	enable_obj_read_lock();
+	for (i = 0; i < compress_threads; i++) {
+		ret = pthread_create(&compress_thread[i], NULL,
+				     compress_worker, NULL);
+		if (ret)
+			die("unable to create thread: %s", strerror(ret));
+	}
+}
+
+static void stop_compress_threads(void)
+{
+	int i;
+
+	if (!compress_threads)
+		return;
+	compress_lock();
+	compress_stop = 1;
+	pthread_cond_broadcast(&compress_cond);
+	compress_unlock();
+	for (i = 0; i < compress_threads; i++)
+		pthread_join(compress_thread[i], NULL);
+	compress_advance(nr_objects);
+	disable_obj_read_lock();
+	free(compress_thread);
+	compress_thread = NULL;
+	compress_threads = 0;
+}
+
+#else
+
+#define take_compressed(e, buf, size, type, datalen)	0
+#define compress_advance(pos)	(void)0
+#define start_compress_threads()	(void)0
+#define stop_compress_threads()	(void)0
+
+#endif
+
 static unsigned long write_object(struct sha1file *f,
 				  struct object_entry *entry,
 				  off_t write_offset)
@@ -238,7 +656,7 @@ static unsigned long write_object(struct sha1file *f,
 	unsigned char header[10], dheader[10];
 	unsigned hdrlen;
 	enum object_type type;
-	int usable_delta, to_reuse;
+	int usable_delta, to_reuse, deflated;
 
 	if (!pack_to_stdout)
 		crc32_begin(f);
@@ -287,7 +705,13 @@ static unsigned long write_object(struct sha1file *f,
 
 	if (!to_reuse) {
 		no_reuse:
-		if (!usable_delta) {
+		deflated = take_compressed(entry, &buf, &size, &type, &datalen);
+		if (deflated) {
+			/* a worker did it all but for the delta type */
+			if (entry->delta)
+				type = (allow_ofs_delta && entry->delta->idx.offset) ?
+					OBJ_OFS_DELTA : OBJ_REF_DELTA;
+		} else if (!usable_delta) {
 			buf = read_sha1_file(entry->idx.sha1, &type, &size);
 			if (!buf)
 				die("unable to read %s", sha1_to_hex(entry->idx.sha1));
@@ -311,7 +735,9 @@ static unsigned long write_object(struct sha1file *f,
 				OBJ_OFS_DELTA : OBJ_REF_DELTA;
 		}
 
-		if (entry->z_delta_size)
+		if (deflated)
+			; /* nothing to do */
+		else if (entry->z_delta_size)
 			datalen = entry->z_delta_size;
 		else
 			datalen = do_compress(&buf, size);
@@ -365,7 +791,7 @@ static unsigned long write_object(struct sha1file *f,
 	else {
 		struct packed_git *p = entry->in_pack;
 		struct pack_window *w_curs = NULL;
-		struct revindex_entry *revidx;
+		uint32_t pos, nr;
 		off_t offset;
 
 		if (entry->delta)
@@ -374,10 +800,17 @@ static unsigned long write_object(struct sha1file *f,
 		hdrlen = encode_header(type, entry->size, header);
 
 		offset = entry->in_pack_offset;
-		revidx = find_pack_revindex(p, offset);
-		datalen = revidx[1].offset - offset;
+		/* the revindex is shared with threads deflating objects */
+		obj_read_lock();
+		if (offset_to_pack_pos(p, offset, &pos) < 0) {
+			obj_read_unlock();
+			goto no_reuse;
+		}
+		datalen = pack_pos_to_offset(p, pos + 1) - offset;
+		nr = pack_pos_to_index(p, pos);
+		obj_read_unlock();
 		if (!pack_to_stdout && p->index_version > 1 &&
-		    check_pack_crc(p, &w_curs, offset, datalen, revidx->nr)) {
+		    check_pack_crc(p, &w_curs, offset, datalen, nr)) {
 			error("bad packed object CRC for %s", sha1_to_hex(entry->idx.sha1));
 			unuse_pack(&w_curs);
 			goto no_reuse;
@@ -466,6 +899,33 @@ static int write_one(struct sha1file *f,
 /* forward declaration for write_pack_file */
 static int adjust_perm(const char *path, mode_t mode);
 
+static void write_bitmap_file(const char *path, const unsigned char *sha1,
+			      mode_t mode)
+{
+	struct bitmap_pack_object *list;
+	uint32_t i;
+
+	/* the pack we just wrote may have replaced one of the same name */
+	reprepare_packed_git();
+
+	/* write_idx_file() left written_list sorted by object name */
+	list = xmalloc(nr_written * sizeof(*list));
+	for (i = 0; i < nr_written; i++) {
+		struct object_entry *e = (struct object_entry *)written_list[i];
+		list[i].sha1 = e->idx.sha1;
+		list[i].type = e->type;
+		list[i].name_hash = e->hash;
+		/* reused deltas only know the type of their representation */
+		if (e->type == OBJ_REF_DELTA || e->type == OBJ_OFS_DELTA)
+			list[i].type = sha1_object_info(e->idx.sha1, NULL);
+	}
+	if (!write_pack_bitmap(path, sha1, list, nr_written) &&
+	    adjust_perm(path, mode))
+		die("unable to make bitmap file readable: %s",
+		    strerror(errno));
+	free(list);
+}
+
 static void write_pack_file(void)
 {
 	uint32_t i = 0, j;
@@ -478,6 +938,7 @@ static void write_pack_file(void)
 	if (progress > pack_to_stdout)
 		progress_state = start_progress("Writing objects", nr_result);
 	written_list = xmalloc(nr_objects * sizeof(*written_list));
+	start_compress_threads();
 
 	do {
 		unsigned char sha1[20];
@@ -503,8 +964,10 @@ static void write_pack_file(void)
 		for (; i < nr_objects; i++) {
 			if (!write_one(f, objects + i, &offset))
 				break;
+			compress_advance(i + 1);
 			display_progress(progress_state, written);
 		}
+		stop_compress_threads();
 
 		/*
 		 * Did we write the wrong # entries in the header?
@@ -524,13 +987,20 @@ static void write_pack_file(void)
 		if (!pack_to_stdout) {
 			mode_t mode = umask(0);
 			struct stat st;
-			char *idx_tmp_name, tmpname[PATH_MAX];
+			char *idx_tmp_name, *rev_tmp_name = NULL;
+			char tmpname[PATH_MAX];
+			unsigned char pack_checksum[20];
 
 			umask(mode);
 			mode = 0444 & ~mode;
 
+			hashcpy(pack_checksum, sha1);
 			idx_tmp_name = write_idx_file(NULL, written_list,
 						      nr_written, sha1);
+			if (pack_write_rev_index)
+				rev_tmp_name = write_rev_file(NULL, written_list,
+							      nr_written,
+							      pack_checksum);
 
 			snprintf(tmpname, sizeof(tmpname), "%s-%s.pack",
 				 base_name, sha1_to_hex(sha1));
@@ -563,6 +1033,18 @@ static void write_pack_file(void)
 						tmpname, strerror(errno));
 			}
 
+			if (rev_tmp_name) {
+				snprintf(tmpname, sizeof(tmpname), "%s-%s.rev",
+					 base_name, sha1_to_hex(sha1));
+				if (adjust_perm(rev_tmp_name, mode))
+					die("unable to make temporary reverse index file readable: %s",
+					    strerror(errno));
+				if (rename(rev_tmp_name, tmpname))
+					die("unable to rename temporary reverse index file: %s",
+					    strerror(errno));
+				free(rev_tmp_name);
+			}
+
 			snprintf(tmpname, sizeof(tmpname), "%s-%s.idx",
 				 base_name, sha1_to_hex(sha1));
 			if (adjust_perm(idx_tmp_name, mode))
@@ -574,6 +1056,23 @@ static void write_pack_file(void)
 
 			free(idx_tmp_name);
 			free(pack_tmp_name);
+
+			if (write_bitmap_index) {
+				/*
+				 * The bitmap names objects by their position
+				 * in the index, which is only complete when
+				 * everything went into this one pack.
+				 */
+				if (nr_written != nr_result)
+					warning("not writing a bitmap index "
+						"for a split pack");
+				else {
+					snprintf(tmpname, sizeof(tmpname),
+						 "%s-%s.bitmap", base_name,
+						 sha1_to_hex(sha1));
+					write_bitmap_file(tmpname, sha1, mode);
+				}
+			}
 			puts(sha1_to_hex(sha1));
 		}
 
@@ -694,14 +1193,13 @@ static int no_try_delta(const char *path)
 	return 0;
 }
 
-static int add_object_entry(const unsigned char *sha1, enum object_type type,
-			    const char *name, int exclude)
+static int add_object_entry_1(const unsigned char *sha1, enum object_type type,
+			      unsigned hash, const char *name, int exclude)
 {
 	struct object_entry *entry;
 	struct packed_git *p, *found_pack = NULL;
 	off_t found_offset = 0;
 	int ix;
-	unsigned hash = name_hash(name);
 
 	ix = nr_objects ? locate_object_entry_hash(sha1) : -1;
 	if (ix >= 0) {
@@ -726,7 +1224,7 @@ static int add_object_entry(const unsigned char *sha1, enum object_type type,
 			}
 			if (exclude)
 				break;
-			if (incremental)
+			if (incremental && !p->pack_rollup)
 				return 0;
 			if (local && !p->pack_local)
 				return 0;
@@ -768,6 +1266,12 @@ static int add_object_entry(const unsigned char *sha1, enum object_type type,
 	return 1;
 }
 
+static int add_object_entry(const unsigned char *sha1, enum object_type type,
+			    const char *name, int exclude)
+{
+	return add_object_entry_1(sha1, type, name_hash(name), name, exclude);
+}
+
 struct pbase_tree_cache {
 	unsigned char sha1[20];
 	int ref;
@@ -1080,11 +1584,11 @@ static void check_object(struct object_entry *entry)
 				goto give_up;
 			}
 			if (reuse_delta && !entry->preferred_base) {
-				struct revindex_entry *revidx;
-				revidx = find_pack_revindex(p, ofs);
-				if (!revidx)
+				uint32_t pos;
+				if (offset_to_pack_pos(p, ofs, &pos) < 0)
 					goto give_up;
-				base_ref = nth_packed_object_sha1(p, revidx->nr);
+				base_ref = nth_packed_object_sha1(p,
+						pack_pos_to_index(p, pos));
 			}
 			entry->in_pack_header_size = used + used_0;
 			break;
@@ -1212,6 +1716,7 @@ struct unpacked {
 	struct object_entry *entry;
 	void *data;
 	struct delta_index *index;
+	struct cached_index *cached;	/* owns data and index if set */
 	unsigned depth;
 };
 
@@ -1233,10 +1738,6 @@ static int delta_cacheable(unsigned long src_size, unsigned long trg_size,
 
 #ifdef THREADED_DELTA_SEARCH
 
-static pthread_mutex_t read_mutex = PTHREAD_MUTEX_INITIALIZER;
-#define read_lock()		pthread_mutex_lock(&read_mutex)
-#define read_unlock()		pthread_mutex_unlock(&read_mutex)
-
 static pthread_mutex_t cache_mutex = PTHREAD_MUTEX_INITIALIZER;
 #define cache_lock()		pthread_mutex_lock(&cache_mutex)
 #define cache_unlock()		pthread_mutex_unlock(&cache_mutex)
@@ -1247,8 +1748,6 @@ static pthread_mutex_t progress_mutex = PTHREAD_MUTEX_INITIALIZER;
 
 #else
 
-#define read_lock()		(void)0
-#define read_unlock()		(void)0
 #define cache_lock()		(void)0
 #define cache_unlock()		(void)0
 #define progress_lock()		(void)0
@@ -1304,11 +1803,21 @@ static int try_delta(struct unpacked *trg, struct unpacked *src,
 	if (trg_size < src_size / 32)
 		return 0;
 
+	/* Somebody may have indexed src already */
+	if (!src->index &&
+	    (src->cached = find_delta_index(src_entry->idx.sha1))) {
+		if (src->data)
+			free(src->data);
+		else
+			*mem_usage += src_size;
+		src->data = src->cached->data;
+		src->index = src->cached->index;
+		*mem_usage += sizeof_delta_index(src->index);
+	}
+
 	/* Load data if not already done */
 	if (!trg->data) {
-		read_lock();
 		trg->data = read_sha1_file(trg_entry->idx.sha1, &type, &sz);
-		read_unlock();
 		if (!trg->data)
 			die("object %s cannot be read",
 			    sha1_to_hex(trg_entry->idx.sha1));
@@ -1318,9 +1827,7 @@ static int try_delta(struct unpacked *trg, struct unpacked *src,
 		*mem_usage += sz;
 	}
 	if (!src->data) {
-		read_lock();
 		src->data = read_sha1_file(src_entry->idx.sha1, &type, &sz);
-		read_unlock();
 		if (!src->data)
 			die("object %s cannot be read",
 			    sha1_to_hex(src_entry->idx.sha1));
@@ -1330,13 +1837,16 @@ static int try_delta(struct unpacked *trg, struct unpacked *src,
 		*mem_usage += sz;
 	}
 	if (!src->index) {
-		src->index = create_delta_index(src->data, src_size);
-		if (!src->index) {
+		src->cached = add_delta_index(src_entry->idx.sha1,
+					      src->data, src_size);
+		if (!src->cached) {
 			static int warned = 0;
 			if (!warned++)
 				warning("suboptimal pack - out of memory");
 			return 0;
 		}
+		src->data = src->cached->data;
+		src->index = src->cached->index;
 		*mem_usage += sizeof_delta_index(src->index);
 	}
 
@@ -1396,11 +1906,16 @@ static unsigned int check_delta_limit(struct object_entry *me, unsigned int n)
 static unsigned long free_unpacked(struct unpacked *n)
 {
 	unsigned long freed_mem = sizeof_delta_index(n->index);
-	free_delta_index(n->index);
+	if (n->cached) {
+		release_delta_index(n->cached);
+		n->cached = NULL;
+	} else {
+		free_delta_index(n->index);
+		free(n->data);
+	}
 	n->index = NULL;
 	if (n->data) {
 		freed_mem += n->entry->size;
-		free(n->data);
 		n->data = NULL;
 	}
 	n->entry = NULL;
@@ -1536,10 +2051,8 @@ static void find_deltas(struct object_entry **list, unsigned *list_size,
 			idx = 0;
 	}
 
-	for (i = 0; i < window; ++i) {
-		free_delta_index(array[i].index);
-		free(array[i].data);
-	}
+	for (i = 0; i < window; ++i)
+		free_unpacked(array + i);
 	free(array);
 }
 
@@ -1644,6 +2157,7 @@ static void ll_find_deltas(struct object_entry **list, unsigned list_size,
 	}
 
 	/* Start work threads. */
+	enable_obj_read_lock();
 	for (i = 0; i < delta_search_threads; i++) {
 		if (!p[i].list_size)
 			continue;
@@ -1722,6 +2236,7 @@ static void ll_find_deltas(struct object_entry **list, unsigned list_size,
 			active_threads--;
 		}
 	}
+	disable_obj_read_lock();
 }
 
 #else
@@ -1843,6 +2358,10 @@ static int git_pack_config(const char *k, const char *v, void *cb)
 		cache_max_small_delta_size = git_config_int(k, v);
 		return 0;
 	}
+	if (!strcmp(k, "pack.deltaindexcachesize")) {
+		delta_index_cache_size = git_config_ulong(k, v);
+		return 0;
+	}
 	if (!strcmp(k, "pack.threads")) {
 		delta_search_threads = git_config_int(k, v);
 		if (delta_search_threads < 0)
@@ -1861,10 +2380,18 @@ static int git_pack_config(const char *k, const char *v, void *cb)
 				pack_idx_default_version);
 		return 0;
 	}
+	if (!strcmp(k, "pack.writereverseindex")) {
+		pack_write_rev_index = git_config_bool(k, v);
+		return 0;
+	}
 	if (!strcmp(k, "pack.packsizelimit")) {
 		pack_size_limit_cfg = git_config_ulong(k, v);
 		return 0;
 	}
+	if (!strcmp(k, "pack.usebitmaps")) {
+		use_bitmap_index = git_config_bool(k, v);
+		return 0;
+	}
 	return git_default_config(k, v, cb);
 }
 
@@ -1899,6 +2426,49 @@ static void read_object_list_from_stdin(void)
 	}
 }
 
+/*
+ * With --stdin-packs, stdin names local packs whose objects all go
+ * into the new pack, in the order they are stored there, whether they
+ * are reachable or not.  Together with --incremental, objects that
+ * are also in a pack not on the list are left out.
+ */
+static void read_packs_list_from_stdin(void)
+{
+	struct strbuf buf = STRBUF_INIT;
+	struct packed_git *p;
+	uint32_t pos;
+
+	while (strbuf_getline(&buf, stdin, '\n') != EOF) {
+		int len = buf.len;
+
+		if (!len)
+			continue;
+		for (p = packed_git; p; p = p->next) {
+			int namelen = strlen(p->pack_name);
+			if (p->pack_local && len < namelen &&
+			    p->pack_name[namelen - len - 1] == '/' &&
+			    !strcmp(p->pack_name + namelen - len, buf.buf))
+				break;
+		}
+		if (!p)
+			die("could not find pack '%s'", buf.buf);
+		p->pack_rollup = 1;
+	}
+	strbuf_release(&buf);
+
+	for (p = packed_git; p; p = p->next) {
+		if (!p->pack_rollup)
+			continue;
+		if (open_pack_index(p))
+			die("cannot open pack index for %s", p->pack_name);
+		for (pos = 0; pos < p->num_objects; pos++) {
+			uint32_t nr = pack_pos_to_index(p, pos);
+			add_object_entry(nth_packed_object_sha1(p, nr), 0,
+					 NULL, 0);
+		}
+	}
+}
+
 #define OBJECT_ADDED (1u<<20)
 
 static void show_commit(struct commit *commit, void *data)
@@ -2049,7 +2619,32 @@ static void loosen_unused_packed_objects(struct rev_info *revs)
 	}
 }
 
-static void get_object_list(int ac, const char **av)
+static int add_object_entry_from_bitmap(const unsigned char *sha1,
+					enum object_type type,
+					uint32_t name_hash)
+{
+	add_object_entry_1(sha1, type, name_hash, NULL, 0);
+	return 0;
+}
+
+/*
+ * A thin pack wants the edges of the walk as preferred bases, which
+ * only a real traversal finds.
+ */
+static int bitmap_walk_ok(struct rev_info *revs, int thin)
+{
+	int i;
+
+	if (!use_bitmap_index || keep_unreachable || unpack_unreachable)
+		return 0;
+	if (thin)
+		for (i = 0; i < revs->pending.nr; i++)
+			if (revs->pending.objects[i].item->flags & UNINTERESTING)
+				return 0;
+	return 1;
+}
+
+static void get_object_list(int ac, const char **av, int thin)
 {
 	struct rev_info revs;
 	char line[1000];
@@ -2076,6 +2671,11 @@ static void get_object_list(int ac, const char **av)
 			die("bad revision '%s'", line);
 	}
 
+	if (bitmap_walk_ok(&revs, thin) && !prepare_bitmap_walk(&revs)) {
+		traverse_bitmap_commit_list(add_object_entry_from_bitmap);
+		return;
+	}
+
 	if (prepare_revision_walk(&revs))
 		die("revision walk setup failed");
 	mark_edges_uninteresting(revs.commits, &revs, show_edge);
@@ -2112,6 +2712,8 @@ int cmd_pack_objects(int argc, const char **argv, const char *prefix)
 	git_config(git_pack_config, NULL);
 	if (!pack_compression_seen && core_compression_seen)
 		pack_compression_level = core_compression_level;
+	if (trace_want(DELTA_INDEX_CACHE_TRACE))
+		atexit(report_delta_index_cache);
 
 	progress = isatty(2);
 	for (i = 1; i < argc; i++) {
@@ -2136,6 +2738,10 @@ int cmd_pack_objects(int argc, const char **argv, const char *prefix)
 			ignore_packed_keep = 1;
 			continue;
 		}
+		if (!strcmp("--stdin-packs", arg)) {
+			stdin_packs = 1;
+			continue;
+		}
 		if (!prefixcmp(arg, "--compression=")) {
 			char *end;
 			int level = strtoul(arg+14, &end, 0);
@@ -2231,6 +2837,10 @@ int cmd_pack_objects(int argc, const char **argv, const char *prefix)
 			include_tag = 1;
 			continue;
 		}
+		if (!strcmp("--write-bitmap-index", arg)) {
+			write_bitmap_index = 1;
+			continue;
+		}
 		if (!strcmp("--unpacked", arg) ||
 		    !strcmp("--reflog", arg) ||
 		    !strcmp("--all", arg)) {
@@ -2294,6 +2904,11 @@ int cmd_pack_objects(int argc, const char **argv, const char *prefix)
 	if (keep_unreachable && unpack_unreachable)
 		die("--keep-unreachable and --unpack-unreachable are incompatible.");
 
+	if (stdin_packs && (thin || keep_unreachable || unpack_unreachable ||
+			    write_bitmap_index))
+		die("--stdin-packs cannot be used with --thin, --keep-unreachable, "
+		    "--unpack-unreachable or --write-bitmap-index.");
+
 #ifdef THREADED_DELTA_SEARCH
 	if (!delta_search_threads)	/* --threads=0 means autodetect */
 		delta_search_threads = online_cpus();
@@ -2301,23 +2916,36 @@ int cmd_pack_objects(int argc, const char **argv, const char *prefix)
 
 	prepare_packed_git();
 
+	trace_region_enter("pack-objects", "enumerate");
 	if (progress)
 		progress_state = start_progress("Counting objects", 0);
-	if (!use_internal_rev_list)
-		read_object_list_from_stdin();
-	else {
+	if (stdin_packs)
+		read_packs_list_from_stdin();
+	if (!use_internal_rev_list) {
+		if (!stdin_packs)
+			read_object_list_from_stdin();
+	} else {
 		rp_av[rp_ac] = NULL;
-		get_object_list(rp_ac, rp_av);
+		get_object_list(rp_ac, rp_av, thin);
 	}
 	if (include_tag && nr_result)
 		for_each_ref(add_ref_tag, NULL);
 	stop_progress(&progress_state);
+	trace_counter("pack-objects", "objects", nr_result);
+	trace_region_leave("pack-objects", "enumerate");
 
 	if (non_empty && !nr_result)
 		return 0;
-	if (nr_result)
+	if (nr_result) {
+		trace_region_enter("pack-objects", "prepare_pack");
 		prepare_pack(window, depth);
+		trace_region_leave("pack-objects", "prepare_pack");
+	}
+	trace_region_enter("pack-objects", "write");
 	write_pack_file();
+	trace_counter("pack-objects", "written", written);
+	trace_counter("pack-objects", "reused", reused);
+	trace_region_leave("pack-objects", "write");
 	if (progress)
 		fprintf(stderr, "Total %"PRIu32" (delta %"PRIu32"),"
 			" reused %"PRIu32" (delta %"PRIu32")\n",
@@ -7,6 +7,7 @@
 #include "log-tree.h"
 #include "graph.h"
 #include "bisect.h"
+#include "pack-bitmap.h"
 
 static const char rev_list_usage[] =
 "git rev-list [OPTION] <commit-id>... [ -- paths... ]\n"
@@ -23,6 +24,7 @@ static const char rev_list_usage[] =
 "    --remotes\n"
 "    --stdin\n"
 "    --quiet\n"
+"    --count\n"
 "  ordering output:\n"
 "    --topo-order\n"
 "    --date-order\n"
@@ -39,9 +41,12 @@ static const char rev_list_usage[] =
 "  special purpose:\n"
 "    --bisect\n"
 "    --bisect-vars\n"
-"    --bisect-all"
+"    --bisect-all\n"
+"    --use-bitmap-index"
 ;
 
+static uint32_t count;
+
 static void finish_commit(struct commit *commit, void *data);
 static void show_commit(struct commit *commit, void *data)
 {
@@ -186,6 +191,25 @@ static void show_edge(struct commit *commit)
 	printf("-%s\n", sha1_to_hex(commit->object.sha1));
 }
 
+static void count_commit(struct commit *commit, void *data)
+{
+	count++;
+	finish_commit(commit, data);
+}
+
+static void count_object(struct object *obj, const struct name_path *path, const char *name)
+{
+	count++;
+	finish_object(obj, path, name);
+}
+
+static int show_object_from_bitmap(const unsigned char *sha1,
+				   enum object_type type, uint32_t name_hash)
+{
+	puts(sha1_to_hex(sha1));
+	return 0;
+}
+
 static inline int log2i(int n)
 {
 	int log2 = 0;
@@ -305,6 +329,8 @@ int cmd_rev_list(int argc, const char **argv, const char *prefix)
 	int bisect_show_vars = 0;
 	int bisect_find_all = 0;
 	int quiet = 0;
+	int show_count = 0;
+	int use_bitmap_index = 0;
 
 	git_config(git_default_config, NULL);
 	init_revisions(&revs, prefix);
@@ -343,6 +369,14 @@ int cmd_rev_list(int argc, const char **argv, const char *prefix)
 			bisect_show_vars = 1;
 			continue;
 		}
+		if (!strcmp(arg, "--count")) {
+			show_count = 1;
+			continue;
+		}
+		if (!strcmp(arg, "--use-bitmap-index")) {
+			use_bitmap_index = 1;
+			continue;
+		}
 		if (!strcmp(arg, "--stdin")) {
 			if (read_from_stdin++)
 				die("--stdin given twice?");
@@ -375,6 +409,15 @@ int cmd_rev_list(int argc, const char **argv, const char *prefix)
 	if (bisect_list)
 		revs.limited = 1;
 
+	if (use_bitmap_index && !bisect_list && !revs.edge_hint &&
+	    !prepare_bitmap_walk(&revs)) {
+		if (show_count)
+			printf("%"PRIu32"\n", count_bitmap_commit_list());
+		else if (!quiet)
+			traverse_bitmap_commit_list(show_object_from_bitmap);
+		return 0;
+	}
+
 	if (prepare_revision_walk(&revs))
 		die("revision walk setup failed");
 	if (revs.tree_objects)
@@ -390,6 +433,12 @@ int cmd_rev_list(int argc, const char **argv, const char *prefix)
 			return show_bisect_vars(&info, reaches, all);
 	}
 
+	if (show_count) {
+		traverse_commit_list(&revs, count_commit, count_object, &info);
+		printf("%"PRIu32"\n", count);
+		return 0;
+	}
+
 	traverse_commit_list(&revs,
 			     quiet ? finish_commit : show_commit,
 			     quiet ? finish_object : show_object,
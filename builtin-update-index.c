@@ -9,6 +9,8 @@
 #include "tree-walk.h"
 #include "builtin.h"
 #include "refs.h"
+#include "bulk-checkin.h"
+#include "dir.h"
 
 /*
  * Default to not allowing changes to the list of files. The
@@ -388,7 +390,7 @@ static void read_index_info(int line_termination)
 }
 
 static const char update_index_usage[] =
-"git update-index [-q] [--add] [--replace] [--remove] [--unmerged] [--refresh] [--really-refresh] [--cacheinfo] [--chmod=(+|-)x] [--assume-unchanged] [--info-only] [--force-remove] [--stdin] [--index-info] [--unresolve] [--again | -g] [--ignore-missing] [-z] [--verbose] [--] <file>...";
+"git update-index [-q] [--add] [--replace] [--remove] [--unmerged] [--refresh] [--really-refresh] [--cacheinfo] [--chmod=(+|-)x] [--assume-unchanged] [--info-only] [--[no-]split-index] [--[no-]untracked-cache] [--force-remove] [--stdin] [--index-info] [--unresolve] [--again | -g] [--ignore-missing] [-z] [--verbose] [--] <file>...";
 
 static unsigned char head_sha1[20];
 static unsigned char merge_head_sha1[20];
@@ -581,6 +583,8 @@ int cmd_update_index(int argc, const char **argv, const char *prefix)
 	if (entries < 0)
 		die("cache corrupted");
 
+	plug_bulk_checkin();
+
 	for (i = 1 ; i < argc; i++) {
 		const char *path = argv[i];
 		const char *p;
@@ -658,6 +662,22 @@ int cmd_update_index(int argc, const char **argv, const char *prefix)
 				info_only = 1;
 				continue;
 			}
+			if (!strcmp(path, "--split-index") ||
+			    !strcmp(path, "--no-split-index")) {
+				core_split_index = path[2] == 's';
+				active_cache_changed = 1;
+				continue;
+			}
+			if (!strcmp(path, "--untracked-cache") ||
+			    !strcmp(path, "--no-untracked-cache")) {
+				core_untracked_cache = path[2] == 'u';
+				if (core_untracked_cache)
+					add_untracked_cache(&the_index);
+				else
+					remove_untracked_cache(&the_index);
+				active_cache_changed = 1;
+				continue;
+			}
 			if (!strcmp(path, "--force-remove")) {
 				force_remove = 1;
 				continue;
@@ -738,6 +758,8 @@ int cmd_update_index(int argc, const char **argv, const char *prefix)
 	}
 
  finish:
+	unplug_bulk_checkin();
+
 	if (active_cache_changed) {
 		if (newfd < 0) {
 			if (refresh_flags & REFRESH_QUIET)
@@ -117,6 +117,8 @@ int cmd_verify_pack(int argc, const char **argv, const char *prefix)
 	int nothing_done = 1;
 
 	git_config(git_default_config, NULL);
+	/* every pack is read from start to end */
+	sequential_pack_access = 1;
 	while (1 < argc) {
 		if (!no_more_options && argv[1][0] == '-') {
 			if (!strcmp("-v", argv[1]))
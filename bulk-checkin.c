@@ -0,0 +1,215 @@
+#include "cache.h"
+#include "bulk-checkin.h"
+#include "csum-file.h"
+#include "pack.h"
+#include "hash.h"
+
+struct bulk_checkin_entry {
+	struct pack_idx_entry idx;
+	struct bulk_checkin_entry *next;	/* same hash */
+};
+
+static struct bulk_checkin_state {
+	int plugged;
+	char *pack_tmp_name;
+	struct sha1file *f;
+	off_t offset;
+	struct pack_idx_entry **written;
+	uint32_t alloc_written, nr_written;
+	struct hash_table seen;
+} state;
+
+static unsigned int hash_sha1(const unsigned char *sha1)
+{
+	unsigned int hash;
+	memcpy(&hash, sha1, sizeof(hash));
+	return hash;
+}
+
+static int already_written(const unsigned char *sha1)
+{
+	struct bulk_checkin_entry *e;
+
+	e = lookup_hash(hash_sha1(sha1), &state.seen);
+	for (; e; e = e->next)
+		if (!hashcmp(e->idx.sha1, sha1))
+			return 1;
+	return 0;
+}
+
+static void record_written(struct bulk_checkin_entry *e)
+{
+	void **pos;
+
+	pos = insert_hash(hash_sha1(e->idx.sha1), e, &state.seen);
+	if (pos) {
+		e->next = *pos;
+		*pos = e;
+	}
+	ALLOC_GROW(state.written, state.nr_written + 1, state.alloc_written);
+	state.written[state.nr_written++] = &e->idx;
+}
+
+static int encode_header(enum object_type type, unsigned long size,
+			 unsigned char *hdr)
+{
+	int n = 1;
+	unsigned char c;
+
+	c = (type << 4) | (size & 15);
+	size >>= 4;
+	while (size) {
+		*hdr++ = c | 0x80;
+		c = size & 0x7f;
+		size >>= 7;
+		n++;
+	}
+	*hdr = c;
+	return n;
+}
+
+static void install_file(const char *tmp_name, const unsigned char *sha1,
+			 const char *ext, mode_t mode)
+{
+	char name[PATH_MAX];
+
+	snprintf(name, sizeof(name), "%s/pack/pack-%s.%s",
+		 get_object_directory(), sha1_to_hex(sha1), ext);
+	if (chmod(tmp_name, mode) || adjust_shared_perm(tmp_name))
+		die("unable to make temporary %s file readable: %s",
+		    ext, strerror(errno));
+	if (rename(tmp_name, name))
+		die("unable to rename temporary %s file: %s",
+		    ext, strerror(errno));
+}
+
+static void clear_bulk_checkin_state(void)
+{
+	uint32_t i;
+
+	for (i = 0; i < state.nr_written; i++)
+		free(state.written[i]);
+	free(state.written);
+	free_hash(&state.seen);
+	free(state.pack_tmp_name);
+	memset(&state, 0, sizeof(state));
+}
+
+static void finish_bulk_checkin(void)
+{
+	unsigned char sha1[20], pack_sha1[20];
+	char *idx_tmp_name, *rev_tmp_name = NULL;
+	mode_t mode;
+	int fd;
+
+	if (!state.f)
+		return;
+
+	/* the object count in the header is only known now */
+	fd = sha1close(state.f, sha1, 0);
+	fixup_pack_header_footer(fd, sha1, state.pack_tmp_name,
+				 state.nr_written, sha1, state.offset);
+	close(fd);
+	hashcpy(pack_sha1, sha1);
+
+	idx_tmp_name = write_idx_file(NULL, state.written,
+				      state.nr_written, sha1);
+	if (pack_write_rev_index)
+		rev_tmp_name = write_rev_file(NULL, state.written,
+					      state.nr_written, pack_sha1);
+
+	mode = umask(0);
+	umask(mode);
+	mode = 0444 & ~mode;
+
+	install_file(state.pack_tmp_name, sha1, "pack", mode);
+	if (rev_tmp_name) {
+		install_file(rev_tmp_name, sha1, "rev", mode);
+		free(rev_tmp_name);
+	}
+	install_file(idx_tmp_name, sha1, "idx", mode);
+	free(idx_tmp_name);
+
+	clear_bulk_checkin_state();
+	reprepare_packed_git();
+}
+
+static void prepare_to_stream(void)
+{
+	char tmpname[PATH_MAX];
+	struct pack_header hdr;
+	int fd;
+
+	fd = odb_mkstemp(tmpname, sizeof(tmpname), "pack/tmp_pack_XXXXXX");
+	state.pack_tmp_name = xstrdup(tmpname);
+	state.f = sha1fd(fd, state.pack_tmp_name);
+
+	hdr.hdr_signature = htonl(PACK_SIGNATURE);
+	hdr.hdr_version = htonl(PACK_VERSION);
+	hdr.hdr_entries = 0;
+	sha1write(state.f, &hdr, sizeof(hdr));
+	state.offset = sizeof(hdr);
+}
+
+int index_bulk_checkin(unsigned char *sha1, void *buf, size_t size,
+		       enum object_type type)
+{
+	struct bulk_checkin_entry *e;
+	unsigned char hdr[10], out[16384];
+	z_stream stream;
+	int hdrlen, status;
+
+	if (hash_sha1_file(buf, size, typename(type), sha1))
+		return -1;
+	if (already_written(sha1) || has_sha1_file(sha1))
+		return 0;
+
+	if (!state.f)
+		prepare_to_stream();
+
+	e = xcalloc(1, sizeof(*e));
+	hashcpy(e->idx.sha1, sha1);
+	e->idx.offset = state.offset;
+
+	crc32_begin(state.f);
+	hdrlen = encode_header(type, size, hdr);
+	sha1write(state.f, hdr, hdrlen);
+	state.offset += hdrlen;
+
+	memset(&stream, 0, sizeof(stream));
+	deflateInit(&stream, zlib_compression_level);
+	stream.next_in = buf;
+	stream.avail_in = size;
+	do {
+		stream.next_out = out;
+		stream.avail_out = sizeof(out);
+		status = deflate(&stream, Z_FINISH);
+		sha1write(state.f, out, stream.next_out - out);
+		state.offset += stream.next_out - out;
+	} while (status == Z_OK);
+	if (status != Z_STREAM_END)
+		die("unable to deflate new object %s (%d)",
+		    sha1_to_hex(sha1), status);
+	deflateEnd(&stream);
+
+	e->idx.crc32 = crc32_end(state.f);
+	record_written(e);
+	return 0;
+}
+
+int bulk_checkin_plugged(void)
+{
+	return core_bulk_checkin && state.plugged;
+}
+
+void plug_bulk_checkin(void)
+{
+	state.plugged++;
+}
+
+void unplug_bulk_checkin(void)
+{
+	if (!state.plugged || --state.plugged)
+		return;
+	finish_bulk_checkin();
+}
@@ -0,0 +1,19 @@
+#ifndef BULK_CHECKIN_H
+#define BULK_CHECKIN_H
+
+/*
+ * With core.bulkCheckin, objects that index_fd() and index_path()
+ * write between plug_bulk_checkin() and the matching
+ * unplug_bulk_checkin() are appended to a single new pack instead of
+ * being written as loose objects.  The pack and its .idx are put in
+ * place by the outermost unplug_bulk_checkin(); until then the objects
+ * cannot be read back, only named.
+ */
+extern void plug_bulk_checkin(void);
+extern void unplug_bulk_checkin(void);
+extern int bulk_checkin_plugged(void);
+
+extern int index_bulk_checkin(unsigned char *sha1, void *buf, size_t size,
+			      enum object_type type);
+
+#endif
@@ -12,6 +12,9 @@
 #define git_SHA1_Update	SHA1_Update
 #define git_SHA1_Final	SHA1_Final
 #endif
+#ifndef git_SHA1_Multi
+#define git_SHA1_Multi	serial_SHA1_Multi
+#endif
 
 #include <zlib.h>
 #if defined(NO_DEFLATE_BOUND) || ZLIB_VERNUM < 0x1200
@@ -177,6 +180,9 @@ struct cache_entry {
 #define CE_HASHED    (0x100000)
 #define CE_UNHASHED  (0x200000)
 
+/* the file system monitor says the work tree file is unchanged */
+#define CE_FSMONITOR_VALID (0x400000)
+
 /*
  * Extended on-disk flags
  */
@@ -190,9 +196,9 @@ struct cache_entry {
  * Safeguard to avoid saving wrong flags:
  *  - CE_EXTENDED2 won't get saved until its semantic is known
  *  - Bits in 0x0000FFFF have been saved in ce_flags already
- *  - Bits in 0x003F0000 are currently in-memory flags
+ *  - Bits in 0x007F0000 are currently in-memory flags
  */
-#if CE_EXTENDED_FLAGS & 0x803FFFFF
+#if CE_EXTENDED_FLAGS & 0x807FFFFF
 #error "CE_EXTENDED_FLAGS out of range"
 #endif
 
@@ -278,10 +284,18 @@ static inline int ce_to_dtype(const struct cache_entry *ce)
 #define ondisk_cache_entry_size(len) flexible_size(ondisk_cache_entry,len)
 #define ondisk_cache_entry_extended_size(len) flexible_size(ondisk_cache_entry_extended,len)
 
+struct split_index;
+struct untracked_cache;
+
 struct index_state {
 	struct cache_entry **cache;
 	unsigned int cache_nr, cache_alloc, cache_changed;
 	struct cache_tree *cache_tree;
+	struct split_index *split_index;
+	struct untracked_cache *untracked;
+	uint64_t fsmonitor_last_update;
+	unsigned char *fsmonitor_dirty;
+	unsigned int fsmonitor_dirty_nr;
 	struct cache_time timestamp;
 	void *alloc;
 	unsigned name_hash_initialized : 1,
@@ -434,6 +448,8 @@ extern int unmerged_index(const struct index_state *);
 extern int verify_path(const char *path);
 extern struct cache_entry *index_name_exists(struct index_state *istate, const char *name, int namelen, int igncase);
 extern int index_name_pos(const struct index_state *, const char *name, int namelen);
+extern struct split_index *share_split_index(struct split_index *);
+extern void release_split_index(struct split_index *);
 #define ADD_CACHE_OK_TO_ADD 1		/* Ok to add */
 #define ADD_CACHE_OK_TO_REPLACE 2	/* Ok to replace file/directory */
 #define ADD_CACHE_SKIP_DFCHECK 4	/* Ok to skip DF conflict checks */
@@ -514,10 +530,22 @@ extern int core_compression_level;
 extern int core_compression_seen;
 extern size_t packed_git_window_size;
 extern size_t packed_git_limit;
+extern int packed_git_map_whole;
 extern size_t delta_base_cache_limit;
+extern unsigned int delta_base_cache_slots;
+extern int core_commit_graph;
+extern int core_multi_pack_index;
+extern int core_loose_object_cache;
+extern unsigned long big_file_threshold;
+extern int core_bulk_checkin;
 extern int auto_crlf;
 extern int fsync_object_files;
 extern int core_preload_index;
+extern int core_split_index;
+extern int split_index_max_percent;
+extern int core_untracked_cache;
+extern const char *core_fsmonitor;
+extern int index_threads;
 
 enum safe_crlf {
 	SAFE_CRLF_FALSE = 0,
@@ -646,12 +674,31 @@ char *strip_path_suffix(const char *path, const char *suffix);
 extern int sha1_object_info(const unsigned char *, unsigned long *);
 extern void * read_sha1_file(const unsigned char *sha1, enum object_type *type, unsigned long *size);
 extern int hash_sha1_file(const void *buf, unsigned long len, const char *type, unsigned char *sha1);
+#define MAX_SHA1_BATCH 8
+extern void serial_SHA1_Multi(int nr, git_SHA_CTX **c, const void **p, const unsigned long *n);
+extern void hash_sha1_files(int nr, const void **buf, const unsigned long *len, const char **type, unsigned char **sha1);
 extern int write_sha1_file(void *buf, unsigned long len, const char *type, unsigned char *return_sha1);
 extern int pretend_sha1_file(void *, unsigned long, enum object_type, unsigned char *);
 extern int force_object_loose(const unsigned char *sha1, time_t mtime);
+extern void *map_sha1_file(const unsigned char *sha1, unsigned long *size);
+extern int unpack_sha1_header(z_stream *stream, unsigned char *map, unsigned long mapsize, void *buffer, unsigned long bufsiz);
+extern int parse_sha1_header(const char *hdr, unsigned long *sizep);
+
+/*
+ * Between these calls, read_sha1_file(), sha1_object_info(),
+ * unpack_entry(), has_sha1_file() and has_sha1_pack() may be called
+ * from several threads at once.  The calls nest.  Other code that
+ * looks at pack data meanwhile (e.g. the revindex) takes the lock
+ * with obj_read_lock() and obj_read_unlock().
+ */
+extern void enable_obj_read_lock(void);
+extern void disable_obj_read_lock(void);
+extern void obj_read_lock(void);
+extern void obj_read_unlock(void);
 
 /* global flag to enable extra checks when accessing packed objects */
 extern int do_check_packed_object_crc;
+extern int sequential_pack_access;
 
 extern int check_sha1_signature(const unsigned char *sha1, void *buf, unsigned long size, const char *type);
 
@@ -747,6 +794,7 @@ extern void remove_scheduled_dirs(void);
 
 extern struct alternate_object_database {
 	struct alternate_object_database *next;
+	struct loose_object_cache *loose_objects;
 	char *name;
 	char base[FLEX_ARRAY]; /* more */
 } *alt_odb_list;
@@ -757,6 +805,8 @@ extern void foreach_alt_odb(alt_odb_fn, void*);
 
 struct pack_window {
 	struct pack_window *next;
+	struct pack_window *lru_prev, *lru_next;	/* while unused */
+	struct packed_git *pack;
 	unsigned char *base;
 	off_t offset;
 	size_t len;
@@ -777,7 +827,10 @@ extern struct packed_git {
 	time_t mtime;
 	int pack_fd;
 	unsigned pack_local:1,
-		 pack_keep:1;
+		 pack_keep:1,
+		 pack_rollup:1,	/* pack-objects --stdin-packs */
+		 multi_pack_index:1,
+		 pack_installed:1;	/* on packed_git */
 	unsigned char sha1[20];
 	/* something like ".git/objects/pack/xxxxx.pack" */
 	char pack_name[FLEX_ARRAY]; /* more */
@@ -788,6 +841,7 @@ struct pack_entry {
 	unsigned char sha1[20];
 	struct packed_git *p;
 };
+extern int find_pack_entry(const unsigned char *sha1, struct pack_entry *e);
 
 struct ref {
 	struct ref *next;
@@ -849,9 +903,11 @@ extern void clear_delta_base_cache(void);
 extern struct packed_git *add_packed_git(const char *, int, int);
 extern const unsigned char *nth_packed_object_sha1(struct packed_git *, uint32_t);
 extern off_t nth_packed_object_offset(const struct packed_git *, uint32_t);
+extern int find_pack_entry_pos(const unsigned char *, struct packed_git *);
 extern off_t find_pack_entry_one(const unsigned char *, struct packed_git *);
 extern void *unpack_entry(struct packed_git *, off_t, enum object_type *, unsigned long *);
 extern unsigned long unpack_object_header_buffer(const unsigned char *buf, unsigned long len, enum object_type *type, unsigned long *sizep);
+extern int unpack_object_header(struct packed_git *, struct pack_window **, off_t *, unsigned long *);
 extern unsigned long get_size_from_delta(struct packed_git *, struct pack_window **, off_t);
 extern const char *packed_object_info_detail(struct packed_git *, off_t, unsigned long *, unsigned long *, unsigned int *, unsigned char *);
 
@@ -922,12 +978,22 @@ extern void alloc_report(void);
 /* trace.c */
 extern void trace_printf(const char *format, ...);
 extern void trace_argv_printf(const char **argv, const char *format, ...);
+/* like trace_printf(), but to where the environment variable "key" says */
+extern void trace_printf_key(const char *key, const char *format, ...);
+extern int trace_want(const char *key);
+/* GIT_TRACE_PERFORMANCE; regions nest and must be left in order */
+extern void trace_performance_start(const char **argv);
+extern void trace_region_enter(const char *category, const char *label);
+extern void trace_region_leave(const char *category, const char *label);
+extern void trace_counter(const char *category, const char *name,
+			  uintmax_t value);
 
 /* convert.c */
 /* returns 1 if *dst was used */
 extern int convert_to_git(const char *path, const char *src, size_t len,
                           struct strbuf *dst, enum safe_crlf checksafe);
 extern int convert_to_working_tree(const char *path, const char *src, size_t len, struct strbuf *dst);
+extern int would_convert_to_working_tree(const char *path);
 
 /* add */
 /*
@@ -0,0 +1,565 @@
+#include "cache.h"
+#include "commit.h"
+#include "tag.h"
+#include "refs.h"
+#include "csum-file.h"
+#include "sha1-lookup.h"
+#include "commit-graph.h"
+
+/*
+ * File layout (all integers in network byte order):
+ *
+ *   - 16-byte header: signature, version, number of commits N,
+ *     number of extra edge entries E
+ *   - 256 entries of fan-out table, 4 bytes each
+ *   - N 20-byte commit object names, sorted
+ *   - N 40-byte commit data records, in the same order:
+ *     tree object name, first parent position, second parent
+ *     position (or index into the extra edge list), generation,
+ *     upper and lower 32 bits of the committer date
+ *   - E 4-byte extra edge entries for octopus merges
+ *   - 20-byte SHA-1 checksum of all of the above
+ */
+#define GRAPH_HEADER_SIZE 16
+#define GRAPH_FANOUT_SIZE (4 * 256)
+#define GRAPH_DATA_WIDTH 40
+
+/* only used while writing, in a process that does not walk revisions */
+#define GRAPH_SEEN (1u<<15)
+
+struct commit_graph {
+	const unsigned char *data;
+	size_t data_len;
+	uint32_t num_commits;
+	uint32_t num_extra_edges;
+	const uint32_t *fanout;
+	const unsigned char *sha1s;
+	const unsigned char *commit_data;
+	const uint32_t *extra_edges;
+};
+
+static struct commit_graph *the_graph;
+static int graph_prepared;
+static int graph_disabled;
+
+static const char *commit_graph_filename(void)
+{
+	static char path[PATH_MAX];
+	if (!*path)
+		snprintf(path, sizeof(path), "%s/info/commit-graph",
+			 get_object_directory());
+	return path;
+}
+
+static struct commit_graph *load_commit_graph(const char *path)
+{
+	struct commit_graph *g;
+	const uint32_t *hdr;
+	unsigned char *data;
+	size_t len, expect;
+	uint32_t i, nr, prev;
+	struct stat st;
+	int fd = open(path, O_RDONLY);
+
+	if (fd < 0)
+		return NULL;
+	if (fstat(fd, &st)) {
+		close(fd);
+		return NULL;
+	}
+	len = xsize_t(st.st_size);
+	if (len < GRAPH_HEADER_SIZE + GRAPH_FANOUT_SIZE + 20) {
+		close(fd);
+		error("commit-graph file %s is too small", path);
+		return NULL;
+	}
+	data = xmmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	hdr = (const uint32_t *)data;
+	if (ntohl(hdr[0]) != COMMIT_GRAPH_SIGNATURE) {
+		error("commit-graph file %s has a bad signature", path);
+		goto bad;
+	}
+	if (ntohl(hdr[1]) != COMMIT_GRAPH_VERSION) {
+		error("commit-graph file %s is version %"PRIu32
+		      " and is not supported by this binary",
+		      path, ntohl(hdr[1]));
+		goto bad;
+	}
+
+	g = xcalloc(1, sizeof(*g));
+	g->data = data;
+	g->data_len = len;
+	g->num_commits = nr = ntohl(hdr[2]);
+	g->num_extra_edges = ntohl(hdr[3]);
+	expect = GRAPH_HEADER_SIZE + GRAPH_FANOUT_SIZE +
+		(size_t)nr * (20 + GRAPH_DATA_WIDTH) +
+		(size_t)g->num_extra_edges * 4 + 20;
+	if (len != expect) {
+		free(g);
+		error("wrong commit-graph file size in %s", path);
+		goto bad;
+	}
+	g->fanout = (const uint32_t *)(data + GRAPH_HEADER_SIZE);
+	for (i = prev = 0; i < 256; i++) {
+		uint32_t n = ntohl(g->fanout[i]);
+		if (n < prev) {
+			free(g);
+			error("non-monotonic fan-out table in %s", path);
+			goto bad;
+		}
+		prev = n;
+	}
+	if (prev != nr) {
+		free(g);
+		error("fan-out table of %s does not match its size", path);
+		goto bad;
+	}
+	g->sha1s = data + GRAPH_HEADER_SIZE + GRAPH_FANOUT_SIZE;
+	g->commit_data = g->sha1s + (size_t)nr * 20;
+	g->extra_edges = (const uint32_t *)(g->commit_data +
+					     (size_t)nr * GRAPH_DATA_WIDTH);
+	return g;
+
+bad:
+	munmap(data, len);
+	return NULL;
+}
+
+static struct commit_graph *prepare_commit_graph(void)
+{
+	if (!graph_prepared) {
+		graph_prepared = 1;
+		if (core_commit_graph)
+			the_graph = load_commit_graph(commit_graph_filename());
+	}
+	return the_graph;
+}
+
+void close_commit_graph(void)
+{
+	if (the_graph) {
+		munmap((void *)the_graph->data, the_graph->data_len);
+		free(the_graph);
+		the_graph = NULL;
+	}
+	graph_prepared = 0;
+}
+
+static const unsigned char *graph_sha1(const struct commit_graph *g,
+				       uint32_t pos)
+{
+	return g->sha1s + (size_t)pos * 20;
+}
+
+static int graph_pos(const struct commit_graph *g,
+		     const unsigned char *sha1, uint32_t *pos)
+{
+	uint32_t lo, hi;
+
+	lo = sha1[0] ? ntohl(g->fanout[sha1[0] - 1]) : 0;
+	hi = ntohl(g->fanout[sha1[0]]);
+	while (lo < hi) {
+		uint32_t mi = lo + (hi - lo) / 2;
+		int cmp = hashcmp(sha1, graph_sha1(g, mi));
+		if (!cmp) {
+			*pos = mi;
+			return 1;
+		}
+		if (cmp < 0)
+			hi = mi;
+		else
+			lo = mi + 1;
+	}
+	return 0;
+}
+
+static const uint32_t *graph_record(const struct commit_graph *g,
+				    uint32_t pos)
+{
+	return (const uint32_t *)(g->commit_data +
+				  (size_t)pos * GRAPH_DATA_WIDTH + 20);
+}
+
+/*
+ * Make sure all parent positions of the record are within the
+ * file, so that a corrupt file cannot make us half-parse a commit.
+ */
+static int graph_record_ok(const struct commit_graph *g, uint32_t pos)
+{
+	const uint32_t *rec = graph_record(g, pos);
+	uint32_t p1 = ntohl(rec[0]), p2 = ntohl(rec[1]);
+	uint32_t e;
+
+	if (p1 == GRAPH_PARENT_NONE)
+		return p2 == GRAPH_PARENT_NONE;
+	if (p1 >= g->num_commits)
+		return 0;
+	if (p2 == GRAPH_PARENT_NONE)
+		return 1;
+	if (!(p2 & GRAPH_EXTRA_EDGES))
+		return p2 < g->num_commits;
+	for (e = p2 & GRAPH_POS_MASK; e < g->num_extra_edges; e++) {
+		uint32_t edge = ntohl(g->extra_edges[e]);
+		if ((edge & GRAPH_POS_MASK) >= g->num_commits)
+			return 0;
+		if (edge & GRAPH_EDGE_LAST)
+			return 1;
+	}
+	return 0;
+}
+
+static struct commit_list **insert_graph_parent(const struct commit_graph *g,
+						uint32_t pos,
+						struct commit_list **pptr)
+{
+	struct commit *parent = lookup_commit(graph_sha1(g, pos));
+	if (parent)
+		pptr = &commit_list_insert(parent, pptr)->next;
+	return pptr;
+}
+
+static void fill_commit_in_graph(const struct commit_graph *g,
+				 struct commit *item, uint32_t pos)
+{
+	const uint32_t *rec = graph_record(g, pos);
+	uint32_t p1 = ntohl(rec[0]), p2 = ntohl(rec[1]);
+	struct commit_list **pptr = &item->parents;
+
+	item->object.parsed = 1;
+	item->tree = lookup_tree(g->commit_data + (size_t)pos * GRAPH_DATA_WIDTH);
+	item->generation = ntohl(rec[2]);
+	item->date = (unsigned long)(((uint64_t)ntohl(rec[3]) << 32) |
+				     ntohl(rec[4]));
+
+	if (p1 == GRAPH_PARENT_NONE)
+		return;
+	pptr = insert_graph_parent(g, p1, pptr);
+	if (p2 == GRAPH_PARENT_NONE)
+		return;
+	if (!(p2 & GRAPH_EXTRA_EDGES)) {
+		insert_graph_parent(g, p2, pptr);
+		return;
+	}
+	for (p2 &= GRAPH_POS_MASK; ; p2++) {
+		uint32_t edge = ntohl(g->extra_edges[p2]);
+		pptr = insert_graph_parent(g, edge & GRAPH_POS_MASK, pptr);
+		if (edge & GRAPH_EDGE_LAST)
+			break;
+	}
+}
+
+int parse_commit_in_graph(struct commit *item)
+{
+	struct commit_graph *g;
+	uint32_t pos;
+
+	if (graph_disabled || !core_commit_graph)
+		return 0;
+	g = prepare_commit_graph();
+	if (!g || !g->num_commits)
+		return 0;
+	/* grafts and shallow boundaries rewrite parents behind our back */
+	if (has_commit_grafts())
+		return 0;
+	if (!graph_pos(g, item->object.sha1, &pos))
+		return 0;
+	if (!graph_record_ok(g, pos)) {
+		warning("corrupt commit-graph entry for %s",
+			sha1_to_hex(item->object.sha1));
+		return 0;
+	}
+	fill_commit_in_graph(g, item, pos);
+	return 1;
+}
+
+/*
+ * Writing
+ */
+static struct commit **graph_commits;
+static int graph_commits_nr, graph_commits_alloc;
+
+static void add_graph_commit(struct commit *commit)
+{
+	if (commit->object.flags & GRAPH_SEEN)
+		return;
+	commit->object.flags |= GRAPH_SEEN;
+	ALLOC_GROW(graph_commits, graph_commits_nr + 1, graph_commits_alloc);
+	graph_commits[graph_commits_nr++] = commit;
+}
+
+static int add_ref_tip(const char *path, const unsigned char *sha1,
+		       int flags, void *cb_data)
+{
+	struct commit *commit = lookup_commit_reference_gently(sha1, 1);
+	if (commit)
+		add_graph_commit(commit);
+	return 0;
+}
+
+static int commit_sha1_cmp(const void *a_, const void *b_)
+{
+	const struct commit *a = *(const struct commit **)a_;
+	const struct commit *b = *(const struct commit **)b_;
+	return hashcmp(a->object.sha1, b->object.sha1);
+}
+
+static const unsigned char *graph_commit_access(size_t index, void *table)
+{
+	struct commit **commits = table;
+	return commits[index]->object.sha1;
+}
+
+static uint32_t graph_commit_pos(const unsigned char *sha1)
+{
+	int pos = sha1_pos(sha1, graph_commits, graph_commits_nr,
+			   graph_commit_access);
+	if (pos < 0)
+		die("BUG: commit %s missing from commit-graph",
+		    sha1_to_hex(sha1));
+	return pos;
+}
+
+static uint32_t *compute_generations(void)
+{
+	uint32_t *gen = xcalloc(graph_commits_nr, sizeof(*gen));
+	uint32_t *stack = NULL;
+	int i, nr = 0, alloc = 0;
+
+	for (i = 0; i < graph_commits_nr; i++) {
+		if (gen[i])
+			continue;
+		ALLOC_GROW(stack, nr + 1, alloc);
+		stack[nr++] = i;
+		while (nr) {
+			uint32_t pos = stack[nr - 1], max = 0;
+			struct commit_list *p;
+			int pending = 0;
+
+			for (p = graph_commits[pos]->parents; p; p = p->next) {
+				uint32_t ppos = graph_commit_pos(p->item->object.sha1);
+				if (!gen[ppos]) {
+					ALLOC_GROW(stack, nr + 1, alloc);
+					stack[nr++] = ppos;
+					pending = 1;
+				} else if (max < gen[ppos])
+					max = gen[ppos];
+			}
+			if (pending)
+				continue;
+			gen[pos] = max + 1;
+			nr--;
+		}
+	}
+	free(stack);
+	return gen;
+}
+
+static void write_be32(struct sha1file *f, uint32_t v)
+{
+	v = htonl(v);
+	sha1write(f, &v, 4);
+}
+
+int write_commit_graph(int quiet)
+{
+	static struct lock_file lock;
+	struct sha1file *f;
+	uint32_t *gen, num_extra_edges = 0;
+	int i, j, fd;
+
+	if (has_commit_grafts()) {
+		if (!quiet)
+			warning("not writing a commit-graph in a repository "
+				"with grafts or shallow history");
+		return 0;
+	}
+
+	close_commit_graph();
+	graph_disabled = 1;
+
+	head_ref(add_ref_tip, NULL);
+	for_each_ref(add_ref_tip, NULL);
+	for (i = 0; i < graph_commits_nr; i++) {
+		struct commit *commit = graph_commits[i];
+		struct commit_list *parents;
+		int nr_parents;
+
+		if (parse_commit(commit) || !commit->tree)
+			return error("unable to parse commit %s",
+				     sha1_to_hex(commit->object.sha1));
+		for (parents = commit->parents, nr_parents = 0;
+		     parents;
+		     parents = parents->next, nr_parents++)
+			add_graph_commit(parents->item);
+		if (nr_parents > 2)
+			num_extra_edges += nr_parents - 1;
+	}
+	qsort(graph_commits, graph_commits_nr, sizeof(*graph_commits),
+	      commit_sha1_cmp);
+	gen = compute_generations();
+
+	safe_create_leading_directories((char *)commit_graph_filename());
+	fd = hold_lock_file_for_update(&lock, commit_graph_filename(),
+				       LOCK_DIE_ON_ERROR);
+	f = sha1fd(fd, lock.filename);
+
+	write_be32(f, COMMIT_GRAPH_SIGNATURE);
+	write_be32(f, COMMIT_GRAPH_VERSION);
+	write_be32(f, graph_commits_nr);
+	write_be32(f, num_extra_edges);
+
+	for (i = 0, j = 0; j < 256; j++) {
+		while (i < graph_commits_nr &&
+		       graph_commits[i]->object.sha1[0] == j)
+			i++;
+		write_be32(f, i);
+	}
+
+	for (i = 0; i < graph_commits_nr; i++)
+		sha1write(f, graph_commits[i]->object.sha1, 20);
+
+	for (i = 0, num_extra_edges = 0; i < graph_commits_nr; i++) {
+		struct commit *commit = graph_commits[i];
+		struct commit_list *p = commit->parents;
+		uint64_t date = commit->date;
+
+		sha1write(f, commit->tree->object.sha1, 20);
+		write_be32(f, p ? graph_commit_pos(p->item->object.sha1)
+			   : GRAPH_PARENT_NONE);
+		if (!p || !p->next)
+			write_be32(f, GRAPH_PARENT_NONE);
+		else if (!p->next->next)
+			write_be32(f, graph_commit_pos(p->next->item->object.sha1));
+		else {
+			struct commit_list *q;
+			write_be32(f, GRAPH_EXTRA_EDGES | num_extra_edges);
+			for (q = p->next; q; q = q->next)
+				num_extra_edges++;
+		}
+		write_be32(f, gen[i]);
+		write_be32(f, (uint32_t)(date >> 32));
+		write_be32(f, (uint32_t)date);
+	}
+
+	for (i = 0; i < graph_commits_nr; i++) {
+		struct commit_list *p = graph_commits[i]->parents;
+		if (!p || !p->next || !p->next->next)
+			continue;
+		for (p = p->next; p; p = p->next)
+			write_be32(f, graph_commit_pos(p->item->object.sha1) |
+				   (p->next ? 0 : GRAPH_EDGE_LAST));
+	}
+
+	sha1close(f, NULL, CSUM_CLOSE);
+	lock.fd = -1;
+	if (commit_lock_file(&lock))
+		return error("unable to write %s", commit_graph_filename());
+
+	if (!quiet)
+		fprintf(stderr, "Wrote commit-graph with %d commits\n",
+			graph_commits_nr);
+	free(gen);
+	graph_disabled = 0;
+	return 0;
+}
+
+/*
+ * Verification
+ */
+static int verify_graph_entry(const struct commit_graph *g, uint32_t pos)
+{
+	const unsigned char *sha1 = graph_sha1(g, pos);
+	const uint32_t *rec = graph_record(g, pos);
+	struct commit *commit = lookup_commit(sha1);
+	struct commit_list *p;
+	struct commit_list *graph_parents = NULL;
+	struct commit_list *gp;
+	struct commit tmp;
+	uint32_t max = 0;
+	int ret = 0;
+
+	if (!commit || parse_commit(commit))
+		return error("commit-graph lists %s which is not a commit",
+			     sha1_to_hex(sha1));
+	if (!graph_record_ok(g, pos))
+		return error("commit-graph entry for %s has bad parent positions",
+			     sha1_to_hex(sha1));
+
+	memset(&tmp, 0, sizeof(tmp));
+	hashcpy(tmp.object.sha1, sha1);
+	fill_commit_in_graph(g, &tmp, pos);
+	graph_parents = tmp.parents;
+
+	if (!tmp.tree || !commit->tree ||
+	    hashcmp(tmp.tree->object.sha1, commit->tree->object.sha1))
+		ret = error("commit-graph has wrong tree for %s",
+			    sha1_to_hex(sha1));
+	if (tmp.date != commit->date)
+		ret = error("commit-graph has wrong date for %s",
+			    sha1_to_hex(sha1));
+	for (p = commit->parents, gp = graph_parents;
+	     p && gp;
+	     p = p->next, gp = gp->next) {
+		uint32_t ppos;
+		if (p->item != gp->item) {
+			ret = error("commit-graph has wrong parents for %s",
+				    sha1_to_hex(sha1));
+			break;
+		}
+		if (graph_pos(g, gp->item->object.sha1, &ppos)) {
+			uint32_t pgen = ntohl(graph_record(g, ppos)[2]);
+			if (max < pgen)
+				max = pgen;
+		}
+	}
+	if (p || gp)
+		ret = error("commit-graph has wrong number of parents for %s",
+			    sha1_to_hex(sha1));
+	if (ntohl(rec[2]) != max + 1)
+		ret = error("commit-graph has wrong generation for %s",
+			    sha1_to_hex(sha1));
+	free_commit_list(graph_parents);
+	return ret;
+}
+
+int verify_commit_graph(int verbose)
+{
+	struct commit_graph *g;
+	unsigned char sha1[20];
+	git_SHA_CTX ctx;
+	uint32_t i;
+	int errors = 0;
+
+	graph_disabled = 1;
+	g = load_commit_graph(commit_graph_filename());
+	if (!g)
+		return error("no usable commit-graph in %s",
+			     commit_graph_filename());
+
+	git_SHA1_Init(&ctx);
+	git_SHA1_Update(&ctx, g->data, g->data_len - 20);
+	git_SHA1_Final(sha1, &ctx);
+	if (hashcmp(sha1, g->data + g->data_len - 20))
+		errors += !!error("commit-graph checksum mismatch");
+
+	for (i = 1; i < g->num_commits; i++)
+		if (hashcmp(graph_sha1(g, i - 1), graph_sha1(g, i)) >= 0) {
+			errors += !!error("commit-graph is not sorted at %s",
+					  sha1_to_hex(graph_sha1(g, i)));
+			break;
+		}
+
+	for (i = 0; i < g->num_commits; i++)
+		if (verify_graph_entry(g, i))
+			errors++;
+
+	if (verbose && !errors)
+		printf("commit-graph: %"PRIu32" commits, %"PRIu32
+		       " extra edges: ok\n",
+		       g->num_commits, g->num_extra_edges);
+	munmap((void *)g->data, g->data_len);
+	free(g);
+	return errors;
+}
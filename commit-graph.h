@@ -0,0 +1,32 @@
+#ifndef COMMIT_GRAPH_H
+#define COMMIT_GRAPH_H
+
+/*
+ * The commit-graph file ($GIT_OBJECT_DIRECTORY/info/commit-graph)
+ * caches the parts of each commit object that history traversal
+ * needs: tree, parents, committer date and generation number.
+ * See Documentation/technical/commit-graph-format.txt.
+ */
+
+#define COMMIT_GRAPH_SIGNATURE 0x43475048	/* "CGPH" */
+#define COMMIT_GRAPH_VERSION 1
+
+#define GRAPH_PARENT_NONE	0x70000000
+#define GRAPH_EXTRA_EDGES	0x80000000
+#define GRAPH_EDGE_LAST		0x80000000
+#define GRAPH_POS_MASK		0x7fffffff
+
+struct commit;
+
+/*
+ * Fill in tree, parents, date and generation of "item" from the
+ * commit-graph file, if it is present, usable and knows the commit.
+ * Returns 1 when the commit was parsed this way, 0 otherwise.
+ */
+extern int parse_commit_in_graph(struct commit *item);
+
+extern int write_commit_graph(int quiet);
+extern int verify_commit_graph(int verbose);
+extern void close_commit_graph(void);
+
+#endif
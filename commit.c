@@ -5,6 +5,7 @@
 #include "utf8.h"
 #include "diff.h"
 #include "revision.h"
+#include "commit-graph.h"
 
 int save_commit_buffer = 1;
 
@@ -203,6 +204,12 @@ struct commit_graft *lookup_commit_graft(const unsigned char *sha1)
 	return commit_graft[pos];
 }
 
+int has_commit_grafts(void)
+{
+	prepare_commit_graft();
+	return commit_graft_nr > 0;
+}
+
 int write_shallow_commits(int fd, int use_pack_protocol)
 {
 	int i, count = 0;
@@ -298,6 +305,12 @@ int parse_commit(struct commit *item)
 		return -1;
 	if (item->object.parsed)
 		return 0;
+	/*
+	 * Callers that want the commit message need the object itself;
+	 * everybody else can be served from the commit-graph.
+	 */
+	if (!save_commit_buffer && parse_commit_in_graph(item))
+		return 0;
 	buffer = read_sha1_file(item->object.sha1, &type, &size);
 	if (!buffer)
 		return error("Could not read %s",
@@ -725,6 +738,15 @@ int in_merge_bases(struct commit *commit, struct commit **reference, int num)
 	struct commit_list *bases, *b;
 	int ret = 0;
 
+	/*
+	 * A commit can only be an ancestor of commits with a larger
+	 * generation number, when both are known.
+	 */
+	if (num == 1 && !parse_commit(commit) && !parse_commit(*reference) &&
+	    commit->generation && (*reference)->generation &&
+	    commit->generation >= (*reference)->generation)
+		return commit == *reference;
+
 	if (num == 1)
 		bases = get_merge_bases(commit, *reference, 1);
 	else
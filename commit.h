@@ -15,6 +15,7 @@ struct commit {
 	struct object object;
 	void *util;
 	unsigned int indegree;
+	unsigned int generation; /* 0 unless parsed from the commit-graph */
 	unsigned long date;
 	struct commit_list *parents;
 	struct tree *tree;
@@ -121,6 +122,7 @@ struct commit_graft {
 struct commit_graft *read_graft_line(char *buf, int len);
 int register_commit_graft(struct commit_graft *, int);
 struct commit_graft *lookup_commit_graft(const unsigned char *sha1);
+int has_commit_grafts(void);
 
 extern struct commit_list *get_merge_bases(struct commit *rev1, struct commit *rev2, int cleanup);
 extern struct commit_list *get_merge_bases_many(struct commit *one, int n, struct commit **twos, int cleanup);
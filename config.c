@@ -446,11 +446,49 @@ static int git_default_core_config(const char *var, const char *value)
 		return 0;
 	}
 
+	if (!strcmp(var, "core.packedgitmapwhole")) {
+		packed_git_map_whole = git_config_bool(var, value);
+		return 0;
+	}
+
 	if (!strcmp(var, "core.deltabasecachelimit")) {
 		delta_base_cache_limit = git_config_int(var, value);
 		return 0;
 	}
 
+	if (!strcmp(var, "core.deltabasecacheslots")) {
+		int slots = git_config_int(var, value);
+		if (slots < 1)
+			die("bad core.deltaBaseCacheSlots %d", slots);
+		delta_base_cache_slots = slots;
+		return 0;
+	}
+
+	if (!strcmp(var, "core.commitgraph")) {
+		core_commit_graph = git_config_bool(var, value);
+		return 0;
+	}
+
+	if (!strcmp(var, "core.multipackindex")) {
+		core_multi_pack_index = git_config_bool(var, value);
+		return 0;
+	}
+
+	if (!strcmp(var, "core.looseobjectcache")) {
+		core_loose_object_cache = git_config_bool(var, value);
+		return 0;
+	}
+
+	if (!strcmp(var, "core.bigfilethreshold")) {
+		big_file_threshold = git_config_ulong(var, value);
+		return 0;
+	}
+
+	if (!strcmp(var, "core.bulkcheckin")) {
+		core_bulk_checkin = git_config_bool(var, value);
+		return 0;
+	}
+
 	if (!strcmp(var, "core.autocrlf")) {
 		if (value && !strcasecmp(value, "input")) {
 			auto_crlf = -1;
@@ -495,6 +533,19 @@ static int git_default_core_config(const char *var, const char *value)
 		return 0;
 	}
 
+	if (!strcmp(var, "core.splitindex")) {
+		core_split_index = git_config_bool(var, value);
+		return 0;
+	}
+
+	if (!strcmp(var, "core.untrackedcache")) {
+		core_untracked_cache = git_config_bool(var, value);
+		return 0;
+	}
+
+	if (!strcmp(var, "core.fsmonitor"))
+		return git_config_string(&core_fsmonitor, var, value);
+
 	if (!strcmp(var, "core.unreliablehardlinks")) {
 		unreliable_hardlinks = git_config_bool(var, value);
 		return 0;
@@ -624,6 +675,24 @@ int git_default_config(const char *var, const char *value, void *dummy)
 	if (!prefixcmp(var, "mailmap."))
 		return git_default_mailmap_config(var, value);
 
+	if (!strcmp(var, "splitindex.maxpercentchange")) {
+		split_index_max_percent = git_config_int(var, value);
+		if (split_index_max_percent < 0 || split_index_max_percent > 100)
+			return error("%s must be between 0 and 100", var);
+		return 0;
+	}
+
+	if (!strcmp(var, "index.threads")) {
+		int is_bool;
+
+		index_threads = git_config_bool_or_int(var, value, &is_bool);
+		if (is_bool)
+			index_threads = index_threads ? 0 : 1;
+		else if (index_threads < 0)
+			return error("%s cannot be negative", var);
+		return 0;
+	}
+
 	if (!strcmp(var, "pager.color") || !strcmp(var, "color.pager")) {
 		pager_use_color = git_config_bool(var,value);
 		return 0;
@@ -626,3 +626,24 @@ int convert_to_working_tree(const char *path, const char *src, size_t len, struc
 	}
 	return ret | apply_filter(path, src, len, dst, filter);
 }
+
+/*
+ * Tell whether convert_to_working_tree() might change the contents of
+ * "path", so that callers can write a blob out as it is stored without
+ * holding it in memory first when the answer is no.
+ */
+int would_convert_to_working_tree(const char *path)
+{
+	struct git_attr_check check[3];
+	struct convert_driver *drv;
+	int crlf;
+
+	setup_convert_check(check);
+	if (git_checkattr(path, ARRAY_SIZE(check), check))
+		return auto_crlf > 0;
+	crlf = git_path_check_crlf(path, check + 0);
+	drv = git_path_check_convert(path, check + 2);
+	if (git_path_check_ident(path, check + 1) || (drv && drv->smudge))
+		return 1;
+	return crlf != CRLF_BINARY && crlf != CRLF_INPUT && auto_crlf > 0;
+}
@@ -79,6 +79,57 @@ extern void *patch_delta(const void *src_buf, unsigned long src_size,
 			 const void *delta_buf, unsigned long delta_size,
 			 unsigned long *dst_size);
 
+/*
+ * A delta, or several of them composed into one, as the fragments
+ * of its result: bytes to copy from the source, or literal bytes
+ * (which point into the delta data they came from).  Fragments are
+ * in the order of, and cover, the result.
+ */
+struct delta_fragment {
+	unsigned long off;		/* where it goes in the result */
+	unsigned long len;
+	const unsigned char *data;	/* literal bytes, or NULL */
+	unsigned long src_off;		/* where it comes from if !data */
+};
+
+struct composed_delta {
+	unsigned long src_size, size;
+	unsigned int nr, alloc;
+	struct delta_fragment *frag;
+};
+
+/*
+ * parse_delta: turn delta data into a composed_delta, which refers
+ * to it, so it must be kept around.  Returns -1 if it is corrupt.
+ */
+extern int parse_delta(struct composed_delta *cd,
+		       const void *delta_buf, unsigned long delta_size);
+
+/*
+ * compose_delta: given the delta "upper" from B to C and "lower" from
+ * A to B, make "out" the delta from A to C, without building B.
+ */
+extern int compose_delta(struct composed_delta *out,
+			 const struct composed_delta *upper,
+			 const struct composed_delta *lower);
+
+/*
+ * apply_composed_delta: like patch_delta(); NULL if the source does
+ * not have the size the delta expects.
+ */
+extern void *apply_composed_delta(const void *src_buf, unsigned long src_size,
+				  const struct composed_delta *cd,
+				  unsigned long *dst_size);
+
+extern void free_composed_delta(struct composed_delta *cd);
+
+/*
+ * dup_composed_delta: copy "cd" and its literal bytes into a single
+ * allocation, of "*memsize" bytes, to be freed with free().
+ */
+extern struct composed_delta *dup_composed_delta(const struct composed_delta *cd,
+						 unsigned long *memsize);
+
 /* the smallest possible delta size is 4 bytes */
 #define DELTA_SIZE_MIN	4
 
@@ -14,6 +14,10 @@
 #include "git-compat-util.h"
 #include "delta.h"
 
+#if defined(__SSE2__) && defined(__GNUC__)
+#include <emmintrin.h>
+#endif
+
 /* maximum hash entry list for the same hash bucket */
 #define HASH_LIMIT 64
 
@@ -117,11 +121,6 @@ struct index_entry {
 	unsigned int val;
 };
 
-struct unpacked_index_entry {
-	struct index_entry entry;
-	struct unpacked_index_entry *next;
-};
-
 struct delta_index {
 	unsigned long memsize;
 	const void *src_buf;
@@ -130,12 +129,56 @@ struct delta_index {
 	struct index_entry *hash[FLEX_ARRAY];
 };
 
+/*
+ * Fingerprint "nr" consecutive blocks of RABIN_WINDOW bytes, each
+ * starting one byte after "buf" + its offset.  The blocks do not
+ * depend on each other, so four of them are hashed at once: that
+ * keeps several table lookups in flight instead of waiting for each.
+ * While fewer than 24 bits have been shifted in, T[val >> RABIN_SHIFT]
+ * is T[0], i.e. 0, so the first three bytes are simply loaded.
+ */
+#define RABIN_START(d) (((d)[1] << 16) | ((d)[2] << 8) | (d)[3])
+#define RABIN_STEP(v, c) (v) = (((v) << 8) | (c)) ^ T[(v) >> RABIN_SHIFT]
+
+static void hash_blocks(const unsigned char *buf, unsigned int nr,
+			unsigned int *vals)
+{
+	unsigned int b, i;
+
+	for (b = 0; b + 4 <= nr; b += 4) {
+		const unsigned char *d0 = buf + b * RABIN_WINDOW;
+		const unsigned char *d1 = d0 + RABIN_WINDOW;
+		const unsigned char *d2 = d1 + RABIN_WINDOW;
+		const unsigned char *d3 = d2 + RABIN_WINDOW;
+		unsigned int v0 = RABIN_START(d0), v1 = RABIN_START(d1);
+		unsigned int v2 = RABIN_START(d2), v3 = RABIN_START(d3);
+
+		for (i = 4; i <= RABIN_WINDOW; i++) {
+			RABIN_STEP(v0, d0[i]);
+			RABIN_STEP(v1, d1[i]);
+			RABIN_STEP(v2, d2[i]);
+			RABIN_STEP(v3, d3[i]);
+		}
+		vals[b] = v0;
+		vals[b + 1] = v1;
+		vals[b + 2] = v2;
+		vals[b + 3] = v3;
+	}
+	for (; b < nr; b++) {
+		const unsigned char *d = buf + b * RABIN_WINDOW;
+		unsigned int v = RABIN_START(d);
+
+		for (i = 4; i <= RABIN_WINDOW; i++)
+			RABIN_STEP(v, d[i]);
+		vals[b] = v;
+	}
+}
+
 struct delta_index * create_delta_index(const void *buf, unsigned long bufsize)
 {
-	unsigned int i, hsize, hmask, entries, prev_val, *hash_count;
-	const unsigned char *data, *buffer = buf;
+	unsigned int i, j, hsize, hmask, blocks, entries, *vals, *block, *start;
+	const unsigned char *buffer = buf;
 	struct delta_index *index;
-	struct unpacked_index_entry *entry, **hash;
 	struct index_entry *packed_entry, **packed_hash;
 	void *mem;
 	unsigned long memsize;
@@ -146,53 +189,45 @@ struct delta_index * create_delta_index(const void *buf, unsigned long bufsize)
 	/* Determine index hash size.  Note that indexing skips the
 	   first byte to allow for optimizing the Rabin's polynomial
 	   initialization in create_delta(). */
-	entries = (bufsize - 1)  / RABIN_WINDOW;
-	hsize = entries / 4;
+	blocks = (bufsize - 1)  / RABIN_WINDOW;
+	hsize = blocks / 4;
 	for (i = 4; (1u << i) < hsize && i < 31; i++);
 	hsize = 1 << i;
 	hmask = hsize - 1;
 
-	/* allocate lookup index */
-	memsize = sizeof(*hash) * hsize +
-		  sizeof(*entry) * entries;
-	mem = malloc(memsize);
-	if (!mem)
-		return NULL;
-	hash = mem;
-	mem = hash + hsize;
-	entry = mem;
-
-	memset(hash, 0, hsize * sizeof(*hash));
-
-	/* allocate an array to count hash entries */
-	hash_count = calloc(hsize, sizeof(*hash_count));
-	if (!hash_count) {
-		free(hash);
+	/*
+	 * Fingerprint all blocks, then sort them into their hash
+	 * buckets with a counting sort: block[] gets the blocks of each
+	 * bucket in turn, ordered by offset, and start[] where each
+	 * bucket begins in it.  Of consecutive identical blocks, only
+	 * the lowest one is indexed.
+	 */
+	vals = malloc(sizeof(*vals) * (blocks + 1));
+	block = malloc(sizeof(*block) * (blocks + 1));
+	start = calloc(hsize + 1, sizeof(*start));
+	if (!vals || !block || !start) {
+		free(vals);
+		free(block);
+		free(start);
 		return NULL;
 	}
-
-	/* then populate the index */
-	prev_val = ~0;
-	for (data = buffer + entries * RABIN_WINDOW - RABIN_WINDOW;
-	     data >= buffer;
-	     data -= RABIN_WINDOW) {
-		unsigned int val = 0;
-		for (i = 1; i <= RABIN_WINDOW; i++)
-			val = ((val << 8) | data[i]) ^ T[val >> RABIN_SHIFT];
-		if (val == prev_val) {
-			/* keep the lowest of consecutive identical blocks */
-			entry[-1].entry.ptr = data + RABIN_WINDOW;
-			--entries;
-		} else {
-			prev_val = val;
-			i = val & hmask;
-			entry->entry.ptr = data + RABIN_WINDOW;
-			entry->entry.val = val;
-			entry->next = hash[i];
-			hash[i] = entry++;
-			hash_count[i]++;
-		}
+	hash_blocks(buffer, blocks, vals);
+
+	for (i = 0; i < blocks; i++)
+		if (!i || vals[i] != vals[i - 1])
+			start[vals[i] & hmask]++;
+	for (i = 0, j = 0; i <= hsize; i++) {
+		unsigned int n = start[i];
+		start[i] = j;
+		j += n;
 	}
+	for (i = 0; i < blocks; i++)
+		if (!i || vals[i] != vals[i - 1])
+			block[start[vals[i] & hmask]++] = i;
+	/* each start[i] has moved to where bucket i+1 begins */
+	for (i = hsize; i > 0; i--)
+		start[i] = start[i - 1];
+	start[0] = 0;
 
 	/*
 	 * Determine a limit on the number of entries in the same hash
@@ -206,55 +241,20 @@ struct delta_index * create_delta_index(const void *buf, unsigned long bufsize)
 	 * uniformly to still preserve a good repartition across
 	 * the reference buffer.
 	 */
+	entries = 0;
 	for (i = 0; i < hsize; i++) {
-		int acc;
-
-		if (hash_count[i] <= HASH_LIMIT)
-			continue;
-
-		/* We leave exactly HASH_LIMIT entries in the bucket */
-		entries -= hash_count[i] - HASH_LIMIT;
-
-		entry = hash[i];
-		acc = 0;
-
-		/*
-		 * Assume that this loop is gone through exactly
-		 * HASH_LIMIT times and is entered and left with
-		 * acc==0.  So the first statement in the loop
-		 * contributes (hash_count[i]-HASH_LIMIT)*HASH_LIMIT
-		 * to the accumulator, and the inner loop consequently
-		 * is run (hash_count[i]-HASH_LIMIT) times, removing
-		 * one element from the list each time.  Since acc
-		 * balances out to 0 at the final run, the inner loop
-		 * body can't be left with entry==NULL.  So we indeed
-		 * encounter entry==NULL in the outer loop only.
-		 */
-		do {
-			acc += hash_count[i] - HASH_LIMIT;
-			if (acc > 0) {
-				struct unpacked_index_entry *keep = entry;
-				do {
-					entry = entry->next;
-					acc -= HASH_LIMIT;
-				} while (acc > 0);
-				keep->next = entry->next;
-			}
-			entry = entry->next;
-		} while (entry);
+		unsigned int n = start[i + 1] - start[i];
+		entries += n < HASH_LIMIT ? n : HASH_LIMIT;
 	}
-	free(hash_count);
 
-	/*
-	 * Now create the packed index in array form
-	 * rather than linked lists.
-	 */
 	memsize = sizeof(*index)
 		+ sizeof(*packed_hash) * (hsize+1)
 		+ sizeof(*packed_entry) * entries;
 	mem = malloc(memsize);
 	if (!mem) {
-		free(hash);
+		free(vals);
+		free(block);
+		free(start);
 		return NULL;
 	}
 
@@ -270,20 +270,41 @@ struct delta_index * create_delta_index(const void *buf, unsigned long bufsize)
 	packed_entry = mem;
 
 	for (i = 0; i < hsize; i++) {
-		/*
-		 * Coalesce all entries belonging to one linked list
-		 * into consecutive array entries.
-		 */
+		unsigned int n = start[i + 1] - start[i];
+		unsigned int *b = block + start[i];
+		int acc = 0;
+
 		packed_hash[i] = packed_entry;
-		for (entry = hash[i]; entry; entry = entry->next)
-			*packed_entry++ = entry->entry;
+		for (j = 0; j < n; j++) {
+			packed_entry->ptr = buffer + b[j] * RABIN_WINDOW
+					    + RABIN_WINDOW;
+			packed_entry->val = vals[b[j]];
+			packed_entry++;
+			if (n <= HASH_LIMIT)
+				continue;
+			/*
+			 * We leave exactly HASH_LIMIT entries in the
+			 * bucket: each one kept adds n-HASH_LIMIT to
+			 * the accumulator and each one skipped takes
+			 * HASH_LIMIT from it, so that the HASH_LIMIT
+			 * entries kept are followed by n-HASH_LIMIT
+			 * skipped ones in all, spread uniformly.
+			 */
+			acc += n - HASH_LIMIT;
+			while (acc > 0) {
+				j++;
+				acc -= HASH_LIMIT;
+			}
+		}
 	}
 
 	/* Sentinel value to indicate the length of the last hash bucket */
 	packed_hash[hsize] = packed_entry;
 
 	assert(packed_entry - (struct index_entry *)mem == entries);
-	free(hash);
+	free(vals);
+	free(block);
+	free(start);
 
 	return index;
 }
@@ -301,6 +322,43 @@ unsigned long sizeof_delta_index(struct delta_index *index)
 		return 0;
 }
 
+/*
+ * How many of the first "max" bytes of "a" and "b" are the same.
+ * Compare a word, or with SSE2 16 bytes, at a time, and let the
+ * lowest bit that differs tell where the mismatch is.
+ */
+static inline unsigned int match_length(const unsigned char *a,
+					const unsigned char *b,
+					unsigned int max)
+{
+	unsigned int len = 0;
+
+#if defined(__SSE2__) && defined(__GNUC__)
+	while (len + 16 <= max) {
+		__m128i x = _mm_loadu_si128((const __m128i *)(a + len));
+		__m128i y = _mm_loadu_si128((const __m128i *)(b + len));
+		unsigned int neq = ~_mm_movemask_epi8(_mm_cmpeq_epi8(x, y))
+				   & 0xffff;
+		if (neq)
+			return len + __builtin_ctz(neq);
+		len += 16;
+	}
+#elif defined(__GNUC__) && defined(__BYTE_ORDER__) && \
+	__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+	while (len + sizeof(unsigned long) <= max) {
+		unsigned long x, y;
+		memcpy(&x, a + len, sizeof(x));
+		memcpy(&y, b + len, sizeof(y));
+		if (x != y)
+			return len + __builtin_ctzl(x ^ y) / 8;
+		len += sizeof(unsigned long);
+	}
+#endif
+	while (len < max && a[len] == b[len])
+		len++;
+	return len;
+}
+
 /*
  * The maximum size for any opcode sequence, including the initial header
  * plus Rabin window plus biggest copy.
@@ -375,8 +433,7 @@ create_delta(const struct delta_index *index,
 					ref_size = top - src;
 				if (ref_size <= msize)
 					break;
-				while (ref_size-- && *src++ == *ref)
-					ref++;
+				ref += match_length(ref, src, ref_size);
 				if (msize < ref - entry->ptr) {
 					/* this is our best match so far */
 					msize = ref - entry->ptr;
@@ -14,9 +14,42 @@ struct path_simplify {
 	const char *path;
 };
 
+/*
+ * An untracked cache entry for one directory.  Its entries are kept
+ * as they came out of readdir(), each a type byte (UC_*, possibly with
+ * UC_EXCLUDED) followed by the NUL-terminated name.  What is shown of
+ * them depends on the index and on how read_directory() was called,
+ * so that is worked out again each time.
+ */
+struct uc_stat {
+	unsigned int mtime_sec, mtime_nsec, ino, size;
+};
+
+struct untracked_cache_dir {
+	char *name;
+	struct uc_stat stat;
+	/* of its per-directory exclude file; the sha1 is null if none */
+	struct uc_stat exclude_stat;
+	unsigned char exclude_sha1[20];
+	unsigned valid : 1;
+	unsigned seen : 1;	/* in-core only, while reading it */
+	unsigned int nr;
+	struct strbuf entries;
+	struct untracked_cache_dir **dirs;	/* sorted by name */
+	int dirs_nr, dirs_alloc;
+};
+
+#define UC_REG		1
+#define UC_LNK		2
+#define UC_DIR		3
+#define UC_OTHER	4
+#define UC_TYPE_MASK	7
+#define UC_EXCLUDED	8
+
 static int read_directory_recursive(struct dir_struct *dir,
 	const char *path, const char *base, int baselen,
-	int check_only, const struct path_simplify *simplify);
+	int check_only, const struct path_simplify *simplify,
+	struct untracked_cache_dir *ucd);
 static int get_dtype(struct dirent *de, const char *path);
 
 int common_prefix(const char **pathspec)
@@ -477,9 +510,13 @@ enum directory_treatment {
 	recurse_into_directory,
 };
 
+static struct untracked_cache_dir *untracked_subdir(struct untracked_cache_dir *,
+						    const char *, int);
+
 static enum directory_treatment treat_directory(struct dir_struct *dir,
 	const char *dirname, int len,
-	const struct path_simplify *simplify)
+	const struct path_simplify *simplify,
+	struct untracked_cache_dir *ucd)
 {
 	/* The "len-1" is to strip the final '/' */
 	switch (directory_exists_in_index(dirname, len-1)) {
@@ -505,7 +542,8 @@ static enum directory_treatment treat_directory(struct dir_struct *dir,
 	/* This is the "show_other_directories" case */
 	if (!(dir->flags & DIR_HIDE_EMPTY_DIRECTORIES))
 		return show_directory;
-	if (!read_directory_recursive(dir, dirname, dirname, len, 1, simplify))
+	if (!read_directory_recursive(dir, dirname, dirname, len, 1, simplify,
+				      untracked_subdir(ucd, dirname, len)))
 		return ignore_directory;
 	return show_directory;
 }
@@ -565,6 +603,391 @@ static int get_dtype(struct dirent *de, const char *path)
 	return dtype;
 }
 
+static struct untracked_cache_dir *new_untracked_dir(const char *name, int len)
+{
+	struct untracked_cache_dir *ucd = xcalloc(1, sizeof(*ucd));
+
+	ucd->name = xmemdupz(name, len);
+	strbuf_init(&ucd->entries, 0);
+	return ucd;
+}
+
+static void free_untracked_dir(struct untracked_cache_dir *ucd)
+{
+	int i;
+
+	if (!ucd)
+		return;
+	for (i = 0; i < ucd->dirs_nr; i++)
+		free_untracked_dir(ucd->dirs[i]);
+	free(ucd->dirs);
+	strbuf_release(&ucd->entries);
+	free(ucd->name);
+	free(ucd);
+}
+
+/*
+ * The exclude patterns that applied to "ucd" have changed, so neither
+ * its entries nor anything below it can be trusted.
+ */
+static void invalidate_untracked_dir(struct untracked_cache_dir *ucd)
+{
+	int i;
+
+	for (i = 0; i < ucd->dirs_nr; i++)
+		free_untracked_dir(ucd->dirs[i]);
+	ucd->dirs_nr = 0;
+	ucd->valid = 0;
+}
+
+static int find_untracked_dir(struct untracked_cache_dir *ucd,
+			      const char *name, int len)
+{
+	int lo = 0, hi = ucd->dirs_nr;
+
+	while (lo < hi) {
+		int mi = (lo + hi) / 2;
+		const char *mi_name = ucd->dirs[mi]->name;
+		int cmp = strncmp(mi_name, name, len);
+
+		if (!cmp)
+			cmp = mi_name[len] ? 1 : 0;
+		if (!cmp)
+			return mi;
+		if (cmp < 0)
+			lo = mi + 1;
+		else
+			hi = mi;
+	}
+	return -lo - 1;
+}
+
+static struct untracked_cache_dir *lookup_untracked_dir(struct untracked_cache_dir *ucd,
+							const char *name, int len)
+{
+	int pos = find_untracked_dir(ucd, name, len);
+
+	if (pos >= 0)
+		return ucd->dirs[pos];
+	pos = -pos - 1;
+	ALLOC_GROW(ucd->dirs, ucd->dirs_nr + 1, ucd->dirs_alloc);
+	memmove(ucd->dirs + pos + 1, ucd->dirs + pos,
+		(ucd->dirs_nr - pos) * sizeof(*ucd->dirs));
+	ucd->dirs_nr++;
+	return ucd->dirs[pos] = new_untracked_dir(name, len);
+}
+
+/* "dirname" is the path of a subdirectory of "ucd", ending with a slash */
+static struct untracked_cache_dir *untracked_subdir(struct untracked_cache_dir *ucd,
+						    const char *dirname, int len)
+{
+	int start = len - 1;
+
+	if (!ucd)
+		return NULL;
+	while (start && dirname[start - 1] != '/')
+		start--;
+	return lookup_untracked_dir(ucd, dirname + start, len - 1 - start);
+}
+
+static void fill_uc_stat(struct uc_stat *s, const struct stat *st)
+{
+	s->mtime_sec = (unsigned int)st->st_mtime;
+	s->mtime_nsec = ST_MTIME_NSEC(*st);
+	s->ino = (unsigned int)st->st_ino;
+	s->size = (unsigned int)st->st_size;
+}
+
+static int uc_stat_matches(const struct uc_stat *s, const struct stat *st)
+{
+	return s->mtime_sec == (unsigned int)st->st_mtime &&
+		s->mtime_nsec == ST_MTIME_NSEC(*st) &&
+		s->ino == (unsigned int)st->st_ino &&
+		s->size == (unsigned int)st->st_size;
+}
+
+/*
+ * Check the per-directory exclude file of "ucd" at "path", and return
+ * 1 if its contents are not what the entries were checked against.
+ */
+static int exclude_file_changed(struct untracked_cache *uc,
+				struct untracked_cache_dir *ucd,
+				const char *path)
+{
+	unsigned char sha1[20];
+	struct stat st;
+	int fd;
+
+	if (lstat(path, &st)) {
+		if (is_null_sha1(ucd->exclude_sha1))
+			return 0;
+		hashclr(ucd->exclude_sha1);
+		memset(&ucd->exclude_stat, 0, sizeof(ucd->exclude_stat));
+		uc->changed = 1;
+		return 1;
+	}
+	if (!is_null_sha1(ucd->exclude_sha1) &&
+	    uc_stat_matches(&ucd->exclude_stat, &st))
+		return 0;
+
+	hashclr(sha1);
+	fd = open(path, O_RDONLY);
+	if (fd >= 0) {
+		struct strbuf buf = STRBUF_INIT;
+
+		if (strbuf_read(&buf, fd, xsize_t(st.st_size)) >= 0) {
+			git_SHA_CTX c;
+
+			git_SHA1_Init(&c);
+			git_SHA1_Update(&c, buf.buf, buf.len);
+			git_SHA1_Final(sha1, &c);
+		}
+		strbuf_release(&buf);
+		close(fd);
+	}
+	/* a file changed in the current second may change again unnoticed */
+	if (st.st_mtime < uc->start)
+		fill_uc_stat(&ucd->exclude_stat, &st);
+	else
+		memset(&ucd->exclude_stat, 0, sizeof(ucd->exclude_stat));
+	uc->changed = 1;
+	if (!hashcmp(sha1, ucd->exclude_sha1))
+		return 0;
+	hashcpy(ucd->exclude_sha1, sha1);
+	return 1;
+}
+
+/*
+ * Can the cached entries of the directory at "path" be used?  The
+ * exclude file is looked for after "base" in "fullname".
+ */
+static int untracked_dir_valid(struct dir_struct *dir,
+			       struct untracked_cache_dir *ucd,
+			       const char *path, char *fullname, int baselen)
+{
+	struct stat st;
+
+	if (baselen + strlen(dir->exclude_per_dir) >= PATH_MAX)
+		return 0;
+	strcpy(fullname + baselen, dir->exclude_per_dir);
+	if (exclude_file_changed(dir->untracked, ucd, fullname))
+		invalidate_untracked_dir(ucd);
+	if (dir->untracked->use_fsmonitor && ucd->valid)
+		return 1;
+	return ucd->valid && !lstat(path, &st) &&
+		uc_stat_matches(&ucd->stat, &st);
+}
+
+/*
+ * Read the directory at "path" into "ucd", checking each entry against
+ * the excludes, and forget the subdirectories that are gone.
+ */
+static void fill_untracked_dir(struct dir_struct *dir,
+			       struct untracked_cache_dir *ucd,
+			       const char *path, char *fullname, int baselen)
+{
+	struct stat st;
+	struct dirent *de;
+	DIR *fdir;
+	int i, j;
+
+	dir->untracked->changed = 1;
+	dir->untracked->dir_read++;
+	strbuf_reset(&ucd->entries);
+	ucd->nr = 0;
+	ucd->valid = 0;
+	for (i = 0; i < ucd->dirs_nr; i++)
+		ucd->dirs[i]->seen = 0;
+
+	fdir = lstat(path, &st) ? NULL : opendir(path);
+	while (fdir && (de = readdir(fdir)) != NULL) {
+		int len, dtype, type;
+
+		if (is_dot_or_dotdot(de->d_name) ||
+		     !strcmp(de->d_name, ".git"))
+			continue;
+		len = strlen(de->d_name);
+		/* Ignore overly long pathnames! */
+		if (len + baselen + 8 > PATH_MAX + 1)
+			continue;
+		memcpy(fullname + baselen, de->d_name, len+1);
+
+		dtype = get_dtype(de, fullname);
+		switch (dtype) {
+		case DT_REG:
+			type = UC_REG;
+			break;
+		case DT_LNK:
+			type = UC_LNK;
+			break;
+		case DT_DIR:
+			type = UC_DIR;
+			i = find_untracked_dir(ucd, de->d_name, len);
+			if (i >= 0)
+				ucd->dirs[i]->seen = 1;
+			break;
+		default:
+			type = UC_OTHER;
+			break;
+		}
+		if (excluded(dir, fullname, &dtype))
+			type |= UC_EXCLUDED;
+		strbuf_addch(&ucd->entries, type);
+		strbuf_add(&ucd->entries, de->d_name, len + 1);
+		ucd->nr++;
+	}
+
+	for (i = j = 0; i < ucd->dirs_nr; i++) {
+		if (fdir && ucd->dirs[i]->seen)
+			ucd->dirs[j++] = ucd->dirs[i];
+		else
+			free_untracked_dir(ucd->dirs[i]);
+	}
+	ucd->dirs_nr = j;
+	if (!fdir)
+		return;
+	closedir(fdir);
+	fill_uc_stat(&ucd->stat, &st);
+	/* a directory changed in the current second may change again unnoticed */
+	ucd->valid = st.st_mtime < dir->untracked->start;
+}
+
+/*
+ * Find the untracked cache entry for "base", where the walk starts,
+ * checking the exclude files of the directories above it on the way.
+ */
+static struct untracked_cache_dir *untracked_cache_start(struct dir_struct *dir,
+							 const char *base,
+							 int baselen)
+{
+	struct untracked_cache *uc = dir->untracked;
+	struct untracked_cache_dir *ucd;
+	struct strbuf sb = STRBUF_INIT;
+	unsigned char sha1[20];
+	git_SHA_CTX c;
+	int len = 0, i;
+
+	if (!dir->exclude_per_dir)
+		return NULL;
+
+	/*
+	 * The entries were checked against these patterns, together
+	 * with those of the per-directory files.
+	 */
+	strbuf_addf(&sb, "%s\n", dir->exclude_per_dir);
+	for (i = EXC_CMDL; i <= EXC_FILE; i++) {
+		struct exclude_list *el = &dir->exclude_list[i];
+		int j;
+
+		if (i == EXC_DIRS)
+			continue;
+		strbuf_addf(&sb, "%d\n", i);
+		for (j = 0; j < el->nr; j++) {
+			struct exclude *x = el->excludes[j];
+			strbuf_addf(&sb, "%d %d %.*s %s\n", x->to_exclude,
+				    x->flags, x->baselen, x->base, x->pattern);
+		}
+	}
+	git_SHA1_Init(&c);
+	git_SHA1_Update(&c, sb.buf, sb.len);
+	git_SHA1_Final(sha1, &c);
+	strbuf_reset(&sb);
+
+	if (hashcmp(sha1, uc->exclude_sha1)) {
+		free_untracked_dir(uc->root);
+		uc->root = NULL;
+		hashcpy(uc->exclude_sha1, sha1);
+	}
+	if (!uc->root) {
+		uc->root = new_untracked_dir("", 0);
+		uc->changed = 1;
+	}
+	uc->start = time(NULL);
+	uc->dir_read = uc->dir_cached = 0;
+
+	ucd = uc->root;
+	while (len < baselen) {
+		const char *slash = memchr(base + len, '/', baselen - len);
+
+		if (!slash ||
+		    len + strlen(dir->exclude_per_dir) >= PATH_MAX)
+			return NULL;
+		strbuf_add(&sb, base, len);
+		strbuf_addstr(&sb, dir->exclude_per_dir);
+		if (exclude_file_changed(uc, ucd, sb.buf))
+			invalidate_untracked_dir(ucd);
+		strbuf_reset(&sb);
+		ucd = lookup_untracked_dir(ucd, base + len,
+					   slash - (base + len));
+		len = slash - base + 1;
+	}
+	strbuf_release(&sb);
+	return ucd;
+}
+
+/*
+ * Where the entries of the directory being read come from: readdir(),
+ * or the untracked cache if we use it.
+ */
+struct dir_reader {
+	DIR *fdir;
+	const char *cached;
+	unsigned int cached_nr;
+};
+
+/*
+ * Put the name of the next entry after "base" in "fullname".  Its
+ * exclude status is -1 unless it was cached.
+ */
+static int next_entry(struct dir_reader *r, char *fullname, int baselen,
+		      int *len, int *dtype, int *exclude)
+{
+	struct dirent *de;
+
+	if (!r->fdir) {
+		int type;
+
+		if (!r->cached_nr)
+			return 0;
+		r->cached_nr--;
+		type = *r->cached++;
+		*len = strlen(r->cached);
+		memcpy(fullname + baselen, r->cached, *len + 1);
+		r->cached += *len + 1;
+		*exclude = !!(type & UC_EXCLUDED);
+		switch (type & UC_TYPE_MASK) {
+		case UC_REG:
+			*dtype = DT_REG;
+			break;
+		case UC_LNK:
+			*dtype = DT_LNK;
+			break;
+		case UC_DIR:
+			*dtype = DT_DIR;
+			break;
+		default:
+			*dtype = DT_UNKNOWN;
+			break;
+		}
+		return 1;
+	}
+
+	while ((de = readdir(r->fdir)) != NULL) {
+		if (is_dot_or_dotdot(de->d_name) ||
+		     !strcmp(de->d_name, ".git"))
+			continue;
+		*len = strlen(de->d_name);
+		/* Ignore overly long pathnames! */
+		if (*len + baselen + 8 > PATH_MAX + 1)
+			continue;
+		memcpy(fullname + baselen, de->d_name, *len + 1);
+		*dtype = DTYPE(de);
+		*exclude = -1;
+		return 1;
+	}
+	return 0;
+}
+
 /*
  * Read a directory tree. We currently ignore anything but
  * directories, regular files and symlinks. That's because git
@@ -574,91 +997,92 @@ static int get_dtype(struct dirent *de, const char *path)
  * Also, we ignore the name ".git" (even if it is not a directory).
  * That likely will not change.
  */
-static int read_directory_recursive(struct dir_struct *dir, const char *path, const char *base, int baselen, int check_only, const struct path_simplify *simplify)
+static int read_directory_recursive(struct dir_struct *dir, const char *path, const char *base, int baselen, int check_only, const struct path_simplify *simplify, struct untracked_cache_dir *ucd)
 {
-	DIR *fdir = opendir(path);
+	struct dir_reader r;
 	int contents = 0;
+	char fullname[PATH_MAX + 1];
+	int len, dtype, exclude;
+
+	memset(&r, 0, sizeof(r));
+	memcpy(fullname, base, baselen);
+	if (ucd) {
+		if (untracked_dir_valid(dir, ucd, path, fullname, baselen))
+			dir->untracked->dir_cached++;
+		else
+			fill_untracked_dir(dir, ucd, path, fullname, baselen);
+		r.cached = ucd->entries.buf;
+		r.cached_nr = ucd->nr;
+	} else {
+		r.fdir = opendir(path);
+		if (!r.fdir)
+			return 0;
+	}
 
-	if (fdir) {
-		struct dirent *de;
-		char fullname[PATH_MAX + 1];
-		memcpy(fullname, base, baselen);
-
-		while ((de = readdir(fdir)) != NULL) {
-			int len, dtype;
-			int exclude;
-
-			if (is_dot_or_dotdot(de->d_name) ||
-			     !strcmp(de->d_name, ".git"))
-				continue;
-			len = strlen(de->d_name);
-			/* Ignore overly long pathnames! */
-			if (len + baselen + 8 > sizeof(fullname))
-				continue;
-			memcpy(fullname + baselen, de->d_name, len+1);
-			if (simplify_away(fullname, baselen + len, simplify))
-				continue;
+	while (next_entry(&r, fullname, baselen, &len, &dtype, &exclude)) {
+		if (simplify_away(fullname, baselen + len, simplify))
+			continue;
 
-			dtype = DTYPE(de);
+		if (exclude < 0)
 			exclude = excluded(dir, fullname, &dtype);
-			if (exclude && (dir->flags & DIR_COLLECT_IGNORED)
-			    && in_pathspec(fullname, baselen + len, simplify))
-				dir_add_ignored(dir, fullname, baselen + len);
-
-			/*
-			 * Excluded? If we don't explicitly want to show
-			 * ignored files, ignore it
-			 */
-			if (exclude && !(dir->flags & DIR_SHOW_IGNORED))
-				continue;
-
-			if (dtype == DT_UNKNOWN)
-				dtype = get_dtype(de, fullname);
-
-			/*
-			 * Do we want to see just the ignored files?
-			 * We still need to recurse into directories,
-			 * even if we don't ignore them, since the
-			 * directory may contain files that we do..
-			 */
-			if (!exclude && (dir->flags & DIR_SHOW_IGNORED)) {
-				if (dtype != DT_DIR)
-					continue;
-			}
+		if (exclude && (dir->flags & DIR_COLLECT_IGNORED)
+		    && in_pathspec(fullname, baselen + len, simplify))
+			dir_add_ignored(dir, fullname, baselen + len);
+
+		/*
+		 * Excluded? If we don't explicitly want to show
+		 * ignored files, ignore it
+		 */
+		if (exclude && !(dir->flags & DIR_SHOW_IGNORED))
+			continue;
 
-			switch (dtype) {
-			default:
+		if (dtype == DT_UNKNOWN)
+			dtype = get_dtype(NULL, fullname);
+
+		/*
+		 * Do we want to see just the ignored files?
+		 * We still need to recurse into directories,
+		 * even if we don't ignore them, since the
+		 * directory may contain files that we do..
+		 */
+		if (!exclude && (dir->flags & DIR_SHOW_IGNORED)) {
+			if (dtype != DT_DIR)
 				continue;
-			case DT_DIR:
-				memcpy(fullname + baselen + len, "/", 2);
-				len++;
-				switch (treat_directory(dir, fullname, baselen + len, simplify)) {
-				case show_directory:
-					if (exclude != !!(dir->flags
-							& DIR_SHOW_IGNORED))
-						continue;
-					break;
-				case recurse_into_directory:
-					contents += read_directory_recursive(dir,
-						fullname, fullname, baselen + len, 0, simplify);
-					continue;
-				case ignore_directory:
+		}
+
+		switch (dtype) {
+		default:
+			continue;
+		case DT_DIR:
+			memcpy(fullname + baselen + len, "/", 2);
+			len++;
+			switch (treat_directory(dir, fullname, baselen + len, simplify, ucd)) {
+			case show_directory:
+				if (exclude != !!(dir->flags
+						& DIR_SHOW_IGNORED))
 					continue;
-				}
-				break;
-			case DT_REG:
-			case DT_LNK:
 				break;
+			case recurse_into_directory:
+				contents += read_directory_recursive(dir,
+					fullname, fullname, baselen + len, 0, simplify,
+					untracked_subdir(ucd, fullname, baselen + len));
+				continue;
+			case ignore_directory:
+				continue;
 			}
-			contents++;
-			if (check_only)
-				goto exit_early;
-			else
-				dir_add_name(dir, fullname, baselen + len);
+			break;
+		case DT_REG:
+		case DT_LNK:
+			break;
 		}
-exit_early:
-		closedir(fdir);
+		contents++;
+		if (check_only)
+			break;
+		else
+			dir_add_name(dir, fullname, baselen + len);
 	}
+	if (r.fdir)
+		closedir(r.fdir);
 
 	return contents;
 }
@@ -720,15 +1144,27 @@ static void free_simplify(struct path_simplify *simplify)
 int read_directory(struct dir_struct *dir, const char *path, const char *base, int baselen, const char **pathspec)
 {
 	struct path_simplify *simplify;
+	struct untracked_cache_dir *ucd = NULL;
 
 	if (has_symlink_leading_path(path, strlen(path)))
 		return dir->nr;
 
+	trace_region_enter("dir", "read_directory");
+	if (dir->untracked)
+		ucd = untracked_cache_start(dir, base, baselen);
 	simplify = create_simplify(pathspec);
-	read_directory_recursive(dir, path, base, baselen, 0, simplify);
+	read_directory_recursive(dir, path, base, baselen, 0, simplify, ucd);
 	free_simplify(simplify);
 	qsort(dir->entries, dir->nr, sizeof(struct dir_entry *), cmp_name);
 	qsort(dir->ignored, dir->ignored_nr, sizeof(struct dir_entry *), cmp_name);
+	trace_counter("dir", "entries", dir->nr);
+	if (ucd) {
+		trace_counter("dir", "directories-read",
+			      dir->untracked->dir_read);
+		trace_counter("dir", "directories-cached",
+			      dir->untracked->dir_cached);
+	}
+	trace_region_leave("dir", "read_directory");
 	return dir->nr;
 }
 
@@ -870,3 +1306,223 @@ int remove_path(const char *name)
 	return 0;
 }
 
+void add_untracked_cache(struct index_state *istate)
+{
+	if (istate->untracked)
+		return;
+	istate->untracked = xcalloc(1, sizeof(*istate->untracked));
+	istate->untracked->changed = 1;
+}
+
+void remove_untracked_cache(struct index_state *istate)
+{
+	free_untracked_cache(istate->untracked);
+	istate->untracked = NULL;
+}
+
+/*
+ * The file system monitor says "path" has changed: read again the
+ * directory that has it, and the directory it names if there is one.
+ */
+void untracked_cache_invalidate_path(struct index_state *istate,
+				     const char *path)
+{
+	struct untracked_cache_dir *ucd;
+	const char *slash;
+	int len = strlen(path), pos;
+
+	if (!istate->untracked || !istate->untracked->root)
+		return;
+	while (len && path[len - 1] == '/')
+		len--;
+	ucd = istate->untracked->root;
+	while ((slash = memchr(path, '/', len)) != NULL) {
+		pos = find_untracked_dir(ucd, path, slash - path);
+		if (pos < 0) {
+			ucd->valid = 0;
+			return;
+		}
+		ucd = ucd->dirs[pos];
+		len -= slash + 1 - path;
+		path = slash + 1;
+	}
+	ucd->valid = 0;
+	pos = find_untracked_dir(ucd, path, len);
+	if (pos >= 0)
+		ucd->dirs[pos]->valid = 0;
+}
+
+static void clear_untracked_dir_valid(struct untracked_cache_dir *ucd)
+{
+	int i;
+
+	ucd->valid = 0;
+	for (i = 0; i < ucd->dirs_nr; i++)
+		clear_untracked_dir_valid(ucd->dirs[i]);
+}
+
+/*
+ * The file system monitor cannot say what changed: every directory
+ * has to be checked against its stat data again.
+ */
+void untracked_cache_invalidate_all(struct index_state *istate)
+{
+	if (!istate->untracked || !istate->untracked->root)
+		return;
+	clear_untracked_dir_valid(istate->untracked->root);
+}
+
+/*
+ * Let read_directory() use the untracked cache of the index, if it
+ * has one and core.untrackedCache does not say otherwise.
+ */
+void use_untracked_cache(struct dir_struct *dir)
+{
+	if (core_untracked_cache > 0)
+		add_untracked_cache(&the_index);
+	if (core_untracked_cache)
+		dir->untracked = the_index.untracked;
+}
+
+void free_untracked_cache(struct untracked_cache *uc)
+{
+	if (!uc)
+		return;
+	free_untracked_dir(uc->root);
+	free(uc);
+}
+
+/*
+ * One directory of the "UNTR" extension consists of:
+ * its name (NUL terminated)
+ * valid flag, its stat data and that of its exclude file (4-byte each)
+ * the sha1 of its exclude file
+ * number of entries, length of the entries, the entries themselves
+ * number of subdirectories, followed by those.
+ * All numbers are in network byte order.
+ */
+static void write_one_untracked(struct strbuf *out,
+				struct untracked_cache_dir *ucd)
+{
+	uint32_t data[9];
+	int i;
+
+	strbuf_add(out, ucd->name, strlen(ucd->name) + 1);
+	data[0] = htonl(ucd->valid);
+	data[1] = htonl(ucd->stat.mtime_sec);
+	data[2] = htonl(ucd->stat.mtime_nsec);
+	data[3] = htonl(ucd->stat.ino);
+	data[4] = htonl(ucd->stat.size);
+	data[5] = htonl(ucd->exclude_stat.mtime_sec);
+	data[6] = htonl(ucd->exclude_stat.mtime_nsec);
+	data[7] = htonl(ucd->exclude_stat.ino);
+	data[8] = htonl(ucd->exclude_stat.size);
+	strbuf_add(out, data, sizeof(data));
+	strbuf_add(out, ucd->exclude_sha1, 20);
+	data[0] = htonl(ucd->nr);
+	data[1] = htonl(ucd->entries.len);
+	strbuf_add(out, data, 8);
+	strbuf_add(out, ucd->entries.buf, ucd->entries.len);
+	data[0] = htonl(ucd->dirs_nr);
+	strbuf_add(out, data, 4);
+	for (i = 0; i < ucd->dirs_nr; i++)
+		write_one_untracked(out, ucd->dirs[i]);
+}
+
+void write_untracked_extension(struct strbuf *out, struct untracked_cache *uc)
+{
+	strbuf_add(out, uc->exclude_sha1, 20);
+	if (uc->root)
+		write_one_untracked(out, uc->root);
+}
+
+static unsigned int get_be32(const unsigned char **p)
+{
+	uint32_t v;
+
+	memcpy(&v, *p, 4);
+	*p += 4;
+	return ntohl(v);
+}
+
+static struct untracked_cache_dir *read_one_untracked(const unsigned char **data,
+						      const unsigned char *end)
+{
+	const unsigned char *p = *data, *name_end, *entries_end;
+	struct untracked_cache_dir *ucd;
+	unsigned int i, len, dirs_nr;
+
+	name_end = memchr(p, 0, end - p);
+	if (!name_end || end - name_end < 1 + 9 * 4 + 20 + 8)
+		return NULL;
+	ucd = new_untracked_dir((const char *)p, name_end - p);
+	p = name_end + 1;
+	ucd->valid = !!get_be32(&p);
+	ucd->stat.mtime_sec = get_be32(&p);
+	ucd->stat.mtime_nsec = get_be32(&p);
+	ucd->stat.ino = get_be32(&p);
+	ucd->stat.size = get_be32(&p);
+	ucd->exclude_stat.mtime_sec = get_be32(&p);
+	ucd->exclude_stat.mtime_nsec = get_be32(&p);
+	ucd->exclude_stat.ino = get_be32(&p);
+	ucd->exclude_stat.size = get_be32(&p);
+	hashcpy(ucd->exclude_sha1, p);
+	p += 20;
+	ucd->nr = get_be32(&p);
+	len = get_be32(&p);
+	if (end - p < len + 4)
+		goto corrupt;
+	entries_end = p + len;
+	strbuf_add(&ucd->entries, p, len);
+
+	/* each entry is a type byte and a NUL-terminated name */
+	for (i = 0; i < ucd->nr; i++) {
+		const unsigned char *nul;
+
+		if (entries_end - p < 2 || !*p ||
+		    !(nul = memchr(p + 1, 0, entries_end - p - 1)))
+			goto corrupt;
+		p = nul + 1;
+	}
+	if (p != entries_end)
+		goto corrupt;
+
+	dirs_nr = get_be32(&p);
+	for (i = 0; i < dirs_nr; i++) {
+		struct untracked_cache_dir *sub = read_one_untracked(&p, end);
+
+		if (!sub)
+			goto corrupt;
+		ALLOC_GROW(ucd->dirs, ucd->dirs_nr + 1, ucd->dirs_alloc);
+		ucd->dirs[ucd->dirs_nr++] = sub;
+		if (i && strcmp(ucd->dirs[i - 1]->name, sub->name) >= 0)
+			goto corrupt;
+	}
+	*data = p;
+	return ucd;
+
+corrupt:
+	free_untracked_dir(ucd);
+	return NULL;
+}
+
+struct untracked_cache *read_untracked_extension(const void *data,
+						 unsigned long sz)
+{
+	const unsigned char *p = data, *end = p + sz;
+	struct untracked_cache *uc;
+
+	if (sz < 20)
+		return NULL;
+	uc = xcalloc(1, sizeof(*uc));
+	hashcpy(uc->exclude_sha1, p);
+	p += 20;
+	if (p < end) {
+		uc->root = read_one_untracked(&p, end);
+		if (!uc->root || p != end) {
+			free_untracked_cache(uc);
+			return NULL;
+		}
+	}
+	return uc;
+}
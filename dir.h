@@ -31,6 +31,27 @@ struct exclude_stack {
 	int exclude_ix;
 };
 
+/*
+ * The untracked cache remembers, for each directory read_directory()
+ * has read, what was in it and which of its entries were excluded,
+ * so that directories whose stat data and per-directory exclude file
+ * have not changed since need not be read again.
+ */
+struct untracked_cache_dir;
+
+struct untracked_cache {
+	/* of the exclude patterns the entries were checked against */
+	unsigned char exclude_sha1[20];
+	struct untracked_cache_dir *root;
+	int changed;
+	/* in-core only: when the current read_directory() started */
+	time_t start;
+	/* and how many directories it read, and found in the cache */
+	unsigned int dir_read, dir_cached;
+	/* in-core only: valid directories need no lstat() */
+	int use_fsmonitor;
+};
+
 struct dir_struct {
 	int nr, alloc;
 	int ignored_nr, ignored_alloc;
@@ -59,6 +80,9 @@ struct dir_struct {
 
 	struct exclude_stack *exclude_stack;
 	char basebuf[PATH_MAX];
+
+	/* set by use_untracked_cache() */
+	struct untracked_cache *untracked;
 };
 
 extern int common_prefix(const char **pathspec);
@@ -91,6 +115,18 @@ extern int is_empty_dir(const char *dir);
 extern void setup_standard_excludes(struct dir_struct *dir);
 extern int remove_dir_recursively(struct strbuf *path, int only_empty);
 
+extern void add_untracked_cache(struct index_state *istate);
+extern void remove_untracked_cache(struct index_state *istate);
+extern void use_untracked_cache(struct dir_struct *dir);
+extern void untracked_cache_invalidate_path(struct index_state *istate,
+					    const char *path);
+extern void untracked_cache_invalidate_all(struct index_state *istate);
+extern void free_untracked_cache(struct untracked_cache *uc);
+extern struct untracked_cache *read_untracked_extension(const void *data,
+							 unsigned long sz);
+extern void write_untracked_extension(struct strbuf *out,
+				      struct untracked_cache *uc);
+
 /* tries to remove the path with empty directories along it, ignores ENOENT */
 extern int remove_path(const char *path);
 
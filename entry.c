@@ -1,5 +1,6 @@
 #include "cache.h"
 #include "blob.h"
+#include "streaming.h"
 #include "dir.h"
 
 static void create_directories(const char *path, int path_len,
@@ -91,6 +92,61 @@ static void *read_blob_entry(struct cache_entry *ce, unsigned long *size)
 	return NULL;
 }
 
+static int open_output_fd(char *path, struct cache_entry *ce, int to_tempfile)
+{
+	int regular = (ce->ce_mode & S_IFMT) == S_IFREG;
+
+	if (to_tempfile) {
+		strcpy(path, regular
+		       ? ".merge_file_XXXXXX" : ".merge_link_XXXXXX");
+		return mkstemp(path);
+	}
+	return create_file(path, regular ? ce->ce_mode : 0666);
+}
+
+/*
+ * A regular file that needs no conversion is copied from the object
+ * database to the file a piece at a time, instead of being read into
+ * memory as a whole first.
+ */
+static int streaming_write_entry(struct cache_entry *ce, char *path,
+				 const struct checkout *state, int to_tempfile,
+				 int *fstat_done, struct stat *st)
+{
+	struct git_istream *is;
+	enum object_type type;
+	unsigned long size;
+	int fd, ret;
+
+	is = open_istream(ce->sha1, &type, &size);
+	if (!is || type != OBJ_BLOB) {
+		if (is)
+			close_istream(is);
+		return error("git checkout-index: unable to read sha1 file of %s (%s)",
+			     path, sha1_to_hex(ce->sha1));
+	}
+
+	fd = open_output_fd(path, ce, to_tempfile);
+	if (fd < 0) {
+		close_istream(is);
+		return error("git checkout-index: unable to create file %s (%s)",
+			     path, strerror(errno));
+	}
+
+	ret = stream_istream_to_fd(fd, is);
+	close_istream(is);
+	/* use fstat() only when path == ce->name */
+	if (!ret && fstat_is_reliable() &&
+	    state->refresh_cache && !to_tempfile && !state->base_dir_len) {
+		fstat(fd, st);
+		*fstat_done = 1;
+	}
+	close(fd);
+	if (ret)
+		return error("git checkout-index: unable to write file %s", path);
+	return 0;
+}
+
 static int write_entry(struct cache_entry *ce, char *path, const struct checkout *state, int to_tempfile)
 {
 	unsigned int ce_mode_s_ifmt = ce->ce_mode & S_IFMT;
@@ -103,6 +159,15 @@ static int write_entry(struct cache_entry *ce, char *path, const struct checkout
 
 	switch (ce_mode_s_ifmt) {
 	case S_IFREG:
+		if (sha1_object_info(ce->sha1, &size) == OBJ_BLOB &&
+		    size >= big_file_threshold &&
+		    !would_convert_to_working_tree(ce->name)) {
+			if (streaming_write_entry(ce, path, state, to_tempfile,
+						  &fstat_done, &st))
+				return -1;
+			break;
+		}
+		/* fallthrough */
 	case S_IFLNK:
 		new = read_blob_entry(ce, &size);
 		if (!new)
@@ -128,17 +193,7 @@ static int write_entry(struct cache_entry *ce, char *path, const struct checkout
 			size = newsize;
 		}
 
-		if (to_tempfile) {
-			if (ce_mode_s_ifmt == S_IFREG)
-				strcpy(path, ".merge_file_XXXXXX");
-			else
-				strcpy(path, ".merge_link_XXXXXX");
-			fd = mkstemp(path);
-		} else if (ce_mode_s_ifmt == S_IFREG) {
-			fd = create_file(path, ce->ce_mode);
-		} else {
-			fd = create_file(path, 0666);
-		}
+		fd = open_output_fd(path, ce, to_tempfile);
 		if (fd < 0) {
 			free(new);
 			return error("git checkout-index: unable to create file %s (%s)",
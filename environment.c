@@ -32,7 +32,14 @@ int core_compression_seen;
 int fsync_object_files;
 size_t packed_git_window_size = DEFAULT_PACKED_GIT_WINDOW_SIZE;
 size_t packed_git_limit = DEFAULT_PACKED_GIT_LIMIT;
+int packed_git_map_whole;
 size_t delta_base_cache_limit = 16 * 1024 * 1024;
+unsigned int delta_base_cache_slots = 1024;
+int core_commit_graph = 1;
+int core_multi_pack_index = 1;
+int core_loose_object_cache;
+unsigned long big_file_threshold = 512 * 1024 * 1024;
+int core_bulk_checkin;
 const char *pager_program;
 int pager_use_color = 1;
 const char *editor_program;
@@ -51,6 +58,16 @@ int unreliable_hardlinks = UNRELIABLE_HARDLINKS;
 /* Parallel index stat data preload? */
 int core_preload_index = 0;
 
+/* Split index: -1 keeps whatever the index file does */
+int core_split_index = -1;
+int split_index_max_percent = 20;
+/* Untracked cache: -1 uses it if the index file has one */
+int core_untracked_cache = -1;
+/* File system monitor hook, asked what changed since the last time */
+const char *core_fsmonitor;
+/* Threads to read the index with; 0 is one per CPU */
+int index_threads;
+
 /* This is set by setup_git_dir_gently() and/or git_default_config() */
 char *git_work_tree_cfg;
 static char *work_tree;
@@ -0,0 +1,276 @@
+/*
+ * Plain and EWAH-compressed bitmaps; see ewah.h.
+ */
+#include "cache.h"
+#include "ewah.h"
+
+#define EWORD_ONES (~(eword_t)0)
+
+static inline size_t eword_popcount(eword_t x)
+{
+	x = x - ((x >> 1) & 0x5555555555555555ULL);
+	x = (x & 0x3333333333333333ULL) + ((x >> 2) & 0x3333333333333333ULL);
+	x = (x + (x >> 4)) & 0x0f0f0f0f0f0f0f0fULL;
+	return (size_t)((x * 0x0101010101010101ULL) >> 56);
+}
+
+static inline unsigned eword_ctz(eword_t x)
+{
+	unsigned n = 0;
+
+	if (!(x & 0xffffffffULL)) {
+		n += 32;
+		x >>= 32;
+	}
+	if (!(x & 0xffff)) {
+		n += 16;
+		x >>= 16;
+	}
+	if (!(x & 0xff)) {
+		n += 8;
+		x >>= 8;
+	}
+	while (!(x & 1)) {
+		n++;
+		x >>= 1;
+	}
+	return n;
+}
+
+struct bitmap *bitmap_new(void)
+{
+	struct bitmap *b = xmalloc(sizeof(*b));
+	b->word_alloc = 32;
+	b->words = xcalloc(b->word_alloc, sizeof(eword_t));
+	return b;
+}
+
+void bitmap_free(struct bitmap *b)
+{
+	if (!b)
+		return;
+	free(b->words);
+	free(b);
+}
+
+static void bitmap_grow(struct bitmap *b, size_t nr_words)
+{
+	size_t old = b->word_alloc;
+
+	if (nr_words <= old)
+		return;
+	b->word_alloc = alloc_nr(old);
+	if (b->word_alloc < nr_words)
+		b->word_alloc = nr_words;
+	b->words = xrealloc(b->words, b->word_alloc * sizeof(eword_t));
+	memset(b->words + old, 0, (b->word_alloc - old) * sizeof(eword_t));
+}
+
+void bitmap_set(struct bitmap *b, size_t pos)
+{
+	size_t block = pos / BITS_IN_EWORD;
+
+	bitmap_grow(b, block + 1);
+	b->words[block] |= (eword_t)1 << (pos % BITS_IN_EWORD);
+}
+
+int bitmap_get(const struct bitmap *b, size_t pos)
+{
+	size_t block = pos / BITS_IN_EWORD;
+
+	return block < b->word_alloc &&
+		(b->words[block] & ((eword_t)1 << (pos % BITS_IN_EWORD))) != 0;
+}
+
+void bitmap_or(struct bitmap *self, const struct bitmap *other)
+{
+	size_t i;
+
+	bitmap_grow(self, other->word_alloc);
+	for (i = 0; i < other->word_alloc; i++)
+		self->words[i] |= other->words[i];
+}
+
+void bitmap_and_not(struct bitmap *self, const struct bitmap *other)
+{
+	size_t i, n = self->word_alloc;
+
+	if (n > other->word_alloc)
+		n = other->word_alloc;
+	for (i = 0; i < n; i++)
+		self->words[i] &= ~other->words[i];
+}
+
+size_t bitmap_popcount(const struct bitmap *b)
+{
+	size_t i, count = 0;
+
+	for (i = 0; i < b->word_alloc; i++)
+		count += eword_popcount(b->words[i]);
+	return count;
+}
+
+size_t bitmap_popcount_and(const struct bitmap *a, const struct bitmap *b)
+{
+	size_t i, n = a->word_alloc, count = 0;
+
+	if (n > b->word_alloc)
+		n = b->word_alloc;
+	for (i = 0; i < n; i++)
+		count += eword_popcount(a->words[i] & b->words[i]);
+	return count;
+}
+
+int bitmap_for_each(const struct bitmap *b, bitmap_each_fn fn, void *data)
+{
+	size_t i;
+
+	for (i = 0; i < b->word_alloc; i++) {
+		eword_t word = b->words[i];
+		while (word) {
+			unsigned bit = eword_ctz(word);
+			int ret = fn(i * BITS_IN_EWORD + bit, data);
+			if (ret)
+				return ret;
+			word &= word - 1;
+		}
+	}
+	return 0;
+}
+
+static void ewah_push(struct ewah_bitmap *e, size_t *alloc, eword_t word)
+{
+	ALLOC_GROW(e->buffer, e->buffer_size + 1, *alloc);
+	e->buffer[e->buffer_size++] = word;
+}
+
+struct ewah_bitmap *bitmap_to_ewah(const struct bitmap *b)
+{
+	struct ewah_bitmap *e = xcalloc(1, sizeof(*e));
+	size_t alloc = 0, nr = b->word_alloc, i = 0;
+
+	/* trailing zero words carry no information */
+	while (nr && !b->words[nr - 1])
+		nr--;
+	e->bit_size = nr * BITS_IN_EWORD;
+
+	while (i < nr) {
+		eword_t run_word = 0, marker;
+		size_t run = 0, literals = 0, marker_pos;
+
+		if (b->words[i] == 0 || b->words[i] == EWORD_ONES) {
+			run_word = b->words[i];
+			while (i < nr && b->words[i] == run_word &&
+			       run < RLW_LARGEST_RUN) {
+				run++;
+				i++;
+			}
+		}
+
+		marker_pos = e->buffer_size;
+		ewah_push(e, &alloc, 0);
+		while (i < nr && b->words[i] != 0 && b->words[i] != EWORD_ONES &&
+		       literals < RLW_LARGEST_LITERAL) {
+			ewah_push(e, &alloc, b->words[i]);
+			literals++;
+			i++;
+		}
+
+		marker = (run_word ? 1 : 0) |
+			((eword_t)run << 1) |
+			((eword_t)literals << (1 + RLW_RUNNING_BITS));
+		e->buffer[marker_pos] = marker;
+	}
+	return e;
+}
+
+void bitmap_or_ewah(struct bitmap *b, const struct ewah_bitmap *e)
+{
+	size_t i = 0, pos = 0;
+
+	bitmap_grow(b, (e->bit_size + BITS_IN_EWORD - 1) / BITS_IN_EWORD);
+	while (i < e->buffer_size) {
+		eword_t marker = e->buffer[i++];
+		size_t run = rlw_running_len(marker);
+		size_t literals = rlw_literal_words(marker);
+		size_t k;
+
+		bitmap_grow(b, pos + run + literals);
+		if (rlw_running_bit(marker))
+			for (k = 0; k < run; k++)
+				b->words[pos + k] = EWORD_ONES;
+		pos += run;
+		for (k = 0; k < literals && i < e->buffer_size; k++)
+			b->words[pos++] |= e->buffer[i++];
+	}
+}
+
+struct bitmap *ewah_to_bitmap(const struct ewah_bitmap *e)
+{
+	struct bitmap *b = bitmap_new();
+	bitmap_or_ewah(b, e);
+	return b;
+}
+
+void ewah_free(struct ewah_bitmap *e)
+{
+	if (!e)
+		return;
+	free(e->buffer);
+	free(e);
+}
+
+static void put_be32(struct strbuf *sb, uint32_t v)
+{
+	v = htonl(v);
+	strbuf_add(sb, &v, 4);
+}
+
+static uint32_t get_be32(const unsigned char *p)
+{
+	uint32_t v;
+	memcpy(&v, p, 4);
+	return ntohl(v);
+}
+
+void ewah_serialize(const struct ewah_bitmap *e, struct strbuf *sb)
+{
+	size_t i;
+
+	put_be32(sb, e->bit_size);
+	put_be32(sb, e->buffer_size);
+	for (i = 0; i < e->buffer_size; i++) {
+		put_be32(sb, (uint32_t)(e->buffer[i] >> 32));
+		put_be32(sb, (uint32_t)e->buffer[i]);
+	}
+}
+
+ssize_t ewah_read(struct ewah_bitmap *e, const unsigned char *map, size_t len)
+{
+	size_t i, words, expect;
+
+	if (len < 8)
+		return -1;
+	e->bit_size = get_be32(map);
+	words = get_be32(map + 4);
+	expect = 8 + words * 8;
+	if (len < expect || words > len / 8)
+		return -1;
+	map += 8;
+	e->buffer_size = words;
+	e->buffer = xmalloc((words ? words : 1) * sizeof(eword_t));
+	for (i = 0; i < words; i++, map += 8)
+		e->buffer[i] = ((eword_t)get_be32(map) << 32) | get_be32(map + 4);
+
+	/* the markers must describe exactly the words that follow */
+	for (i = 0; i < words; ) {
+		size_t literals = rlw_literal_words(e->buffer[i]);
+		if (literals > words - i - 1) {
+			free(e->buffer);
+			e->buffer = NULL;
+			return -1;
+		}
+		i += 1 + literals;
+	}
+	return expect;
+}
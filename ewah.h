@@ -0,0 +1,84 @@
+#ifndef EWAH_H
+#define EWAH_H
+
+/*
+ * Plain and EWAH-compressed bitmaps of 64-bit words.
+ *
+ * A "struct bitmap" is an uncompressed, growable bit array, good for
+ * setting bits and combining bitmaps in memory.  A "struct
+ * ewah_bitmap" is the run-length compressed form used on disk: a
+ * sequence of marker words, each describing a run of all-zero or
+ * all-one words followed by a number of literal words that are
+ * stored verbatim.
+ */
+
+typedef uint64_t eword_t;
+#define BITS_IN_EWORD (sizeof(eword_t) * 8)
+
+struct bitmap {
+	eword_t *words;
+	size_t word_alloc;
+};
+
+extern struct bitmap *bitmap_new(void);
+extern void bitmap_free(struct bitmap *);
+extern void bitmap_set(struct bitmap *, size_t pos);
+extern int bitmap_get(const struct bitmap *, size_t pos);
+extern void bitmap_or(struct bitmap *, const struct bitmap *);
+extern void bitmap_and_not(struct bitmap *, const struct bitmap *);
+extern size_t bitmap_popcount(const struct bitmap *);
+extern size_t bitmap_popcount_and(const struct bitmap *, const struct bitmap *);
+
+/*
+ * Call "fn" for every set bit, in ascending order.  Iteration stops
+ * early if "fn" returns non-zero, and that value is returned.
+ */
+typedef int (*bitmap_each_fn)(size_t pos, void *data);
+extern int bitmap_for_each(const struct bitmap *, bitmap_each_fn fn, void *data);
+
+struct ewah_bitmap {
+	eword_t *buffer;
+	size_t buffer_size;
+	size_t bit_size;
+};
+
+/* The marker word: running bit, 32-bit run length, 31-bit literal count */
+#define RLW_RUNNING_BITS 32
+#define RLW_LITERAL_BITS 31
+#define RLW_LARGEST_RUN ((((eword_t)1) << RLW_RUNNING_BITS) - 1)
+#define RLW_LARGEST_LITERAL ((((eword_t)1) << RLW_LITERAL_BITS) - 1)
+
+static inline int rlw_running_bit(eword_t w)
+{
+	return (int)(w & 1);
+}
+
+static inline size_t rlw_running_len(eword_t w)
+{
+	return (size_t)((w >> 1) & RLW_LARGEST_RUN);
+}
+
+static inline size_t rlw_literal_words(eword_t w)
+{
+	return (size_t)(w >> (1 + RLW_RUNNING_BITS));
+}
+
+extern struct ewah_bitmap *bitmap_to_ewah(const struct bitmap *);
+extern struct bitmap *ewah_to_bitmap(const struct ewah_bitmap *);
+extern void bitmap_or_ewah(struct bitmap *, const struct ewah_bitmap *);
+extern void ewah_free(struct ewah_bitmap *);
+
+/*
+ * The serialized form is a 4-byte bit size, a 4-byte word count and
+ * that many 8-byte words, all in network byte order.
+ */
+extern void ewah_serialize(const struct ewah_bitmap *, struct strbuf *);
+
+/*
+ * Read a serialized bitmap from "map", which has "len" bytes left.
+ * Returns the number of bytes consumed, or -1 if the data is
+ * truncated or inconsistent.
+ */
+extern ssize_t ewah_read(struct ewah_bitmap *, const unsigned char *map, size_t len);
+
+#endif
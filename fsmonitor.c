@@ -0,0 +1,215 @@
+#include "cache.h"
+#include "dir.h"
+#include "fsmonitor.h"
+#include "run-command.h"
+#include "strbuf.h"
+
+#define FSMONITOR_VERSION 1
+
+/*
+ * The "FSMN" extension consists of:
+ * version (4-byte), the time of the last update in nanoseconds since
+ * the epoch (8-byte), the number of entries (4-byte), then one bit per
+ * entry, set for those that were not known to match the work tree.
+ * All numbers are in network byte order.
+ */
+int read_fsmonitor_extension(struct index_state *istate,
+			     const void *data, unsigned long sz)
+{
+	const unsigned char *p = data;
+	uint32_t hdr[4];
+	unsigned int nr;
+
+	if (sz < sizeof(hdr))
+		return error("corrupt fsmonitor extension");
+	memcpy(hdr, p, sizeof(hdr));
+	if (ntohl(hdr[0]) != FSMONITOR_VERSION)
+		return 0;
+	nr = ntohl(hdr[3]);
+	if (sz != sizeof(hdr) + (nr + 7) / 8)
+		return error("corrupt fsmonitor extension");
+
+	istate->fsmonitor_last_update =
+		(uint64_t)ntohl(hdr[1]) << 32 | ntohl(hdr[2]);
+	free(istate->fsmonitor_dirty);
+	istate->fsmonitor_dirty = xmalloc((nr + 7) / 8 + 1);
+	memcpy(istate->fsmonitor_dirty, p + sizeof(hdr), (nr + 7) / 8);
+	istate->fsmonitor_dirty_nr = nr;
+	return 0;
+}
+
+void write_fsmonitor_extension(struct strbuf *sb, struct index_state *istate)
+{
+	uint32_t hdr[4];
+	unsigned char *bits;
+	unsigned int i, nr = 0;
+
+	bits = xcalloc(istate->cache_nr / 8 + 1, 1);
+	for (i = 0; i < istate->cache_nr; i++) {
+		struct cache_entry *ce = istate->cache[i];
+
+		if (ce->ce_flags & CE_REMOVE)
+			continue;
+		if (!(ce->ce_flags & CE_FSMONITOR_VALID))
+			bits[nr / 8] |= 1 << (nr % 8);
+		nr++;
+	}
+
+	hdr[0] = htonl(FSMONITOR_VERSION);
+	hdr[1] = htonl((uint32_t)(istate->fsmonitor_last_update >> 32));
+	hdr[2] = htonl((uint32_t)istate->fsmonitor_last_update);
+	hdr[3] = htonl(nr);
+	strbuf_add(sb, hdr, sizeof(hdr));
+	strbuf_add(sb, bits, (nr + 7) / 8);
+	free(bits);
+}
+
+static uint64_t fsmonitor_now(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return (uint64_t)tv.tv_sec * 1000000000 + tv.tv_usec * 1000;
+}
+
+/*
+ * Run the hook as "<hook> <version> <token>"; it lists the paths
+ * changed since then, NUL terminated and relative to the top of the
+ * work tree, or "/" if it cannot tell.
+ */
+static int query_fsmonitor(uint64_t since, struct strbuf *out)
+{
+	struct child_process cp;
+	const char *argv[4];
+	char version[20], token[40];
+	int ret = 0;
+
+	snprintf(version, sizeof(version), "%d", FSMONITOR_VERSION);
+	snprintf(token, sizeof(token), "%"PRIuMAX, (uintmax_t)since);
+	argv[0] = core_fsmonitor;
+	argv[1] = version;
+	argv[2] = token;
+	argv[3] = NULL;
+
+	memset(&cp, 0, sizeof(cp));
+	cp.argv = argv;
+	cp.no_stdin = 1;
+	cp.out = -1;
+	if (start_command(&cp))
+		return error("cannot run fsmonitor hook '%s'", core_fsmonitor);
+	if (strbuf_read(out, cp.out, 1024) < 0)
+		ret = error("cannot read from fsmonitor hook '%s'",
+			    core_fsmonitor);
+	close(cp.out);
+	if (finish_command(&cp))
+		ret = -1;
+	return ret;
+}
+
+/* Clear CE_FSMONITOR_VALID of "path" and of everything below it */
+static void fsmonitor_invalidate_path(struct index_state *istate,
+				      const char *path, int len)
+{
+	struct strbuf dir = STRBUF_INIT;
+	int pos;
+
+	pos = index_name_pos(istate, path, len);
+	if (pos < 0)
+		pos = -pos - 1;
+	while (pos < istate->cache_nr &&
+	       !strcmp(istate->cache[pos]->name, path))
+		istate->cache[pos++]->ce_flags &= ~CE_FSMONITOR_VALID;
+
+	strbuf_add(&dir, path, len);
+	strbuf_addch(&dir, '/');
+	pos = index_name_pos(istate, dir.buf, dir.len);
+	if (pos < 0)
+		pos = -pos - 1;
+	while (pos < istate->cache_nr &&
+	       !strncmp(istate->cache[pos]->name, dir.buf, dir.len))
+		istate->cache[pos++]->ce_flags &= ~CE_FSMONITOR_VALID;
+	strbuf_release(&dir);
+
+	untracked_cache_invalidate_path(istate, path);
+}
+
+/*
+ * Ask the file system monitor what changed since the index was last
+ * written, and mark the entries that neither it nor the index says
+ * are dirty CE_FSMONITOR_VALID.  Whatever happens, later writes
+ * record now as the time the work tree was last looked at.
+ */
+void refresh_fsmonitor(struct index_state *istate)
+{
+	struct strbuf out = STRBUF_INIT;
+	uint64_t now = fsmonitor_now();
+	unsigned int i, nr_paths = 0, nr_valid = 0;
+	int trusted = 0;
+
+	trace_region_enter("fsmonitor", "refresh");
+	if (istate->fsmonitor_last_update &&
+	    istate->fsmonitor_dirty_nr == istate->cache_nr &&
+	    !query_fsmonitor(istate->fsmonitor_last_update, &out))
+		trusted = 1;
+
+	for (i = 0; i < istate->cache_nr; i++) {
+		struct cache_entry *ce = istate->cache[i];
+
+		if (trusted &&
+		    !(istate->fsmonitor_dirty[i / 8] & (1 << (i % 8))))
+			ce->ce_flags |= CE_FSMONITOR_VALID;
+		else
+			ce->ce_flags &= ~CE_FSMONITOR_VALID;
+	}
+
+	if (trusted) {
+		const char *p = out.buf, *end = out.buf + out.len;
+
+		while (p < end) {
+			const char *nul = memchr(p, '\0', end - p);
+			int len = (nul ? nul : end) - p;
+
+			if (len == 1 && *p == '/') {
+				trusted = 0;
+				break;
+			}
+			while (len && p[len - 1] == '/')
+				len--;
+			if (len) {
+				struct strbuf path = STRBUF_INIT;
+
+				strbuf_add(&path, p, len);
+				fsmonitor_invalidate_path(istate, path.buf,
+							  path.len);
+				strbuf_release(&path);
+				nr_paths++;
+			}
+			if (!nul)
+				break;
+			p = nul + 1;
+		}
+	}
+
+	for (i = 0; i < istate->cache_nr; i++) {
+		struct cache_entry *ce = istate->cache[i];
+
+		if (!trusted)
+			ce->ce_flags &= ~CE_FSMONITOR_VALID;
+		else if (ce->ce_flags & CE_FSMONITOR_VALID)
+			nr_valid++;
+	}
+	if (istate->untracked)
+		istate->untracked->use_fsmonitor = trusted;
+	if (!trusted)
+		untracked_cache_invalidate_all(istate);
+
+	istate->fsmonitor_last_update = now;
+	free(istate->fsmonitor_dirty);
+	istate->fsmonitor_dirty = NULL;
+	istate->fsmonitor_dirty_nr = 0;
+	strbuf_release(&out);
+
+	trace_counter("fsmonitor", "paths", nr_paths);
+	trace_counter("fsmonitor", "valid", nr_valid);
+	trace_region_leave("fsmonitor", "refresh");
+}
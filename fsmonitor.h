@@ -0,0 +1,25 @@
+#ifndef FSMONITOR_H
+#define FSMONITOR_H
+
+/*
+ * With core.fsmonitor, the index remembers when the file system
+ * monitor was last asked what changed, and which entries had not
+ * been verified against the work tree then.  On the next read the
+ * monitor is asked again, and the entries that neither it nor the
+ * index says are dirty get CE_FSMONITOR_VALID, so that refreshing
+ * the index need not lstat() them.
+ */
+extern int read_fsmonitor_extension(struct index_state *istate,
+				    const void *data, unsigned long sz);
+extern void write_fsmonitor_extension(struct strbuf *sb,
+				      struct index_state *istate);
+extern void refresh_fsmonitor(struct index_state *istate);
+
+/* "ce" has just been found to match the work tree */
+static inline void mark_fsmonitor_valid(struct cache_entry *ce)
+{
+	if (core_fsmonitor)
+		ce->ce_flags |= CE_FSMONITOR_VALID;
+}
+
+#endif
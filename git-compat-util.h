@@ -141,6 +141,15 @@
 #define is_dir_sep(c) ((c) == '/')
 #endif
 
+#ifndef va_copy
+#ifdef __va_copy
+#define va_copy(dst, src) __va_copy(dst, src)
+#else
+/* va_list is a plain pointer on most platforms without va_copy */
+#define va_copy(dst, src) ((dst) = (src))
+#endif
+#endif
+
 #ifdef __GNUC__
 #define NORETURN __attribute__((__noreturn__))
 #else
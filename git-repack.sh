@@ -14,6 +14,8 @@ f               pass --no-reuse-object to git-pack-objects
 n               do not run git-update-server-info
 q,quiet         be quiet
 l               pass --local to git-pack-objects
+b,write-bitmap-index write a bitmap index along with the pack (with -a)
+g,geometric=    roll up the smallest packs so that pack sizes grow by this factor
  Packing constraints
 window=         size of the window used for delta compression
 window-memory=  same as the above, but limit memory size instead of entries count
@@ -24,7 +26,7 @@ SUBDIRECTORY_OK='Yes'
 . git-sh-setup
 
 no_update_info= all_into_one= remove_redundant= unpack_unreachable=
-local= quiet= no_reuse= extra=
+local= quiet= no_reuse= extra= write_bitmap= geometric=
 while test $# != 0
 do
 	case "$1" in
@@ -36,6 +38,10 @@ do
 	-q)	quiet=-q ;;
 	-f)	no_reuse=--no-reuse-object ;;
 	-l)	local=--local ;;
+	-b|--write-bitmap-index)
+		write_bitmap=t ;;
+	-g|--geometric)
+		geometric=$2; shift ;;
 	--max-pack-size|--window|--window-memory|--depth)
 		extra="$extra $1=$2"; shift ;;
 	--) shift; break;;
@@ -49,15 +55,80 @@ true)
 	extra="$extra --delta-base-offset" ;;
 esac
 
+if test -z "$write_bitmap" &&
+   test "`git config --bool repack.writebitmaps`" = true
+then
+	write_bitmap=t
+fi
+
+if test -n "$geometric"
+then
+	case "$geometric" in
+	[2-9]|[1-9][0-9]*) ;;
+	*)	die "geometric factor must be an integer of at least 2" ;;
+	esac
+	test -z "$all_into_one" ||
+		die "--geometric cannot be used with -a or -A"
+	write_bitmap=
+fi
+
+# Print the names of the packs that have to be packed together, with
+# the loose objects, for the sizes of all packs to form a geometric
+# progression with factor $1.  The largest packs already forming one
+# are left alone, so the work done is proportional to the size of the
+# packs made since the last time, not to the size of the repository.
+geometric_rollup () {
+	(
+		loose=$(cd "$GIT_OBJECT_DIRECTORY" &&
+			find [0-9a-f][0-9a-f] -type f 2>/dev/null | xargs wc -c |
+			awk '$2 != "total" { sum += $1 } END { print sum + 0 }')
+		test "$loose" = 0 || echo $loose loose
+		cd "$PACKDIR" 2>/dev/null || exit 0
+		for e in `find . -type f -name '*.pack' \
+			| sed -e 's/^\.\///' -e 's/\.pack$//'`
+		do
+			test -e "$e.keep" || echo $(wc -c <"$e.pack") $e
+		done
+	) |
+	sort -n |
+	awk -v factor="$1" '
+		{ size[NR] = $1; name[NR] = $2 }
+		$2 == "loose" { loose = NR }
+		END {
+			k = NR
+			while (k > 1 && size[k] >= factor * size[k - 1])
+				k--
+			if (k == 1)
+				k = 0
+			# the loose objects are packed in any case
+			if (k < loose)
+				k = loose
+			for (i = 1; i <= k; i++)
+				total += size[i]
+			while (k && k < NR && size[k + 1] < factor * total)
+				total += size[++k]
+			for (i = 1; i <= k; i++)
+				if (name[i] != "loose")
+					print name[i]
+		}'
+}
+
 PACKDIR="$GIT_OBJECT_DIRECTORY/pack"
 PACKTMP="$GIT_OBJECT_DIRECTORY/.tmp-$$-pack"
 rm -f "$PACKTMP"-*
 trap 'rm -f "$PACKTMP"-*' 0 1 2 3 15
 
 # There will be more repacking strategies to come...
+rollup=
 case ",$all_into_one," in
 ,,)
 	args='--unpacked --incremental'
+	if test -n "$geometric"
+	then
+		rollup=$(geometric_rollup "$geometric") || exit
+		existing=$rollup
+		args="$args --stdin-packs"
+	fi
 	;;
 ,t,)
 	args= existing=
@@ -77,11 +148,14 @@ case ",$all_into_one," in
 			args="$args $unpack_unreachable"
 		fi
 	fi
+	# A bitmap can only be written for a pack holding everything
+	test -n "$write_bitmap" && args="$args --write-bitmap-index"
 	;;
 esac
 
 args="$args $local $quiet $no_reuse$extra"
-names=$(git pack-objects --honor-pack-keep --non-empty --all --reflog $args </dev/null "$PACKTMP") ||
+names=$(for e in $rollup; do echo "$e.pack"; done |
+	git pack-objects --honor-pack-keep --non-empty --all --reflog $args "$PACKTMP") ||
 	exit 1
 if [ -z "$names" ]; then
 	if test -z "$quiet"; then
@@ -99,7 +173,7 @@ rollback=
 failed=
 for name in $names
 do
-	for sfx in pack idx
+	for sfx in pack idx rev bitmap
 	do
 		file=pack-$name.$sfx
 		test -f "$PACKDIR/$file" || continue
@@ -145,11 +219,23 @@ fullbases=
 for name in $names
 do
 	fullbases="$fullbases pack-$name"
+	if test -f "$PACKTMP-$name.rev"
+	then
+		chmod a-w "$PACKTMP-$name.rev"
+		mv -f "$PACKTMP-$name.rev" "$PACKDIR/pack-$name.rev" ||
+		exit
+	fi
 	chmod a-w "$PACKTMP-$name.pack"
 	chmod a-w "$PACKTMP-$name.idx"
 	mv -f "$PACKTMP-$name.pack" "$PACKDIR/pack-$name.pack" &&
 	mv -f "$PACKTMP-$name.idx"  "$PACKDIR/pack-$name.idx" ||
 	exit
+	if test -f "$PACKTMP-$name.bitmap"
+	then
+		chmod a-w "$PACKTMP-$name.bitmap"
+		mv -f "$PACKTMP-$name.bitmap" "$PACKDIR/pack-$name.bitmap" ||
+		exit
+	fi
 done
 
 # Remove the "old-" files
@@ -157,6 +243,8 @@ for name in $names
 do
 	rm -f "$PACKDIR/old-pack-$name.idx"
 	rm -f "$PACKDIR/old-pack-$name.pack"
+	rm -f "$PACKDIR/old-pack-$name.rev"
+	rm -f "$PACKDIR/old-pack-$name.bitmap"
 done
 
 # End of pack replacement.
@@ -171,9 +259,12 @@ then
 		  do
 			case " $fullbases " in
 			*" $e "*) ;;
-			*)	rm -f "$e.pack" "$e.idx" "$e.keep" ;;
+			*)	rm -f "$e.pack" "$e.idx" "$e.rev" "$e.bitmap" \
+				      "$e.keep" ;;
 			esac
 		  done
+		  # it would only name packs that are gone now
+		  rm -f multi-pack-index
 		)
 	fi
 	git prune-packed $quiet
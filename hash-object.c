@@ -33,21 +33,119 @@ static void hash_object(const char *path, const char *type, int write_object,
 	hash_fd(fd, type, write_object, vpath);
 }
 
+/*
+ * When only hashing, the contents of up to MAX_SHA1_BATCH paths are
+ * read before they are hashed together; the names are printed in
+ * the order they came in.  The queue is flushed whenever no more
+ * paths are waiting on stdin, as the caller may want each name
+ * before it sends the next path.
+ */
+static struct strbuf hash_queue[MAX_SHA1_BATCH];
+static int hash_queue_nr;
+
+static void flush_hash_queue(const char *type)
+{
+	const void *buf[MAX_SHA1_BATCH];
+	unsigned long len[MAX_SHA1_BATCH];
+	const char *types[MAX_SHA1_BATCH];
+	unsigned char sha1[MAX_SHA1_BATCH][20], *sha1p[MAX_SHA1_BATCH];
+	int i;
+
+	for (i = 0; i < hash_queue_nr; i++) {
+		buf[i] = hash_queue[i].buf;
+		len[i] = hash_queue[i].len;
+		types[i] = type;
+		sha1p[i] = sha1[i];
+	}
+	hash_sha1_files(hash_queue_nr, buf, len, types, sha1p);
+	for (i = 0; i < hash_queue_nr; i++) {
+		printf("%s\n", sha1_to_hex(sha1[i]));
+		strbuf_reset(&hash_queue[i]);
+	}
+	maybe_flush_or_die(stdout, "hash to stdout");
+	hash_queue_nr = 0;
+}
+
+static void queue_hash(const char *path, const char *type)
+{
+	struct strbuf *sb = &hash_queue[hash_queue_nr];
+
+	if (strbuf_read_file(sb, path, 0) < 0)
+		die("Cannot open %s", path);
+	if (type_from_string(type) == OBJ_BLOB)
+		convert_to_git(path, sb->buf, sb->len, sb, 0);
+	if (++hash_queue_nr == MAX_SHA1_BATCH)
+		flush_hash_queue(type);
+}
+
+static int stdin_has_input(void)
+{
+	struct pollfd pfd;
+
+	pfd.fd = 0;
+	pfd.events = POLLIN;
+	return poll(&pfd, 1, 0) > 0;
+}
+
+/*
+ * Like strbuf_getline() on stdin, but read through our own buffer,
+ * so that we know when reading on would block.
+ */
+static int read_stdin_path(struct strbuf *sb, struct strbuf *in,
+			   const char *type)
+{
+	for (;;) {
+		char *eol = memchr(in->buf, '\n', in->len);
+		ssize_t n;
+
+		if (eol) {
+			strbuf_reset(sb);
+			strbuf_add(sb, in->buf, eol - in->buf);
+			strbuf_remove(in, 0, eol - in->buf + 1);
+			return 0;
+		}
+		if (hash_queue_nr && !stdin_has_input())
+			flush_hash_queue(type);
+		strbuf_grow(in, 8192);
+		n = xread(0, in->buf + in->len, 8192);
+		if (n < 0)
+			die("unable to read paths: %s", strerror(errno));
+		if (!n) {
+			if (!in->len)
+				return EOF;
+			strbuf_reset(sb);
+			strbuf_swap(sb, in);
+			return 0;
+		}
+		strbuf_setlen(in, in->len + n);
+	}
+}
+
 static void hash_stdin_paths(const char *type, int write_objects)
 {
-	struct strbuf buf = STRBUF_INIT, nbuf = STRBUF_INIT;
+	struct strbuf buf = STRBUF_INIT, nbuf = STRBUF_INIT, in = STRBUF_INIT;
+	int i;
 
-	while (strbuf_getline(&buf, stdin, '\n') != EOF) {
+	for (i = 0; i < MAX_SHA1_BATCH; i++)
+		strbuf_init(&hash_queue[i], 0);
+	while (read_stdin_path(&buf, &in, type) != EOF) {
 		if (buf.buf[0] == '"') {
 			strbuf_reset(&nbuf);
 			if (unquote_c_style(&nbuf, buf.buf, NULL))
 				die("line is badly quoted");
 			strbuf_swap(&buf, &nbuf);
 		}
-		hash_object(buf.buf, type, write_objects, buf.buf);
+		if (write_objects)
+			hash_object(buf.buf, type, write_objects, buf.buf);
+		else
+			queue_hash(buf.buf, type);
 	}
+	flush_hash_queue(type);
+	for (i = 0; i < MAX_SHA1_BATCH; i++)
+		strbuf_release(&hash_queue[i]);
 	strbuf_release(&buf);
 	strbuf_release(&nbuf);
+	strbuf_release(&in);
 }
 
 static const char * const hash_object_usage[] = {
@@ -10,8 +10,13 @@
 #include "fsck.h"
 #include "exec_cmd.h"
 
+#ifdef THREADED_DELTA_SEARCH
+#include "thread-utils.h"
+#include <pthread.h>
+#endif
+
 static const char index_pack_usage[] =
-"git index-pack [-v] [-o <index-file>] [{ ---keep | --keep=<msg> }] [--strict] { <pack-file> | --stdin [--fix-thin] [<pack-file>] }";
+"git index-pack [-v] [-o <index-file>] [{ ---keep | --keep=<msg> }] [--strict] [--threads=<n>] { <pack-file> | --stdin [--fix-thin] [<pack-file>] }";
 
 struct object_entry
 {
@@ -50,13 +55,25 @@ struct delta_entry
 	int obj_no;
 };
 
+/*
+ * Each thread resolving deltas keeps its own cache of base objects,
+ * bounded by core.deltaBaseCacheLimit.
+ */
+struct thread_local {
+#ifdef THREADED_DELTA_SEARCH
+	pthread_t thread;
+#endif
+	struct base_data *base_cache;
+	size_t base_cache_used;
+};
+
 static struct object_entry *objects;
 static struct delta_entry *deltas;
-static struct base_data *base_cache;
-static size_t base_cache_used;
+static struct thread_local nothread_data;
 static int nr_objects;
 static int nr_deltas;
 static int nr_resolved_deltas;
+static int nr_threads;
 
 static int from_stdin;
 static int strict;
@@ -72,6 +89,302 @@ static git_SHA_CTX input_ctx;
 static uint32_t input_crc32;
 static int input_fd, output_fd, pack_fd;
 
+/* input read past the end of the pack, to be passed on to stdout */
+static struct strbuf input_leftover = STRBUF_INIT;
+
+/*
+ * Non-delta objects found by the first pass are hashed a few at a
+ * time, so that a SHA-1 implementation that can hash several buffers
+ * at once gets to do so.  A large object is hashed on its own.
+ */
+#define HASH_BATCH_LIMIT (1024 * 1024)
+
+struct hash_batch {
+	int nr;
+	unsigned long size;
+	struct object_entry *obj[MAX_SHA1_BATCH];
+	void *data[MAX_SHA1_BATCH];
+};
+
+static struct hash_batch hash_batch;
+
+#ifdef THREADED_DELTA_SEARCH
+
+static struct thread_local *thread_data;
+static int nr_dispatched;
+static int threads_active;
+static pthread_key_t key;
+
+static pthread_mutex_t counter_mutex = PTHREAD_MUTEX_INITIALIZER;
+#define counter_lock()		pthread_mutex_lock(&counter_mutex)
+#define counter_unlock()	pthread_mutex_unlock(&counter_mutex)
+
+static pthread_mutex_t work_mutex = PTHREAD_MUTEX_INITIALIZER;
+#define work_lock()		pthread_mutex_lock(&work_mutex)
+#define work_unlock()		pthread_mutex_unlock(&work_mutex)
+
+/* the object table filled by --strict is not thread safe */
+static pthread_mutex_t strict_mutex = PTHREAD_MUTEX_INITIALIZER;
+#define strict_lock()		pthread_mutex_lock(&strict_mutex)
+#define strict_unlock()		pthread_mutex_unlock(&strict_mutex)
+
+static struct thread_local *get_thread_data(void)
+{
+	if (threads_active)
+		return pthread_getspecific(key);
+	return &nothread_data;
+}
+
+/*
+ * With more than one thread, the first pass is a pipeline:
+ *
+ *  - the reader thread reads the input in INPUT_CHUNK pieces ahead
+ *    of fill();
+ *
+ *  - the main thread parses and inflates one object after another,
+ *    as before;
+ *
+ *  - the writer thread copies what has been consumed to the output
+ *    pack and computes the pack checksum;
+ *
+ *  - the hasher thread computes the object names of non-delta
+ *    objects and checks them against the object database.
+ *
+ * The stages are connected by bounded queues, so that a fast network
+ * cannot make us buffer much more than QUEUE_DEPTH pieces per stage.
+ */
+#define INPUT_CHUNK (64 * 1024)
+#define OUTPUT_CHUNK (64 * 1024)
+#define QUEUE_DEPTH 16
+
+struct input_chunk {
+	ssize_t len;		/* 0 at the end of input, -1 on error */
+	int err;
+	unsigned int used;
+	unsigned char buf[INPUT_CHUNK];
+};
+
+struct output_chunk {
+	unsigned int len;
+	unsigned char buf[OUTPUT_CHUNK];
+};
+
+static int reader_active, writer_active, hasher_active;
+static pthread_t reader_thread, writer_thread, hasher_thread;
+static struct thread_queue input_queue, output_queue, hasher_queue;
+static struct input_chunk *input_chunk;
+static struct output_chunk *output_chunk;
+static int reader_wakeup[2];
+
+static void *run_reader(void *unused)
+{
+	for (;;) {
+		struct input_chunk *c = xmalloc(sizeof(*c));
+		struct pollfd pfd[2];
+
+		pfd[0].fd = input_fd;
+		pfd[0].events = POLLIN;
+		pfd[1].fd = reader_wakeup[0];
+		pfd[1].events = POLLIN;
+		if (poll(pfd, 2, -1) < 0) {
+			free(c);
+			if (errno == EINTR)
+				continue;
+			c = xmalloc(sizeof(*c));
+			c->len = -1;
+			c->err = errno;
+		} else if (pfd[1].revents) {
+			/* we have all we want; do not wait for more */
+			free(c);
+			break;
+		} else {
+			c->len = xread(input_fd, c->buf, sizeof(c->buf));
+			c->err = errno;
+		}
+		c->used = 0;
+		if (thread_queue_push(&input_queue, c)) {
+			free(c);
+			break;
+		}
+		if (c->len <= 0)
+			break;
+	}
+	thread_queue_close(&input_queue);
+	return NULL;
+}
+
+static void *run_writer(void *unused)
+{
+	struct output_chunk *c;
+
+	while ((c = thread_queue_pop(&output_queue))) {
+		if (output_fd >= 0)
+			write_or_die(output_fd, c->buf, c->len);
+		git_SHA1_Update(&input_ctx, c->buf, c->len);
+		free(c);
+	}
+	return NULL;
+}
+
+static void hash_objects(struct hash_batch *b);
+
+static void *run_hasher(void *unused)
+{
+	struct hash_batch *b;
+
+	while ((b = thread_queue_pop(&hasher_queue))) {
+		hash_objects(b);
+		free(b);
+	}
+	return NULL;
+}
+
+static void start_thread(pthread_t *thread, void *(*fn)(void *))
+{
+	int ret = pthread_create(thread, NULL, fn, NULL);
+	if (ret)
+		die("unable to create thread: %s", strerror(ret));
+}
+
+static void start_pipeline(void)
+{
+	if (pipe(reader_wakeup) < 0)
+		die("unable to create pipe: %s", strerror(errno));
+	thread_queue_init(&input_queue, QUEUE_DEPTH);
+	thread_queue_init(&output_queue, QUEUE_DEPTH);
+	thread_queue_init(&hasher_queue, QUEUE_DEPTH);
+	enable_obj_read_lock();
+	start_thread(&reader_thread, run_reader);
+	start_thread(&writer_thread, run_writer);
+	start_thread(&hasher_thread, run_hasher);
+	reader_active = writer_active = hasher_active = 1;
+}
+
+static void stop_hasher(void)
+{
+	thread_queue_close(&hasher_queue);
+	pthread_join(hasher_thread, NULL);
+	thread_queue_release(&hasher_queue);
+	disable_obj_read_lock();
+	hasher_active = 0;
+}
+
+static void stop_writer(void)
+{
+	if (output_chunk && output_chunk->len)
+		thread_queue_push(&output_queue, output_chunk);
+	else
+		free(output_chunk);
+	output_chunk = NULL;
+	thread_queue_close(&output_queue);
+	pthread_join(writer_thread, NULL);
+	thread_queue_release(&output_queue);
+	writer_active = 0;
+}
+
+/*
+ * Whatever the reader has got beyond what we consumed is not ours;
+ * keep it in input_leftover to be passed on.
+ */
+static void stop_reader(void)
+{
+	struct input_chunk *c = input_chunk;
+
+	write_or_die(reader_wakeup[1], "", 1);
+	do {
+		if (c && c->len > 0)
+			strbuf_add(&input_leftover, c->buf + c->used,
+				   c->len - c->used);
+		free(c);
+	} while ((c = thread_queue_pop(&input_queue)));
+	input_chunk = NULL;
+	pthread_join(reader_thread, NULL);
+	thread_queue_release(&input_queue);
+	close(reader_wakeup[0]);
+	close(reader_wakeup[1]);
+	reader_active = 0;
+}
+
+static ssize_t read_input(unsigned char *buf, size_t len)
+{
+	struct input_chunk *c;
+
+	if (!reader_active)
+		return xread(input_fd, buf, len);
+	c = input_chunk;
+	if (!c) {
+		c = input_chunk = thread_queue_pop(&input_queue);
+		if (!c)
+			return 0;
+	}
+	if (c->len <= 0) {
+		errno = c->err;
+		return c->len;
+	}
+	if (len > c->len - c->used)
+		len = c->len - c->used;
+	memcpy(buf, c->buf + c->used, len);
+	c->used += len;
+	if (c->used == c->len) {
+		free(c);
+		input_chunk = NULL;
+	}
+	return len;
+}
+
+static void write_input(const unsigned char *buf, unsigned int len)
+{
+	if (!writer_active) {
+		if (output_fd >= 0)
+			write_or_die(output_fd, buf, len);
+		git_SHA1_Update(&input_ctx, buf, len);
+		return;
+	}
+	while (len) {
+		unsigned int n;
+
+		if (!output_chunk) {
+			output_chunk = xmalloc(sizeof(*output_chunk));
+			output_chunk->len = 0;
+		}
+		n = OUTPUT_CHUNK - output_chunk->len;
+		if (n > len)
+			n = len;
+		memcpy(output_chunk->buf + output_chunk->len, buf, n);
+		output_chunk->len += n;
+		buf += n;
+		len -= n;
+		if (output_chunk->len == OUTPUT_CHUNK) {
+			thread_queue_push(&output_queue, output_chunk);
+			output_chunk = NULL;
+		}
+	}
+}
+
+#else
+
+#define counter_lock()		(void)0
+#define counter_unlock()	(void)0
+#define work_lock()		(void)0
+#define work_unlock()		(void)0
+#define strict_lock()		(void)0
+#define strict_unlock()		(void)0
+#define get_thread_data()	(&nothread_data)
+
+static ssize_t read_input(unsigned char *buf, size_t len)
+{
+	return xread(input_fd, buf, len);
+}
+
+static void write_input(const unsigned char *buf, unsigned int len)
+{
+	if (output_fd >= 0)
+		write_or_die(output_fd, buf, len);
+	git_SHA1_Update(&input_ctx, buf, len);
+}
+
+#endif
+
 static int mark_link(struct object *obj, int type, void *data)
 {
 	if (!obj)
@@ -118,9 +431,7 @@ static void check_objects(void)
 static void flush(void)
 {
 	if (input_offset) {
-		if (output_fd >= 0)
-			write_or_die(output_fd, input_buffer, input_offset);
-		git_SHA1_Update(&input_ctx, input_buffer, input_offset);
+		write_input(input_buffer, input_offset);
 		memmove(input_buffer, input_buffer + input_offset, input_len);
 		input_offset = 0;
 	}
@@ -138,7 +449,7 @@ static void *fill(int min)
 		die("cannot fill %d bytes", min);
 	flush();
 	do {
-		ssize_t ret = xread(input_fd, input_buffer + input_len,
+		ssize_t ret = read_input(input_buffer + input_len,
 				sizeof(input_buffer) - input_len);
 		if (ret <= 0) {
 			if (!ret)
@@ -185,6 +496,10 @@ static char *open_pack_file(char *pack_name)
 		if (input_fd < 0)
 			die("cannot open packfile '%s': %s",
 			    pack_name, strerror(errno));
+#ifdef POSIX_FADV_SEQUENTIAL
+		/* the first pass reads it from start to end */
+		posix_fadvise(input_fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
 		output_fd = -1;
 		pack_fd = input_fd;
 	}
@@ -226,15 +541,16 @@ static void free_base_data(struct base_data *c)
 	if (c->data) {
 		free(c->data);
 		c->data = NULL;
-		base_cache_used -= c->size;
+		get_thread_data()->base_cache_used -= c->size;
 	}
 }
 
 static void prune_base_data(struct base_data *retain)
 {
+	struct thread_local *data = get_thread_data();
 	struct base_data *b;
-	for (b = base_cache;
-	     base_cache_used > delta_base_cache_limit && b;
+	for (b = data->base_cache;
+	     data->base_cache_used > delta_base_cache_limit && b;
 	     b = b->child) {
 		if (b->data && b != retain)
 			free_base_data(b);
@@ -246,12 +562,12 @@ static void link_base_data(struct base_data *base, struct base_data *c)
 	if (base)
 		base->child = c;
 	else
-		base_cache = c;
+		get_thread_data()->base_cache = c;
 
 	c->base = base;
 	c->child = NULL;
 	if (c->data)
-		base_cache_used += c->size;
+		get_thread_data()->base_cache_used += c->size;
 	prune_base_data(c);
 }
 
@@ -261,7 +577,7 @@ static void unlink_base_data(struct base_data *c)
 	if (base)
 		base->child = NULL;
 	else
-		base_cache = NULL;
+		get_thread_data()->base_cache = NULL;
 	free_base_data(c);
 }
 
@@ -432,10 +748,13 @@ static void find_delta_children(const union delta_base *base,
 	*last_index = last;
 }
 
+/*
+ * Check a freshly hashed object against what we already have, and
+ * fsck it when asked to.
+ */
 static void sha1_object(const void *data, unsigned long size,
 			enum object_type type, unsigned char *sha1)
 {
-	hash_sha1_file(data, size, typename(type), sha1);
 	if (has_sha1_file(sha1)) {
 		void *has_data;
 		enum object_type has_type;
@@ -449,6 +768,7 @@ static void sha1_object(const void *data, unsigned long size,
 		free(has_data);
 	}
 	if (strict) {
+		strict_lock();
 		if (type == OBJ_BLOB) {
 			struct blob *blob = lookup_blob(sha1);
 			if (blob)
@@ -482,6 +802,7 @@ static void sha1_object(const void *data, unsigned long size,
 			}
 			obj->flags |= FLAG_CHECKED;
 		}
+		strict_unlock();
 	}
 }
 
@@ -505,7 +826,7 @@ static void *get_base_data(struct base_data *c)
 			c->size = obj->size;
 		}
 
-		base_cache_used += c->size;
+		get_thread_data()->base_cache_used += c->size;
 		prune_base_data(c);
 	}
 	return c->data;
@@ -525,9 +846,13 @@ static void resolve_delta(struct object_entry *delta_obj,
 	free(delta_data);
 	if (!result->data)
 		bad_object(delta_obj->idx.offset, "failed to apply delta");
+	hash_sha1_file(result->data, result->size,
+		       typename(delta_obj->real_type), delta_obj->idx.sha1);
 	sha1_object(result->data, result->size, delta_obj->real_type,
 		    delta_obj->idx.sha1);
+	counter_lock();
 	nr_resolved_deltas++;
+	counter_unlock();
 }
 
 static void find_unresolved_deltas(struct base_data *base,
@@ -582,6 +907,69 @@ static void find_unresolved_deltas(struct base_data *base,
 	unlink_base_data(base);
 }
 
+static void resolve_base(struct object_entry *obj)
+{
+	struct base_data base_obj;
+
+	base_obj.obj = obj;
+	base_obj.data = NULL;
+	find_unresolved_deltas(&base_obj, NULL);
+}
+
+#ifdef THREADED_DELTA_SEARCH
+/*
+ * Worker for the second pass: take the next non-delta object in
+ * pack order and resolve the whole tree of deltas hanging off it.
+ */
+static void *threaded_second_pass(void *data)
+{
+	pthread_setspecific(key, data);
+	for (;;) {
+		int i;
+
+		work_lock();
+		while (nr_dispatched < nr_objects &&
+		       (objects[nr_dispatched].type == OBJ_REF_DELTA ||
+			objects[nr_dispatched].type == OBJ_OFS_DELTA))
+			nr_dispatched++;
+		if (nr_dispatched >= nr_objects) {
+			work_unlock();
+			break;
+		}
+		i = nr_dispatched++;
+		work_unlock();
+
+		resolve_base(&objects[i]);
+		counter_lock();
+		display_progress(progress, nr_resolved_deltas);
+		counter_unlock();
+	}
+	return NULL;
+}
+
+static void resolve_deltas_threaded(void)
+{
+	int i, ret;
+
+	thread_data = xcalloc(nr_threads, sizeof(*thread_data));
+	pthread_key_create(&key, NULL);
+	enable_obj_read_lock();
+	threads_active = 1;
+	for (i = 0; i < nr_threads; i++) {
+		ret = pthread_create(&thread_data[i].thread, NULL,
+				     threaded_second_pass, thread_data + i);
+		if (ret)
+			die("unable to create thread: %s", strerror(ret));
+	}
+	for (i = 0; i < nr_threads; i++)
+		pthread_join(thread_data[i].thread, NULL);
+	threads_active = 0;
+	disable_obj_read_lock();
+	pthread_key_delete(key);
+	free(thread_data);
+}
+#endif
+
 static int compare_delta_entry(const void *a, const void *b)
 {
 	const struct delta_entry *delta_a = a;
@@ -589,6 +977,55 @@ static int compare_delta_entry(const void *a, const void *b)
 	return memcmp(&delta_a->base, &delta_b->base, UNION_BASE_SZ);
 }
 
+static void hash_objects(struct hash_batch *b)
+{
+	const void *buf[MAX_SHA1_BATCH];
+	unsigned long len[MAX_SHA1_BATCH];
+	const char *type[MAX_SHA1_BATCH];
+	unsigned char *sha1[MAX_SHA1_BATCH];
+	int i;
+
+	for (i = 0; i < b->nr; i++) {
+		buf[i] = b->data[i];
+		len[i] = b->obj[i]->size;
+		type[i] = typename(b->obj[i]->type);
+		sha1[i] = b->obj[i]->idx.sha1;
+	}
+	hash_sha1_files(b->nr, buf, len, type, sha1);
+	for (i = 0; i < b->nr; i++) {
+		struct object_entry *obj = b->obj[i];
+		sha1_object(b->data[i], obj->size, obj->type, obj->idx.sha1);
+		free(b->data[i]);
+	}
+}
+
+static void flush_hash_batch(void)
+{
+	if (!hash_batch.nr)
+		return;
+#ifdef THREADED_DELTA_SEARCH
+	if (hasher_active) {
+		struct hash_batch *b = xmalloc(sizeof(*b));
+		*b = hash_batch;
+		thread_queue_push(&hasher_queue, b);
+	} else
+#endif
+		hash_objects(&hash_batch);
+	hash_batch.nr = 0;
+	hash_batch.size = 0;
+}
+
+static void queue_hash(struct object_entry *obj, void *data)
+{
+	hash_batch.obj[hash_batch.nr] = obj;
+	hash_batch.data[hash_batch.nr] = data;
+	hash_batch.nr++;
+	hash_batch.size += obj->size;
+	if (hash_batch.nr == MAX_SHA1_BATCH ||
+	    hash_batch.size >= HASH_BATCH_LIMIT)
+		flush_hash_batch();
+}
+
 /* Parse all objects and return the pack content SHA1 hash */
 static void parse_pack_objects(unsigned char *sha1)
 {
@@ -606,6 +1043,10 @@ static void parse_pack_objects(unsigned char *sha1)
 		progress = start_progress(
 				from_stdin ? "Receiving objects" : "Indexing objects",
 				nr_objects);
+#ifdef THREADED_DELTA_SEARCH
+	if (nr_threads > 1)
+		start_pipeline();
+#endif
 	for (i = 0; i < nr_objects; i++) {
 		struct object_entry *obj = &objects[i];
 		void *data = unpack_raw_entry(obj, &delta->base);
@@ -614,26 +1055,40 @@ static void parse_pack_objects(unsigned char *sha1)
 			nr_deltas++;
 			delta->obj_no = i;
 			delta++;
+			free(data);
 		} else
-			sha1_object(data, obj->size, obj->type, obj->idx.sha1);
-		free(data);
+			queue_hash(obj, data);
 		display_progress(progress, i+1);
 	}
+	flush_hash_batch();
+#ifdef THREADED_DELTA_SEARCH
+	if (hasher_active)
+		stop_hasher();
+#endif
 	objects[i].idx.offset = consumed_bytes;
 	stop_progress(&progress);
 
 	/* Check pack integrity */
 	flush();
+#ifdef THREADED_DELTA_SEARCH
+	if (writer_active)
+		stop_writer();
+#endif
 	git_SHA1_Final(sha1, &input_ctx);
 	if (hashcmp(fill(20), sha1))
 		die("pack is corrupted (SHA1 mismatch)");
 	use(20);
+#ifdef THREADED_DELTA_SEARCH
+	if (reader_active)
+		stop_reader();
+#endif
 
 	/* If input_fd is a file, we should have reached its end now. */
 	if (fstat(input_fd, &st))
 		die("cannot fstat packfile: %s", strerror(errno));
 	if (S_ISREG(st.st_mode) &&
-			lseek(input_fd, 0, SEEK_CUR) - input_len != st.st_size)
+			lseek(input_fd, 0, SEEK_CUR) - input_len -
+			input_leftover.len != st.st_size)
 		die("pack has junk at the end");
 
 	if (!nr_deltas)
@@ -653,15 +1108,18 @@ static void parse_pack_objects(unsigned char *sha1)
 	 */
 	if (verbose)
 		progress = start_progress("Resolving deltas", nr_deltas);
+#ifdef THREADED_DELTA_SEARCH
+	if (nr_threads > 1) {
+		resolve_deltas_threaded();
+		return;
+	}
+#endif
 	for (i = 0; i < nr_objects; i++) {
 		struct object_entry *obj = &objects[i];
-		struct base_data base_obj;
 
 		if (obj->type == OBJ_REF_DELTA || obj->type == OBJ_OFS_DELTA)
 			continue;
-		base_obj.obj = obj;
-		base_obj.data = NULL;
-		find_unresolved_deltas(&base_obj, NULL);
+		resolve_base(obj);
 		display_progress(progress, nr_resolved_deltas);
 	}
 }
@@ -775,6 +1233,7 @@ static void fix_unresolved_deltas(struct sha1file *f, int nr_unresolved)
 
 static void final(const char *final_pack_name, const char *curr_pack_name,
 		  const char *final_index_name, const char *curr_index_name,
+		  const char *final_rev_name, const char *curr_rev_name,
 		  const char *keep_name, const char *keep_msg,
 		  unsigned char *sha1)
 {
@@ -815,6 +1274,18 @@ static void final(const char *final_pack_name, const char *curr_pack_name,
 		}
 	}
 
+	/* in place before the index makes the pack visible */
+	if (curr_rev_name && final_rev_name != curr_rev_name) {
+		if (!final_rev_name) {
+			snprintf(name, sizeof(name), "%s/pack/pack-%s.rev",
+				 get_object_directory(), sha1_to_hex(sha1));
+			final_rev_name = name;
+		}
+		if (move_temp_to_file(curr_rev_name, final_rev_name))
+			die("cannot store reverse index file");
+	} else if (curr_rev_name)
+		chmod(final_rev_name, 0444);
+
 	if (final_pack_name != curr_pack_name) {
 		if (!final_pack_name) {
 			snprintf(name, sizeof(name), "%s/pack/pack-%s.pack",
@@ -856,6 +1327,8 @@ static void final(const char *final_pack_name, const char *curr_pack_name,
 			input_len -= err;
 			input_offset += err;
 		}
+		if (!input_len && input_leftover.len)
+			write_in_full(1, input_leftover.buf, input_leftover.len);
 	}
 }
 
@@ -868,6 +1341,22 @@ static int git_index_pack_config(const char *k, const char *v, void *cb)
 				pack_idx_default_version);
 		return 0;
 	}
+	if (!strcmp(k, "pack.writereverseindex")) {
+		pack_write_rev_index = git_config_bool(k, v);
+		return 0;
+	}
+	if (!strcmp(k, "pack.threads")) {
+		nr_threads = git_config_int(k, v);
+		if (nr_threads < 0)
+			die("invalid number of threads specified (%d)",
+			    nr_threads);
+#ifndef THREADED_DELTA_SEARCH
+		if (nr_threads != 1)
+			warning("no threads support, ignoring %s", k);
+		nr_threads = 1;
+#endif
+		return 0;
+	}
 	return git_default_config(k, v, cb);
 }
 
@@ -876,10 +1365,11 @@ int main(int argc, char **argv)
 	int i, fix_thin_pack = 0;
 	char *curr_pack, *pack_name = NULL;
 	char *curr_index, *index_name = NULL;
+	char *curr_rev = NULL, *rev_name = NULL;
 	const char *keep_name = NULL, *keep_msg = NULL;
 	char *index_name_buf = NULL, *keep_name_buf = NULL;
 	struct pack_idx_entry **idx_objects;
-	unsigned char pack_sha1[20];
+	unsigned char pack_sha1[20], pack_checksum[20];
 
 	git_extract_argv0_path(argv[0]);
 
@@ -932,6 +1422,17 @@ int main(int argc, char **argv)
 				input_len = sizeof(*hdr);
 			} else if (!strcmp(arg, "-v")) {
 				verbose = 1;
+			} else if (!prefixcmp(arg, "--threads=")) {
+				char *end;
+				nr_threads = strtoul(arg+10, &end, 0);
+				if (!arg[10] || *end || nr_threads < 0)
+					usage(index_pack_usage);
+#ifndef THREADED_DELTA_SEARCH
+				if (nr_threads != 1)
+					warning("no threads support, "
+						"ignoring %s", arg);
+				nr_threads = 1;
+#endif
 			} else if (!strcmp(arg, "-o")) {
 				if (index_name || (i+1) >= argc)
 					usage(index_pack_usage);
@@ -969,6 +1470,13 @@ int main(int argc, char **argv)
 		strcpy(index_name_buf + len - 5, ".idx");
 		index_name = index_name_buf;
 	}
+	if (pack_write_rev_index && index_name &&
+	    has_extension(index_name, ".idx")) {
+		int len = strlen(index_name);
+		rev_name = xmalloc(len + 1);
+		memcpy(rev_name, index_name, len - 4);
+		strcpy(rev_name + len - 4, ".rev");
+	}
 	if (keep_msg && !keep_name && pack_name) {
 		int len = strlen(pack_name);
 		if (!has_extension(pack_name, ".pack"))
@@ -980,6 +1488,18 @@ int main(int argc, char **argv)
 		keep_name = keep_name_buf;
 	}
 
+#ifdef THREADED_DELTA_SEARCH
+	/*
+	 * --threads=0 means autodetect; beyond three threads, reading
+	 * the pack and allocating memory dominate.
+	 */
+	if (!nr_threads) {
+		nr_threads = online_cpus();
+		if (nr_threads > 3)
+			nr_threads = 3;
+	}
+#endif
+
 	curr_pack = open_pack_file(pack_name);
 	parse_pack_header();
 	objects = xmalloc((nr_objects + 1) * sizeof(struct object_entry));
@@ -1026,15 +1546,23 @@ int main(int argc, char **argv)
 	idx_objects = xmalloc((nr_objects) * sizeof(struct pack_idx_entry *));
 	for (i = 0; i < nr_objects; i++)
 		idx_objects[i] = &objects[i].idx;
+	hashcpy(pack_checksum, pack_sha1);
 	curr_index = write_idx_file(index_name, idx_objects, nr_objects, pack_sha1);
+	if (pack_write_rev_index && (rev_name || !index_name))
+		curr_rev = write_rev_file(rev_name, idx_objects, nr_objects,
+					  pack_checksum);
 	free(idx_objects);
 
 	final(pack_name, curr_pack,
 		index_name, curr_index,
+		rev_name, curr_rev,
 		keep_name, keep_msg,
 		pack_sha1);
 	free(objects);
 	free(index_name_buf);
+	if (rev_name == NULL)
+		free(curr_rev);
+	free(rev_name);
 	free(keep_name_buf);
 	if (pack_name == NULL)
 		free(curr_pack);
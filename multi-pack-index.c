@@ -0,0 +1,485 @@
+#include "cache.h"
+#include "csum-file.h"
+#include "multi-pack-index.h"
+
+/*
+ * File layout (all integers in network byte order):
+ *
+ *   - 24-byte header: signature, version, number of packs P, number
+ *     of objects N, number of large offsets L, size of the pack name
+ *     block
+ *   - P 20-byte pack checksums, as found at the end of each .idx
+ *   - the pack name block: P NUL-terminated file names relative to
+ *     the pack directory, padded with NULs to a multiple of 4 bytes
+ *   - 256 entries of fan-out table, 4 bytes each
+ *   - N 20-byte object names, sorted
+ *   - N 8-byte records, in the same order: pack number, and offset
+ *     in that pack (or MIDX_LARGE_OFFSET plus an index into the
+ *     large offset table)
+ *   - L 8-byte large offsets
+ *   - 20-byte SHA-1 checksum of all of the above
+ */
+#define MIDX_HEADER_SIZE 24
+#define MIDX_FANOUT_SIZE (4 * 256)
+
+struct multi_pack_index {
+	const unsigned char *data;
+	size_t data_len;
+	uint32_t num_packs;
+	uint32_t num_objects;
+	uint32_t num_large_offsets;
+	const unsigned char *checksums;
+	const char **names;
+	const uint32_t *fanout;
+	const unsigned char *sha1s;
+	const uint32_t *records;
+	const uint32_t *large_offsets;
+
+	/* the packs named above; NULL when one has gone away */
+	struct packed_git **packs;
+	/* 0 if not checked yet, 1 if the pack matches, -1 if not */
+	signed char *pack_ok;
+};
+
+static struct multi_pack_index *the_midx;
+static int midx_prepared;
+
+static const char *multi_pack_index_filename(void)
+{
+	static char path[PATH_MAX];
+	if (!*path)
+		snprintf(path, sizeof(path), "%s/pack/multi-pack-index",
+			 get_object_directory());
+	return path;
+}
+
+static void free_midx(struct multi_pack_index *m)
+{
+	munmap((void *)m->data, m->data_len);
+	free(m->names);
+	free(m->packs);
+	free(m->pack_ok);
+	free(m);
+}
+
+static struct multi_pack_index *load_multi_pack_index(const char *path)
+{
+	struct multi_pack_index *m;
+	const uint32_t *hdr;
+	const unsigned char *names, *end;
+	unsigned char *data;
+	size_t len, expect, names_len;
+	uint32_t i, prev;
+	struct stat st;
+	int fd = open(path, O_RDONLY);
+
+	if (fd < 0)
+		return NULL;
+	if (fstat(fd, &st)) {
+		close(fd);
+		return NULL;
+	}
+	len = xsize_t(st.st_size);
+	if (len < MIDX_HEADER_SIZE + MIDX_FANOUT_SIZE + 20) {
+		close(fd);
+		error("multi-pack-index file %s is too small", path);
+		return NULL;
+	}
+	data = xmmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	hdr = (const uint32_t *)data;
+	if (ntohl(hdr[0]) != MIDX_SIGNATURE) {
+		error("multi-pack-index file %s has a bad signature", path);
+		goto bad;
+	}
+	if (ntohl(hdr[1]) != MIDX_VERSION) {
+		error("multi-pack-index file %s is version %"PRIu32
+		      " and is not supported by this binary",
+		      path, ntohl(hdr[1]));
+		goto bad;
+	}
+
+	m = xcalloc(1, sizeof(*m));
+	m->data = data;
+	m->data_len = len;
+	m->num_packs = ntohl(hdr[2]);
+	m->num_objects = ntohl(hdr[3]);
+	m->num_large_offsets = ntohl(hdr[4]);
+	names_len = ntohl(hdr[5]);
+	expect = MIDX_HEADER_SIZE + (size_t)m->num_packs * 20 + names_len +
+		MIDX_FANOUT_SIZE + (size_t)m->num_objects * 28 +
+		(size_t)m->num_large_offsets * 8 + 20;
+	if (len != expect || names_len % 4) {
+		error("wrong multi-pack-index file size in %s", path);
+		goto bad_midx;
+	}
+
+	m->checksums = data + MIDX_HEADER_SIZE;
+	names = m->checksums + (size_t)m->num_packs * 20;
+	end = names + names_len;
+	m->names = xcalloc(m->num_packs, sizeof(*m->names));
+	for (i = 0; i < m->num_packs; i++) {
+		const unsigned char *nul = memchr(names, 0, end - names);
+		if (!nul || nul == names) {
+			error("bad pack name block in %s", path);
+			goto bad_midx;
+		}
+		m->names[i] = (const char *)names;
+		names = nul + 1;
+	}
+
+	m->fanout = (const uint32_t *)end;
+	for (i = prev = 0; i < 256; i++) {
+		uint32_t n = ntohl(m->fanout[i]);
+		if (n < prev) {
+			error("non-monotonic fan-out table in %s", path);
+			goto bad_midx;
+		}
+		prev = n;
+	}
+	if (prev != m->num_objects) {
+		error("fan-out table of %s does not match its size", path);
+		goto bad_midx;
+	}
+	m->sha1s = end + MIDX_FANOUT_SIZE;
+	m->records = (const uint32_t *)(m->sha1s + (size_t)m->num_objects * 20);
+	m->large_offsets = m->records + (size_t)m->num_objects * 2;
+
+	m->packs = xcalloc(m->num_packs, sizeof(*m->packs));
+	m->pack_ok = xcalloc(m->num_packs, 1);
+	return m;
+
+bad_midx:
+	free(m->names);
+	free(m);
+bad:
+	munmap(data, len);
+	return NULL;
+}
+
+static const char *pack_basename(struct packed_git *p)
+{
+	const char *slash = strrchr(p->pack_name, '/');
+	return slash ? slash + 1 : p->pack_name;
+}
+
+void prepare_multi_pack_index(void)
+{
+	struct packed_git *p;
+	uint32_t i;
+
+	if (midx_prepared)
+		return;
+	midx_prepared = 1;
+	if (!core_multi_pack_index)
+		return;
+	if (!the_midx)
+		the_midx = load_multi_pack_index(multi_pack_index_filename());
+	if (!the_midx)
+		return;
+
+	for (p = packed_git; p; p = p->next)
+		p->multi_pack_index = 0;
+	for (p = packed_git; p; p = p->next) {
+		const char *name = pack_basename(p);
+
+		if (!p->pack_local)
+			continue;
+		for (i = 0; i < the_midx->num_packs; i++) {
+			if (!strcmp(the_midx->names[i], name)) {
+				the_midx->packs[i] = p;
+				p->multi_pack_index = 1;
+				break;
+			}
+		}
+	}
+}
+
+void close_multi_pack_index(void)
+{
+	struct packed_git *p;
+
+	if (the_midx) {
+		free_midx(the_midx);
+		the_midx = NULL;
+	}
+	for (p = packed_git; p; p = p->next)
+		p->multi_pack_index = 0;
+	midx_prepared = 0;
+}
+
+static int midx_pos(const struct multi_pack_index *m,
+		    const unsigned char *sha1, uint32_t *pos)
+{
+	uint32_t lo, hi;
+
+	lo = sha1[0] ? ntohl(m->fanout[sha1[0] - 1]) : 0;
+	hi = ntohl(m->fanout[sha1[0]]);
+	while (lo < hi) {
+		uint32_t mi = lo + (hi - lo) / 2;
+		int cmp = hashcmp(sha1, m->sha1s + (size_t)mi * 20);
+		if (!cmp) {
+			*pos = mi;
+			return 1;
+		}
+		if (cmp < 0)
+			hi = mi;
+		else
+			lo = mi + 1;
+	}
+	return 0;
+}
+
+static off_t midx_offset(const struct multi_pack_index *m, uint32_t pos)
+{
+	uint32_t off = ntohl(m->records[2 * pos + 1]);
+
+	if (!(off & MIDX_LARGE_OFFSET))
+		return off;
+	off &= ~MIDX_LARGE_OFFSET;
+	if (off >= m->num_large_offsets)
+		return 0;
+	return (((uint64_t)ntohl(m->large_offsets[2 * off])) << 32) |
+		ntohl(m->large_offsets[2 * off + 1]);
+}
+
+/*
+ * A pack of the same name may have been written again with the same
+ * objects at other offsets; trust the index only for the very pack
+ * it was written from.
+ */
+static int midx_pack_ok(struct multi_pack_index *m, uint32_t nr)
+{
+	struct packed_git *p = m->packs[nr];
+
+	if (!m->pack_ok[nr]) {
+		if (!p || open_pack_index(p) ||
+		    hashcmp(m->checksums + (size_t)nr * 20,
+			    (const unsigned char *)p->index_data +
+			    p->index_size - 40)) {
+			m->pack_ok[nr] = -1;
+			if (p)
+				p->multi_pack_index = 0;
+		} else
+			m->pack_ok[nr] = 1;
+	}
+	return m->pack_ok[nr] > 0;
+}
+
+int find_pack_entry_in_midx(const unsigned char *sha1, struct pack_entry *e)
+{
+	struct multi_pack_index *m;
+	struct packed_git *p;
+	uint32_t pos, nr;
+	unsigned i;
+
+	prepare_multi_pack_index();
+	m = the_midx;
+	if (!m)
+		return -1;
+	if (!midx_pos(m, sha1, &pos))
+		return 0;
+
+	nr = ntohl(m->records[2 * pos]);
+	if (nr >= m->num_packs || !midx_pack_ok(m, nr))
+		return -1;
+	p = m->packs[nr];
+	for (i = 0; i < p->num_bad_objects; i++)
+		if (!hashcmp(sha1, p->bad_object_sha1 + 20 * i))
+			return -1;
+
+	e->offset = midx_offset(m, pos);
+	if (!e->offset)
+		return -1;
+	e->p = p;
+	hashcpy(e->sha1, sha1);
+	return 1;
+}
+
+/*
+ * Writing
+ */
+struct midx_entry {
+	const unsigned char *sha1;
+	uint32_t pack;
+	off_t offset;
+};
+
+static int midx_entry_cmp(const void *a_, const void *b_)
+{
+	const struct midx_entry *a = a_, *b = b_;
+	int cmp = hashcmp(a->sha1, b->sha1);
+
+	if (cmp)
+		return cmp;
+	/* prefer the pack that comes first in packed_git */
+	return a->pack < b->pack ? -1 : a->pack > b->pack;
+}
+
+static void write_be32(struct sha1file *f, uint32_t v)
+{
+	v = htonl(v);
+	sha1write(f, &v, 4);
+}
+
+int write_multi_pack_index(int quiet)
+{
+	static struct lock_file lock;
+	struct packed_git *p, **packs = NULL;
+	struct midx_entry *entries = NULL;
+	struct sha1file *f;
+	uint32_t nr_packs = 0, alloc_packs = 0, nr = 0, alloc = 0;
+	uint32_t i, j, nr_large = 0, names_len = 0;
+	int fd;
+
+	close_multi_pack_index();
+	prepare_packed_git();
+	for (p = packed_git; p; p = p->next) {
+		if (!p->pack_local || open_pack_index(p))
+			continue;
+		ALLOC_GROW(packs, nr_packs + 1, alloc_packs);
+		packs[nr_packs] = p;
+		for (i = 0; i < p->num_objects; i++) {
+			ALLOC_GROW(entries, nr + 1, alloc);
+			entries[nr].sha1 = nth_packed_object_sha1(p, i);
+			entries[nr].pack = nr_packs;
+			entries[nr].offset = nth_packed_object_offset(p, i);
+			nr++;
+		}
+		names_len += strlen(pack_basename(p)) + 1;
+		nr_packs++;
+	}
+	names_len = (names_len + 3) & ~3;
+
+	qsort(entries, nr, sizeof(*entries), midx_entry_cmp);
+	for (i = j = 0; i < nr; i++) {
+		if (j && !hashcmp(entries[j - 1].sha1, entries[i].sha1))
+			continue;
+		entries[j] = entries[i];
+		if (entries[j].offset > 0x7fffffff)
+			nr_large++;
+		j++;
+	}
+	nr = j;
+
+	fd = hold_lock_file_for_update(&lock, multi_pack_index_filename(),
+				       LOCK_DIE_ON_ERROR);
+	f = sha1fd(fd, lock.filename);
+
+	write_be32(f, MIDX_SIGNATURE);
+	write_be32(f, MIDX_VERSION);
+	write_be32(f, nr_packs);
+	write_be32(f, nr);
+	write_be32(f, nr_large);
+	write_be32(f, names_len);
+
+	for (i = 0; i < nr_packs; i++)
+		sha1write(f, (unsigned char *)packs[i]->index_data +
+			  packs[i]->index_size - 40, 20);
+	for (i = 0, j = 0; i < nr_packs; i++) {
+		const char *name = pack_basename(packs[i]);
+		sha1write(f, (char *)name, strlen(name) + 1);
+		j += strlen(name) + 1;
+	}
+	for (; j < names_len; j++)
+		sha1write(f, "", 1);
+
+	for (i = 0, j = 0; j < 256; j++) {
+		while (i < nr && entries[i].sha1[0] == j)
+			i++;
+		write_be32(f, i);
+	}
+
+	for (i = 0; i < nr; i++)
+		sha1write(f, (unsigned char *)entries[i].sha1, 20);
+
+	for (i = 0, j = 0; i < nr; i++) {
+		write_be32(f, entries[i].pack);
+		if (entries[i].offset > 0x7fffffff)
+			write_be32(f, MIDX_LARGE_OFFSET | j++);
+		else
+			write_be32(f, (uint32_t)entries[i].offset);
+	}
+	for (i = 0; i < nr; i++) {
+		uint64_t off = entries[i].offset;
+		if (off <= 0x7fffffff)
+			continue;
+		write_be32(f, (uint32_t)(off >> 32));
+		write_be32(f, (uint32_t)off);
+	}
+
+	sha1close(f, NULL, CSUM_CLOSE);
+	lock.fd = -1;
+	if (commit_lock_file(&lock))
+		return error("unable to write %s", multi_pack_index_filename());
+
+	if (!quiet)
+		fprintf(stderr, "Wrote multi-pack-index with %"PRIu32
+			" objects from %"PRIu32" packs\n", nr, nr_packs);
+	free(entries);
+	free(packs);
+	return 0;
+}
+
+/*
+ * Verification
+ */
+int verify_multi_pack_index(int verbose)
+{
+	struct multi_pack_index *m;
+	unsigned char sha1[20];
+	git_SHA_CTX ctx;
+	uint32_t i;
+	int errors = 0;
+
+	close_multi_pack_index();
+	prepare_packed_git();
+	prepare_multi_pack_index();
+	m = the_midx;
+	if (!m)
+		return error("no usable multi-pack-index in %s",
+			     multi_pack_index_filename());
+
+	git_SHA1_Init(&ctx);
+	git_SHA1_Update(&ctx, m->data, m->data_len - 20);
+	git_SHA1_Final(sha1, &ctx);
+	if (hashcmp(sha1, m->data + m->data_len - 20))
+		errors += !!error("multi-pack-index checksum mismatch");
+
+	for (i = 0; i < m->num_packs; i++)
+		if (!midx_pack_ok(m, i))
+			errors += !!error("multi-pack-index names %s, "
+					  "which is missing or was rewritten",
+					  m->names[i]);
+
+	for (i = 1; i < m->num_objects; i++)
+		if (hashcmp(m->sha1s + (size_t)(i - 1) * 20,
+			    m->sha1s + (size_t)i * 20) >= 0) {
+			errors += !!error("multi-pack-index is not sorted at %s",
+					  sha1_to_hex(m->sha1s + (size_t)i * 20));
+			break;
+		}
+
+	for (i = 0; i < m->num_objects; i++) {
+		const unsigned char *name = m->sha1s + (size_t)i * 20;
+		uint32_t nr = ntohl(m->records[2 * i]);
+
+		if (nr >= m->num_packs) {
+			errors += !!error("multi-pack-index has a bad pack "
+					  "number for %s", sha1_to_hex(name));
+			continue;
+		}
+		if (m->pack_ok[nr] < 0)
+			continue;
+		if (find_pack_entry_one(name, m->packs[nr]) !=
+		    midx_offset(m, i))
+			errors += !!error("multi-pack-index has a wrong "
+					  "offset for %s", sha1_to_hex(name));
+	}
+
+	if (verbose && !errors)
+		printf("multi-pack-index: %"PRIu32" objects in %"PRIu32
+		       " packs: ok\n", m->num_objects, m->num_packs);
+	return errors;
+}
@@ -0,0 +1,39 @@
+#ifndef MULTI_PACK_INDEX_H
+#define MULTI_PACK_INDEX_H
+
+/*
+ * The multi-pack index ($GIT_OBJECT_DIRECTORY/pack/multi-pack-index)
+ * maps the name of every object in the local packs to the pack and
+ * offset it can be found at, so that a lookup does not need to search
+ * each pack index in turn.
+ * See Documentation/technical/multi-pack-index-format.txt.
+ */
+
+#define MIDX_SIGNATURE 0x4d494458	/* "MIDX" */
+#define MIDX_VERSION 1
+
+#define MIDX_LARGE_OFFSET 0x80000000
+
+struct pack_entry;
+
+/*
+ * Load the multi-pack index and match the packs it names with those
+ * on the packed_git list; done on the first lookup.  Packs added to
+ * the list later are not covered and are searched as usual.
+ */
+extern void prepare_multi_pack_index(void);
+extern void close_multi_pack_index(void);
+
+/*
+ * Look "sha1" up in the multi-pack index.  Returns 1 and fills "e"
+ * when it was found; 0 when it is not in any of the packs the index
+ * covers; -1 when the index cannot tell, and all packs need to be
+ * searched.
+ */
+extern int find_pack_entry_in_midx(const unsigned char *sha1,
+				   struct pack_entry *e);
+
+extern int write_multi_pack_index(int quiet);
+extern int verify_multi_pack_index(int verbose);
+
+#endif
@@ -0,0 +1,203 @@
+#include "cache.h"
+#include "commit.h"
+#include "tag.h"
+#include "refs.h"
+#include "csum-file.h"
+#include "sha1-lookup.h"
+#include "pack-bitmap.h"
+
+#define BITMAP_WALKED	(1u<<21)
+#define BITMAP_TIP	(1u<<22)
+
+/*
+ * Commits closer to the tips are asked about more often, so they get
+ * a bitmap more densely than old history does.
+ */
+#define BITMAP_RECENT_COMMITS 100
+#define BITMAP_RECENT_SPACING 10
+#define BITMAP_OLD_SPACING 100
+
+struct bitmap_writer {
+	struct bitmap_pack_object *objects;
+	uint32_t nr;
+
+	struct commit **tips;
+	int tips_nr, tips_alloc;
+
+	/* compressed bitmap of each selected commit, by pack position */
+	struct ewah_bitmap **stored;
+};
+
+static const unsigned char *pack_object_sha1(size_t pos, void *table)
+{
+	struct bitmap_pack_object *objects = table;
+	return objects[pos].sha1;
+}
+
+static int writer_position(struct bitmap_fill *f, struct object *obj)
+{
+	struct bitmap_writer *w = f->data;
+	int pos = sha1_pos(obj->sha1, w->objects, w->nr, pack_object_sha1);
+	return pos < 0 ? -1 : pos;
+}
+
+static const struct ewah_bitmap *writer_stored(struct bitmap_fill *f, int pos)
+{
+	struct bitmap_writer *w = f->data;
+	return w->stored[pos];
+}
+
+static int add_tip(const char *path, const unsigned char *sha1,
+		   int flags, void *cb_data)
+{
+	struct bitmap_writer *w = cb_data;
+	struct object *obj = deref_tag(parse_object(sha1), NULL, 0);
+
+	if (!obj || obj->type != OBJ_COMMIT)
+		return 0;
+	ALLOC_GROW(w->tips, w->tips_nr + 1, w->tips_alloc);
+	w->tips[w->tips_nr++] = (struct commit *)obj;
+	return 0;
+}
+
+/*
+ * Pick the commits to store bitmaps for: every ref tip, and a sample
+ * of the history below them, newest first.  The result is returned
+ * oldest first, so that each bitmap can reuse those of its ancestors.
+ */
+static struct commit_list *select_commits(struct bitmap_writer *w)
+{
+	struct commit_list *queue = NULL, *selected = NULL;
+	int i, nth = 0;
+
+	for (i = 0; i < w->tips_nr; i++) {
+		struct commit *c = w->tips[i];
+		c->object.flags |= BITMAP_TIP;
+		if (c->object.flags & BITMAP_WALKED)
+			continue;
+		c->object.flags |= BITMAP_WALKED;
+		insert_by_date(c, &queue);
+	}
+	while (queue) {
+		struct commit *c = pop_most_recent_commit(&queue, BITMAP_WALKED);
+		int spacing = nth < BITMAP_RECENT_COMMITS ?
+			BITMAP_RECENT_SPACING : BITMAP_OLD_SPACING;
+
+		if (!(nth++ % spacing) || (c->object.flags & BITMAP_TIP))
+			commit_list_insert(c, &selected);
+		c->object.flags &= ~BITMAP_TIP;
+	}
+	return selected;
+}
+
+static void write_be32(struct sha1file *f, uint32_t v)
+{
+	v = htonl(v);
+	sha1write(f, &v, 4);
+}
+
+static void write_ewah(struct sha1file *f, const struct ewah_bitmap *e)
+{
+	struct strbuf sb = STRBUF_INIT;
+
+	ewah_serialize(e, &sb);
+	sha1write(f, sb.buf, sb.len);
+	strbuf_release(&sb);
+}
+
+static void write_type_bitmap(struct sha1file *f, struct bitmap_writer *w,
+			      enum object_type type)
+{
+	struct bitmap *b = bitmap_new();
+	struct ewah_bitmap *e;
+	uint32_t i;
+
+	for (i = 0; i < w->nr; i++)
+		if (w->objects[i].type == type)
+			bitmap_set(b, i);
+	e = bitmap_to_ewah(b);
+	write_ewah(f, e);
+	ewah_free(e);
+	bitmap_free(b);
+}
+
+int write_pack_bitmap(const char *path, const unsigned char *name_sha1,
+		      struct bitmap_pack_object *objects, uint32_t nr)
+{
+	static struct lock_file lock;
+	struct bitmap_writer w;
+	struct bitmap_fill fill;
+	struct commit_list *selected, *list;
+	struct sha1file *f;
+	uint32_t i, nr_entries = 0;
+	int ret = 0, fd;
+
+	memset(&w, 0, sizeof(w));
+	w.objects = objects;
+	w.nr = nr;
+	w.stored = xcalloc(nr, sizeof(*w.stored));
+
+	head_ref(add_tip, &w);
+	for_each_ref(add_tip, &w);
+	selected = select_commits(&w);
+
+	memset(&fill, 0, sizeof(fill));
+	fill.position = writer_position;
+	fill.stored = writer_stored;
+	fill.data = &w;
+	for (list = selected; list; list = list->next) {
+		struct commit *c = list->item;
+		int pos = writer_position(&fill, &c->object);
+
+		if (pos < 0 || w.stored[pos])
+			continue;
+		fill.bits = bitmap_new();
+		ret = fill_bitmap(&fill, &c->object);
+		if (!ret)
+			w.stored[pos] = bitmap_to_ewah(fill.bits);
+		bitmap_free(fill.bits);
+		if (ret) {
+			warning("not all objects reachable from %s are in the pack; "
+				"not writing a bitmap index",
+				sha1_to_hex(c->object.sha1));
+			goto out;
+		}
+		nr_entries++;
+	}
+
+	fd = hold_lock_file_for_update(&lock, path, LOCK_DIE_ON_ERROR);
+	f = sha1fd(fd, lock.filename);
+
+	write_be32(f, BITMAP_SIGNATURE);
+	write_be32(f, BITMAP_VERSION);
+	write_be32(f, BITMAP_OPT_HASH_CACHE);
+	write_be32(f, nr_entries);
+	sha1write(f, (unsigned char *)name_sha1, 20);
+
+	write_type_bitmap(f, &w, OBJ_COMMIT);
+	write_type_bitmap(f, &w, OBJ_TREE);
+	write_type_bitmap(f, &w, OBJ_BLOB);
+	write_type_bitmap(f, &w, OBJ_TAG);
+
+	for (i = 0; i < nr; i++) {
+		if (!w.stored[i])
+			continue;
+		write_be32(f, i);
+		write_ewah(f, w.stored[i]);
+	}
+	for (i = 0; i < nr; i++)
+		write_be32(f, objects[i].name_hash);
+
+	sha1close(f, NULL, CSUM_FSYNC);
+	lock.fd = -1;
+	if (commit_lock_file(&lock))
+		ret = error("unable to write %s", path);
+
+out:
+	free_commit_list(selected);
+	for (i = 0; i < nr; i++)
+		ewah_free(w.stored[i]);
+	free(w.stored);
+	free(w.tips);
+	return ret;
+}
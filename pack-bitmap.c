@@ -0,0 +1,541 @@
+#include "cache.h"
+#include "commit.h"
+#include "tag.h"
+#include "tree.h"
+#include "blob.h"
+#include "tree-walk.h"
+#include "diff.h"
+#include "revision.h"
+#include "decorate.h"
+#include "pack-revindex.h"
+#include "pack-bitmap.h"
+
+/*
+ * Walking
+ */
+static int fill_position(struct bitmap_fill *f, struct object *obj)
+{
+	int pos;
+
+	if (!obj)
+		return -1;
+	pos = f->position(f, obj);
+	if (pos < 0)
+		return -1;
+	if (bitmap_get(f->bits, pos) || (f->seen && bitmap_get(f->seen, pos)))
+		return -2;
+	return pos;
+}
+
+static int fill_bitmap_tree(struct bitmap_fill *f, struct tree *tree)
+{
+	struct tree_desc desc;
+	struct name_entry entry;
+	int pos = fill_position(f, tree ? &tree->object : NULL);
+	int ret = 0;
+
+	if (pos == -2)
+		return 0;
+	if (pos < 0)
+		return -1;
+	/* a revision walk may have freed the buffer of a parsed tree */
+	if (!tree->buffer)
+		tree->object.parsed = 0;
+	if (parse_tree(tree))
+		return -1;
+	bitmap_set(f->bits, pos);
+
+	init_tree_desc(&desc, tree->buffer, tree->size);
+	while (tree_entry(&desc, &entry)) {
+		if (S_ISGITLINK(entry.mode))
+			continue;
+		if (S_ISDIR(entry.mode)) {
+			if (fill_bitmap_tree(f, lookup_tree(entry.sha1))) {
+				ret = -1;
+				break;
+			}
+			continue;
+		}
+		pos = fill_position(f, (struct object *)lookup_blob(entry.sha1));
+		if (pos == -1) {
+			ret = -1;
+			break;
+		}
+		if (pos >= 0)
+			bitmap_set(f->bits, pos);
+	}
+
+	/* the same tree is visited again for other bitmaps */
+	free(tree->buffer);
+	tree->buffer = NULL;
+	tree->object.parsed = 0;
+	return ret;
+}
+
+static int fill_bitmap_commits(struct bitmap_fill *f, struct commit *root)
+{
+	struct commit_list *todo = NULL, *reached = NULL, *list;
+	int ret = 0;
+
+	commit_list_insert(root, &todo);
+	while (todo) {
+		struct commit *commit = pop_commit(&todo);
+		struct commit_list *parents;
+		const struct ewah_bitmap *stored;
+		int pos = fill_position(f, &commit->object);
+
+		if (pos == -2)
+			continue;
+		if (pos < 0) {
+			ret = -1;
+			break;
+		}
+		stored = f->stored ? f->stored(f, pos) : NULL;
+		if (stored) {
+			bitmap_or_ewah(f->bits, stored);
+			continue;
+		}
+		if (parse_commit(commit)) {
+			ret = -1;
+			break;
+		}
+		bitmap_set(f->bits, pos);
+		commit_list_insert(commit, &reached);
+		for (parents = commit->parents; parents; parents = parents->next)
+			commit_list_insert(parents->item, &todo);
+	}
+	free_commit_list(todo);
+
+	/*
+	 * Trees go last, so that the ones already covered by stored
+	 * bitmaps of ancestors are not walked again.
+	 */
+	for (list = reached; list && !ret; list = list->next)
+		ret = fill_bitmap_tree(f, list->item->tree);
+	free_commit_list(reached);
+	return ret;
+}
+
+int fill_bitmap(struct bitmap_fill *f, struct object *obj)
+{
+	int pos;
+
+	while (obj && obj->type == OBJ_TAG) {
+		pos = fill_position(f, obj);
+		if (pos == -2)
+			return 0;
+		if (pos < 0 || parse_tag((struct tag *)obj))
+			return -1;
+		bitmap_set(f->bits, pos);
+		obj = ((struct tag *)obj)->tagged;
+		if (obj)
+			obj = parse_object(obj->sha1);
+	}
+	if (!obj)
+		return -1;
+
+	switch (obj->type) {
+	case OBJ_COMMIT:
+		return fill_bitmap_commits(f, (struct commit *)obj);
+	case OBJ_TREE:
+		return fill_bitmap_tree(f, (struct tree *)obj);
+	case OBJ_BLOB:
+		pos = fill_position(f, obj);
+		if (pos == -1)
+			return -1;
+		if (pos >= 0)
+			bitmap_set(f->bits, pos);
+		return 0;
+	default:
+		return -1;
+	}
+}
+
+/*
+ * Reading
+ */
+struct stored_bitmap {
+	uint32_t pos;
+	struct ewah_bitmap ewah;
+};
+
+static struct bitmap_index {
+	struct packed_git *pack;
+	unsigned char *map;
+	size_t map_size;
+
+	/* which objects of the pack are of which type */
+	struct bitmap *commits, *trees, *blobs, *tags;
+
+	/* stored bitmaps, sorted by position */
+	struct stored_bitmap *entries;
+	uint32_t entry_count;
+
+	/* name hashes, in index order, or NULL */
+	const unsigned char *hashes;
+
+	/*
+	 * Objects that are not in the pack get positions after the
+	 * last object of the pack.
+	 */
+	struct object **ext;
+	uint32_t ext_nr, ext_alloc;
+	struct decoration ext_index;
+
+	struct bitmap *result;
+	unsigned show_trees:1,
+		 show_blobs:1,
+		 show_tags:1;
+	int loaded;
+} bitmap_git;
+
+static uint32_t get_be32(const unsigned char *p)
+{
+	uint32_t v;
+	memcpy(&v, p, 4);
+	return ntohl(v);
+}
+
+static char *pack_bitmap_filename(struct packed_git *p)
+{
+	size_t len = strlen(p->pack_name);
+	char *name;
+
+	if (len < 5 || strcmp(p->pack_name + len - 5, ".pack"))
+		return NULL;
+	name = xmalloc(len + 3);
+	memcpy(name, p->pack_name, len - 5);
+	strcpy(name + len - 5, ".bitmap");
+	return name;
+}
+
+static void free_bitmap_index(void)
+{
+	uint32_t i;
+
+	for (i = 0; i < bitmap_git.entry_count; i++)
+		free(bitmap_git.entries[i].ewah.buffer);
+	free(bitmap_git.entries);
+	bitmap_free(bitmap_git.commits);
+	bitmap_free(bitmap_git.trees);
+	bitmap_free(bitmap_git.blobs);
+	bitmap_free(bitmap_git.tags);
+	if (bitmap_git.map)
+		munmap(bitmap_git.map, bitmap_git.map_size);
+	memset(&bitmap_git, 0, sizeof(bitmap_git));
+}
+
+static struct bitmap *read_type_bitmap(const unsigned char **map,
+				       const unsigned char *end)
+{
+	struct ewah_bitmap e;
+	struct bitmap *b;
+	ssize_t len = ewah_read(&e, *map, end - *map);
+
+	if (len < 0)
+		return NULL;
+	*map += len;
+	b = ewah_to_bitmap(&e);
+	free(e.buffer);
+	return b;
+}
+
+static int load_bitmap_index(struct packed_git *p, const char *path)
+{
+	const unsigned char *map, *end;
+	uint32_t flags, i;
+	struct stat st;
+	int fd = open(path, O_RDONLY);
+
+	if (fd < 0)
+		return -1;
+	if (fstat(fd, &st) || open_pack_index(p)) {
+		close(fd);
+		return -1;
+	}
+	bitmap_git.map_size = xsize_t(st.st_size);
+	if (bitmap_git.map_size < 16 + 20 + 20) {
+		close(fd);
+		return error("bitmap file %s is too small", path);
+	}
+	bitmap_git.map = xmmap(NULL, bitmap_git.map_size, PROT_READ,
+			       MAP_PRIVATE, fd, 0);
+	close(fd);
+	bitmap_git.pack = p;
+
+	map = bitmap_git.map;
+	end = map + bitmap_git.map_size - 20;
+	if (get_be32(map) != BITMAP_SIGNATURE) {
+		error("bitmap file %s has a bad signature", path);
+		goto bad;
+	}
+	if (get_be32(map + 4) != BITMAP_VERSION) {
+		error("bitmap file %s is version %"PRIu32
+		      " and is not supported by this binary",
+		      path, get_be32(map + 4));
+		goto bad;
+	}
+	flags = get_be32(map + 8);
+	bitmap_git.entry_count = get_be32(map + 12);
+	if (hashcmp(map + 16, p->sha1)) {
+		error("bitmap file %s does not match its pack", path);
+		goto bad;
+	}
+	map += 36;
+
+	if (!(bitmap_git.commits = read_type_bitmap(&map, end)) ||
+	    !(bitmap_git.trees = read_type_bitmap(&map, end)) ||
+	    !(bitmap_git.blobs = read_type_bitmap(&map, end)) ||
+	    !(bitmap_git.tags = read_type_bitmap(&map, end)))
+		goto corrupt;
+
+	if (bitmap_git.entry_count > (end - map) / 12)
+		goto corrupt;
+	bitmap_git.entries = xcalloc(bitmap_git.entry_count,
+				     sizeof(*bitmap_git.entries));
+	for (i = 0; i < bitmap_git.entry_count; i++) {
+		struct stored_bitmap *e = &bitmap_git.entries[i];
+		ssize_t len;
+
+		if (end - map < 4)
+			goto corrupt;
+		e->pos = get_be32(map);
+		if (e->pos >= p->num_objects ||
+		    (i && e->pos <= bitmap_git.entries[i - 1].pos))
+			goto corrupt;
+		len = ewah_read(&e->ewah, map + 4, end - map - 4);
+		if (len < 0)
+			goto corrupt;
+		map += 4 + len;
+	}
+
+	if (flags & BITMAP_OPT_HASH_CACHE) {
+		if ((size_t)(end - map) < (size_t)p->num_objects * 4)
+			goto corrupt;
+		bitmap_git.hashes = map;
+		map += (size_t)p->num_objects * 4;
+	}
+	if (map != end)
+		goto corrupt;
+	return 0;
+
+corrupt:
+	error("corrupt bitmap file %s", path);
+bad:
+	free_bitmap_index();
+	return -1;
+}
+
+static int open_pack_bitmap(void)
+{
+	struct packed_git *p;
+
+	if (bitmap_git.loaded)
+		return bitmap_git.pack ? 0 : -1;
+
+	prepare_packed_git();
+	for (p = packed_git; p; p = p->next) {
+		char *path;
+		int ret;
+
+		if (!p->pack_local)
+			continue;
+		path = pack_bitmap_filename(p);
+		if (!path)
+			continue;
+		if (access(path, F_OK)) {
+			free(path);
+			continue;
+		}
+		ret = load_bitmap_index(p, path);
+		if (!ret)
+			trace_printf("trace: using bitmap index %s\n", path);
+		free(path);
+		if (!ret) {
+			bitmap_git.loaded = 1;
+			return 0;
+		}
+	}
+	bitmap_git.loaded = 1;
+	return -1;
+}
+
+static int bitmap_position(struct bitmap_fill *f, struct object *obj)
+{
+	void *ext = lookup_decoration(&bitmap_git.ext_index, obj);
+	uint32_t pos;
+	int nth;
+
+	if (ext)
+		return bitmap_git.pack->num_objects + (intptr_t)ext - 1;
+	nth = find_pack_entry_pos(obj->sha1, bitmap_git.pack);
+	if (nth >= 0)
+		return nth;
+
+	/* objects we do not know the type of cannot be shown later */
+	if (obj->type == OBJ_NONE)
+		return -1;
+	ALLOC_GROW(bitmap_git.ext, bitmap_git.ext_nr + 1, bitmap_git.ext_alloc);
+	bitmap_git.ext[bitmap_git.ext_nr++] = obj;
+	pos = bitmap_git.ext_nr;
+	add_decoration(&bitmap_git.ext_index, obj, (void *)(intptr_t)pos);
+	return bitmap_git.pack->num_objects + pos - 1;
+}
+
+static const struct ewah_bitmap *stored_bitmap(struct bitmap_fill *f, int pos)
+{
+	uint32_t lo = 0, hi = bitmap_git.entry_count;
+
+	while (lo < hi) {
+		uint32_t mi = lo + (hi - lo) / 2;
+		struct stored_bitmap *e = &bitmap_git.entries[mi];
+		if (e->pos == pos)
+			return &e->ewah;
+		if (e->pos < pos)
+			lo = mi + 1;
+		else
+			hi = mi;
+	}
+	return NULL;
+}
+
+static int can_use_bitmaps(struct rev_info *revs)
+{
+	return !revs->prune_data &&
+		revs->max_count < 0 && revs->skip_count < 0 &&
+		revs->max_age == -1 && revs->min_age == -1 &&
+		!revs->no_merges && !revs->no_walk &&
+		!revs->first_parent_only && !revs->unpacked &&
+		!revs->boundary && !revs->left_right &&
+		!revs->print_parents && !revs->children.name &&
+		!revs->verbose_header && !revs->graph &&
+		!revs->cherry_pick && !revs->reflog_info &&
+		!revs->simplify_by_decoration &&
+		!revs->grep_filter.pattern_list;
+}
+
+int prepare_bitmap_walk(struct rev_info *revs)
+{
+	struct bitmap_fill haves, wants;
+	int i;
+
+	if (!can_use_bitmaps(revs) || open_pack_bitmap())
+		return -1;
+
+	memset(&haves, 0, sizeof(haves));
+	haves.bits = bitmap_new();
+	haves.position = bitmap_position;
+	haves.stored = stored_bitmap;
+	wants = haves;
+	wants.bits = bitmap_new();
+	wants.seen = haves.bits;
+
+	for (i = 0; i < revs->pending.nr; i++) {
+		struct object *obj = revs->pending.objects[i].item;
+		if (obj->flags & UNINTERESTING && fill_bitmap(&haves, obj))
+			goto fail;
+	}
+	for (i = 0; i < revs->pending.nr; i++) {
+		struct object *obj = revs->pending.objects[i].item;
+		if (!(obj->flags & UNINTERESTING) && fill_bitmap(&wants, obj))
+			goto fail;
+	}
+
+	bitmap_and_not(wants.bits, haves.bits);
+	bitmap_free(haves.bits);
+	bitmap_free(bitmap_git.result);
+	bitmap_git.result = wants.bits;
+	bitmap_git.show_trees = revs->tree_objects;
+	bitmap_git.show_blobs = revs->blob_objects;
+	bitmap_git.show_tags = revs->tag_objects;
+	return 0;
+
+fail:
+	bitmap_free(haves.bits);
+	bitmap_free(wants.bits);
+	return -1;
+}
+
+static enum object_type bitmap_object_type(uint32_t pos)
+{
+	if (pos >= bitmap_git.pack->num_objects)
+		return bitmap_git.ext[pos - bitmap_git.pack->num_objects]->type;
+	if (bitmap_get(bitmap_git.commits, pos))
+		return OBJ_COMMIT;
+	if (bitmap_get(bitmap_git.trees, pos))
+		return OBJ_TREE;
+	if (bitmap_get(bitmap_git.blobs, pos))
+		return OBJ_BLOB;
+	if (bitmap_get(bitmap_git.tags, pos))
+		return OBJ_TAG;
+	return OBJ_BAD;
+}
+
+static int want_type(enum object_type type)
+{
+	switch (type) {
+	case OBJ_COMMIT:
+		return 1;
+	case OBJ_TREE:
+		return bitmap_git.show_trees;
+	case OBJ_BLOB:
+		return bitmap_git.show_blobs;
+	case OBJ_TAG:
+		return bitmap_git.show_tags;
+	default:
+		return 0;
+	}
+}
+
+void traverse_bitmap_commit_list(show_reachable_fn show)
+{
+	struct packed_git *p = bitmap_git.pack;
+	uint32_t i;
+
+	if (!bitmap_git.result)
+		die("BUG: traverse_bitmap_commit_list without a bitmap walk");
+
+	/* pack order keeps the output close to what rev-list would give */
+	for (i = 0; i < p->num_objects; i++) {
+		uint32_t pos = pack_pos_to_index(p, i);
+		enum object_type type;
+		uint32_t hash = 0;
+
+		if (!bitmap_get(bitmap_git.result, pos))
+			continue;
+		type = bitmap_object_type(pos);
+		if (!want_type(type))
+			continue;
+		if (bitmap_git.hashes)
+			hash = get_be32(bitmap_git.hashes + (size_t)pos * 4);
+		show(nth_packed_object_sha1(p, pos), type, hash);
+	}
+	for (i = 0; i < bitmap_git.ext_nr; i++) {
+		struct object *obj = bitmap_git.ext[i];
+		if (bitmap_get(bitmap_git.result, p->num_objects + i) &&
+		    want_type(obj->type))
+			show(obj->sha1, obj->type, 0);
+	}
+}
+
+uint32_t count_bitmap_commit_list(void)
+{
+	const struct bitmap *result = bitmap_git.result;
+	uint32_t i, count;
+
+	if (!result)
+		die("BUG: count_bitmap_commit_list without a bitmap walk");
+
+	count = bitmap_popcount_and(result, bitmap_git.commits);
+	if (bitmap_git.show_trees)
+		count += bitmap_popcount_and(result, bitmap_git.trees);
+	if (bitmap_git.show_blobs)
+		count += bitmap_popcount_and(result, bitmap_git.blobs);
+	if (bitmap_git.show_tags)
+		count += bitmap_popcount_and(result, bitmap_git.tags);
+	for (i = 0; i < bitmap_git.ext_nr; i++)
+		if (bitmap_get(result, bitmap_git.pack->num_objects + i) &&
+		    want_type(bitmap_git.ext[i]->type))
+			count++;
+	return count;
+}
@@ -0,0 +1,69 @@
+#ifndef PACK_BITMAP_H
+#define PACK_BITMAP_H
+
+#include "ewah.h"
+
+/*
+ * A pack may come with a "pack-<name>.bitmap" file holding, for a
+ * selection of commits, the set of objects reachable from them.
+ * Bit "i" of each bitmap stands for the i-th object of the pack
+ * index.  See Documentation/technical/bitmap-format.txt.
+ */
+#define BITMAP_SIGNATURE 0x4249544d	/* "BITM" */
+#define BITMAP_VERSION 1
+#define BITMAP_OPT_HASH_CACHE 1
+
+struct rev_info;
+
+/*
+ * Walk state shared by the reader and the writer: the bits reachable
+ * from the objects given to fill_bitmap() are set in "bits".  The
+ * walk does not descend into objects already set in "bits" or in
+ * "seen", and takes the stored bitmap of a commit wholesale when
+ * "stored" knows one.
+ */
+struct bitmap_fill {
+	struct bitmap *bits;
+	const struct bitmap *seen;
+	int (*position)(struct bitmap_fill *, struct object *);
+	const struct ewah_bitmap *(*stored)(struct bitmap_fill *, int pos);
+	void *data;
+};
+
+extern int fill_bitmap(struct bitmap_fill *, struct object *);
+
+/*
+ * Compute the objects reachable from the positive but not from the
+ * negative (UNINTERESTING) pending objects of "revs" using the bitmap
+ * index.  Returns 0 on success, and -1 when the bitmaps cannot answer
+ * the query, in which case the caller should walk the history itself.
+ */
+extern int prepare_bitmap_walk(struct rev_info *revs);
+
+typedef int (*show_reachable_fn)(const unsigned char *sha1,
+				 enum object_type type,
+				 uint32_t name_hash);
+
+/*
+ * Show the objects computed by prepare_bitmap_walk() that the type
+ * options of "revs" asked for, in pack order.
+ */
+extern void traverse_bitmap_commit_list(show_reachable_fn show);
+extern uint32_t count_bitmap_commit_list(void);
+
+struct bitmap_pack_object {
+	const unsigned char *sha1;
+	enum object_type type;
+	uint32_t name_hash;
+};
+
+/*
+ * Write the bitmap index for a pack whose objects, sorted by name,
+ * are given in "objects"; "name_sha1" is the name of the pack.
+ */
+extern int write_pack_bitmap(const char *path,
+			     const unsigned char *name_sha1,
+			     struct bitmap_pack_object *objects,
+			     uint32_t nr);
+
+#endif
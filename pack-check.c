@@ -96,6 +96,15 @@ static int verify_packfile(struct packed_git *p,
 	}
 	qsort(entries, nr_objects, sizeof(*entries), compare_entries);
 
+	/* a .rev file of the pack must list the objects in that order */
+	for (i = 0; i < nr_objects; i++) {
+		if (pack_pos_to_index(p, i) != entries[i].nr) {
+			err = error("%s reverse index does not match its index",
+				    p->pack_name);
+			break;
+		}
+	}
+
 	for (i = 0; i < nr_objects; i++) {
 		void *data;
 		enum object_type type;
@@ -1,4 +1,5 @@
 #include "cache.h"
+#include "pack.h"
 #include "pack-revindex.h"
 
 /*
@@ -14,11 +15,24 @@
  * ordered by offset, so if you know the offset of an object, next offset
  * is where its packed representation ends and the index_nr can be used to
  * get the object sha1 from the main index.
+ *
+ * When the pack comes with a .rev file, which lists the index_nr in
+ * offset order, we map that instead and look offsets up in the pack
+ * index, so that nothing needs to be sorted.
  */
 
+struct revindex_entry {
+	off_t offset;
+	unsigned int nr;
+};
+
 struct pack_revindex {
 	struct packed_git *p;
 	struct revindex_entry *revindex;
+	/* the mmapped .rev file, and the index positions in it */
+	void *rev_data;
+	size_t rev_size;
+	const uint32_t *rev_map;
 };
 
 static struct pack_revindex *pack_revindex;
@@ -111,12 +125,73 @@ static void create_pack_revindex(struct pack_revindex *rix)
 	qsort(rix->revindex, num_ent, sizeof(*rix->revindex), cmp_offset);
 }
 
-struct revindex_entry *find_pack_revindex(struct packed_git *p, off_t ofs)
+/*
+ * Map pack-<name>.rev, if the pack has a usable one.
+ */
+static int load_pack_rev_file(struct pack_revindex *rix)
+{
+	struct packed_git *p = rix->p;
+	char *rev_name;
+	const uint32_t *hdr;
+	void *data;
+	size_t len;
+	struct stat st;
+	int fd;
+
+	if (open_pack_index(p))
+		return -1;
+	rev_name = xstrdup(p->pack_name);
+	strcpy(rev_name + strlen(rev_name) - strlen(".pack"), ".rev");
+	fd = open(rev_name, O_RDONLY);
+	if (fd < 0) {
+		free(rev_name);
+		return -1;
+	}
+	if (fstat(fd, &st)) {
+		close(fd);
+		free(rev_name);
+		return -1;
+	}
+	len = xsize_t(st.st_size);
+	if (len != PACK_REV_HEADER_SIZE + 4 * p->num_objects + 40) {
+		close(fd);
+		error("reverse index file %s has the wrong size", rev_name);
+		free(rev_name);
+		return -1;
+	}
+	data = xmmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	hdr = data;
+	if (ntohl(hdr[0]) != PACK_REV_SIGNATURE ||
+	    ntohl(hdr[1]) != PACK_REV_VERSION) {
+		error("reverse index file %s has an unknown format", rev_name);
+		goto bad;
+	}
+	/* it must have been written for the pack we have */
+	if (hashcmp((unsigned char *)data + len - 40,
+		    (unsigned char *)p->index_data + p->index_size - 40)) {
+		error("reverse index file %s does not match its pack",
+		      rev_name);
+		goto bad;
+	}
+
+	free(rev_name);
+	rix->rev_data = data;
+	rix->rev_size = len;
+	rix->rev_map = hdr + PACK_REV_HEADER_SIZE / 4;
+	return 0;
+
+bad:
+	munmap(data, len);
+	free(rev_name);
+	return -1;
+}
+
+static struct pack_revindex *get_pack_revindex(struct packed_git *p)
 {
 	int num;
-	int lo, hi;
 	struct pack_revindex *rix;
-	struct revindex_entry *revindex;
 
 	if (!pack_revindex_hashsz)
 		init_pack_revindex();
@@ -125,32 +200,73 @@ struct revindex_entry *find_pack_revindex(struct packed_git *p, off_t ofs)
 		die("internal error: pack revindex fubar");
 
 	rix = &pack_revindex[num];
-	if (!rix->revindex)
+	if (!rix->revindex && !rix->rev_map && load_pack_rev_file(rix))
 		create_pack_revindex(rix);
-	revindex = rix->revindex;
+	return rix;
+}
+
+static off_t rix_offset(struct pack_revindex *rix, uint32_t pos)
+{
+	struct packed_git *p = rix->p;
+
+	if (!rix->rev_map)
+		return rix->revindex[pos].offset;
+	/* This knows the pack format, as create_pack_revindex() does */
+	if (pos == p->num_objects)
+		return p->pack_size - 20;
+	return nth_packed_object_offset(p, ntohl(rix->rev_map[pos]));
+}
+
+uint32_t pack_pos_to_index(struct packed_git *p, uint32_t pos)
+{
+	struct pack_revindex *rix = get_pack_revindex(p);
+
+	if (rix->rev_map) {
+		uint32_t nr = ntohl(rix->rev_map[pos]);
+		if (nr >= p->num_objects)
+			die("corrupt reverse index for %s", p->pack_name);
+		return nr;
+	}
+	return rix->revindex[pos].nr;
+}
+
+off_t pack_pos_to_offset(struct packed_git *p, uint32_t pos)
+{
+	return rix_offset(get_pack_revindex(p), pos);
+}
+
+int offset_to_pack_pos(struct packed_git *p, off_t ofs, uint32_t *pos)
+{
+	struct pack_revindex *rix = get_pack_revindex(p);
+	uint32_t lo, hi;
 
 	lo = 0;
 	hi = p->num_objects + 1;
 	do {
-		int mi = (lo + hi) / 2;
-		if (revindex[mi].offset == ofs) {
-			return revindex + mi;
-		} else if (ofs < revindex[mi].offset)
+		uint32_t mi = lo + (hi - lo) / 2;
+		off_t mi_ofs = rix_offset(rix, mi);
+
+		if (mi_ofs == ofs) {
+			*pos = mi;
+			return 0;
+		} else if (ofs < mi_ofs)
 			hi = mi;
 		else
 			lo = mi + 1;
 	} while (lo < hi);
-	error("bad offset for revindex");
-	return NULL;
+	return error("bad offset for revindex");
 }
 
 void discard_revindex(void)
 {
 	if (pack_revindex_hashsz) {
 		int i;
-		for (i = 0; i < pack_revindex_hashsz; i++)
-			if (pack_revindex[i].revindex)
-				free(pack_revindex[i].revindex);
+		for (i = 0; i < pack_revindex_hashsz; i++) {
+			struct pack_revindex *rix = &pack_revindex[i];
+			free(rix->revindex);
+			if (rix->rev_data)
+				munmap(rix->rev_data, rix->rev_size);
+		}
 		free(pack_revindex);
 		pack_revindex_hashsz = 0;
 	}
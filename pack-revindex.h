@@ -1,12 +1,15 @@
 #ifndef PACK_REVINDEX_H
 #define PACK_REVINDEX_H
 
-struct revindex_entry {
-	off_t offset;
-	unsigned int nr;
-};
-
-struct revindex_entry *find_pack_revindex(struct packed_git *p, off_t ofs);
+/*
+ * Objects of a pack are numbered by their position in the pack (in
+ * offset order) from 0 to num_objects - 1; position num_objects
+ * stands for the pack trailer, so the data of the object at position
+ * pos ends at pack_pos_to_offset(p, pos + 1).
+ */
+int offset_to_pack_pos(struct packed_git *p, off_t ofs, uint32_t *pos);
+uint32_t pack_pos_to_index(struct packed_git *p, uint32_t pos);
+off_t pack_pos_to_offset(struct packed_git *p, uint32_t pos);
 void discard_revindex(void);
 
 #endif
@@ -4,6 +4,7 @@
 
 uint32_t pack_idx_default_version = 2;
 uint32_t pack_idx_off32_limit = 0x7fffffff;
+int pack_write_rev_index = 1;
 
 static int sha1_compare(const void *_a, const void *_b)
 {
@@ -142,6 +143,59 @@ char *write_idx_file(char *index_name, struct pack_idx_entry **objects,
 	return index_name;
 }
 
+static struct pack_idx_entry **rev_objects;
+
+static int rev_offset_compare(const void *_a, const void *_b)
+{
+	off_t a = rev_objects[*(uint32_t *)_a]->offset;
+	off_t b = rev_objects[*(uint32_t *)_b]->offset;
+	return a < b ? -1 : a > b;
+}
+
+/*
+ * Write the reverse index of a pack: the index position of every
+ * object, in the order the objects appear in the pack.  The objects
+ * must be sorted by name, as write_idx_file() leaves them, and
+ * pack_sha1 is the checksum of the pack.
+ */
+char *write_rev_file(char *rev_name, struct pack_idx_entry **objects,
+		     uint32_t nr_objects, const unsigned char *pack_sha1)
+{
+	struct sha1file *f;
+	uint32_t *pos, hdr[2], i;
+	int fd;
+
+	if (!rev_name) {
+		static char tmpfile[PATH_MAX];
+		fd = odb_mkstemp(tmpfile, sizeof(tmpfile), "pack/tmp_rev_XXXXXX");
+		rev_name = xstrdup(tmpfile);
+	} else {
+		unlink(rev_name);
+		fd = open(rev_name, O_CREAT|O_EXCL|O_WRONLY, 0600);
+	}
+	if (fd < 0)
+		die("unable to create %s: %s", rev_name, strerror(errno));
+	f = sha1fd(fd, rev_name);
+
+	pos = xmalloc(nr_objects * sizeof(*pos));
+	for (i = 0; i < nr_objects; i++)
+		pos[i] = i;
+	rev_objects = objects;
+	qsort(pos, nr_objects, sizeof(*pos), rev_offset_compare);
+	rev_objects = NULL;
+
+	hdr[0] = htonl(PACK_REV_SIGNATURE);
+	hdr[1] = htonl(PACK_REV_VERSION);
+	sha1write(f, hdr, sizeof(hdr));
+	for (i = 0; i < nr_objects; i++)
+		pos[i] = htonl(pos[i]);
+	sha1write(f, pos, nr_objects * sizeof(*pos));
+	sha1write(f, (unsigned char *)pack_sha1, 20);
+	sha1close(f, NULL, CSUM_FSYNC);
+	free(pos);
+	return rev_name;
+}
+
 /*
  * Update pack header with object_count and compute new SHA1 for pack data
  * associated to pack_fd, and write that SHA1 at the end.  That new SHA1
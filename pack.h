@@ -38,6 +38,17 @@ struct pack_header {
 extern uint32_t pack_idx_default_version;
 extern uint32_t pack_idx_off32_limit;
 
+/*
+ * Reverse index (.rev) of a pack: the index position of every object
+ * in pack offset order.  See Documentation/technical/pack-format.txt.
+ */
+#define PACK_REV_SIGNATURE 0x52494458	/* "RIDX" */
+#define PACK_REV_VERSION 1
+#define PACK_REV_HEADER_SIZE 8
+
+/* pack.writereverseindex */
+extern int pack_write_rev_index;
+
 /*
  * Packed object index header
  */
@@ -56,6 +67,7 @@ struct pack_idx_entry {
 };
 
 extern char *write_idx_file(char *index_name, struct pack_idx_entry **objects, int nr_objects, unsigned char *sha1);
+extern char *write_rev_file(char *rev_name, struct pack_idx_entry **objects, uint32_t nr_objects, const unsigned char *pack_sha1);
 extern int check_pack_crc(struct packed_git *p, struct pack_window **w_curs, off_t offset, off_t len, unsigned int nr);
 extern int verify_pack(struct packed_git *);
 extern void fixup_pack_header_footer(int, unsigned char *, const char *, uint32_t, unsigned char *, off_t);
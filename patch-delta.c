@@ -85,3 +85,215 @@ void *patch_delta(const void *src_buf, unsigned long src_size,
 	*dst_size = out - dst_buf;
 	return dst_buf;
 }
+
+static struct delta_fragment *add_fragment(struct composed_delta *cd,
+					   unsigned long len)
+{
+	struct delta_fragment *f;
+
+	if (cd->nr == cd->alloc) {
+		cd->alloc = cd->alloc ? cd->alloc * 3 / 2 : 64;
+		cd->frag = xrealloc(cd->frag, cd->alloc * sizeof(*cd->frag));
+	}
+	f = cd->frag + cd->nr++;
+	f->off = cd->size;
+	f->len = len;
+	cd->size += len;
+	return f;
+}
+
+static void add_copy(struct composed_delta *cd,
+		     unsigned long src_off, unsigned long len)
+{
+	struct delta_fragment *f = cd->nr ? cd->frag + cd->nr - 1 : NULL;
+
+	if (f && !f->data && f->src_off + f->len == src_off) {
+		f->len += len;
+		cd->size += len;
+		return;
+	}
+	f = add_fragment(cd, len);
+	f->data = NULL;
+	f->src_off = src_off;
+}
+
+static void add_literal(struct composed_delta *cd,
+			const unsigned char *data, unsigned long len)
+{
+	struct delta_fragment *f = cd->nr ? cd->frag + cd->nr - 1 : NULL;
+
+	if (f && f->data && f->data + f->len == data) {
+		f->len += len;
+		cd->size += len;
+		return;
+	}
+	f = add_fragment(cd, len);
+	f->data = data;
+	f->src_off = 0;
+}
+
+int parse_delta(struct composed_delta *cd,
+		const void *delta_buf, unsigned long delta_size)
+{
+	const unsigned char *data, *top;
+	unsigned long size;
+	unsigned char cmd;
+
+	memset(cd, 0, sizeof(*cd));
+	if (delta_size < DELTA_SIZE_MIN)
+		return -1;
+
+	data = delta_buf;
+	top = (const unsigned char *) delta_buf + delta_size;
+	cd->src_size = get_delta_hdr_size(&data, top);
+	size = get_delta_hdr_size(&data, top);
+
+	while (data < top) {
+		cmd = *data++;
+		if (cmd & 0x80) {
+			unsigned long cp_off = 0, cp_size = 0;
+			if (cmd & 0x01) cp_off = *data++;
+			if (cmd & 0x02) cp_off |= (*data++ << 8);
+			if (cmd & 0x04) cp_off |= (*data++ << 16);
+			if (cmd & 0x08) cp_off |= (*data++ << 24);
+			if (cmd & 0x10) cp_size = *data++;
+			if (cmd & 0x20) cp_size |= (*data++ << 8);
+			if (cmd & 0x40) cp_size |= (*data++ << 16);
+			if (cp_size == 0) cp_size = 0x10000;
+			if (cp_off + cp_size < cp_size ||
+			    cp_off + cp_size > cd->src_size ||
+			    cp_size > size - cd->size)
+				break;
+			add_copy(cd, cp_off, cp_size);
+		} else if (cmd) {
+			if (cmd > size - cd->size || cmd > top - data)
+				break;
+			add_literal(cd, data, cmd);
+			data += cmd;
+		} else {
+			error("unexpected delta opcode 0");
+			goto bad;
+		}
+	}
+
+	if (data != top || cd->size != size) {
+		error("delta replay has gone wild");
+		bad:
+		free_composed_delta(cd);
+		return -1;
+	}
+	return 0;
+}
+
+int compose_delta(struct composed_delta *out,
+		  const struct composed_delta *upper,
+		  const struct composed_delta *lower)
+{
+	unsigned int i, lo = 0;
+
+	memset(out, 0, sizeof(*out));
+	if (upper->src_size != lower->size)
+		return error("delta chain does not match up");
+	out->src_size = lower->src_size;
+
+	for (i = 0; i < upper->nr; i++) {
+		const struct delta_fragment *f = upper->frag + i;
+		unsigned long pos = f->src_off, len = f->len;
+
+		if (f->data) {
+			add_literal(out, f->data, len);
+			continue;
+		}
+
+		/*
+		 * Copies mostly go forward through the lower delta, so
+		 * look from where the last one ended before bisecting.
+		 */
+		if (lo >= lower->nr || lower->frag[lo].off > pos ||
+		    lower->frag[lo].off + lower->frag[lo].len <= pos) {
+			unsigned int hi = lower->nr;
+			lo = 0;
+			while (hi - lo > 1) {
+				unsigned int mi = lo + (hi - lo) / 2;
+				if (lower->frag[mi].off <= pos)
+					lo = mi;
+				else
+					hi = mi;
+			}
+		}
+		while (len) {
+			const struct delta_fragment *l = lower->frag + lo;
+			unsigned long skip = pos - l->off;
+			unsigned long n = l->len - skip;
+
+			if (n > len)
+				n = len;
+			if (l->data)
+				add_literal(out, l->data + skip, n);
+			else
+				add_copy(out, l->src_off + skip, n);
+			pos += n;
+			len -= n;
+			if (skip + n == l->len)
+				lo++;
+		}
+	}
+	return 0;
+}
+
+void *apply_composed_delta(const void *src_buf, unsigned long src_size,
+			   const struct composed_delta *cd,
+			   unsigned long *dst_size)
+{
+	unsigned char *dst_buf, *out;
+	unsigned int i;
+
+	if (src_size != cd->src_size)
+		return NULL;
+	dst_buf = xmalloc(cd->size + 1);
+	dst_buf[cd->size] = 0;
+	out = dst_buf;
+	for (i = 0; i < cd->nr; i++) {
+		const struct delta_fragment *f = cd->frag + i;
+		memcpy(out, f->data ? f->data :
+		       (const unsigned char *)src_buf + f->src_off, f->len);
+		out += f->len;
+	}
+	*dst_size = cd->size;
+	return dst_buf;
+}
+
+void free_composed_delta(struct composed_delta *cd)
+{
+	free(cd->frag);
+	memset(cd, 0, sizeof(*cd));
+}
+
+struct composed_delta *dup_composed_delta(const struct composed_delta *cd,
+					  unsigned long *memsize)
+{
+	struct composed_delta *dup;
+	unsigned char *lit;
+	unsigned long size = sizeof(*dup) + cd->nr * sizeof(*cd->frag);
+	unsigned int i;
+
+	for (i = 0; i < cd->nr; i++)
+		if (cd->frag[i].data)
+			size += cd->frag[i].len;
+	dup = xmalloc(size);
+	*dup = *cd;
+	dup->alloc = cd->nr;
+	dup->frag = (struct delta_fragment *)(dup + 1);
+	memcpy(dup->frag, cd->frag, cd->nr * sizeof(*cd->frag));
+	lit = (unsigned char *)(dup->frag + cd->nr);
+	for (i = 0; i < cd->nr; i++) {
+		struct delta_fragment *f = dup->frag + i;
+		if (!f->data)
+			continue;
+		memcpy(lit, f->data, f->len);
+		f->data = lit;
+		lit += f->len;
+	}
+	*memsize = size;
+	return dup;
+}
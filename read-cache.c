@@ -14,6 +14,12 @@
 #include "diffcore.h"
 #include "revision.h"
 #include "blob.h"
+#include "bulk-checkin.h"
+#include "fsmonitor.h"
+#ifdef THREADED_DELTA_SEARCH
+#include "thread-utils.h"
+#include <pthread.h>
+#endif
 
 /* Index extensions.
  *
@@ -26,9 +32,45 @@
 
 #define CACHE_EXT(s) ( (s[0]<<24)|(s[1]<<16)|(s[2]<<8)|(s[3]) )
 #define CACHE_EXT_TREE 0x54524545	/* "TREE" */
+#define CACHE_EXT_LINK 0x6c696e6b	/* "link" */
+#define CACHE_EXT_UNTRACKED 0x554e5452	/* "UNTR" */
+#define CACHE_EXT_FSMONITOR 0x46534d4e	/* "FSMN" */
+#define CACHE_EXT_ENTRY_OFFSETS 0x49454f54	/* "IEOT" */
+#define CACHE_EXT_END_OF_ENTRIES 0x454f4945	/* "EOIE" */
 
 struct index_state the_index;
 
+/*
+ * A split index keeps most of its entries in a shared index file,
+ * $GIT_DIR/sharedindex.<sha1>, that is rarely rewritten.  The index
+ * file proper then holds only the entries added or changed since, and
+ * a "link" extension with the name of the shared index followed by
+ * the positions (4-byte, network byte order, ascending) of the shared
+ * entries that have been removed or replaced.  The extension name is
+ * in lowercase so that a git that does not know about it refuses the
+ * index instead of missing the shared entries.
+ *
+ * The shared index stays mapped while the index is in core, so that
+ * writing it out again only has to compare each entry with its
+ * on-disk form to tell what changed.
+ */
+struct split_index {
+	unsigned char base_sha1[20];
+	void *base_mmap;
+	size_t base_mmap_size;
+	unsigned int base_nr;
+	size_t *base_offset;	/* of each entry in base_mmap */
+	void *base_alloc;	/* the in-core entries read from it */
+	unsigned int *deleted;	/* from the "link" extension, while reading */
+	unsigned int nr_deleted;
+	/* the one we replaced, whose entries we may still be using */
+	struct split_index *previous;
+	int refcount;
+};
+
+/* shared indexes not used for this long are removed */
+#define SHARED_INDEX_EXPIRE (14 * 24 * 3600)
+
 static void set_index_entry(struct index_state *istate, int nr, struct cache_entry *ce)
 {
 	istate->cache[nr] = ce;
@@ -82,6 +124,7 @@ void fill_stat_cache_info(struct cache_entry *ce, struct stat *st)
 
 	if (S_ISREG(st->st_mode))
 		ce_mark_uptodate(ce);
+	mark_fsmonitor_valid(ce);
 }
 
 static int ce_compare_data(struct cache_entry *ce, struct stat *st)
@@ -1013,6 +1056,15 @@ static struct cache_entry *refresh_cache_ent(struct index_state *istate,
 		return ce;
 	}
 
+	/*
+	 * Nor do we need to look at what the file system monitor
+	 * says has not changed since we last did.
+	 */
+	if (!ignore_valid && (ce->ce_flags & CE_FSMONITOR_VALID)) {
+		ce_mark_uptodate(ce);
+		return ce;
+	}
+
 	if (lstat(ce->name, &st) < 0) {
 		if (err)
 			*err = errno;
@@ -1038,6 +1090,7 @@ static struct cache_entry *refresh_cache_ent(struct index_state *istate,
 			 * we are not going to write this change out.
 			 */
 			ce_mark_uptodate(ce);
+			mark_fsmonitor_valid(ce);
 			return ce;
 		}
 	}
@@ -1079,6 +1132,7 @@ int refresh_index(struct index_state *istate, unsigned int flags, const char **p
 
 	needs_update_message = ((flags & REFRESH_SAY_CHANGED)
 				? "locally modified" : "needs update");
+	trace_region_enter("index", "refresh");
 	for (i = 0; i < istate->cache_nr; i++) {
 		struct cache_entry *ce, *new;
 		int cache_errno = 0;
@@ -1124,6 +1178,7 @@ int refresh_index(struct index_state *istate, unsigned int flags, const char **p
 
 		replace_index_entry(istate, i, new);
 	}
+	trace_region_leave("index", "refresh");
 	return has_errors;
 }
 
@@ -1149,6 +1204,49 @@ static int verify_hdr(struct cache_header *hdr, unsigned long size)
 	return 0;
 }
 
+struct split_index *share_split_index(struct split_index *si)
+{
+	if (si)
+		si->refcount++;
+	return si;
+}
+
+void release_split_index(struct split_index *si)
+{
+	if (!si || --si->refcount)
+		return;
+	if (si->base_mmap)
+		munmap(si->base_mmap, si->base_mmap_size);
+	free(si->base_offset);
+	free(si->base_alloc);
+	free(si->deleted);
+	release_split_index(si->previous);
+	free(si);
+}
+
+static int read_link_extension(struct index_state *istate,
+			       const unsigned char *data, unsigned long sz)
+{
+	struct split_index *si;
+	unsigned int i;
+
+	if (sz < 20 || (sz - 20) % 4)
+		return error("corrupt link extension (length %lu)", sz);
+	si = xcalloc(1, sizeof(*si));
+	si->refcount = 1;
+	hashcpy(si->base_sha1, data);
+	si->nr_deleted = (sz - 20) / 4;
+	si->deleted = xmalloc(si->nr_deleted * sizeof(*si->deleted));
+	for (i = 0; i < si->nr_deleted; i++) {
+		uint32_t pos;
+		memcpy(&pos, data + 20 + i * 4, 4);
+		si->deleted[i] = ntohl(pos);
+	}
+	release_split_index(istate->split_index);
+	istate->split_index = si;
+	return 0;
+}
+
 static int read_index_extension(struct index_state *istate,
 				const char *ext, void *data, unsigned long sz)
 {
@@ -1156,6 +1254,17 @@ static int read_index_extension(struct index_state *istate,
 	case CACHE_EXT_TREE:
 		istate->cache_tree = cache_tree_read(data, sz);
 		break;
+	case CACHE_EXT_LINK:
+		return read_link_extension(istate, data, sz);
+	case CACHE_EXT_UNTRACKED:
+		istate->untracked = read_untracked_extension(data, sz);
+		break;
+	case CACHE_EXT_FSMONITOR:
+		return read_fsmonitor_extension(istate, data, sz);
+	case CACHE_EXT_ENTRY_OFFSETS:
+	case CACHE_EXT_END_OF_ENTRIES:
+		/* used before the entries were read */
+		break;
 	default:
 		if (*ext < 'A' || 'Z' < *ext)
 			return error("index uses %.4s extension, which we do not understand",
@@ -1216,6 +1325,30 @@ static void convert_from_disk(struct ondisk_cache_entry *ondisk, struct cache_en
 	memcpy(ce->name, name, len + 1);
 }
 
+static size_t ondisk_entry_size(const struct ondisk_cache_entry *ondisk)
+{
+	unsigned int flags = ntohs(ondisk->flags);
+	size_t len = flags & CE_NAMEMASK;
+	const char *name;
+
+	if (flags & CE_EXTENDED)
+		name = ((const struct ondisk_cache_entry_extended *)ondisk)->name;
+	else
+		name = ondisk->name;
+	if (len == CE_NAMEMASK)
+		len = strlen(name);
+	return (flags & CE_EXTENDED) ?
+		ondisk_cache_entry_extended_size(len) :
+		ondisk_cache_entry_size(len);
+}
+
+static const char *ondisk_entry_name(const struct ondisk_cache_entry *ondisk)
+{
+	if (ntohs(ondisk->flags) & CE_EXTENDED)
+		return ((const struct ondisk_cache_entry_extended *)ondisk)->name;
+	return ondisk->name;
+}
+
 static inline size_t estimate_cache_size(size_t ondisk_size, unsigned int entries)
 {
 	long per_entry;
@@ -1230,12 +1363,470 @@ static inline size_t estimate_cache_size(size_t ondisk_size, unsigned int entrie
 	return ondisk_size + entries*per_entry;
 }
 
+static const char *shared_index_path(const unsigned char *sha1)
+{
+	return git_path("sharedindex.%s", sha1_to_hex(sha1));
+}
+
+/*
+ * A shared index is removed when it has not been used for a while,
+ * so touch it whenever an index that refers to it is read or written.
+ * Once a day is often enough.
+ */
+static void freshen_shared_index(const unsigned char *sha1)
+{
+	const char *path = shared_index_path(sha1);
+	struct stat st;
+
+	if (!stat(path, &st) && st.st_mtime < time(NULL) - 24 * 3600)
+		utime(path, NULL);
+}
+
+/*
+ * Map the shared index named by si->base_sha1 and find where each of
+ * its entries starts.  The checksum is only verified when "verify" is
+ * set; there is no point when we have just written the file.
+ */
+static int map_shared_index(struct split_index *si, int verify)
+{
+	const char *path = shared_index_path(si->base_sha1);
+	struct cache_header *hdr;
+	struct stat st;
+	size_t size, offset;
+	unsigned int i;
+	void *map;
+	int fd;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return error("cannot open shared index %s: %s",
+			     path, strerror(errno));
+	if (fstat(fd, &st)) {
+		close(fd);
+		return error("cannot stat shared index %s: %s",
+			     path, strerror(errno));
+	}
+	size = xsize_t(st.st_size);
+	if (size < sizeof(struct cache_header) + 20) {
+		close(fd);
+		return error("shared index %s is too small", path);
+	}
+	map = xmmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	hdr = map;
+	if (verify && verify_hdr(hdr, size) < 0)
+		goto corrupt;
+	if (hashcmp((unsigned char *)map + size - 20, si->base_sha1))
+		goto corrupt;
+
+	si->base_nr = ntohl(hdr->hdr_entries);
+	si->base_offset = xmalloc(si->base_nr * sizeof(*si->base_offset));
+	offset = sizeof(*hdr);
+	for (i = 0; i < si->base_nr; i++) {
+		if (offset + ondisk_cache_entry_size(0) > size - 20)
+			goto corrupt;
+		si->base_offset[i] = offset;
+		offset += ondisk_entry_size((struct ondisk_cache_entry *)
+					    ((char *)map + offset));
+	}
+	if (offset > size - 20)
+		goto corrupt;
+	si->base_mmap = map;
+	si->base_mmap_size = size;
+	return 0;
+
+corrupt:
+	free(si->base_offset);
+	si->base_offset = NULL;
+	munmap(map, size);
+	return error("shared index %s is corrupt", path);
+}
+
+/*
+ * The entries of the index file proper have been read; merge in
+ * those of the shared index that the "link" extension keeps.
+ */
+static void merge_shared_index(struct index_state *istate)
+{
+	struct split_index *si = istate->split_index;
+	struct cache_entry **cache;
+	unsigned int i, j, k, d, nr;
+	size_t dst_offset = 0;
+
+	if (map_shared_index(si, 1))
+		die("index file corrupt");
+	freshen_shared_index(si->base_sha1);
+	for (d = 0; d < si->nr_deleted; d++)
+		if (si->deleted[d] >= si->base_nr ||
+		    (d && si->deleted[d] <= si->deleted[d - 1]))
+			die("index file corrupt");
+
+	nr = istate->cache_nr + si->base_nr - si->nr_deleted;
+	istate->cache_alloc = alloc_nr(nr);
+	cache = xcalloc(istate->cache_alloc, sizeof(*cache));
+	si->base_alloc = xmalloc(estimate_cache_size(si->base_mmap_size,
+						     si->base_nr));
+	for (i = j = k = d = 0; i < si->base_nr; i++) {
+		struct cache_entry *ce;
+
+		if (d < si->nr_deleted && si->deleted[d] == i) {
+			d++;
+			continue;
+		}
+		ce = (struct cache_entry *)((char *)si->base_alloc + dst_offset);
+		convert_from_disk((struct ondisk_cache_entry *)
+				  ((char *)si->base_mmap + si->base_offset[i]),
+				  ce);
+		dst_offset += ce_size(ce);
+		while (j < istate->cache_nr &&
+		       cache_name_compare(istate->cache[j]->name,
+					  istate->cache[j]->ce_flags,
+					  ce->name, ce->ce_flags) < 0)
+			cache[k++] = istate->cache[j++];
+		cache[k++] = ce;
+		add_name_hash(istate, ce);
+	}
+	while (j < istate->cache_nr)
+		cache[k++] = istate->cache[j++];
+
+	free(istate->cache);
+	istate->cache = cache;
+	istate->cache_nr = k;
+	free(si->deleted);
+	si->deleted = NULL;
+	si->nr_deleted = 0;
+}
+
+/*
+ * Convert "nr" entries starting with the one at "src_offset" of
+ * "mmap" into istate->cache[first...] at "dst", and return where the
+ * next entry starts.
+ */
+static unsigned long load_cache_entry_block(struct index_state *istate,
+					    char *dst, const char *mmap,
+					    unsigned long src_offset,
+					    int first, int nr)
+{
+	int i;
+
+	for (i = first; i < first + nr; i++) {
+		struct cache_entry *ce = (struct cache_entry *)dst;
+
+		convert_from_disk((struct ondisk_cache_entry *)
+				  (mmap + src_offset), ce);
+		set_index_entry(istate, i, ce);
+		src_offset += ondisk_ce_size(ce);
+		dst += ce_size(ce);
+	}
+	return src_offset;
+}
+
+static int read_index_extensions(struct index_state *istate,
+				 char *mmap, size_t mmap_size,
+				 unsigned long src_offset)
+{
+	while (src_offset <= mmap_size - 20 - 8) {
+		/* After an array of active_nr index entries,
+		 * there can be arbitrary number of extended
+		 * sections, each of which is prefixed with
+		 * extension name (4-byte) and section length
+		 * in 4-byte network byte order.
+		 */
+		uint32_t extsize;
+		memcpy(&extsize, mmap + src_offset + 4, 4);
+		extsize = ntohl(extsize);
+		if (read_index_extension(istate, mmap + src_offset,
+					 mmap + src_offset + 8, extsize) < 0)
+			return -1;
+		src_offset += 8;
+		src_offset += extsize;
+	}
+	return 0;
+}
+
+/*
+ * A large index records where its entries end in the "EOIE"
+ * extension, which is always the last one: the offset (4-byte)
+ * followed by the SHA-1 of the names and sizes of the extensions
+ * before it.  With that, the "IEOT" extension can be found before
+ * the entries are read; it consists of its version (4-byte, 1),
+ * then for each block of entries the offset of its first entry and
+ * the number of entries in it (4-byte each).  All numbers are in
+ * network byte order.  The blocks can be converted independently.
+ */
+#define EOIE_SIZE (4 + 20)
+#define EOIE_SIZE_WITH_HEADER (4 + 4 + EOIE_SIZE)
+#define IEOT_VERSION 1
+
+/* do not bother with threads for fewer entries than this each */
+#define THREAD_COST (10000)
+
+struct index_entry_offset {
+	unsigned int offset, nr;
+};
+
+struct index_entry_offset_table {
+	int nr;
+	struct index_entry_offset entries[FLEX_ARRAY];
+};
+
+static void write_ieot_extension(struct strbuf *sb,
+				 struct index_entry_offset_table *ieot)
+{
+	uint32_t val;
+	int i;
+
+	val = htonl(IEOT_VERSION);
+	strbuf_add(sb, &val, 4);
+	for (i = 0; i < ieot->nr; i++) {
+		val = htonl(ieot->entries[i].offset);
+		strbuf_add(sb, &val, 4);
+		val = htonl(ieot->entries[i].nr);
+		strbuf_add(sb, &val, 4);
+	}
+}
+
+/*
+ * How many blocks to record the entries of a new index in; a build
+ * that cannot read them in threads writes no offsets at all.
+ */
+static int index_entry_blocks(int entries)
+{
+#ifdef THREADED_DELTA_SEARCH
+	int nr = index_threads;
+
+	if (nr == 1)
+		return 1;
+	if (!nr) {
+		nr = online_cpus();
+		if (nr > entries / THREAD_COST)
+			nr = entries / THREAD_COST;
+	}
+	if (nr > entries)
+		nr = entries;
+	return nr < 1 ? 1 : nr;
+#else
+	return 1;
+#endif
+}
+
+#ifdef THREADED_DELTA_SEARCH
+/* Return where the extensions start, or 0 if the index does not say */
+static unsigned long read_eoie_extension(const char *mmap, size_t mmap_size)
+{
+	const char *eoie;
+	unsigned long offset, src_offset, eoie_offset;
+	unsigned char sha1[20];
+	uint32_t val;
+	git_SHA_CTX c;
+
+	if (mmap_size < sizeof(struct cache_header) + EOIE_SIZE_WITH_HEADER + 20)
+		return 0;
+	eoie_offset = mmap_size - 20 - EOIE_SIZE_WITH_HEADER;
+	eoie = mmap + eoie_offset;
+	if (CACHE_EXT(eoie) != CACHE_EXT_END_OF_ENTRIES)
+		return 0;
+	memcpy(&val, eoie + 4, 4);
+	if (ntohl(val) != EOIE_SIZE)
+		return 0;
+	memcpy(&val, eoie + 8, 4);
+	offset = ntohl(val);
+	if (offset < sizeof(struct cache_header) || offset > eoie_offset)
+		return 0;
+
+	git_SHA1_Init(&c);
+	src_offset = offset;
+	while (src_offset + 8 <= eoie_offset) {
+		memcpy(&val, mmap + src_offset + 4, 4);
+		if (ntohl(val) > eoie_offset - src_offset - 8)
+			return 0;
+		git_SHA1_Update(&c, mmap + src_offset, 8);
+		src_offset += 8 + ntohl(val);
+	}
+	git_SHA1_Final(sha1, &c);
+	if (src_offset != eoie_offset || hashcmp(sha1, (const unsigned char *)eoie + 12))
+		return 0;
+	return offset;
+}
+
+static struct index_entry_offset_table *read_ieot_extension(const char *mmap,
+		size_t mmap_size, unsigned long ext_offset, unsigned int entries)
+{
+	struct index_entry_offset_table *ieot;
+	unsigned long src_offset = ext_offset, extsize = 0;
+	unsigned int i, nr, total = 0, next;
+	const char *p = NULL;
+	uint32_t val;
+
+	while (src_offset + 8 <= mmap_size - 20) {
+		memcpy(&val, mmap + src_offset + 4, 4);
+		extsize = ntohl(val);
+		if (CACHE_EXT((mmap + src_offset)) == CACHE_EXT_ENTRY_OFFSETS) {
+			p = mmap + src_offset + 8;
+			break;
+		}
+		src_offset += 8 + extsize;
+	}
+	if (!p || extsize < 4 || (extsize - 4) % 8)
+		return NULL;
+	memcpy(&val, p, 4);
+	if (ntohl(val) != IEOT_VERSION)
+		return NULL;
+	nr = (extsize - 4) / 8;
+	p += 4;
+
+	ieot = xmalloc(sizeof(*ieot) + nr * sizeof(struct index_entry_offset));
+	ieot->nr = nr;
+	next = sizeof(struct cache_header);
+	for (i = 0; i < nr; i++) {
+		memcpy(&val, p + 8 * i, 4);
+		ieot->entries[i].offset = ntohl(val);
+		memcpy(&val, p + 8 * i + 4, 4);
+		ieot->entries[i].nr = ntohl(val);
+		if (ieot->entries[i].offset < next ||
+		    ieot->entries[i].offset >= ext_offset ||
+		    !ieot->entries[i].nr ||
+		    entries - total < ieot->entries[i].nr)
+			goto bad;
+		if (!i && ieot->entries[i].offset != next)
+			goto bad;
+		next = ieot->entries[i].offset + 1;
+		total += ieot->entries[i].nr;
+	}
+	if (total == entries)
+		return ieot;
+bad:
+	free(ieot);
+	return NULL;
+}
+
+struct load_block {
+	unsigned long src_offset, end_offset, dst_offset;
+	int first, nr;
+};
+
+struct load_entries_thread {
+	pthread_t pthread;
+	struct index_state *istate;
+	char *mmap;
+	size_t mmap_size;
+	unsigned long ext_offset;
+	struct load_block *block;
+	int nr, bad;
+};
+
+static void *load_entries_thread(void *_data)
+{
+	struct load_entries_thread *p = _data;
+	int i;
+
+	for (i = 0; i < p->nr; i++) {
+		struct load_block *b = p->block + i;
+
+		if (load_cache_entry_block(p->istate,
+					   (char *)p->istate->alloc + b->dst_offset,
+					   p->mmap, b->src_offset,
+					   b->first, b->nr) != b->end_offset)
+			p->bad = 1;
+	}
+	return NULL;
+}
+
+static void *load_extensions_thread(void *_data)
+{
+	struct load_entries_thread *p = _data;
+
+	if (read_index_extensions(p->istate, p->mmap, p->mmap_size,
+				  p->ext_offset) < 0)
+		p->bad = 1;
+	return NULL;
+}
+
+/*
+ * If the index records where its blocks of entries start, convert
+ * them in several threads while another one reads the extensions,
+ * and return 1; return 0 if it does not, or -1 if it is corrupt.
+ */
+static int load_index_threaded(struct index_state *istate,
+			       char *mmap, size_t mmap_size)
+{
+	struct index_entry_offset_table *ieot;
+	struct load_entries_thread *data;
+	struct load_block *block;
+	unsigned long dst_offset = 0, ext_offset;
+	int i, first = 0, bad = 0, nr_threads;
+
+	ext_offset = read_eoie_extension(mmap, mmap_size);
+	if (!ext_offset)
+		return 0;
+	ieot = read_ieot_extension(mmap, mmap_size, ext_offset,
+				   istate->cache_nr);
+	if (!ieot)
+		return 0;
+	nr_threads = index_threads ? index_threads : online_cpus();
+	if (nr_threads > ieot->nr)
+		nr_threads = ieot->nr;
+	if (nr_threads < 2) {
+		free(ieot);
+		return 0;
+	}
+
+	block = xcalloc(ieot->nr, sizeof(*block));
+	for (i = 0; i < ieot->nr; i++) {
+		unsigned long end = i + 1 < ieot->nr ?
+			ieot->entries[i + 1].offset : ext_offset;
+
+		block[i].src_offset = ieot->entries[i].offset;
+		block[i].end_offset = end;
+		block[i].dst_offset = dst_offset;
+		block[i].first = first;
+		block[i].nr = ieot->entries[i].nr;
+		first += block[i].nr;
+		dst_offset += estimate_cache_size(end - block[i].src_offset,
+						  block[i].nr);
+		dst_offset = (dst_offset + 7) & ~7UL;
+	}
+	istate->alloc = xmalloc(dst_offset);
+
+	data = xcalloc(nr_threads + 1, sizeof(*data));
+	for (i = 0; i <= nr_threads; i++) {
+		struct load_entries_thread *p = data + i;
+		void *(*fn)(void *) = load_extensions_thread;
+
+		p->istate = istate;
+		p->mmap = mmap;
+		p->mmap_size = mmap_size;
+		p->ext_offset = ext_offset;
+		if (i < nr_threads) {
+			int from = ieot->nr * i / nr_threads;
+
+			p->block = block + from;
+			p->nr = ieot->nr * (i + 1) / nr_threads - from;
+			fn = load_entries_thread;
+		}
+		if (pthread_create(&p->pthread, NULL, fn, p))
+			die("unable to create threaded index loader");
+	}
+	for (i = 0; i <= nr_threads; i++) {
+		if (pthread_join(data[i].pthread, NULL))
+			die("unable to join threaded index loader");
+		bad |= data[i].bad;
+	}
+	free(data);
+	free(block);
+	free(ieot);
+	trace_counter("index", "threads", nr_threads);
+	return bad ? -1 : 1;
+}
+#endif
+
 /* remember to discard_cache() before reading a different cache! */
 int read_index_from(struct index_state *istate, const char *path)
 {
-	int fd, i;
+	int fd, loaded = 0;
 	struct stat st;
-	unsigned long src_offset, dst_offset;
+	unsigned long src_offset;
 	struct cache_header *hdr;
 	void *mmap;
 	size_t mmap_size;
@@ -1257,6 +1848,7 @@ int read_index_from(struct index_state *istate, const char *path)
 	if (fstat(fd, &st))
 		die("cannot stat the open index (%s)", strerror(errno));
 
+	trace_region_enter("index", "read");
 	errno = EINVAL;
 	mmap_size = xsize_t(st.st_size);
 	if (mmap_size < sizeof(struct cache_header) + 20)
@@ -1275,51 +1867,39 @@ int read_index_from(struct index_state *istate, const char *path)
 	istate->cache_alloc = alloc_nr(istate->cache_nr);
 	istate->cache = xcalloc(istate->cache_alloc, sizeof(struct cache_entry *));
 
-	/*
-	 * The disk format is actually larger than the in-memory format,
-	 * due to space for nsec etc, so even though the in-memory one
-	 * has room for a few  more flags, we can allocate using the same
-	 * index size
-	 */
-	istate->alloc = xmalloc(estimate_cache_size(mmap_size, istate->cache_nr));
 	istate->initialized = 1;
-
-	src_offset = sizeof(*hdr);
-	dst_offset = 0;
-	for (i = 0; i < istate->cache_nr; i++) {
-		struct ondisk_cache_entry *disk_ce;
-		struct cache_entry *ce;
-
-		disk_ce = (struct ondisk_cache_entry *)((char *)mmap + src_offset);
-		ce = (struct cache_entry *)((char *)istate->alloc + dst_offset);
-		convert_from_disk(disk_ce, ce);
-		set_index_entry(istate, i, ce);
-
-		src_offset += ondisk_ce_size(ce);
-		dst_offset += ce_size(ce);
-	}
 	istate->timestamp.sec = st.st_mtime;
 	istate->timestamp.nsec = ST_MTIME_NSEC(st);
 
-	while (src_offset <= mmap_size - 20 - 8) {
-		/* After an array of active_nr index entries,
-		 * there can be arbitrary number of extended
-		 * sections, each of which is prefixed with
-		 * extension name (4-byte) and section length
-		 * in 4-byte network byte order.
+#ifdef THREADED_DELTA_SEARCH
+	if (index_threads != 1)
+		loaded = load_index_threaded(istate, mmap, mmap_size);
+#endif
+	if (loaded < 0)
+		goto unmap;
+	if (!loaded) {
+		/*
+		 * The disk format is actually larger than the in-memory
+		 * format, due to space for nsec etc, so even though the
+		 * in-memory one has room for a few  more flags, we can
+		 * allocate using the same index size
 		 */
-		unsigned long extsize;
-		memcpy(&extsize, (char *)mmap + src_offset + 4, 4);
-		extsize = ntohl(extsize);
-		if (read_index_extension(istate,
-					 (const char *) mmap + src_offset,
-					 (char *) mmap + src_offset + 8,
-					 extsize) < 0)
+		istate->alloc = xmalloc(estimate_cache_size(mmap_size,
+							    istate->cache_nr));
+		src_offset = load_cache_entry_block(istate, istate->alloc, mmap,
+						    sizeof(*hdr), 0,
+						    istate->cache_nr);
+		if (read_index_extensions(istate, mmap, mmap_size,
+					  src_offset) < 0)
 			goto unmap;
-		src_offset += 8;
-		src_offset += extsize;
 	}
 	munmap(mmap, mmap_size);
+	if (istate->split_index)
+		merge_shared_index(istate);
+	if (core_fsmonitor && !is_bare_repository())
+		refresh_fsmonitor(istate);
+	trace_counter("index", "entries", istate->cache_nr);
+	trace_region_leave("index", "read");
 	return istate->cache_nr;
 
 unmap:
@@ -1344,6 +1924,13 @@ int discard_index(struct index_state *istate)
 	cache_tree_free(&(istate->cache_tree));
 	free(istate->alloc);
 	istate->alloc = NULL;
+	release_split_index(istate->split_index);
+	istate->split_index = NULL;
+	remove_untracked_cache(istate);
+	istate->fsmonitor_last_update = 0;
+	free(istate->fsmonitor_dirty);
+	istate->fsmonitor_dirty = NULL;
+	istate->fsmonitor_dirty_nr = 0;
 	istate->initialized = 0;
 
 	/* no need to throw away allocated active_cache */
@@ -1398,16 +1985,22 @@ static int ce_write(git_SHA_CTX *context, int fd, void *data, unsigned int len)
 	return 0;
 }
 
-static int write_index_ext_header(git_SHA_CTX *context, int fd,
+/* The headers are also hashed into "eoie_context", if given, for "EOIE" */
+static int write_index_ext_header(git_SHA_CTX *context,
+				  git_SHA_CTX *eoie_context, int fd,
 				  unsigned int ext, unsigned int sz)
 {
 	ext = htonl(ext);
 	sz = htonl(sz);
+	if (eoie_context) {
+		git_SHA1_Update(eoie_context, &ext, 4);
+		git_SHA1_Update(eoie_context, &sz, 4);
+	}
 	return ((ce_write(context, fd, &ext, 4) < 0) ||
 		(ce_write(context, fd, &sz, 4) < 0)) ? -1 : 0;
 }
 
-static int ce_flush(git_SHA_CTX *context, int fd)
+static int ce_flush(git_SHA_CTX *context, int fd, unsigned char *sha1)
 {
 	unsigned int left = write_buffer_len;
 
@@ -1425,6 +2018,8 @@ static int ce_flush(git_SHA_CTX *context, int fd)
 
 	/* Append the SHA1 signature at the end */
 	git_SHA1_Final(write_buffer + left, context);
+	if (sha1)
+		hashcpy(sha1, write_buffer + left);
 	left += 20;
 	return (write_in_full(fd, write_buffer, left) != left) ? -1 : 0;
 }
@@ -1478,12 +2073,22 @@ static void ce_smudge_racily_clean_entry(struct cache_entry *ce)
 	}
 }
 
-static int ce_write_entry(git_SHA_CTX *c, int fd, struct cache_entry *ce)
+/*
+ * Fill in the on-disk form of "ce" in a buffer that is reused from
+ * one call to the next, and return it with its size in *sizep.
+ */
+static struct ondisk_cache_entry *ce_to_ondisk(struct cache_entry *ce,
+					       int *sizep)
 {
+	static char *buf;
+	static size_t alloc;
 	int size = ondisk_ce_size(ce);
-	struct ondisk_cache_entry *ondisk = xcalloc(1, size);
+	struct ondisk_cache_entry *ondisk;
 	char *name;
 
+	ALLOC_GROW(buf, size, alloc);
+	memset(buf, 0, size);
+	ondisk = (struct ondisk_cache_entry *)buf;
 	ondisk->ctime.sec = htonl(ce->ce_ctime.sec);
 	ondisk->mtime.sec = htonl(ce->ce_mtime.sec);
 	ondisk->ctime.nsec = htonl(ce->ce_ctime.nsec);
@@ -1506,62 +2111,429 @@ static int ce_write_entry(git_SHA_CTX *c, int fd, struct cache_entry *ce)
 		name = ondisk->name;
 	memcpy(name, ce->name, ce_namelen(ce));
 
-	return ce_write(c, fd, ondisk, size);
+	*sizep = size;
+	return ondisk;
 }
 
-int write_index(struct index_state *istate, int newfd)
+static int ce_write_entry(git_SHA_CTX *c, int fd, struct cache_entry *ce)
 {
-	git_SHA_CTX c;
-	struct cache_header hdr;
-	int i, err, removed, extended;
-	struct cache_entry **cache = istate->cache;
-	int entries = istate->cache_nr;
-	struct stat st;
+	int size;
+	struct ondisk_cache_entry *ondisk = ce_to_ondisk(ce, &size);
 
-	for (i = removed = extended = 0; i < entries; i++) {
-		if (cache[i]->ce_flags & CE_REMOVE)
-			removed++;
+	return ce_write(c, fd, ondisk, size);
+}
 
-		/* reduce extended entries if possible */
-		cache[i]->ce_flags &= ~CE_EXTENDED;
-		if (cache[i]->ce_flags & CE_EXTENDED_FLAGS) {
-			extended++;
-			cache[i]->ce_flags |= CE_EXTENDED;
-		}
-	}
+/*
+ * Write "entries" entries out of the "nr" in "cache" (those without
+ * CE_REMOVE), followed by the "link" extension if we are given one and
+ * the other extensions of "istate" if it is not NULL, and return the
+ * checksum of the file in "sha1" if it is not NULL.
+ */
+static int write_index_file(int newfd, struct cache_entry **cache, int nr,
+			    int entries, int extended,
+			    struct index_state *istate,
+			    struct strbuf *link, unsigned char *sha1)
+{
+	git_SHA_CTX c, eoie_c;
+	struct cache_header hdr;
+	struct index_entry_offset_table *ieot = NULL;
+	unsigned long offset = sizeof(hdr);
+	int i, k, err, per_block = 0;
 
 	hdr.hdr_signature = htonl(CACHE_SIGNATURE);
 	/* for extended format, increase version so older git won't try to read it */
 	hdr.hdr_version = htonl(extended ? 3 : 2);
-	hdr.hdr_entries = htonl(entries - removed);
+	hdr.hdr_entries = htonl(entries);
 
 	git_SHA1_Init(&c);
+	git_SHA1_Init(&eoie_c);
 	if (ce_write(&c, newfd, &hdr, sizeof(hdr)) < 0)
 		return -1;
 
-	for (i = 0; i < entries; i++) {
+	/* the shared index of a split one is not read by read_index_from() */
+	if (istate) {
+		int blocks = index_entry_blocks(entries);
+
+		if (blocks > 1) {
+			per_block = (entries + blocks - 1) / blocks;
+			ieot = xcalloc(1, sizeof(*ieot) +
+				       blocks * sizeof(struct index_entry_offset));
+		}
+	}
+
+	for (i = k = 0; i < nr; i++) {
 		struct cache_entry *ce = cache[i];
 		if (ce->ce_flags & CE_REMOVE)
 			continue;
-		if (!ce_uptodate(ce) && is_racy_timestamp(istate, ce))
-			ce_smudge_racily_clean_entry(ce);
-		if (ce_write_entry(&c, newfd, ce) < 0)
+		if (ieot) {
+			if (!(k++ % per_block))
+				ieot->entries[ieot->nr++].offset = offset;
+			ieot->entries[ieot->nr - 1].nr++;
+			offset += ondisk_ce_size(ce);
+		}
+		if (ce_write_entry(&c, newfd, ce) < 0) {
+			free(ieot);
 			return -1;
+		}
 	}
 
 	/* Write extension data here */
-	if (istate->cache_tree) {
+	if (link) {
+		if (write_index_ext_header(&c, &eoie_c, newfd, CACHE_EXT_LINK,
+					   link->len) < 0 ||
+		    ce_write(&c, newfd, link->buf, link->len) < 0)
+			return -1;
+	}
+	if (istate && istate->cache_tree) {
 		struct strbuf sb = STRBUF_INIT;
 
 		cache_tree_write(&sb, istate->cache_tree);
-		err = write_index_ext_header(&c, newfd, CACHE_EXT_TREE, sb.len) < 0
+		err = write_index_ext_header(&c, &eoie_c, newfd, CACHE_EXT_TREE, sb.len) < 0
+			|| ce_write(&c, newfd, sb.buf, sb.len) < 0;
+		strbuf_release(&sb);
+		if (err)
+			return -1;
+	}
+	if (istate && istate->untracked && core_untracked_cache) {
+		struct strbuf sb = STRBUF_INIT;
+
+		write_untracked_extension(&sb, istate->untracked);
+		err = write_index_ext_header(&c, &eoie_c, newfd, CACHE_EXT_UNTRACKED,
+					     sb.len) < 0
+			|| ce_write(&c, newfd, sb.buf, sb.len) < 0;
+		strbuf_release(&sb);
+		if (err)
+			return -1;
+	}
+	if (istate && istate->fsmonitor_last_update && core_fsmonitor) {
+		struct strbuf sb = STRBUF_INIT;
+
+		write_fsmonitor_extension(&sb, istate);
+		err = write_index_ext_header(&c, &eoie_c, newfd, CACHE_EXT_FSMONITOR,
+					     sb.len) < 0
+			|| ce_write(&c, newfd, sb.buf, sb.len) < 0;
+		strbuf_release(&sb);
+		if (err)
+			return -1;
+	}
+	if (ieot) {
+		struct strbuf sb = STRBUF_INIT;
+		unsigned char eoie_sha1[20];
+		uint32_t ext_offset = htonl(offset);
+
+		write_ieot_extension(&sb, ieot);
+		free(ieot);
+		err = write_index_ext_header(&c, &eoie_c, newfd,
+					     CACHE_EXT_ENTRY_OFFSETS,
+					     sb.len) < 0
 			|| ce_write(&c, newfd, sb.buf, sb.len) < 0;
 		strbuf_release(&sb);
 		if (err)
 			return -1;
+
+		/* this one must come last */
+		git_SHA1_Final(eoie_sha1, &eoie_c);
+		if (write_index_ext_header(&c, NULL, newfd,
+					   CACHE_EXT_END_OF_ENTRIES,
+					   EOIE_SIZE) < 0 ||
+		    ce_write(&c, newfd, &ext_offset, 4) < 0 ||
+		    ce_write(&c, newfd, eoie_sha1, 20) < 0)
+			return -1;
 	}
 
-	if (ce_flush(&c, newfd) || fstat(newfd, &st))
+	return ce_flush(&c, newfd, sha1);
+}
+
+/*
+ * Find the shared index that $GIT_DIR/index links to, without reading
+ * any more of it than that.  Returns 0 if there is one.
+ */
+static int main_index_shared_sha1(unsigned char *sha1)
+{
+	struct cache_header *hdr;
+	struct stat st;
+	size_t size, offset;
+	unsigned int i, nr;
+	char *map;
+	int fd, ret = -1;
+
+	fd = open(git_path("index"), O_RDONLY);
+	if (fd < 0)
+		return -1;
+	if (fstat(fd, &st) ||
+	    xsize_t(st.st_size) < sizeof(struct cache_header) + 20) {
+		close(fd);
+		return -1;
+	}
+	size = xsize_t(st.st_size);
+	map = xmmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	hdr = (struct cache_header *)map;
+	if (hdr->hdr_signature != htonl(CACHE_SIGNATURE))
+		goto out;
+	nr = ntohl(hdr->hdr_entries);
+	offset = sizeof(*hdr);
+	for (i = 0; i < nr; i++) {
+		if (offset + ondisk_cache_entry_size(0) > size - 20)
+			goto out;
+		offset += ondisk_entry_size((struct ondisk_cache_entry *)
+					    (map + offset));
+	}
+	while (offset + 8 <= size - 20) {
+		const char *ext = map + offset;
+		uint32_t extsize;
+
+		memcpy(&extsize, ext + 4, 4);
+		extsize = ntohl(extsize);
+		if (CACHE_EXT(ext) == CACHE_EXT_LINK) {
+			if (extsize >= 20 && offset + 8 + 20 <= size - 20) {
+				hashcpy(sha1, (unsigned char *)map + offset + 8);
+				ret = 0;
+			}
+			break;
+		}
+		offset += 8 + extsize;
+	}
+out:
+	munmap(map, size);
+	return ret;
+}
+
+/*
+ * Remove the shared indexes not used for SHARED_INDEX_EXPIRE, except
+ * for "keep" and the one $GIT_DIR/index still needs; the index being
+ * written may be another file (e.g. GIT_INDEX_FILE).
+ */
+static void expire_shared_indexes(const unsigned char *keep)
+{
+	char keep_name[60], main_name[60] = "";
+	unsigned char main_sha1[20];
+	struct dirent *de;
+	DIR *dir;
+	time_t expire = time(NULL) - SHARED_INDEX_EXPIRE;
+
+	snprintf(keep_name, sizeof(keep_name), "sharedindex.%s",
+		 sha1_to_hex(keep));
+	if (!main_index_shared_sha1(main_sha1))
+		snprintf(main_name, sizeof(main_name), "sharedindex.%s",
+			 sha1_to_hex(main_sha1));
+	dir = opendir(get_git_dir());
+	if (!dir)
+		return;
+	while ((de = readdir(dir)) != NULL) {
+		const char *path;
+		struct stat st;
+
+		if (prefixcmp(de->d_name, "sharedindex") ||
+		    !strcmp(de->d_name, keep_name) ||
+		    !strcmp(de->d_name, main_name))
+			continue;
+		path = git_path("%s", de->d_name);
+		if (!stat(path, &st) && st.st_mtime < expire)
+			unlink(path);
+	}
+	closedir(dir);
+}
+
+/*
+ * Write all the entries to a new shared index and return it, mapped
+ * so that the index can be written as a delta against it.
+ */
+static struct split_index *write_shared_index(struct index_state *istate,
+					      int entries, int extended)
+{
+	struct split_index *si;
+	unsigned char sha1[20];
+	char tmp[PATH_MAX];
+	mode_t mask;
+	int fd;
+
+	if (strlcpy(tmp, git_path("sharedindex_XXXXXX"), sizeof(tmp))
+	    >= sizeof(tmp)) {
+		error("shared index path too long");
+		return NULL;
+	}
+	fd = mkstemp(tmp);
+	if (fd < 0) {
+		error("unable to create shared index: %s", strerror(errno));
+		return NULL;
+	}
+	if (write_index_file(fd, istate->cache, istate->cache_nr, entries,
+			     extended, NULL, NULL, sha1) || close(fd)) {
+		error("unable to write shared index: %s", strerror(errno));
+		unlink(tmp);
+		return NULL;
+	}
+	/* readable by whoever can read the index itself */
+	mask = umask(0);
+	umask(mask);
+	chmod(tmp, 0666 & ~mask);
+	adjust_shared_perm(tmp);
+	if (rename(tmp, shared_index_path(sha1))) {
+		error("unable to rename shared index: %s", strerror(errno));
+		unlink(tmp);
+		return NULL;
+	}
+
+	si = xcalloc(1, sizeof(*si));
+	si->refcount = 1;
+	hashcpy(si->base_sha1, sha1);
+	if (map_shared_index(si, 0)) {
+		free(si);
+		return NULL;
+	}
+	expire_shared_indexes(sha1);
+	return si;
+}
+
+/*
+ * Walk the index and the shared index side by side, collecting in
+ * "changed" the entries that the shared index does not have exactly
+ * as they are in core, and in "link" the positions of the shared
+ * entries that are gone or replaced.  Returns how many of both there
+ * are.
+ */
+static unsigned int split_index_delta(struct index_state *istate,
+				      struct split_index *si,
+				      struct cache_entry ***changed,
+				      unsigned int *nr_changed,
+				      struct strbuf *link)
+{
+	unsigned int i = 0, b = 0, nr_deleted = 0, alloc = 0;
+
+	*nr_changed = 0;
+	while (i < istate->cache_nr || b < si->base_nr) {
+		struct cache_entry *ce = NULL;
+		struct ondisk_cache_entry *base = NULL;
+		int cmp, changed_entry = 0, deleted = 0;
+
+		if (i < istate->cache_nr) {
+			ce = istate->cache[i];
+			if (ce->ce_flags & CE_REMOVE) {
+				i++;
+				continue;
+			}
+		}
+		if (b < si->base_nr)
+			base = (struct ondisk_cache_entry *)
+				((char *)si->base_mmap + si->base_offset[b]);
+
+		if (!ce)
+			cmp = 1;
+		else if (!base)
+			cmp = -1;
+		else
+			cmp = cache_name_compare(ce->name, ce->ce_flags,
+						 ondisk_entry_name(base),
+						 ntohs(base->flags));
+		if (cmp < 0) {
+			changed_entry = 1;
+			i++;
+		} else if (cmp > 0) {
+			deleted = 1;
+			b++;
+		} else {
+			int size;
+			struct ondisk_cache_entry *ondisk = ce_to_ondisk(ce, &size);
+
+			if (size != ondisk_entry_size(base) ||
+			    memcmp(ondisk, base, size))
+				changed_entry = deleted = 1;
+			i++;
+			b++;
+		}
+
+		if (changed_entry) {
+			ALLOC_GROW(*changed, *nr_changed + 1, alloc);
+			(*changed)[(*nr_changed)++] = ce;
+		}
+		if (deleted) {
+			uint32_t pos = htonl(b - 1);
+			strbuf_add(link, &pos, 4);
+			nr_deleted++;
+		}
+	}
+	return *nr_changed + nr_deleted;
+}
+
+static int write_split_index(struct index_state *istate, int newfd,
+			     int entries, int extended)
+{
+	struct split_index *si = istate->split_index;
+	struct cache_entry **changed = NULL;
+	unsigned int nr_changed = 0;
+	struct strbuf link = STRBUF_INIT;
+	int err;
+
+	strbuf_add(&link, null_sha1, 20);
+	if (!si || !si->base_mmap ||
+	    split_index_delta(istate, si, &changed, &nr_changed, &link) * 100 >
+	    (unsigned long)split_index_max_percent * si->base_nr) {
+		struct split_index *new = write_shared_index(istate, entries,
+							    extended);
+		if (!new) {
+			free(changed);
+			strbuf_release(&link);
+			return -1;
+		}
+		/* our entries may still live in the old one's memory */
+		new->previous = si;
+		istate->split_index = si = new;
+		nr_changed = 0;
+		strbuf_setlen(&link, 20);
+	} else {
+		freshen_shared_index(si->base_sha1);
+	}
+	hashcpy((unsigned char *)link.buf, si->base_sha1);
+
+	err = write_index_file(newfd, changed, nr_changed, nr_changed,
+			       extended, istate, &link, NULL);
+	free(changed);
+	strbuf_release(&link);
+	return err;
+}
+
+static int want_split_index(struct index_state *istate)
+{
+	if (core_split_index < 0)
+		return istate->split_index != NULL;
+	return core_split_index;
+}
+
+int write_index(struct index_state *istate, int newfd)
+{
+	int i, err, removed, extended;
+	struct cache_entry **cache = istate->cache;
+	int entries = istate->cache_nr;
+	struct stat st;
+
+	for (i = removed = extended = 0; i < entries; i++) {
+		struct cache_entry *ce = cache[i];
+
+		if (ce->ce_flags & CE_REMOVE) {
+			removed++;
+			continue;
+		}
+
+		/* reduce extended entries if possible */
+		ce->ce_flags &= ~CE_EXTENDED;
+		if (ce->ce_flags & CE_EXTENDED_FLAGS) {
+			extended++;
+			ce->ce_flags |= CE_EXTENDED;
+		}
+
+		if (!ce_uptodate(ce) && is_racy_timestamp(istate, ce))
+			ce_smudge_racily_clean_entry(ce);
+	}
+
+	if (want_split_index(istate))
+		err = write_split_index(istate, newfd, entries - removed,
+					extended);
+	else
+		err = write_index_file(newfd, cache, entries, entries - removed,
+				       extended, istate, NULL, NULL);
+	if (err || fstat(newfd, &st))
 		return -1;
 	istate->timestamp.sec = (unsigned int)st.st_mtime;
 	istate->timestamp.nsec = ST_MTIME_NSEC(st);
@@ -1675,7 +2647,9 @@ int add_files_to_cache(const char *prefix, const char **pathspec, int flags)
 	data.flags = flags;
 	data.add_errors = 0;
 	rev.diffopt.format_callback_data = &data;
+	plug_bulk_checkin();
 	run_diff_files(&rev, DIFF_RACY_IS_MODIFIED);
+	unplug_bulk_checkin();
 	return !!data.add_errors;
 }
 
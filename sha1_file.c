@@ -16,6 +16,8 @@
 #include "refs.h"
 #include "pack-revindex.h"
 #include "sha1-lookup.h"
+#include "multi-pack-index.h"
+#include "bulk-checkin.h"
 
 #ifndef O_NOATIME
 #if defined(__linux__) && (defined(__i386__) || defined(__PPC__))
@@ -33,6 +35,89 @@ static unsigned long sz_fmt(size_t s) { return (unsigned long)s; }
 static size_t sz_fmt(size_t s) { return s; }
 #endif
 
+#ifdef THREADED_DELTA_SEARCH
+#include <pthread.h>
+
+/*
+ * After enable_obj_read_lock(), objects may be read from several
+ * threads at once.  The pack list, the pack windows and the delta
+ * base cache are only looked at with obj_read_mutex held, but it is
+ * let go while inflating and applying deltas, where the time goes,
+ * on buffers and windows (pinned by inuse_cnt) no other thread
+ * touches.  Reading an object can read others, so the mutex is
+ * recursive; obj_read_depth counts how often its owner took it.
+ * use_pack() and unuse_pack() take it themselves.
+ */
+static int obj_read_use_lock;
+static pthread_mutex_t obj_read_mutex;
+static int obj_read_depth;
+
+void enable_obj_read_lock(void)
+{
+	pthread_mutexattr_t attr;
+
+	if (obj_read_use_lock++)
+		return;
+	pthread_mutexattr_init(&attr);
+	pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+	pthread_mutex_init(&obj_read_mutex, &attr);
+	pthread_mutexattr_destroy(&attr);
+}
+
+void disable_obj_read_lock(void)
+{
+	if (--obj_read_use_lock)
+		return;
+	pthread_mutex_destroy(&obj_read_mutex);
+}
+
+void obj_read_lock(void)
+{
+	if (!obj_read_use_lock)
+		return;
+	pthread_mutex_lock(&obj_read_mutex);
+	obj_read_depth++;
+}
+
+void obj_read_unlock(void)
+{
+	if (!obj_read_use_lock)
+		return;
+	obj_read_depth--;
+	pthread_mutex_unlock(&obj_read_mutex);
+}
+
+/* Let other readers in for a while; returns what to pass to _reacquire */
+static int obj_read_release(void)
+{
+	int i, depth = obj_read_depth;
+
+	if (!obj_read_use_lock)
+		return 0;
+	obj_read_depth = 0;
+	for (i = 0; i < depth; i++)
+		pthread_mutex_unlock(&obj_read_mutex);
+	return depth;
+}
+
+static void obj_read_reacquire(int depth)
+{
+	int i;
+
+	for (i = 0; i < depth; i++)
+		pthread_mutex_lock(&obj_read_mutex);
+	if (depth)
+		obj_read_depth = depth;
+}
+#else
+void enable_obj_read_lock(void) { }
+void disable_obj_read_lock(void) { }
+void obj_read_lock(void) { }
+void obj_read_unlock(void) { }
+#define obj_read_release()		0
+#define obj_read_reacquire(depth)	(void)(depth)
+#endif
+
 const unsigned char null_sha1[20];
 
 const signed char hexval_table[256] = {
@@ -270,6 +355,7 @@ static int link_alt_odb_entry(const char * entry, int len, const char * relative
 		pfxlen += base_len;
 	}
 	ent = xmalloc(sizeof(*ent) + entlen);
+	ent->loose_objects = NULL;
 
 	if (!is_absolute_path(entry) && relative_base) {
 		memcpy(ent->base, relative_base, base_len - 1);
@@ -423,9 +509,122 @@ void prepare_alt_odb(void)
 	read_info_alternates(get_object_directory(), 0);
 }
 
+/*
+ * With core.looseObjectCache, the "xx/" fan-out directory of an object
+ * database is read once, on the first lookup that falls into it, and
+ * the object names found there are kept sorted; whether a loose object
+ * exists is then a binary search instead of a failing access(2) or
+ * open(2) in every object database.  Objects written by other
+ * processes while we run are only seen after the cache is dropped,
+ * which reprepare_packed_git() does; our own writes drop the entry
+ * for the directory they went to.
+ */
+struct loose_object_subdir {
+	unsigned char (*sha1)[20];
+	int nr, alloc;
+	int loaded;
+};
+
+struct loose_object_cache {
+	struct loose_object_subdir subdir[256];
+};
+
+static struct loose_object_cache *local_loose_objects;
+
+static int loose_object_cmp(const void *a_, const void *b_)
+{
+	return hashcmp(a_, b_);
+}
+
+static void load_loose_subdir(struct loose_object_subdir *sd,
+			      const char *objdir, int objdir_len, int nr)
+{
+	char path[PATH_MAX], hex[41];
+	unsigned char sha1[20];
+	struct dirent *de;
+	DIR *dir;
+
+	sd->loaded = 1;
+	if (objdir_len + 4 >= PATH_MAX)
+		return;
+	sprintf(path, "%.*s/%02x", objdir_len, objdir, nr);
+	dir = opendir(path);
+	if (!dir)
+		return;
+	sprintf(hex, "%02x", nr);
+	while ((de = readdir(dir)) != NULL) {
+		if (strlen(de->d_name) != 38)
+			continue;
+		memcpy(hex + 2, de->d_name, 39);
+		if (get_sha1_hex(hex, sha1))
+			continue;
+		ALLOC_GROW(sd->sha1, sd->nr + 1, sd->alloc);
+		hashcpy(sd->sha1[sd->nr++], sha1);
+	}
+	closedir(dir);
+	qsort(sd->sha1, sd->nr, sizeof(*sd->sha1), loose_object_cmp);
+}
+
+static int loose_object_cache_has(struct loose_object_cache **cache,
+				  const char *objdir, int objdir_len,
+				  const unsigned char *sha1)
+{
+	struct loose_object_subdir *sd;
+
+	if (!*cache)
+		*cache = xcalloc(1, sizeof(**cache));
+	sd = &(*cache)->subdir[sha1[0]];
+	if (!sd->loaded)
+		load_loose_subdir(sd, objdir, objdir_len, sha1[0]);
+	return !!bsearch(sha1, sd->sha1, sd->nr, sizeof(*sd->sha1),
+			 loose_object_cmp);
+}
+
+static void clear_loose_object_subdir(struct loose_object_cache *cache,
+				      int nr)
+{
+	struct loose_object_subdir *sd;
+
+	if (!cache)
+		return;
+	sd = &cache->subdir[nr];
+	free(sd->sha1);
+	memset(sd, 0, sizeof(*sd));
+}
+
+static void discard_loose_object_cache(void)
+{
+	struct alternate_object_database *alt;
+	int i;
+
+	for (i = 0; i < 256; i++)
+		clear_loose_object_subdir(local_loose_objects, i);
+	for (alt = alt_odb_list; alt; alt = alt->next)
+		for (i = 0; i < 256; i++)
+			clear_loose_object_subdir(alt->loose_objects, i);
+}
+
+static int local_loose_object_cached(const unsigned char *sha1)
+{
+	const char *objdir = get_object_directory();
+	return loose_object_cache_has(&local_loose_objects,
+				      objdir, strlen(objdir), sha1);
+}
+
+static int alt_loose_object_cached(struct alternate_object_database *alt,
+				   const unsigned char *sha1)
+{
+	return loose_object_cache_has(&alt->loose_objects, alt->base,
+				      alt->name - alt->base - 1, sha1);
+}
+
 static int has_loose_object_local(const unsigned char *sha1)
 {
-	char *name = sha1_file_name(sha1);
+	char *name;
+
+	if (core_loose_object_cache)
+		return local_loose_object_cached(sha1);
+	name = sha1_file_name(sha1);
 	return !access(name, F_OK);
 }
 
@@ -434,6 +633,11 @@ int has_loose_object_nonlocal(const unsigned char *sha1)
 	struct alternate_object_database *alt;
 	prepare_alt_odb();
 	for (alt = alt_odb_list; alt; alt = alt->next) {
+		if (core_loose_object_cache) {
+			if (alt_loose_object_cached(alt, sha1))
+				return 1;
+			continue;
+		}
 		fill_sha1_path(alt->name, sha1);
 		if (!access(alt->base, F_OK))
 			return 1;
@@ -449,6 +653,8 @@ static int has_loose_object(const unsigned char *sha1)
 
 static unsigned int pack_used_ctr;
 static unsigned int pack_mmap_calls;
+static unsigned int pack_unmap_calls;
+static unsigned int pack_whole_maps;
 static unsigned int peak_pack_open_windows;
 static unsigned int pack_open_windows;
 static size_t peak_pack_mapped;
@@ -460,18 +666,24 @@ void pack_report(void)
 	fprintf(stderr,
 		"pack_report: getpagesize()            = %10" SZ_FMT "\n"
 		"pack_report: core.packedGitWindowSize = %10" SZ_FMT "\n"
-		"pack_report: core.packedGitLimit      = %10" SZ_FMT "\n",
+		"pack_report: core.packedGitLimit      = %10" SZ_FMT "\n"
+		"pack_report: core.packedGitMapWhole   = %10s\n",
 		sz_fmt(getpagesize()),
 		sz_fmt(packed_git_window_size),
-		sz_fmt(packed_git_limit));
+		sz_fmt(packed_git_limit),
+		packed_git_map_whole ? "true" : "false");
 	fprintf(stderr,
 		"pack_report: pack_used_ctr            = %10u\n"
 		"pack_report: pack_mmap_calls          = %10u\n"
+		"pack_report: pack_whole_maps          = %10u\n"
+		"pack_report: pack_unmap_calls         = %10u\n"
 		"pack_report: pack_open_windows        = %10u / %10u\n"
 		"pack_report: pack_mapped              = "
 			"%10" SZ_FMT " / %10" SZ_FMT "\n",
 		pack_used_ctr,
 		pack_mmap_calls,
+		pack_whole_maps,
+		pack_unmap_calls,
 		pack_open_windows, peak_pack_open_windows,
 		sz_fmt(pack_mapped), sz_fmt(peak_pack_mapped));
 }
@@ -593,58 +805,93 @@ int open_pack_index(struct packed_git *p)
 	return ret;
 }
 
-static void scan_windows(struct packed_git *p,
-	struct packed_git **lru_p,
-	struct pack_window **lru_w,
-	struct pack_window **lru_l)
+/*
+ * Windows nobody uses are kept on a list, least recently used first,
+ * so that the one to unmap when we are over packed_git_limit is found
+ * without looking at every window of every pack.  A window is on the
+ * list exactly when its inuse_cnt is zero.
+ */
+static struct pack_window *lru_window, *mru_window;
+
+static void window_lru_del(struct pack_window *w)
 {
-	struct pack_window *w, *w_l;
+	if (w->lru_prev)
+		w->lru_prev->lru_next = w->lru_next;
+	else
+		lru_window = w->lru_next;
+	if (w->lru_next)
+		w->lru_next->lru_prev = w->lru_prev;
+	else
+		mru_window = w->lru_prev;
+	w->lru_prev = w->lru_next = NULL;
+}
 
-	for (w_l = NULL, w = p->windows; w; w = w->next) {
-		if (!w->inuse_cnt) {
-			if (!*lru_w || w->last_used < (*lru_w)->last_used) {
-				*lru_p = p;
-				*lru_w = w;
-				*lru_l = w_l;
-			}
-		}
-		w_l = w;
-	}
+static void use_window(struct pack_window *w)
+{
+	if (!w->inuse_cnt++)
+		window_lru_del(w);
+	w->last_used = pack_used_ctr++;
 }
 
-static int unuse_one_window(struct packed_git *current, int keep_fd)
+static void window_lru_add(struct pack_window *w)
 {
-	struct packed_git *p, *lru_p = NULL;
-	struct pack_window *lru_w = NULL, *lru_l = NULL;
+	w->lru_next = NULL;
+	w->lru_prev = mru_window;
+	if (mru_window)
+		mru_window->lru_next = w;
+	else
+		lru_window = w;
+	mru_window = w;
+}
 
-	if (current)
-		scan_windows(current, &lru_p, &lru_w, &lru_l);
-	for (p = packed_git; p; p = p->next)
-		scan_windows(p, &lru_p, &lru_w, &lru_l);
-	if (lru_p) {
-		munmap(lru_w->base, lru_w->len);
-		pack_mapped -= lru_w->len;
-		if (lru_l)
-			lru_l->next = lru_w->next;
-		else {
-			lru_p->windows = lru_w->next;
-			if (!lru_p->windows && lru_p->pack_fd != keep_fd) {
-				close(lru_p->pack_fd);
-				lru_p->pack_fd = -1;
-			}
-		}
-		free(lru_w);
-		pack_open_windows--;
-		return 1;
+static void release_window(struct pack_window *w)
+{
+	if (!--w->inuse_cnt)
+		window_lru_add(w);
+}
+
+static void unmap_window(struct pack_window *w)
+{
+	munmap(w->base, w->len);
+	pack_mapped -= w->len;
+	pack_open_windows--;
+	pack_unmap_calls++;
+}
+
+static int unuse_one_window(int keep_fd)
+{
+	struct pack_window *w = lru_window, **pw;
+	struct packed_git *p;
+
+	if (!w)
+		return 0;
+	window_lru_del(w);
+	p = w->pack;
+	for (pw = &p->windows; *pw != w; pw = &(*pw)->next)
+		; /* nothing */
+	*pw = w->next;
+	unmap_window(w);
+	free(w);
+	/*
+	 * The list also holds windows of packs that are not on packed_git,
+	 * like the one fast-import is writing; their pack_fd is not ours.
+	 */
+	if (!p->windows && p->pack_fd != keep_fd && p->pack_installed) {
+		close(p->pack_fd);
+		p->pack_fd = -1;
 	}
-	return 0;
+	return 1;
 }
 
 void release_pack_memory(size_t need, int fd)
 {
-	size_t cur = pack_mapped;
-	while (need >= (cur - pack_mapped) && unuse_one_window(NULL, fd))
+	size_t cur;
+
+	obj_read_lock();
+	cur = pack_mapped;
+	while (need >= (cur - pack_mapped) && unuse_one_window(fd))
 		; /* nothing */
+	obj_read_unlock();
 }
 
 void close_pack_windows(struct packed_git *p)
@@ -655,9 +902,8 @@ void close_pack_windows(struct packed_git *p)
 		if (w->inuse_cnt)
 			die("pack '%s' still has open windows to it",
 			    p->pack_name);
-		munmap(w->base, w->len);
-		pack_mapped -= w->len;
-		pack_open_windows--;
+		window_lru_del(w);
+		unmap_window(w);
 		p->windows = w->next;
 		free(w);
 	}
@@ -667,11 +913,16 @@ void unuse_pack(struct pack_window **w_cursor)
 {
 	struct pack_window *w = *w_cursor;
 	if (w) {
-		w->inuse_cnt--;
+		obj_read_lock();
+		release_window(w);
+		obj_read_unlock();
 		*w_cursor = NULL;
 	}
 }
 
+/* the pack find_pack_entry() looks into first */
+static struct packed_git *last_found = (void *)1;
+
 /*
  * This is used by git-repack in case a newly created pack happens to
  * contain the same set of objects as an existing one.  In that case
@@ -697,6 +948,10 @@ void free_pack_by_name(const char *pack_name)
 				munmap((void *)p->index_data, p->index_size);
 			free(p->bad_object_sha1);
 			*pp = p->next;
+			if (last_found == p)
+				last_found = (void *)1;
+			close_multi_pack_index();
+			discard_revindex();
 			free(p);
 			return;
 		}
@@ -778,6 +1033,28 @@ static int open_packed_git(struct packed_git *p)
 	return -1;
 }
 
+/*
+ * With core.packedGitMapWhole, a pack is mapped as a single window,
+ * however large; only where there is address space to spare.
+ */
+static int map_whole_packs(void)
+{
+	return packed_git_map_whole && sizeof(void *) >= 8;
+}
+
+/*
+ * Tell the kernel how a whole-pack mapping is going to be read, so it
+ * does not read ahead around every object lookup, but does when the
+ * pack is read from start to end (verify-pack).
+ */
+static void advise_window(struct pack_window *win)
+{
+#ifdef MADV_SEQUENTIAL
+	madvise(win->base, win->len,
+		sequential_pack_access ? MADV_SEQUENTIAL : MADV_RANDOM);
+#endif
+}
+
 static int in_window(struct pack_window *win, off_t offset)
 {
 	/* We must promise at least 20 bytes (one hash) after the
@@ -797,7 +1074,9 @@ unsigned char* use_pack(struct packed_git *p,
 		unsigned int *left)
 {
 	struct pack_window *win = *w_cursor;
+	unsigned char *ret;
 
+	obj_read_lock();
 	if (p->pack_fd == -1 && open_packed_git(p))
 		die("packfile %s cannot be accessed", p->pack_name);
 
@@ -811,23 +1090,28 @@ unsigned char* use_pack(struct packed_git *p,
 
 	if (!win || !in_window(win, offset)) {
 		if (win)
-			win->inuse_cnt--;
+			release_window(win);
 		for (win = p->windows; win; win = win->next) {
 			if (in_window(win, offset))
 				break;
 		}
 		if (!win) {
 			size_t window_align = packed_git_window_size / 2;
+			int whole = map_whole_packs();
 			off_t len;
 			win = xcalloc(1, sizeof(*win));
-			win->offset = (offset / window_align) * window_align;
+			win->pack = p;
+			if (whole)
+				win->offset = 0;
+			else
+				win->offset = (offset / window_align) * window_align;
 			len = p->pack_size - win->offset;
-			if (len > packed_git_window_size)
+			if (!whole && len > packed_git_window_size)
 				len = packed_git_window_size;
-			win->len = (size_t)len;
+			win->len = xsize_t(len);
 			pack_mapped += win->len;
 			while (packed_git_limit < pack_mapped
-				&& unuse_one_window(p, p->pack_fd))
+				&& unuse_one_window(p->pack_fd))
 				; /* nothing */
 			win->base = xmmap(NULL, win->len,
 				PROT_READ, MAP_PRIVATE,
@@ -836,6 +1120,10 @@ unsigned char* use_pack(struct packed_git *p,
 				die("packfile %s cannot be mapped: %s",
 					p->pack_name,
 					strerror(errno));
+			if (whole) {
+				advise_window(win);
+				pack_whole_maps++;
+			}
 			pack_mmap_calls++;
 			pack_open_windows++;
 			if (pack_mapped > peak_pack_mapped)
@@ -844,17 +1132,19 @@ unsigned char* use_pack(struct packed_git *p,
 				peak_pack_open_windows = pack_open_windows;
 			win->next = p->windows;
 			p->windows = win;
+			window_lru_add(win);
 		}
 	}
 	if (win != *w_cursor) {
-		win->last_used = pack_used_ctr++;
-		win->inuse_cnt++;
+		use_window(win);
 		*w_cursor = win;
 	}
 	offset -= win->offset;
 	if (left)
 		*left = win->len - xsize_t(offset);
-	return win->base + offset;
+	ret = win->base + offset;
+	obj_read_unlock();
+	return ret;
 }
 
 static struct packed_git *alloc_packed_git(int extra)
@@ -920,6 +1210,7 @@ struct packed_git *parse_pack_index(unsigned char *sha1)
 
 void install_packed_git(struct packed_git *pack)
 {
+	pack->pack_installed = 1;
 	pack->next = packed_git;
 	packed_git = pack;
 }
@@ -1048,6 +1339,8 @@ void prepare_packed_git(void)
 void reprepare_packed_git(void)
 {
 	discard_revindex();
+	close_multi_pack_index();
+	discard_loose_object_cache();
 	prepare_packed_git_run_once = 0;
 	prepare_packed_git();
 }
@@ -1100,16 +1393,22 @@ static int git_open_noatime(const char *name)
 static int open_sha1_file(const unsigned char *sha1)
 {
 	int fd;
-	char *name = sha1_file_name(sha1);
+	char *name;
 	struct alternate_object_database *alt;
 
-	fd = git_open_noatime(name);
-	if (fd >= 0)
-		return fd;
+	if (!core_loose_object_cache || local_loose_object_cached(sha1)) {
+		name = sha1_file_name(sha1);
+		fd = git_open_noatime(name);
+		if (fd >= 0)
+			return fd;
+	}
 
 	prepare_alt_odb();
 	errno = ENOENT;
 	for (alt = alt_odb_list; alt; alt = alt->next) {
+		if (core_loose_object_cache &&
+		    !alt_loose_object_cached(alt, sha1))
+			continue;
 		name = alt->name;
 		fill_sha1_path(name, sha1);
 		fd = git_open_noatime(alt->base);
@@ -1119,7 +1418,7 @@ static int open_sha1_file(const unsigned char *sha1)
 	return -1;
 }
 
-static void *map_sha1_file(const unsigned char *sha1, unsigned long *size)
+void *map_sha1_file(const unsigned char *sha1, unsigned long *size)
 {
 	void *map;
 	int fd;
@@ -1179,7 +1478,7 @@ unsigned long unpack_object_header_buffer(const unsigned char *buf,
 	return used;
 }
 
-static int unpack_sha1_header(z_stream *stream, unsigned char *map, unsigned long mapsize, void *buffer, unsigned long bufsiz)
+int unpack_sha1_header(z_stream *stream, unsigned char *map, unsigned long mapsize, void *buffer, unsigned long bufsiz)
 {
 	unsigned long size, used;
 	static const char valid_loose_object_type[8] = {
@@ -1277,7 +1576,7 @@ static void *unpack_sha1_rest(z_stream *stream, void *buffer, unsigned long size
  * too permissive for what we want to check. So do an anal
  * object header parse by hand.
  */
-static int parse_sha1_header(const char *hdr, unsigned long *sizep)
+int parse_sha1_header(const char *hdr, unsigned long *sizep)
 {
 	char type[10];
 	int i;
@@ -1329,11 +1628,18 @@ static void *unpack_sha1_file(void *map, unsigned long mapsize, enum object_type
 	z_stream stream;
 	char hdr[8192];
 
+	void *buf;
+	int depth;
+
+	/* the map is our own, so nobody else needs the lock meanwhile */
+	depth = obj_read_release();
 	ret = unpack_sha1_header(&stream, map, mapsize, hdr, sizeof(hdr));
 	if (ret < Z_OK || (*type = parse_sha1_header(hdr, size)) < 0)
-		return NULL;
-
-	return unpack_sha1_rest(&stream, hdr, *size, sha1);
+		buf = NULL;
+	else
+		buf = unpack_sha1_rest(&stream, hdr, *size, sha1);
+	obj_read_reacquire(depth);
+	return buf;
 }
 
 unsigned long get_size_from_delta(struct packed_git *p,
@@ -1432,12 +1738,11 @@ static int packed_delta_info(struct packed_git *p,
 		return OBJ_BAD;
 	type = packed_object_info(p, base_offset, NULL);
 	if (type <= OBJ_NONE) {
-		struct revindex_entry *revidx;
+		uint32_t pos;
 		const unsigned char *base_sha1;
-		revidx = find_pack_revindex(p, base_offset);
-		if (!revidx)
+		if (offset_to_pack_pos(p, base_offset, &pos) < 0)
 			return OBJ_BAD;
-		base_sha1 = nth_packed_object_sha1(p, revidx->nr);
+		base_sha1 = nth_packed_object_sha1(p, pack_pos_to_index(p, pos));
 		mark_bad_packed_object(p, base_sha1);
 		type = sha1_object_info(base_sha1, NULL);
 		if (type <= OBJ_NONE)
@@ -1458,10 +1763,10 @@ static int packed_delta_info(struct packed_git *p,
 	return type;
 }
 
-static int unpack_object_header(struct packed_git *p,
-				struct pack_window **w_curs,
-				off_t *curpos,
-				unsigned long *sizep)
+int unpack_object_header(struct packed_git *p,
+			 struct pack_window **w_curs,
+			 off_t *curpos,
+			 unsigned long *sizep)
 {
 	unsigned char *base;
 	unsigned int left;
@@ -1496,14 +1801,16 @@ const char *packed_object_info_detail(struct packed_git *p,
 	unsigned long dummy;
 	unsigned char *next_sha1;
 	enum object_type type;
-	struct revindex_entry *revidx;
+	uint32_t pos;
 
 	*delta_chain_length = 0;
 	curpos = obj_offset;
 	type = unpack_object_header(p, &w_curs, &curpos, size);
 
-	revidx = find_pack_revindex(p, obj_offset);
-	*store_size = revidx[1].offset - obj_offset;
+	if (offset_to_pack_pos(p, obj_offset, &pos) < 0)
+		die("pack %s has no object at offset %"PRIuMAX,
+		    p->pack_name, (uintmax_t)obj_offset);
+	*store_size = pack_pos_to_offset(p, pos + 1) - obj_offset;
 
 	for (;;) {
 		switch (type) {
@@ -1522,8 +1829,11 @@ const char *packed_object_info_detail(struct packed_git *p,
 				die("pack %s contains bad delta base reference of type %s",
 				    p->pack_name, typename(type));
 			if (*delta_chain_length == 0) {
-				revidx = find_pack_revindex(p, obj_offset);
-				hashcpy(base_sha1, nth_packed_object_sha1(p, revidx->nr));
+				if (offset_to_pack_pos(p, obj_offset, &pos) < 0)
+					die("pack %s contains bad delta base reference",
+					    p->pack_name);
+				hashcpy(base_sha1, nth_packed_object_sha1(p,
+						pack_pos_to_index(p, pos)));
 			}
 			break;
 		case OBJ_REF_DELTA:
@@ -1588,9 +1898,12 @@ static void *unpack_compressed_entry(struct packed_git *p,
 
 	git_inflate_init(&stream);
 	do {
+		int depth;
 		in = use_pack(p, w_curs, curpos, &stream.avail_in);
 		stream.next_in = in;
+		depth = obj_read_release();
 		st = git_inflate(&stream, Z_FINISH);
+		obj_read_reacquire(depth);
 		curpos += stream.next_in - in;
 	} while (st == Z_OK || st == Z_BUF_ERROR);
 	git_inflate_end(&stream);
@@ -1602,8 +1915,13 @@ static void *unpack_compressed_entry(struct packed_git *p,
 	return buffer;
 }
 
-#define MAX_DELTA_CACHE (256)
-
+/*
+ * Recently used delta bases, so that unpacking the objects of a delta
+ * chain does not inflate the same bases over and over.  The entries
+ * are kept in a hash table on (pack, offset) with chaining, so that
+ * they only ever leave the cache to keep it within
+ * delta_base_cache_limit bytes, least recently used (and blobs) first.
+ */
 static size_t delta_base_cached;
 
 static struct delta_base_cache_lru_list {
@@ -1611,101 +1929,443 @@ static struct delta_base_cache_lru_list {
 	struct delta_base_cache_lru_list *next;
 } delta_base_cache_lru = { &delta_base_cache_lru, &delta_base_cache_lru };
 
-static struct delta_base_cache_entry {
+struct delta_base_cache_entry {
 	struct delta_base_cache_lru_list lru;
+	struct delta_base_cache_entry *next;
 	void *data;
 	struct packed_git *p;
 	off_t base_offset;
 	unsigned long size;
 	enum object_type type;
-} delta_base_cache[MAX_DELTA_CACHE];
+};
+
+static struct delta_base_cache_entry **delta_base_cache;
+static unsigned int delta_base_cache_size;
+
+static struct delta_base_cache_stats {
+	unsigned long hits, misses, evictions;
+	unsigned long nr, max_nr;
+	size_t max_cached;
+	unsigned long collapsed, composed_hits;
+} delta_base_cache_stats;
+
+static size_t composed_delta_cached;
+
+#define DELTA_BASE_CACHE_TRACE "GIT_TRACE_DELTA_BASE_CACHE"
+
+static void report_delta_base_cache(void)
+{
+	struct delta_base_cache_stats *s = &delta_base_cache_stats;
 
-static unsigned long pack_entry_hash(struct packed_git *p, off_t base_offset)
+	trace_printf_key(DELTA_BASE_CACHE_TRACE,
+			 "delta base cache: %lu hits, %lu misses, "
+			 "%lu evictions, %lu entries (max %lu) in %u slots, "
+			 "%lu bytes (max %lu, limit %lu)\n",
+			 s->hits, s->misses, s->evictions, s->nr, s->max_nr,
+			 delta_base_cache_size, (unsigned long)delta_base_cached,
+			 (unsigned long)s->max_cached,
+			 (unsigned long)delta_base_cache_limit);
+	trace_printf_key(DELTA_BASE_CACHE_TRACE,
+			 "composed deltas: %lu chains collapsed, %lu hits, "
+			 "%lu bytes\n",
+			 s->collapsed, s->composed_hits,
+			 (unsigned long)composed_delta_cached);
+}
+
+static void init_delta_base_cache(void)
+{
+	delta_base_cache_size = delta_base_cache_slots;
+	if (!delta_base_cache_size)
+		delta_base_cache_size = 1;
+	delta_base_cache = xcalloc(delta_base_cache_size,
+				   sizeof(*delta_base_cache));
+	if (trace_want(DELTA_BASE_CACHE_TRACE))
+		atexit(report_delta_base_cache);
+}
+
+static struct delta_base_cache_entry **delta_base_cache_slot(
+	struct packed_git *p, off_t base_offset)
 {
 	unsigned long hash;
 
+	if (!delta_base_cache)
+		init_delta_base_cache();
 	hash = (unsigned long)p + (unsigned long)base_offset;
 	hash += (hash >> 8) + (hash >> 16);
-	return hash % MAX_DELTA_CACHE;
+	return delta_base_cache + hash % delta_base_cache_size;
+}
+
+static struct delta_base_cache_entry **find_delta_base_cache(
+	struct packed_git *p, off_t base_offset)
+{
+	struct delta_base_cache_entry **pos;
+
+	pos = delta_base_cache_slot(p, base_offset);
+	while (*pos && ((*pos)->p != p || (*pos)->base_offset != base_offset))
+		pos = &(*pos)->next;
+	return pos;
+}
+
+static inline void lru_unlink(struct delta_base_cache_entry *ent)
+{
+	ent->lru.next->prev = ent->lru.prev;
+	ent->lru.prev->next = ent->lru.next;
+}
+
+static inline void lru_add_tail(struct delta_base_cache_entry *ent)
+{
+	ent->lru.next = &delta_base_cache_lru;
+	ent->lru.prev = delta_base_cache_lru.prev;
+	delta_base_cache_lru.prev->next = &ent->lru;
+	delta_base_cache_lru.prev = &ent->lru;
+}
+
+/*
+ * Take the entry at *pos out of the cache, and return its data,
+ * which the caller now owns.
+ */
+static void *detach_delta_base_cache(struct delta_base_cache_entry **pos)
+{
+	struct delta_base_cache_entry *ent = *pos;
+	void *data = ent->data;
+
+	*pos = ent->next;
+	lru_unlink(ent);
+	delta_base_cached -= ent->size;
+	delta_base_cache_stats.nr--;
+	free(ent);
+	return data;
 }
 
+static void *unpack_entry_1(struct packed_git *p, off_t obj_offset,
+			    enum object_type *type, unsigned long *sizep);
+
 static void *cache_or_unpack_entry(struct packed_git *p, off_t base_offset,
 	unsigned long *base_size, enum object_type *type, int keep_cache)
 {
+	struct delta_base_cache_entry **pos, *ent;
 	void *ret;
-	unsigned long hash = pack_entry_hash(p, base_offset);
-	struct delta_base_cache_entry *ent = delta_base_cache + hash;
-
-	ret = ent->data;
-	if (!ret || ent->p != p || ent->base_offset != base_offset)
-		return unpack_entry(p, base_offset, type, base_size);
-
-	if (!keep_cache) {
-		ent->data = NULL;
-		ent->lru.next->prev = ent->lru.prev;
-		ent->lru.prev->next = ent->lru.next;
-		delta_base_cached -= ent->size;
-	} else {
-		ret = xmemdupz(ent->data, ent->size);
+
+	pos = find_delta_base_cache(p, base_offset);
+	ent = *pos;
+	if (!ent) {
+		delta_base_cache_stats.misses++;
+		return unpack_entry_1(p, base_offset, type, base_size);
 	}
+
+	delta_base_cache_stats.hits++;
 	*type = ent->type;
 	*base_size = ent->size;
+	if (!keep_cache)
+		return detach_delta_base_cache(pos);
+
+	ret = xmemdupz(ent->data, ent->size);
+	lru_unlink(ent);
+	lru_add_tail(ent);
 	return ret;
 }
 
-static inline void release_delta_base_cache(struct delta_base_cache_entry *ent)
+static void release_delta_base_cache(struct delta_base_cache_entry *ent)
 {
-	if (ent->data) {
-		free(ent->data);
-		ent->data = NULL;
-		ent->lru.next->prev = ent->lru.prev;
-		ent->lru.prev->next = ent->lru.next;
-		delta_base_cached -= ent->size;
-	}
+	free(detach_delta_base_cache(find_delta_base_cache(ent->p,
+							    ent->base_offset)));
 }
 
+static void clear_composed_delta_cache(void);
+
 void clear_delta_base_cache(void)
 {
-	unsigned long p;
-	for (p = 0; p < MAX_DELTA_CACHE; p++)
-		release_delta_base_cache(&delta_base_cache[p]);
+	while (delta_base_cache_lru.next != &delta_base_cache_lru)
+		release_delta_base_cache((void *)delta_base_cache_lru.next);
+	clear_composed_delta_cache();
 }
 
 static void add_delta_base_cache(struct packed_git *p, off_t base_offset,
 	void *base, unsigned long base_size, enum object_type type)
 {
-	unsigned long hash = pack_entry_hash(p, base_offset);
-	struct delta_base_cache_entry *ent = delta_base_cache + hash;
-	struct delta_base_cache_lru_list *lru;
+	struct delta_base_cache_entry **pos, *ent;
+	struct delta_base_cache_lru_list *lru, *next;
 
-	release_delta_base_cache(ent);
+	pos = find_delta_base_cache(p, base_offset);
+	if (*pos)
+		free(detach_delta_base_cache(pos));
 	delta_base_cached += base_size;
 
 	for (lru = delta_base_cache_lru.next;
 	     delta_base_cached > delta_base_cache_limit
 	     && lru != &delta_base_cache_lru;
-	     lru = lru->next) {
+	     lru = next) {
 		struct delta_base_cache_entry *f = (void *)lru;
-		if (f->type == OBJ_BLOB)
+		next = lru->next;
+		if (f->type == OBJ_BLOB) {
 			release_delta_base_cache(f);
+			delta_base_cache_stats.evictions++;
+		}
 	}
-	for (lru = delta_base_cache_lru.next;
-	     delta_base_cached > delta_base_cache_limit
-	     && lru != &delta_base_cache_lru;
-	     lru = lru->next) {
-		struct delta_base_cache_entry *f = (void *)lru;
-		release_delta_base_cache(f);
+	while (delta_base_cached > delta_base_cache_limit &&
+	       delta_base_cache_lru.next != &delta_base_cache_lru) {
+		release_delta_base_cache((void *)delta_base_cache_lru.next);
+		delta_base_cache_stats.evictions++;
 	}
 
+	ent = xmalloc(sizeof(*ent));
 	ent->p = p;
 	ent->base_offset = base_offset;
 	ent->type = type;
 	ent->data = base;
 	ent->size = base_size;
-	ent->lru.next = &delta_base_cache_lru;
-	ent->lru.prev = delta_base_cache_lru.prev;
-	delta_base_cache_lru.prev->next = &ent->lru;
-	delta_base_cache_lru.prev = &ent->lru;
+	lru_add_tail(ent);
+	/* the evictions above may have changed the chain */
+	pos = delta_base_cache_slot(p, base_offset);
+	ent->next = *pos;
+	*pos = ent;
+
+	delta_base_cache_stats.nr++;
+	if (delta_base_cache_stats.max_nr < delta_base_cache_stats.nr)
+		delta_base_cache_stats.max_nr = delta_base_cache_stats.nr;
+	if (delta_base_cache_stats.max_cached < delta_base_cached)
+		delta_base_cache_stats.max_cached = delta_base_cached;
+}
+
+/*
+ * Reconstructing an object at the end of a long delta chain one delta
+ * at a time builds every object in between, so a chain of depth n
+ * moves n times the object's size through memory.  Instead, when
+ * the chain below an object is longer than one delta, compose its
+ * deltas into one and apply that to the bottom base once; only the
+ * deltas, the base and the result are ever in memory.
+ *
+ * The composition is kept, keyed on the object's (pack, offset), in a
+ * cache of its own, within a quarter of delta_base_cache_limit.  The
+ * next time the object, or one whose chain goes through it, is read,
+ * the walk down the chain stops there.  The walk also stops at a base
+ * in the delta base cache.
+ */
+
+static struct delta_base_cache_lru_list composed_delta_lru = {
+	&composed_delta_lru, &composed_delta_lru
+};
+
+struct composed_delta_cache_entry {
+	struct delta_base_cache_lru_list lru;
+	struct composed_delta_cache_entry *next;
+	struct composed_delta *cd;
+	unsigned long memsize;
+	struct packed_git *p;
+	off_t obj_offset, base_offset;
+	enum object_type type;
+};
+
+static struct composed_delta_cache_entry **composed_delta_cache;
+
+static struct composed_delta_cache_entry **find_composed_delta(
+	struct packed_git *p, off_t obj_offset)
+{
+	struct composed_delta_cache_entry **pos;
+	unsigned long hash;
+
+	if (!composed_delta_cache) {
+		if (!delta_base_cache)
+			init_delta_base_cache();
+		composed_delta_cache = xcalloc(delta_base_cache_size,
+					       sizeof(*composed_delta_cache));
+	}
+	hash = (unsigned long)p + (unsigned long)obj_offset;
+	hash += (hash >> 8) + (hash >> 16);
+	pos = composed_delta_cache + hash % delta_base_cache_size;
+	while (*pos && ((*pos)->p != p || (*pos)->obj_offset != obj_offset))
+		pos = &(*pos)->next;
+	return pos;
+}
+
+/* Take the entry at *pos out of the cache; the caller now owns it */
+static struct composed_delta_cache_entry *detach_composed_delta(
+	struct composed_delta_cache_entry **pos)
+{
+	struct composed_delta_cache_entry *ent = *pos;
+
+	*pos = ent->next;
+	ent->lru.next->prev = ent->lru.prev;
+	ent->lru.prev->next = ent->lru.next;
+	composed_delta_cached -= ent->memsize;
+	return ent;
+}
+
+static void free_composed_delta_entry(struct composed_delta_cache_entry *ent)
+{
+	free(ent->cd);
+	free(ent);
+}
+
+static void clear_composed_delta_cache(void)
+{
+	while (composed_delta_lru.next != &composed_delta_lru) {
+		struct composed_delta_cache_entry *ent =
+			(void *)composed_delta_lru.next;
+		free_composed_delta_entry(detach_composed_delta(
+			find_composed_delta(ent->p, ent->obj_offset)));
+	}
+}
+
+static void add_composed_delta(struct composed_delta_cache_entry *ent)
+{
+	struct composed_delta_cache_entry **pos;
+
+	pos = find_composed_delta(ent->p, ent->obj_offset);
+	if (*pos)
+		free_composed_delta_entry(detach_composed_delta(pos));
+	composed_delta_cached += ent->memsize;
+	while (composed_delta_cached > delta_base_cache_limit / 4 &&
+	       composed_delta_lru.next != &composed_delta_lru) {
+		struct composed_delta_cache_entry *f =
+			(void *)composed_delta_lru.next;
+		free_composed_delta_entry(detach_composed_delta(
+			find_composed_delta(f->p, f->obj_offset)));
+	}
+	if (composed_delta_cached > delta_base_cache_limit / 4) {
+		/* too big to be cached at all */
+		composed_delta_cached -= ent->memsize;
+		free_composed_delta_entry(ent);
+		return;
+	}
+	ent->lru.next = &composed_delta_lru;
+	ent->lru.prev = composed_delta_lru.prev;
+	composed_delta_lru.prev->next = &ent->lru;
+	composed_delta_lru.prev = &ent->lru;
+	/* the evictions above may have changed the chain */
+	pos = find_composed_delta(ent->p, ent->obj_offset);
+	ent->next = *pos;
+	*pos = ent;
+}
+
+struct delta_link {
+	off_t curpos;		/* of its delta data */
+	unsigned long size;	/* of its delta data, inflated */
+	void *data;
+	struct composed_delta cd;
+};
+
+/*
+ * Like unpack_delta_entry(), but composing the deltas of the chain as
+ * described above.  Returns NULL if the chain is too short to bother,
+ * or if anything goes wrong, for unpack_delta_entry() to do it (and
+ * report errors) the usual way.
+ */
+static void *unpack_collapsed_delta(struct packed_git *p,
+				    struct pack_window **w_curs,
+				    off_t curpos,
+				    unsigned long delta_size,
+				    off_t obj_offset,
+				    enum object_type *type,
+				    unsigned long *sizep)
+{
+	struct delta_link *link = NULL;
+	int nr = 0, alloc = 0, i, depth;
+	struct composed_delta_cache_entry **pos, *hit = NULL, *ent;
+	struct composed_delta cd, next;
+	enum object_type t = *type, base_type;
+	off_t offset = obj_offset, base_offset;
+	void *base = NULL, *result = NULL;
+	unsigned long base_size;
+
+	/* walk down the chain */
+	for (;;) {
+		base_offset = get_delta_base(p, w_curs, &curpos, t, offset);
+		if (!base_offset)
+			break;
+		ALLOC_GROW(link, nr + 1, alloc);
+		link[nr].curpos = curpos;
+		link[nr].size = delta_size;
+		link[nr].data = NULL;
+		memset(&link[nr].cd, 0, sizeof(link[nr].cd));
+		nr++;
+		if (*find_delta_base_cache(p, base_offset))
+			break;
+		pos = find_composed_delta(p, base_offset);
+		if (*pos) {
+			hit = detach_composed_delta(pos);
+			delta_base_cache_stats.composed_hits++;
+			base_offset = hit->base_offset;
+			break;
+		}
+		offset = base_offset;
+		curpos = offset;
+		t = unpack_object_header(p, w_curs, &curpos, &delta_size);
+		if (t != OBJ_OFS_DELTA && t != OBJ_REF_DELTA)
+			break;
+	}
+	unuse_pack(w_curs);
+	if (!base_offset || (nr < 2 && !hit))
+		goto out;
+
+	base = cache_or_unpack_entry(p, base_offset, &base_size,
+				     &base_type, 0);
+	if (!base)
+		goto out;
+	for (i = 0; i < nr; i++) {
+		link[i].data = unpack_compressed_entry(p, w_curs,
+						       link[i].curpos,
+						       link[i].size);
+		unuse_pack(w_curs);
+		if (!link[i].data)
+			goto out;
+	}
+
+	/* nothing here is shared, so let other readers in meanwhile */
+	depth = obj_read_release();
+	for (i = 0; i < nr; i++)
+		if (parse_delta(&link[i].cd, link[i].data, link[i].size))
+			break;
+	if (i == nr) {
+		cd = link[0].cd;
+		memset(&link[0].cd, 0, sizeof(cd));
+		for (i = 1; i <= nr; i++) {
+			const struct composed_delta *lower;
+			if (i < nr)
+				lower = &link[i].cd;
+			else if (hit)
+				lower = hit->cd;
+			else
+				break;
+			if (compose_delta(&next, &cd, lower)) {
+				free_composed_delta(&next);
+				break;
+			}
+			free_composed_delta(&cd);
+			cd = next;
+		}
+		if (i >= nr)
+			result = apply_composed_delta(base, base_size,
+						      &cd, sizep);
+		if (result) {
+			ent = xmalloc(sizeof(*ent));
+			ent->cd = dup_composed_delta(&cd, &ent->memsize);
+			ent->p = p;
+			ent->obj_offset = obj_offset;
+			ent->base_offset = base_offset;
+			ent->type = base_type;
+		}
+		free_composed_delta(&cd);
+	}
+	obj_read_reacquire(depth);
+
+	if (result) {
+		add_composed_delta(ent);
+		*type = base_type;
+		delta_base_cache_stats.collapsed++;
+	}
+out:
+	if (hit)
+		add_composed_delta(hit);
+	if (base)
+		add_delta_base_cache(p, base_offset, base, base_size,
+				     base_type);
+	for (i = 0; i < nr; i++) {
+		free_composed_delta(&link[i].cd);
+		free(link[i].data);
+	}
+	free(link);
+	return result;
 }
 
 static void *read_object(const unsigned char *sha1, enum object_type *type,
@@ -1722,6 +2382,15 @@ static void *unpack_delta_entry(struct packed_git *p,
 	void *delta_data, *result, *base;
 	unsigned long base_size;
 	off_t base_offset;
+	int depth;
+
+	/* CRC checks are done object by object, on the usual path */
+	if (!do_check_packed_object_crc) {
+		result = unpack_collapsed_delta(p, w_curs, curpos, delta_size,
+						obj_offset, type, sizep);
+		if (result)
+			return result;
+	}
 
 	base_offset = get_delta_base(p, w_curs, &curpos, *type, obj_offset);
 	if (!base_offset) {
@@ -1739,12 +2408,11 @@ static void *unpack_delta_entry(struct packed_git *p,
 		 * This is costly but should happen only in the presence
 		 * of a corrupted pack, and is better than failing outright.
 		 */
-		struct revindex_entry *revidx;
+		uint32_t pos;
 		const unsigned char *base_sha1;
-		revidx = find_pack_revindex(p, base_offset);
-		if (!revidx)
+		if (offset_to_pack_pos(p, base_offset, &pos) < 0)
 			return NULL;
-		base_sha1 = nth_packed_object_sha1(p, revidx->nr);
+		base_sha1 = nth_packed_object_sha1(p, pack_pos_to_index(p, pos));
 		error("failed to read delta base object %s"
 		      " at offset %"PRIuMAX" from %s",
 		      sha1_to_hex(base_sha1), (uintmax_t)base_offset,
@@ -1763,9 +2431,11 @@ static void *unpack_delta_entry(struct packed_git *p,
 		free(base);
 		return NULL;
 	}
+	depth = obj_read_release();
 	result = patch_delta(base, base_size,
 			     delta_data, delta_size,
 			     sizep);
+	obj_read_reacquire(depth);
 	if (!result)
 		die("failed to apply delta");
 	free(delta_data);
@@ -1774,20 +2444,25 @@ static void *unpack_delta_entry(struct packed_git *p,
 }
 
 int do_check_packed_object_crc;
+int sequential_pack_access;
 
-void *unpack_entry(struct packed_git *p, off_t obj_offset,
-		   enum object_type *type, unsigned long *sizep)
+static void *unpack_entry_1(struct packed_git *p, off_t obj_offset,
+			    enum object_type *type, unsigned long *sizep)
 {
 	struct pack_window *w_curs = NULL;
 	off_t curpos = obj_offset;
 	void *data;
 
 	if (do_check_packed_object_crc && p->index_version > 1) {
-		struct revindex_entry *revidx = find_pack_revindex(p, obj_offset);
-		unsigned long len = revidx[1].offset - obj_offset;
-		if (check_pack_crc(p, &w_curs, obj_offset, len, revidx->nr)) {
+		uint32_t pos, nr;
+		unsigned long len;
+		if (offset_to_pack_pos(p, obj_offset, &pos) < 0)
+			return NULL;
+		nr = pack_pos_to_index(p, pos);
+		len = pack_pos_to_offset(p, pos + 1) - obj_offset;
+		if (check_pack_crc(p, &w_curs, obj_offset, len, nr)) {
 			const unsigned char *sha1 =
-				nth_packed_object_sha1(p, revidx->nr);
+				nth_packed_object_sha1(p, nr);
 			error("bad packed object CRC for %s",
 			      sha1_to_hex(sha1));
 			mark_bad_packed_object(p, sha1);
@@ -1818,6 +2493,17 @@ void *unpack_entry(struct packed_git *p, off_t obj_offset,
 	return data;
 }
 
+void *unpack_entry(struct packed_git *p, off_t obj_offset,
+		   enum object_type *type, unsigned long *sizep)
+{
+	void *data;
+
+	obj_read_lock();
+	data = unpack_entry_1(p, obj_offset, type, sizep);
+	obj_read_unlock();
+	return data;
+}
+
 const unsigned char *nth_packed_object_sha1(struct packed_git *p,
 					    uint32_t n)
 {
@@ -1856,8 +2542,7 @@ off_t nth_packed_object_offset(const struct packed_git *p, uint32_t n)
 	}
 }
 
-off_t find_pack_entry_one(const unsigned char *sha1,
-				  struct packed_git *p)
+int find_pack_entry_pos(const unsigned char *sha1, struct packed_git *p)
 {
 	const uint32_t *level1_ofs = p->index_data;
 	const unsigned char *index = p->index_data;
@@ -1870,7 +2555,7 @@ off_t find_pack_entry_one(const unsigned char *sha1,
 
 	if (!index) {
 		if (open_pack_index(p))
-			return 0;
+			return -1;
 		level1_ofs = p->index_data;
 		index = p->index_data;
 	}
@@ -1894,15 +2579,11 @@ off_t find_pack_entry_one(const unsigned char *sha1,
 
 	if (use_lookup < 0)
 		use_lookup = !!getenv("GIT_USE_LOOKUP");
-	if (use_lookup) {
-		int pos = sha1_entry_pos(index, stride, 0,
-					 lo, hi, p->num_objects, sha1);
-		if (pos < 0)
-			return 0;
-		return nth_packed_object_offset(p, pos);
-	}
+	if (use_lookup)
+		return sha1_entry_pos(index, stride, 0,
+				      lo, hi, p->num_objects, sha1);
 
-	do {
+	while (lo < hi) {
 		unsigned mi = (lo + hi) / 2;
 		int cmp = hashcmp(index + mi * stride, sha1);
 
@@ -1910,27 +2591,50 @@ off_t find_pack_entry_one(const unsigned char *sha1,
 			printf("lo %u hi %u rg %u mi %u\n",
 			       lo, hi, hi - lo, mi);
 		if (!cmp)
-			return nth_packed_object_offset(p, mi);
+			return mi;
 		if (cmp > 0)
 			hi = mi;
 		else
 			lo = mi+1;
-	} while (lo < hi);
-	return 0;
+	}
+	return -1;
 }
 
-static int find_pack_entry(const unsigned char *sha1, struct pack_entry *e)
+off_t find_pack_entry_one(const unsigned char *sha1,
+				  struct packed_git *p)
+{
+	int pos = find_pack_entry_pos(sha1, p);
+	if (pos < 0)
+		return 0;
+	return nth_packed_object_offset(p, pos);
+}
+
+int find_pack_entry(const unsigned char *sha1, struct pack_entry *e)
 {
-	static struct packed_git *last_found = (void *)1;
 	struct packed_git *p;
 	off_t offset;
+	int midx;
 
 	prepare_packed_git();
 	if (!packed_git)
 		return 0;
+
+	midx = find_pack_entry_in_midx(sha1, e);
+	if (midx > 0) {
+		p = e->p;
+		if (p->pack_fd != -1 || !open_packed_git(p))
+			return 1;
+		error("packfile %s cannot be accessed", p->pack_name);
+		midx = -1;
+	}
+
 	p = (last_found == (void *)1) ? packed_git : last_found;
 
 	do {
+		/* the multi-pack index already said it is not there */
+		if (!midx && p->multi_pack_index)
+			goto next;
+
 		if (p->num_bad_objects) {
 			unsigned i;
 			for (i = 0; i < p->num_bad_objects; i++)
@@ -2006,7 +2710,7 @@ static int sha1_loose_object_info(const unsigned char *sha1, unsigned long *size
 	return status;
 }
 
-int sha1_object_info(const unsigned char *sha1, unsigned long *sizep)
+static int sha1_object_info_1(const unsigned char *sha1, unsigned long *sizep)
 {
 	struct pack_entry e;
 	int status;
@@ -2019,19 +2723,33 @@ int sha1_object_info(const unsigned char *sha1, unsigned long *sizep)
 
 		/* Not a loose object; someone else may have just packed it. */
 		reprepare_packed_git();
-		if (!find_pack_entry(sha1, &e))
+		if (!find_pack_entry(sha1, &e)) {
+			/* ... or written it after we cached its directory */
+			if (core_loose_object_cache)
+				status = sha1_loose_object_info(sha1, sizep);
 			return status;
+		}
 	}
 
 	status = packed_object_info(e.p, e.offset, sizep);
 	if (status < 0) {
 		mark_bad_packed_object(e.p, sha1);
-		status = sha1_object_info(sha1, sizep);
+		status = sha1_object_info_1(sha1, sizep);
 	}
 
 	return status;
 }
 
+int sha1_object_info(const unsigned char *sha1, unsigned long *sizep)
+{
+	int status;
+
+	obj_read_lock();
+	status = sha1_object_info_1(sha1, sizep);
+	obj_read_unlock();
+	return status;
+}
+
 static void *read_packed_sha1(const unsigned char *sha1,
 			      enum object_type *type, unsigned long *size)
 {
@@ -2114,11 +2832,24 @@ int pretend_sha1_file(void *buf, unsigned long len, enum object_type type,
 	return 0;
 }
 
-static void *read_object(const unsigned char *sha1, enum object_type *type,
-			 unsigned long *size)
+static void *read_loose_sha1(const unsigned char *sha1,
+			     enum object_type *type, unsigned long *size)
 {
 	unsigned long mapsize;
 	void *map, *buf;
+
+	map = map_sha1_file(sha1, &mapsize);
+	if (!map)
+		return NULL;
+	buf = unpack_sha1_file(map, mapsize, type, size, sha1);
+	munmap(map, mapsize);
+	return buf;
+}
+
+static void *read_object(const unsigned char *sha1, enum object_type *type,
+			 unsigned long *size)
+{
+	void *buf;
 	struct cached_object *co;
 
 	co = find_cached_object(sha1);
@@ -2131,23 +2862,28 @@ static void *read_object(const unsigned char *sha1, enum object_type *type,
 	buf = read_packed_sha1(sha1, type, size);
 	if (buf)
 		return buf;
-	map = map_sha1_file(sha1, &mapsize);
-	if (map) {
-		buf = unpack_sha1_file(map, mapsize, type, size, sha1);
-		munmap(map, mapsize);
+	buf = read_loose_sha1(sha1, type, size);
+	if (buf)
 		return buf;
-	}
 	reprepare_packed_git();
-	return read_packed_sha1(sha1, type, size);
+	buf = read_packed_sha1(sha1, type, size);
+	/* the loose object may be newer than its cached directory */
+	if (!buf && core_loose_object_cache)
+		buf = read_loose_sha1(sha1, type, size);
+	return buf;
 }
 
 void *read_sha1_file(const unsigned char *sha1, enum object_type *type,
 		     unsigned long *size)
 {
-	void *data = read_object(sha1, type, size);
+	void *data;
+
+	obj_read_lock();
+	data = read_object(sha1, type, size);
 	/* legacy behavior is to die on corrupted objects */
 	if (!data && (has_loose_object(sha1) || has_packed_and_bad(sha1)))
 		die("object %s is corrupted", sha1_to_hex(sha1));
+	obj_read_unlock();
 	return data;
 }
 
@@ -2277,6 +3013,51 @@ int hash_sha1_file(const void *buf, unsigned long len, const char *type,
 	return 0;
 }
 
+/*
+ * git_SHA1_Multi() for SHA-1 implementations that can only hash one
+ * stream at a time.
+ */
+void serial_SHA1_Multi(int nr, git_SHA_CTX **c,
+		       const void **p, const unsigned long *n)
+{
+	int i;
+	for (i = 0; i < nr; i++)
+		git_SHA1_Update(c[i], p[i], n[i]);
+}
+
+/*
+ * hash_sha1_file() for "nr" objects, handed to the SHA-1 code
+ * MAX_SHA1_BATCH at a time so that a multi-buffer implementation
+ * can work on them in parallel.
+ */
+void hash_sha1_files(int nr, const void **buf, const unsigned long *len,
+		     const char **type, unsigned char **sha1)
+{
+	git_SHA_CTX c[MAX_SHA1_BATCH], *cp[MAX_SHA1_BATCH];
+	char hdr[32];
+	int i, hdrlen;
+
+	while (nr > 0) {
+		int batch = nr < MAX_SHA1_BATCH ? nr : MAX_SHA1_BATCH;
+
+		for (i = 0; i < batch; i++) {
+			hdrlen = sprintf(hdr, "%s %lu", type[i], len[i]) + 1;
+			git_SHA1_Init(&c[i]);
+			git_SHA1_Update(&c[i], hdr, hdrlen);
+			cp[i] = &c[i];
+		}
+		git_SHA1_Multi(batch, cp, buf, len);
+		for (i = 0; i < batch; i++)
+			git_SHA1_Final(sha1[i], &c[i]);
+
+		buf += batch;
+		len += batch;
+		type += batch;
+		sha1 += batch;
+		nr -= batch;
+	}
+}
+
 /* Finalize a file on disk, and close it. */
 static void close_sha1_file(int fd)
 {
@@ -2389,7 +3170,9 @@ static int write_loose_object(const unsigned char *sha1, char *hdr, int hdrlen,
 				tmpfile, strerror(errno));
 	}
 
-	return move_temp_to_file(tmpfile, filename);
+	ret = move_temp_to_file(tmpfile, filename);
+	clear_loose_object_subdir(local_loose_objects, sha1[0]);
+	return ret;
 }
 
 int write_sha1_file(void *buf, unsigned long len, const char *type, unsigned char *returnsha1)
@@ -2449,16 +3232,23 @@ int has_pack_file(const unsigned char *sha1)
 int has_sha1_pack(const unsigned char *sha1)
 {
 	struct pack_entry e;
-	return find_pack_entry(sha1, &e);
+	int ret;
+
+	obj_read_lock();
+	ret = find_pack_entry(sha1, &e);
+	obj_read_unlock();
+	return ret;
 }
 
 int has_sha1_file(const unsigned char *sha1)
 {
 	struct pack_entry e;
+	int ret;
 
-	if (find_pack_entry(sha1, &e))
-		return 1;
-	return has_loose_object(sha1);
+	obj_read_lock();
+	ret = find_pack_entry(sha1, &e) || has_loose_object(sha1);
+	obj_read_unlock();
+	return ret;
 }
 
 static int index_mem(unsigned char *sha1, void *buf, size_t size,
@@ -2481,7 +3271,9 @@ static int index_mem(unsigned char *sha1, void *buf, size_t size,
 		}
 	}
 
-	if (write_object)
+	if (write_object && bulk_checkin_plugged())
+		ret = index_bulk_checkin(sha1, buf, size, type);
+	else if (write_object)
 		ret = write_sha1_file(buf, size, typename(type), sha1);
 	else
 		ret = hash_sha1_file(buf, size, typename(type), sha1);
@@ -0,0 +1,288 @@
+#include "cache.h"
+#include "streaming.h"
+
+enum input_source {
+	stream_incore,
+	stream_loose,
+	stream_pack
+};
+
+struct git_istream {
+	enum input_source source;
+	unsigned char sha1[20];
+	unsigned long size;	/* size of the object contents */
+	unsigned long total;	/* bytes handed out so far */
+	z_stream z;
+	enum { z_unused, z_used, z_done, z_error } z_state;
+
+	union {
+		struct {
+			char *buf;
+		} incore;
+
+		struct {
+			void *mapped;
+			unsigned long mapsize;
+			char hdr[32];
+			int hdr_avail;	/* bytes inflated into hdr */
+			int hdr_used;	/* ... of which were handed out */
+		} loose;
+
+		struct {
+			struct packed_git *pack;
+			struct pack_window *w_curs;
+			off_t pos;
+		} in_pack;
+	} u;
+};
+
+static int open_istream_incore(struct git_istream *st, enum object_type *type)
+{
+	st->u.incore.buf = read_sha1_file(st->sha1, type, &st->size);
+	if (!st->u.incore.buf)
+		return -1;
+	st->source = stream_incore;
+	return 0;
+}
+
+static int open_istream_loose(struct git_istream *st, enum object_type *type)
+{
+	int status;
+
+	st->u.loose.mapped = map_sha1_file(st->sha1, &st->u.loose.mapsize);
+	if (!st->u.loose.mapped)
+		return -1;
+	st->source = stream_loose;
+
+	status = unpack_sha1_header(&st->z, st->u.loose.mapped,
+				    st->u.loose.mapsize, st->u.loose.hdr,
+				    sizeof(st->u.loose.hdr));
+	if (status < Z_OK)
+		goto corrupt;
+	st->z_state = z_used;
+	if (status == Z_STREAM_END) {
+		git_inflate_end(&st->z);
+		st->z_state = z_done;
+	}
+
+	if (!memchr(st->u.loose.hdr, '\0', sizeof(st->u.loose.hdr)))
+		goto corrupt;
+	*type = parse_sha1_header(st->u.loose.hdr, &st->size);
+	if (*type < 0)
+		goto corrupt;
+	st->u.loose.hdr_used = strlen(st->u.loose.hdr) + 1;
+	st->u.loose.hdr_avail = st->z.total_out;
+	if (st->z_state == z_done &&
+	    st->u.loose.hdr_avail - st->u.loose.hdr_used != st->size)
+		goto corrupt;
+	return 0;
+
+corrupt:
+	if (st->z_state == z_used)
+		git_inflate_end(&st->z);
+	st->z_state = z_unused;
+	munmap(st->u.loose.mapped, st->u.loose.mapsize);
+	return error("corrupt loose object '%s'", sha1_to_hex(st->sha1));
+}
+
+static int open_istream_pack(struct git_istream *st, struct pack_entry *e,
+			     enum object_type *type)
+{
+	st->u.in_pack.pack = e->p;
+	st->u.in_pack.pos = e->offset;
+	st->u.in_pack.w_curs = NULL;
+
+	*type = unpack_object_header(e->p, &st->u.in_pack.w_curs,
+				     &st->u.in_pack.pos, &st->size);
+	switch (*type) {
+	case OBJ_COMMIT:
+	case OBJ_TREE:
+	case OBJ_BLOB:
+	case OBJ_TAG:
+		break;
+	default:
+		/* deltified entries are reconstructed in core */
+		unuse_pack(&st->u.in_pack.w_curs);
+		return -1;
+	}
+	st->source = stream_pack;
+	memset(&st->z, 0, sizeof(st->z));
+	git_inflate_init(&st->z);
+	st->z_state = z_used;
+	return 0;
+}
+
+struct git_istream *open_istream(const unsigned char *sha1,
+				 enum object_type *type,
+				 unsigned long *size)
+{
+	struct git_istream *st = xcalloc(1, sizeof(*st));
+	struct pack_entry e;
+
+	hashcpy(st->sha1, sha1);
+	if (find_pack_entry(sha1, &e)) {
+		if (!open_istream_pack(st, &e, type))
+			goto done;
+	} else if (!open_istream_loose(st, type))
+		goto done;
+	if (open_istream_incore(st, type)) {
+		free(st);
+		return NULL;
+	}
+done:
+	*size = st->size;
+	return st;
+}
+
+int close_istream(struct git_istream *st)
+{
+	if (st->z_state == z_used)
+		git_inflate_end(&st->z);
+	switch (st->source) {
+	case stream_incore:
+		free(st->u.incore.buf);
+		break;
+	case stream_loose:
+		munmap(st->u.loose.mapped, st->u.loose.mapsize);
+		break;
+	case stream_pack:
+		unuse_pack(&st->u.in_pack.w_curs);
+		break;
+	}
+	free(st);
+	return 0;
+}
+
+static ssize_t stream_corrupt(struct git_istream *st)
+{
+	if (st->z_state == z_used)
+		git_inflate_end(&st->z);
+	st->z_state = z_error;
+	return error("corrupt object '%s'", sha1_to_hex(st->sha1));
+}
+
+/*
+ * Inflate up to "sz" bytes into "buf".  Once all "size" bytes have
+ * been produced, zlib is asked for one more byte to make sure the
+ * stream ends where the object header says it does.
+ */
+static ssize_t read_istream_inflate(struct git_istream *st, char *buf,
+				    size_t sz, size_t total_read)
+{
+	while (st->z_state == z_used) {
+		unsigned char *in = NULL, extra;
+		unsigned int avail;
+		int status;
+
+		if (total_read < sz) {
+			st->z.next_out = (unsigned char *)buf + total_read;
+			st->z.avail_out = sz - total_read;
+		} else if (st->total + total_read == st->size) {
+			st->z.next_out = &extra;
+			st->z.avail_out = 1;
+		} else
+			break;
+
+		if (st->source == stream_pack) {
+			in = use_pack(st->u.in_pack.pack,
+				      &st->u.in_pack.w_curs,
+				      st->u.in_pack.pos, &avail);
+			st->z.next_in = in;
+			st->z.avail_in = avail;
+		}
+		status = git_inflate(&st->z, Z_FINISH);
+		if (in)
+			st->u.in_pack.pos += st->z.next_in - in;
+
+		if (st->z.next_out == &extra + 1)
+			return stream_corrupt(st);
+		if (st->z.next_out != &extra)
+			total_read = (char *)st->z.next_out - buf;
+
+		if (status == Z_STREAM_END) {
+			git_inflate_end(&st->z);
+			st->z_state = z_done;
+			if (st->total + total_read != st->size)
+				return stream_corrupt(st);
+			break;
+		}
+		/*
+		 * Z_BUF_ERROR only means that zlib wants more room, or
+		 * more input: fine when we are at the end of a pack
+		 * window, but a loose object has given us all it has.
+		 */
+		if (status == Z_OK)
+			continue;
+		if (status != Z_BUF_ERROR ||
+		    (st->z.avail_out &&
+		     (st->source != stream_pack || st->z.avail_in)))
+			return stream_corrupt(st);
+	}
+	if (st->z_state == z_error)
+		return -1;
+	st->total += total_read;
+	return total_read;
+}
+
+ssize_t read_istream(struct git_istream *st, char *buf, size_t sz)
+{
+	size_t total_read = 0;
+
+	if (st->size - st->total < sz)
+		sz = st->size - st->total;
+
+	switch (st->source) {
+	case stream_incore:
+		memcpy(buf, st->u.incore.buf + st->total, sz);
+		st->total += sz;
+		return sz;
+	case stream_loose:
+		if (st->u.loose.hdr_used < st->u.loose.hdr_avail) {
+			total_read = st->u.loose.hdr_avail - st->u.loose.hdr_used;
+			if (sz < total_read)
+				total_read = sz;
+			memcpy(buf, st->u.loose.hdr + st->u.loose.hdr_used,
+			       total_read);
+			st->u.loose.hdr_used += total_read;
+		}
+		/* fallthrough */
+	case stream_pack:
+		break;
+	}
+	return read_istream_inflate(st, buf, sz, total_read);
+}
+
+int stream_istream_to_fd(int fd, struct git_istream *st)
+{
+	char buf[16384];
+
+	for (;;) {
+		ssize_t readlen = read_istream(st, buf, sizeof(buf));
+
+		if (readlen < 0)
+			return -1;
+		if (!readlen)
+			return 0;
+		if (write_in_full(fd, buf, readlen) != readlen)
+			return error("unable to write: %s", strerror(errno));
+	}
+}
+
+int stream_blob_to_fd(int fd, const unsigned char *sha1)
+{
+	struct git_istream *st;
+	enum object_type type;
+	unsigned long size;
+	int ret;
+
+	st = open_istream(sha1, &type, &size);
+	if (!st)
+		return error("unable to read %s", sha1_to_hex(sha1));
+	if (type != OBJ_BLOB) {
+		close_istream(st);
+		return error("%s is not a blob", sha1_to_hex(sha1));
+	}
+	ret = stream_istream_to_fd(fd, st);
+	close_istream(st);
+	return ret;
+}
@@ -0,0 +1,37 @@
+#ifndef STREAMING_H
+#define STREAMING_H
+
+/*
+ * Read the contents of an object a piece at a time, so that a large
+ * blob does not have to be held in memory as a whole.  Loose objects
+ * and pack entries stored without a delta are inflated as they are
+ * read; anything else (deltified entries, objects that only exist in
+ * memory) is read with read_sha1_file() and handed out from there.
+ */
+struct git_istream;
+
+extern struct git_istream *open_istream(const unsigned char *sha1,
+					enum object_type *type,
+					unsigned long *size);
+extern int close_istream(struct git_istream *st);
+
+/*
+ * Fill "buf" with up to "len" bytes of the object; returns the number
+ * of bytes read, 0 at the end of the object, or -1 when the object
+ * turns out to be corrupt.
+ */
+extern ssize_t read_istream(struct git_istream *st, char *buf, size_t len);
+
+/*
+ * Copy the rest of the stream to "fd".  Returns 0, or -1 after
+ * reporting an error.
+ */
+extern int stream_istream_to_fd(int fd, struct git_istream *st);
+
+/*
+ * Write the blob "sha1" to "fd"; returns 0, or -1 after reporting an
+ * error when the object is missing, not a blob or corrupt.
+ */
+extern int stream_blob_to_fd(int fd, const unsigned char *sha1);
+
+#endif
@@ -0,0 +1,28 @@
+#!/bin/sh
+
+test_description='Tests history walking performance'
+
+. ./perf-lib.sh
+
+test_expect_success 'setup' '
+	test_perf_generate_repo --commits=2000 --files=500 --changes=5 \
+		--refs=200
+'
+
+test_perf 'rev-list --all' '
+	git rev-list --all >/dev/null
+'
+
+test_perf 'rev-list --all --objects' '
+	git rev-list --all --objects >/dev/null
+'
+
+test_perf 'log --raw' '
+	git log --raw >/dev/null
+'
+
+test_perf 'for-each-ref' '
+	git for-each-ref >/dev/null
+'
+
+test_done
@@ -0,0 +1,24 @@
+#!/bin/sh
+
+test_description='Tests pack-objects performance'
+
+. ./perf-lib.sh
+
+test_expect_success 'setup' '
+	test_perf_generate_repo --commits=500 --files=1000 --changes=20 &&
+	git rev-list --all --objects >objects
+'
+
+test_perf 'pack-objects, reusing deltas' '
+	git pack-objects --stdout <objects >/dev/null
+'
+
+test_perf 'pack-objects --no-reuse-delta' '
+	git pack-objects --stdout --no-reuse-delta <objects >/dev/null
+'
+
+test_perf 'repack -a -d' '
+	git repack -a -d -q
+'
+
+test_done
@@ -0,0 +1,39 @@
+#!/bin/sh
+
+test_description='Tests working tree status performance'
+
+. ./perf-lib.sh
+
+# git status exits with 1 when there is nothing to commit
+status () {
+	git status >/dev/null
+	test $? -le 1
+}
+
+test_expect_success 'setup' '
+	test_perf_generate_repo --commits=10 --files=10000 --depth=3 &&
+	mkdir untracked &&
+	for i in 0 1 2 3 4 5 6 7 8 9
+	do
+		echo $i >untracked/file$i || return 1
+	done
+'
+
+test_perf 'refresh index' '
+	git update-index --refresh
+'
+
+test_perf 'status' '
+	status
+'
+
+test_perf 'status after touching all files' '
+	git ls-files | xargs touch &&
+	status
+'
+
+test_perf 'ls-files --others' '
+	git ls-files --others >/dev/null
+'
+
+test_done
@@ -0,0 +1,105 @@
+#!/bin/sh
+#
+# Performance testing library.  Perf scripts live in t/perf, are
+# named pNNNN-*.sh, and source this file instead of test-lib.sh:
+#
+#   test_description='...'
+#   . ./perf-lib.sh
+#
+#   test_expect_success 'setup' '...'
+#   test_perf 'description' 'commands to time'
+#   test_done
+#
+# Each test_perf runs its commands GIT_PERF_REPEAT_COUNT times (3 by
+# default) and records the minimum, median and maximum wall-clock time
+# in $GIT_PERF_RESULTS_DIR/<script>.results, one tab-separated line per
+# test:
+#
+#   <test>  <min>  <median>  <max>  <runs>  <description>
+#
+# where <runs> is the comma-separated list of all timings, in seconds.
+#
+# Set GIT_PERF_BUILD_DIR to the top of a built git tree to measure
+# that build instead of the one this library lives in.
+
+perf_dir=$(cd "$(dirname "$0")" && pwd)
+perf_script=$(basename "$0" .sh)
+
+GIT_PERF_REPEAT_COUNT=${GIT_PERF_REPEAT_COUNT:-3}
+GIT_PERF_RESULTS_DIR=${GIT_PERF_RESULTS_DIR:-"$perf_dir/test-results"}
+case "$GIT_PERF_RESULTS_DIR" in
+/*) ;;
+*) GIT_PERF_RESULTS_DIR="$(pwd)/$GIT_PERF_RESULTS_DIR" ;;
+esac
+PERL_PATH=${PERL_PATH:-perl}
+
+if test -n "$GIT_PERF_BUILD_DIR"
+then
+	GIT_TEST_INSTALLED=$(cd "$GIT_PERF_BUILD_DIR" && pwd) || exit 1
+	GIT_TEST_EXEC_PATH=$GIT_TEST_INSTALLED
+	export GIT_TEST_INSTALLED GIT_TEST_EXEC_PATH
+fi
+
+mkdir -p "$GIT_PERF_RESULTS_DIR" || exit 1
+perf_results="$GIT_PERF_RESULTS_DIR/$perf_script.results"
+: >"$perf_results" || exit 1
+
+# test-lib.sh expects to be run from t/, and creates the trash
+# directory there.
+cd "$perf_dir/.." || exit 1
+. ./test-lib.sh
+
+# Populate the trash repository from test-genrepo, which takes
+# the options that shape the history (see "test-genrepo -h").
+# GIT_PERF_GENREPO_OPTIONS is appended to them, so that a run can
+# be made on a larger or smaller repository than the script asks for.
+test_perf_generate_repo () {
+	"$TEST_DIRECTORY/../test-genrepo" "$@" $GIT_PERF_GENREPO_OPTIONS |
+	git fast-import --quiet &&
+	git reset -q --hard
+}
+
+perf_now () {
+	"$PERL_PATH" -MTime::HiRes=time -e 'printf "%.6f\n", time'
+}
+
+test_perf () {
+	test "$#" = 3 && { prereq=$1; shift; } || prereq=
+	test "$#" = 2 ||
+	error "bug in the test script: not 2 or 3 parameters to test_perf"
+	if ! test_skip "$@"
+	then
+		say >&3 "timing $GIT_PERF_REPEAT_COUNT runs: $2"
+		perf_runs=
+		perf_i=0
+		while test $perf_i -lt "$GIT_PERF_REPEAT_COUNT"
+		do
+			perf_start=$(perf_now)
+			test_run_ "$2"
+			perf_end=$(perf_now)
+			test "$eval_ret" = 0 || break
+			perf_runs="$perf_runs $perf_start:$perf_end"
+			perf_i=$(($perf_i + 1))
+		done
+		if test "$eval_ret" = 0
+		then
+			perf_stats=$(echo $perf_runs | "$PERL_PATH" -e '
+				my @t = sort { $a <=> $b }
+					map { my ($s, $e) = split /:/; $e - $s }
+					split " ", <STDIN>;
+				my $n = @t;
+				my $median = $n % 2 ? $t[$n / 2] :
+					($t[$n / 2 - 1] + $t[$n / 2]) / 2;
+				printf "%.4f\t%.4f\t%.4f\t%s\n", $t[0], $median,
+					$t[-1], join(",", map { sprintf "%.4f", $_ } @t);
+			') &&
+			printf "%s.%d\t%s\t%s\n" "$perf_script" "$test_count" \
+				"$perf_stats" "$1" >>"$perf_results" &&
+			test_ok_ "$1 ($(echo "$perf_stats" |
+				cut -f1,2 | sed -e 's/	/s min, /')s median)"
+		else
+			test_failure_ "$@"
+		fi
+	fi
+	echo >&3 ""
+}
@@ -0,0 +1,59 @@
+#!/bin/sh
+
+test_description='delta creation and application'
+
+. ./test-lib.sh
+
+# roundtrip a b: make a delta from a to b, check that it gives b back
+roundtrip () {
+	test-delta -d "$1" "$2" delta &&
+	test-delta -p "$1" delta out &&
+	cmp "$2" out
+}
+
+test_expect_success 'setup' '
+	perl -e "print \"line \$_\n\" for 1..5000" >text &&
+	perl -ne "s/^line (\d*7)\$/changed \$1/; print" text >text-changed &&
+	test-genrandom seed 100000 >random &&
+	{
+		head -c 30000 random &&
+		echo inserted &&
+		tail -c 60000 random
+	} >random-changed &&
+	perl -e "print \"a\" x 200000" >same &&
+	perl -e "print \"ab\" x 50000; print \"x\"; print \"ba\" x 50000" \
+		>same-changed &&
+	printf short >short &&
+	printf shorter >shorter
+'
+
+test_expect_success 'delta of changed text' '
+	roundtrip text text-changed &&
+	test $(wc -c <delta) -lt 10000
+'
+
+test_expect_success 'delta of changed binary data' '
+	roundtrip random random-changed &&
+	test $(wc -c <delta) -lt 1000
+'
+
+test_expect_success 'delta against repetitive data' '
+	roundtrip same same-changed &&
+	roundtrip same-changed same &&
+	roundtrip same-changed random
+'
+
+test_expect_success 'delta of buffers smaller than a block' '
+	roundtrip short shorter &&
+	roundtrip shorter text &&
+	roundtrip text short
+'
+
+test_expect_success 'benchmark mode' '
+	test-delta --bench text text-changed 2 >out &&
+	grep "^index " out &&
+	grep "^delta " out &&
+	grep "^patch " out
+'
+
+test_done
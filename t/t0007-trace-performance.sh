@@ -0,0 +1,81 @@
+#!/bin/sh
+
+test_description='GIT_TRACE_PERFORMANCE regions and counters'
+
+. ./test-lib.sh
+
+# events of the given kind, without the parts that change from run to run
+events () {
+	grep "\"event\":\"$1\"" trace |
+	sed -e 's/"pid":[0-9]*,"time_us":[0-9]*,//' \
+	    -e 's/,"wall_us":[0-9]*,"cpu_us":[0-9]*//'
+}
+
+test_expect_success 'setup' '
+	echo one >file &&
+	git add file &&
+	test_tick &&
+	git commit -q -m one &&
+	echo two >file &&
+	git commit -q -a -m two &&
+	echo three >file &&
+	git add file &&
+	echo untracked >untracked
+'
+
+test_expect_success 'nothing is traced by default' '
+	git status >/dev/null &&
+	! test -f trace
+'
+
+test_expect_success 'status reports nested regions' '
+	GIT_TRACE_PERFORMANCE="$(pwd)/trace" git status >/dev/null &&
+	events region_enter >actual &&
+	grep "\"depth\":0,\"category\":\"status\",\"label\":\"prepare_index\"" actual &&
+	grep "\"depth\":1,\"category\":\"index\",\"label\":\"read\"" actual &&
+	grep "\"depth\":1,\"category\":\"index\",\"label\":\"refresh\"" actual &&
+	grep "\"category\":\"dir\",\"label\":\"read_directory\"" actual &&
+	events counter >actual &&
+	grep "\"category\":\"index\",\"name\":\"entries\",\"value\":1}" actual
+'
+
+test_expect_success 'every region is left, with its times' '
+	events region_enter | sed -e "s/region_enter/region/" >enter &&
+	events region_leave | sed -e "s/region_leave/region/" | sort >leave &&
+	sort enter >expect &&
+	test_cmp expect leave &&
+	grep "\"event\":\"region_leave\",.*\"wall_us\":[0-9]*,\"cpu_us\":[0-9]*}" trace &&
+	grep "\"event\":\"start\",.*\"argv\":\[\"status\"\]}" trace &&
+	grep "\"event\":\"exit\",.*\"wall_us\":[0-9]*,\"cpu_us\":[0-9]*}" trace
+'
+
+test_expect_success 'log counts the commits it walked' '
+	rm -f trace &&
+	GIT_TRACE_PERFORMANCE="$(pwd)/trace" git log >/dev/null &&
+	events counter >actual &&
+	grep "\"category\":\"log\",\"name\":\"commits\",\"value\":2}" actual
+'
+
+test_expect_success 'pack-objects reports its phases' '
+	rm -f trace &&
+	git rev-list --objects --all |
+	GIT_TRACE_PERFORMANCE="$(pwd)/trace" \
+		git pack-objects --stdout >/dev/null &&
+	events region_leave >actual &&
+	grep "\"label\":\"enumerate\"" actual &&
+	grep "\"label\":\"prepare_pack\"" actual &&
+	grep "\"label\":\"write\"" actual &&
+	events counter >actual &&
+	grep "\"name\":\"written\",\"value\":6}" actual
+'
+
+test_expect_success 'checkout reports unpack_trees' '
+	rm -f trace &&
+	git reset -q --hard &&
+	GIT_TRACE_PERFORMANCE="$(pwd)/trace" git checkout -q HEAD^ &&
+	events region_leave >actual &&
+	grep "\"category\":\"checkout\",\"label\":\"unpack_trees\"" actual &&
+	grep "\"category\":\"unpack_trees\",\"label\":\"check_updates\"" actual
+'
+
+test_done
@@ -0,0 +1,54 @@
+#!/bin/sh
+
+test_description='test-bench microbenchmarks'
+
+. ./test-lib.sh
+
+check_output () {
+	grep -v "^#" out | cut -f1 >names &&
+	test_cmp expect names &&
+	! grep "	0	" out
+}
+
+test_expect_success 'generated data' '
+	test-bench --count=2000 --rounds=1 --size=4096 >out &&
+	cat >expect <<-\EOF &&
+	lookup_object
+	lookup_hash
+	sha1_entry_pos
+	find_pack_entry_one
+	index_name_pos
+	create_delta_index
+	create_delta
+	patch_delta
+	xdl_diff
+	EOF
+	check_output
+'
+
+test_expect_success 'selected benchmarks' '
+	test-bench --count=100 --rounds=1 lookup_hash delta >out &&
+	printf "%s\n" lookup_hash create_delta_index create_delta \
+		patch_delta >expect &&
+	check_output
+'
+
+test_expect_success 'unknown benchmark' '
+	test_must_fail test-bench no_such_thing
+'
+
+test_expect_success 'repository data' '
+	for i in 1 2 3 4 5 6 7 8 9
+	do
+		echo $i >file$i &&
+		git add file$i &&
+		git commit -q -m $i || return 1
+	done &&
+	git repack -a -d -q &&
+	test-bench --repo --count=500 --rounds=1 lookup_object \
+		find_pack_entry_one index_name_pos >out &&
+	printf "%s\n" lookup_object find_pack_entry_one index_name_pos >expect &&
+	check_output
+'
+
+test_done
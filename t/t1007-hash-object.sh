@@ -165,6 +165,34 @@ test_expect_success "hash two files with names on stdin" '
 	test "$sha1s" = "$(echo_without_newline "$filenames" | git hash-object --stdin-paths)"
 '
 
+test_expect_success "hash many files of different sizes with names on stdin" '
+	mkdir many &&
+	for i in 0 1 2 3 4 5 6 7 8 9 10 11 12 13 14 15 16 17 18 19
+	do
+		test-genrandom $i $(($i * $i * 97)) >many/$i || return 1
+	done &&
+	ls many/* >paths &&
+	while read path
+	do
+		git hash-object $path || return 1
+	done <paths >expect &&
+	git hash-object --stdin-paths <paths >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success "hash names on stdin one at a time" '
+	perl -MIPC::Open2 -e "
+		alarm 30;
+		open2(my \$out, my \$in, qw(git hash-object --stdin-paths));
+		for (@ARGV) {
+			print \$in \"\$_\n\";
+			\$in->flush;
+			print scalar <\$out>;
+		}
+	" $(cat paths) >actual &&
+	test_cmp expect actual
+'
+
 for args in "-w --stdin-paths" "--stdin-paths -w"; do
 	push_repo
 
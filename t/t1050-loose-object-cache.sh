@@ -0,0 +1,83 @@
+#!/bin/sh
+
+test_description='loose object lookups with core.looseObjectCache'
+
+. ./test-lib.sh
+
+test_expect_success 'setup' '
+	for i in 1 2 3 4 5
+	do
+		echo $i >file$i &&
+		git add file$i &&
+		git commit -q -m $i || return 1
+	done &&
+	git rev-list --objects HEAD | cut -c1-40 >objs &&
+	git config core.looseObjectCache true
+'
+
+test_expect_success 'existing loose objects are found' '
+	git cat-file --batch-check <objs >out &&
+	! grep missing out &&
+	test $(wc -l <out) = $(wc -l <objs)
+'
+
+test_expect_success 'missing loose objects are reported missing' '
+	echo 0000000000000000000000000000000000000001 >missing &&
+	git cat-file --batch-check <missing >out &&
+	grep missing out &&
+	test_must_fail git cat-file -e 0000000000000000000000000000000000000001
+'
+
+test_expect_success 'objects written by the same process are seen' '
+	echo 6 >file6 &&
+	git add file6 &&
+	git commit -q -m 6 &&
+	git fsck --full
+'
+
+test_expect_success 'objects written by another process are seen' '
+	for opt in --batch-check --batch
+	do
+		echo "first $opt" >first &&
+		first=$(git hash-object -w first) &&
+		perl -MDigest::SHA=sha1_hex -e "
+			my \$i = 0;
+			\$i++ while (substr(sha1_hex(\"blob \" . length(\"\$i\n\") .
+					\"\\0\$i\n\"), 0, 2) ne substr(\"$first\", 0, 2));
+			print \"\$i\n\";
+		" >later &&
+		name=$(git hash-object later) &&
+		echo "$first blob $(wc -c <first)" >expect &&
+		echo "$name blob $(wc -c <later)" >>expect &&
+		perl -MIPC::Open2 -e "
+			alarm 30;
+			open2(my \$out, my \$in, qw(git cat-file $opt));
+			for (@ARGV) {
+				system(\"git hash-object -w later >/dev/null\")
+					if \$_ eq \"$name\";
+				print \$in \"\$_\n\";
+				\$in->flush;
+				my \$line = <\$out>;
+				print \$line;
+				read(\$out, my \$buf, \$1 + 1)
+					if \"$opt\" eq \"--batch\" && \$line =~ / (\d+)\$/;
+			}
+		" $first $name >actual &&
+		test_cmp expect actual || return 1
+	done
+'
+
+test_expect_success 'objects in an alternate are found' '
+	mkdir alt &&
+	(
+		cd alt &&
+		git init &&
+		echo "$(pwd)/../.git/objects" >.git/objects/info/alternates &&
+		git config core.looseObjectCache true &&
+		git cat-file --batch-check <../objs >out &&
+		! grep missing out &&
+		test $(wc -l <out) = $(wc -l <../objs)
+	)
+'
+
+test_done
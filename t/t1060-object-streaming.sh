@@ -0,0 +1,89 @@
+#!/bin/sh
+
+test_description='reading large blobs a piece at a time'
+
+. ./test-lib.sh
+
+test_expect_success 'setup' '
+	test-genrandom big 200000 >big &&
+	cp big big-copy &&
+	echo small >small &&
+	printf "line one\nline two\n" >text &&
+	git add big small text &&
+	git commit -q -m initial &&
+	big=$(git rev-parse HEAD:big) &&
+	git config core.bigFileThreshold 1k
+'
+
+check_all () {
+	git cat-file blob $big >actual &&
+	test_cmp big-copy actual &&
+	git cat-file -p $big >actual &&
+	test_cmp big-copy actual &&
+	echo $big | git cat-file --batch >actual &&
+	{
+		echo "$big blob 200000" &&
+		cat big-copy &&
+		echo
+	} >expect &&
+	test_cmp expect actual &&
+	rm -f big &&
+	git checkout-index -f big &&
+	test_cmp big-copy big &&
+	git archive HEAD >out.tar &&
+	rm -rf x && mkdir x &&
+	(cd x && "$TAR" xf ../out.tar) &&
+	test_cmp big-copy x/big
+}
+
+test_expect_success 'loose blob' '
+	check_all
+'
+
+test_expect_success 'undeltified blob in a pack' '
+	git repack -a -d -q &&
+	check_all
+'
+
+test_expect_success 'undeltified blob across pack windows' '
+	git config core.packedGitWindowSize 8k &&
+	check_all &&
+	git config --unset core.packedGitWindowSize
+'
+
+test_expect_success 'deltified blob in a pack' '
+	cat big-copy small >big &&
+	git add big &&
+	git commit -q -m delta &&
+	git repack -a -d -q -f &&
+	git reset -q --hard HEAD^ &&
+	check_all
+'
+
+test_expect_success 'blob needing conversion is written converted' '
+	git config core.autocrlf true &&
+	rm -f text &&
+	git checkout-index -f text &&
+	printf "line one\r\nline two\r\n" >expect &&
+	test_cmp expect text &&
+	git config core.autocrlf false
+'
+
+test_expect_success 'corrupt loose object is refused' '
+	mkdir corrupt &&
+	(
+		cd corrupt &&
+		git init -q &&
+		git config core.bigFileThreshold 1k &&
+		test-genrandom corrupt 100000 >file &&
+		blob=$(git hash-object -w file) &&
+		obj=.git/objects/$(echo $blob | sed -e "s|^..|&/|") &&
+		size=$(wc -c <$obj) &&
+		chmod +w $obj &&
+		dd if=$obj of=tmp bs=1 count=$(($size / 2)) 2>/dev/null &&
+		mv -f tmp $obj &&
+		test_must_fail git cat-file blob $blob >/dev/null
+	)
+'
+
+test_done
@@ -0,0 +1,149 @@
+#!/bin/sh
+
+test_description='split index mode'
+
+. ./test-lib.sh
+
+z40=0000000000000000000000000000000000000000
+
+# The same commands are run in two repositories, one with a split
+# index and one without; the entries must always agree.
+both () {
+	(cd split && eval "$1") &&
+	(cd plain && eval "$1")
+}
+
+check_entries () {
+	(cd split && git ls-files --stage) >expect &&
+	(cd plain && git ls-files --stage) >actual &&
+	test_cmp expect actual
+}
+
+check_index () {
+	check_entries &&
+	(cd split && git diff-files --quiet) &&
+	(cd plain && git diff-files --quiet)
+}
+
+shared_indexes () {
+	ls split/.git | grep -c "^sharedindex\."
+}
+
+index_size () {
+	wc -c <split/.git/index
+}
+
+test_expect_success 'setup' '
+	mkdir split plain &&
+	both "git init -q" &&
+	both "for i in 0 1 2 3 4 5 6 7 8 9; do echo \$i >file\$i || exit 1; done" &&
+	both "git add . && git commit -q -m initial" &&
+	(cd split && git config splitIndex.maxPercentChange 100)
+'
+
+test_expect_success 'enable split index' '
+	(cd split && git update-index --split-index) &&
+	test $(shared_indexes) = 1 &&
+	test $(index_size) -lt $(cat split/.git/sharedindex.* | wc -c) &&
+	check_index
+'
+
+test_expect_success 'add, modify and remove entries' '
+	both "echo new >new && git add new" &&
+	both "echo changed >file3 && git add file3" &&
+	both "git rm -q file5" &&
+	both "chmod +x file7 && git add file7" &&
+	test $(shared_indexes) = 1 &&
+	check_index
+'
+
+test_expect_success 'unmerged entries' '
+	blob=$(echo other | (cd split && git hash-object -w --stdin)) &&
+	(cd plain && echo other | git hash-object -w --stdin) &&
+	both "printf \"0 $z40\tfile1\n100644 $blob 2\tfile1\n\" |
+	      git update-index --index-info" &&
+	check_entries &&
+	both "echo resolved >file1 && git add file1" &&
+	check_index
+'
+
+test_expect_success 'commit, checkout and reset' '
+	both "git commit -q -m second" &&
+	both "git checkout -q -b side HEAD^" &&
+	both "echo side >file9 && git commit -q -a -m side" &&
+	check_index &&
+	both "git checkout -q master" &&
+	both "git reset -q --hard HEAD^" &&
+	check_index
+'
+
+test_expect_success 'too many changes write a new shared index' '
+	before=$(shared_indexes) &&
+	(cd split && git config splitIndex.maxPercentChange 10) &&
+	both "for i in 0 1 2 3 4 6 7 8; do echo more >>file\$i || exit 1; done" &&
+	both "git add ." &&
+	test $(shared_indexes) = $(($before + 1)) &&
+	test $(index_size) -lt 200 &&
+	check_index
+'
+
+test_expect_success 'core.splitIndex splits an index' '
+	(
+		cd plain &&
+		git config core.splitIndex true &&
+		echo split >file0 &&
+		git add file0 &&
+		ls .git/sharedindex.* &&
+		git config core.splitIndex false &&
+		git add file1 &&
+		git config --unset core.splitIndex
+	) &&
+	(cd split && echo split >file0 && git add file0 file1) &&
+	check_index
+'
+
+test_expect_success 'disable split index' '
+	(cd split && git update-index --no-split-index) &&
+	test $(index_size) -gt 200 &&
+	both "echo more >>file2 && git add file2" &&
+	test $(index_size) -gt 200 &&
+	check_index
+'
+
+three_weeks_ago=-1814400
+
+test_expect_success 'reading an index keeps its shared index fresh' '
+	(
+		cd split &&
+		git update-index --split-index &&
+		test-chmtime =$three_weeks_ago .git/sharedindex.* &&
+		test -z "$(find .git -name "sharedindex.*" -mtime -1)" &&
+		git ls-files >/dev/null &&
+		test -n "$(find .git -name "sharedindex.*" -mtime -1)"
+	)
+'
+
+test_expect_success 'another index file leaves the main shared index alone' '
+	(
+		cd split &&
+		test-chmtime =$three_weeks_ago .git/sharedindex.* &&
+		git config core.splitIndex true &&
+		GIT_INDEX_FILE=.git/tmpidx git read-tree HEAD &&
+		git config --unset core.splitIndex &&
+		test $(ls .git | grep -c "^sharedindex\.") = 2 &&
+		git ls-files >/dev/null &&
+		{ git status >/dev/null; test $? -le 1; }
+	) &&
+	check_entries
+'
+
+test_expect_success 'a missing shared index is an error' '
+	(
+		cd split &&
+		rm -f .git/tmpidx &&
+		rm .git/sharedindex.* &&
+		test_must_fail git ls-files
+	)
+'
+
+test_done
@@ -0,0 +1,126 @@
+#!/bin/sh
+
+test_description='reading the index in several threads'
+
+. ./test-lib.sh
+
+threads () {
+	rm -f trace &&
+	GIT_TRACE_PERFORMANCE="$(pwd)/trace" git ls-files >/dev/null &&
+	sed -n -e 's/.*"name":"threads","value":\([0-9]*\)}.*/\1/p' trace
+}
+
+# "git update-index" writes the index only if something changed
+rewrite_index () {
+	echo more >>dir9/file9 &&
+	git update-index dir9/file9
+}
+
+# what is read from the index, with the given number of threads
+dump_index () {
+	git config index.threads $1 &&
+	git ls-files --stage >ls-files-$1 &&
+	git ls-files -t >ls-files-t-$1 &&
+	test-dump-cache-tree >cache-tree-$1 &&
+	git diff-files --name-only >diff-files-$1
+}
+
+test_expect_success 'setup' '
+	for i in 0 1 2 3 4 5 6 7 8 9
+	do
+		mkdir dir$i &&
+		for j in 0 1 2 3 4 5 6 7 8 9
+		do
+			echo $i$j >dir$i/file$j
+		done
+	done &&
+	long=a123456789b123456789c123456789d123456789e123456789 &&
+	mkdir $long &&
+	echo long >$long/$long &&
+	git add . &&
+	test_tick &&
+	git commit -q -m initial &&
+	echo intent >intent &&
+	git add -N intent &&
+	echo changed >dir3/file3 &&
+	git update-index dir5/file5 &&
+	git config index.threads 4 &&
+	rewrite_index
+'
+
+if grep IEOT .git/index >/dev/null
+then
+	test_set_prereq THREADS
+else
+	say "skipping tests of reading the index in threads"
+fi
+
+test_expect_success THREADS 'a large index records where its entries are' '
+	grep IEOT .git/index >/dev/null &&
+	grep EOIE .git/index >/dev/null &&
+	test $(threads) = 4
+'
+
+test_expect_success 'threads read the same index as one does' '
+	dump_index 1 &&
+	dump_index 4 &&
+	dump_index 3 &&
+	test_cmp ls-files-1 ls-files-4 &&
+	test_cmp ls-files-1 ls-files-3 &&
+	test_cmp ls-files-t-1 ls-files-t-4 &&
+	test_cmp cache-tree-1 cache-tree-4 &&
+	test_cmp diff-files-1 diff-files-4 &&
+	printf "dir3/file3\nintent\n" >expect &&
+	test_cmp expect diff-files-4
+'
+
+test_expect_success THREADS 'no more threads than blocks are used' '
+	git config index.threads 8 &&
+	test $(threads) = 4 &&
+	git config index.threads 2 &&
+	test $(threads) = 2
+'
+
+test_expect_success 'index.threads=false writes no offsets' '
+	git config index.threads false &&
+	rewrite_index &&
+	! grep IEOT .git/index >/dev/null &&
+	! grep EOIE .git/index >/dev/null &&
+	dump_index 1 &&
+	dump_index 4 &&
+	test_cmp ls-files-1 ls-files-4 &&
+	test_cmp cache-tree-1 cache-tree-4
+'
+
+test_expect_success 'a small index is read by one thread' '
+	git config --unset index.threads &&
+	rewrite_index &&
+	! grep IEOT .git/index >/dev/null &&
+	test -z "$(threads)"
+'
+
+test_expect_success THREADS 'other extensions are read along with the entries' '
+	git config index.threads 4 &&
+	git update-index --split-index &&
+	for i in 0 1 2 3 4 5 6 7
+	do
+		echo split >dir$i/file0
+	done &&
+	git update-index dir?/file0 &&
+	test $(threads) = 4 &&
+	dump_index 1 &&
+	dump_index 4 &&
+	test_cmp ls-files-1 ls-files-4 &&
+	test_cmp cache-tree-1 cache-tree-4 &&
+	git update-index --no-split-index --untracked-cache &&
+	git status >/dev/null &&
+	git ls-files -o --exclude-standard >.git/untracked-1 &&
+	rm -f trace &&
+	GIT_TRACE_PERFORMANCE="$(pwd)/trace" \
+		git ls-files -o --exclude-standard >.git/untracked-4 &&
+	test_cmp .git/untracked-1 .git/untracked-4 &&
+	grep "\"name\":\"threads\",\"value\":4}" trace >/dev/null &&
+	grep "directories-cached" trace >/dev/null
+'
+
+test_done
@@ -0,0 +1,74 @@
+#!/bin/sh
+
+test_description='adding files with core.bulkCheckin'
+
+. ./test-lib.sh
+
+count_loose () {
+	find .git/objects/?? -type f 2>/dev/null | wc -l
+}
+
+count_packs () {
+	ls .git/objects/pack/pack-*.pack 2>/dev/null | wc -l
+}
+
+test_expect_success 'setup' '
+	git config core.bulkCheckin true &&
+	for i in 0 1 2 3 4 5 6 7 8 9
+	do
+		echo "file $i" >file$i || return 1
+	done &&
+	echo "file 0" >same-as-0
+'
+
+test_expect_success 'git add writes new blobs into one pack' '
+	git add file* same-as-0 &&
+	test $(count_loose) = 0 &&
+	test $(count_packs) = 1 &&
+	git verify-pack -v .git/objects/pack/pack-*.idx >list &&
+	test $(grep -c " blob " list) = 10 &&
+	for i in 0 1 2 3 4 5 6 7 8 9
+	do
+		echo "file $i" >expect &&
+		git cat-file blob :file$i >actual &&
+		test_cmp expect actual || return 1
+	done
+'
+
+test_expect_success 'adding known objects writes no pack' '
+	git add file* &&
+	test $(count_packs) = 1
+'
+
+test_expect_success 'commit -a packs changed files' '
+	git commit -q -m initial &&
+	echo changed >file3 &&
+	echo changed too >file4 &&
+	git commit -q -a -m changed &&
+	test $(count_packs) = 2 &&
+	git show HEAD:file3 >actual &&
+	echo changed >expect &&
+	test_cmp expect actual &&
+	git fsck --full
+'
+
+test_expect_success 'update-index --add uses a pack too' '
+	echo new >new1 &&
+	echo newer >new2 &&
+	git update-index --add new1 new2 &&
+	test $(count_packs) = 3 &&
+	git cat-file blob :new2 >actual &&
+	echo newer >expect &&
+	test_cmp expect actual
+'
+
+test_expect_success 'without core.bulkCheckin objects are loose' '
+	git config core.bulkCheckin false &&
+	before=$(count_loose) &&
+	echo loose >loose &&
+	git add loose &&
+	test $(count_loose) = $(($before + 1)) &&
+	test $(count_packs) = 3
+'
+
+test_done
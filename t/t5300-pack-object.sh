@@ -398,4 +398,85 @@ test_expect_success 'tolerate absurdly small packsizelimit' '
 	test $(wc -l <obj-list) = $(ls test-9-*.pack | wc -l)
 '
 
+test_expect_success 'threaded pack-objects reads objects consistently' '
+	git config --unset pack.packSizeLimit &&
+	mkdir threaded &&
+	(
+		cd threaded &&
+		git init &&
+		i=0 &&
+		while test $i -lt 48
+		do
+			f=file$(($i % 8 + 1)) &&
+			perl -e "print \"line \$_ $i\n\" for 1..1000" >>$f &&
+			git add $f &&
+			git commit -q -m $i &&
+			i=$(($i + 1)) || exit 1
+		done &&
+		git repack -a -d -q &&
+		git config core.packedGitWindowSize 8192 &&
+		git config core.deltaBaseCacheLimit 4096 &&
+		git rev-list --objects HEAD >objs &&
+		cut -d" " -f1 objs >names &&
+		for threads in 1 4
+		do
+			name=$(git pack-objects --threads=$threads --window=10 \
+				--no-reuse-delta test-10-$threads <objs) &&
+			git verify-pack -v test-10-$threads-$name.idx >list-$threads &&
+			GIT_DIR=check-$threads git init -q &&
+			cp test-10-$threads-$name.* check-$threads/objects/pack/ &&
+			GIT_DIR=check-$threads git cat-file --batch \
+				<names >contents-$threads || exit 1
+		done &&
+		grep "^chain length = [2-9]" list-4 &&
+		test_cmp contents-1 contents-4
+	)
+'
+
+test_expect_success 'threaded pack-objects writes the same pack' '
+	(
+		cd threaded &&
+		for i in 1 2 3 4 5 6 7 8
+		do
+			echo $i >>file$i &&
+			git add file$i || exit 1
+		done &&
+		git commit -q -m loose &&
+		git rev-list --objects --all >objs &&
+		for args in "" "--no-reuse-object"
+		do
+			name=$(git pack-objects --threads=1 --window=100 \
+				$args serial <objs) &&
+			git pack-objects --threads=4 --window=100 \
+				$args threaded <objs &&
+			cmp serial-$name.pack threaded-$name.pack || exit 1
+		done &&
+		git config pack.compression 9 &&
+		git pack-objects --threads=1 --window=100 --no-reuse-object \
+			--stdout <objs >serial.pack &&
+		git pack-objects --threads=4 --window=100 --no-reuse-object \
+			--stdout <objs >threaded.pack &&
+		cmp serial.pack threaded.pack
+	)
+'
+
+test_expect_success 'threaded pack-objects writes the same thin pack' '
+	(
+		cd threaded &&
+		printf "HEAD\n^HEAD~8\n" >revs &&
+		git pack-objects --threads=1 --window=100 --no-reuse-object \
+			--revs --thin --delta-base-offset --stdout \
+			<revs >serial-thin.pack &&
+		git pack-objects --threads=4 --window=100 --no-reuse-object \
+			--revs --thin --delta-base-offset --stdout \
+			<revs >threaded-thin.pack &&
+		cmp serial-thin.pack threaded-thin.pack &&
+		GIT_DIR=thin git init -q &&
+		cp -R .git/objects/pack thin/objects/ &&
+		rm -f thin/objects/pack/pack-*.keep &&
+		GIT_DIR=thin git index-pack --stdin --fix-thin \
+			<threaded-thin.pack
+	)
+'
+
 test_done
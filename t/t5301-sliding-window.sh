@@ -57,4 +57,57 @@ test_expect_success \
      git config --unset core.packedGitLimit &&
      git verify-pack -v "$pack2"'
 
+test_expect_success \
+    'reading from many packs, packedGit{WindowSize,Limit} == 1 page' \
+    'for i in 1 2 3 4 5 6 7 8
+     do
+         test-genrandom "pack $i" 8192 >e$i &&
+         git hash-object -w e$i |
+         git pack-objects -q .git/objects/pack/pack >/dev/null ||
+         return 1
+     done &&
+     git prune-packed &&
+     for i in 1 2 3 4 5 6 7 8
+     do
+         git hash-object e$i || return 1
+     done >objects &&
+     git config core.packedGitWindowSize 512 &&
+     git config core.packedGitLimit 512 &&
+     git cat-file --batch <objects >actual &&
+     git config --unset core.packedGitWindowSize &&
+     git config --unset core.packedGitLimit &&
+     git cat-file --batch <objects >expect &&
+     test_cmp expect actual'
+
+test_expect_success \
+    'verify-pack -v, packedGitMapWhole' \
+    'git config core.packedGitMapWhole true &&
+     git verify-pack -v "$pack2" &&
+     git cat-file --batch <objects >actual &&
+     test_cmp expect actual'
+
+test_expect_success \
+    'packedGitMapWhole, packedGitLimit == 1 page' \
+    'git config core.packedGitLimit 512 &&
+     git cat-file --batch <objects >actual &&
+     git config --unset core.packedGitLimit &&
+     test_cmp expect actual'
+
+test_expect_success \
+    'pack_report shows whole-pack mappings' \
+    'cat >input <<-EOF &&
+	commit refs/heads/fast-import
+	committer $GIT_COMMITTER_NAME <$GIT_COMMITTER_EMAIL> 1112912053 -0700
+	data 0
+	from $commit2
+	M 644 inline added
+	data 6
+	added
+
+	EOF
+     git fast-import <input 2>stats &&
+     grep "core.packedGitMapWhole   = *true" stats &&
+     whole=$(sed -n -e "s/.*pack_whole_maps *= *//p" stats) &&
+     test "$whole" -gt 0'
+
 test_done
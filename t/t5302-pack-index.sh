@@ -65,6 +65,28 @@ test_expect_success \
     'cmp "test-1-${pack1}.idx" "1.idx" &&
      cmp "test-2-${pack2}.idx" "2.idx"'
 
+test_expect_success \
+    'index-pack resolving deltas with several threads' \
+    'git index-pack --threads=4 -o 2-threaded.idx "test-1-${pack1}.pack" &&
+     cmp "2.idx" "2-threaded.idx"'
+
+test_expect_success \
+    'threaded index-pack with a small delta base cache and --strict' \
+    'git config core.deltaBaseCacheLimit 1k &&
+     git index-pack --threads=4 --strict -o 2-strict.idx \
+	"test-1-${pack1}.pack" &&
+     git config --unset core.deltaBaseCacheLimit &&
+     cmp "2.idx" "2-strict.idx"'
+
+test_expect_success \
+    'threaded index-pack --stdin passes on what follows the pack' \
+    '{ cat "test-1-${pack1}.pack" && echo trailer; } |
+     git index-pack --threads=4 --stdin -o 2-stdin.idx 2-stdin.pack >actual &&
+     printf "pack\t%s\ntrailer\n" $pack1 >expect &&
+     test_cmp expect actual &&
+     cmp "test-1-${pack1}.pack" 2-stdin.pack &&
+     cmp "2.idx" "2-stdin.idx"'
+
 test_expect_success \
     'index v2: force some 64-bit offsets with pack-objects' \
     'pack3=$(git pack-objects --index-version=2,0x40000 test-3 <obj-list)'
@@ -0,0 +1,132 @@
+#!/bin/sh
+
+test_description='reachability bitmap index'
+
+. ./test-lib.sh
+
+test_expect_success 'setup' '
+	for i in 1 2 3 4 5 6 7 8 9 10 11 12
+	do
+		mkdir -p dir$i &&
+		echo $i >dir$i/file &&
+		test_commit c$i || return 1
+	done &&
+	git tag -a -m "annotated tag" annotated c5 &&
+	git checkout -b side c3 &&
+	test_commit side1 &&
+	test_commit side2 &&
+	git checkout master &&
+	test_merge merge side &&
+	git repack -a -d -b &&
+	test $(ls .git/objects/pack/*.bitmap | wc -l) = 1
+'
+
+rev_list_compare () {
+	git rev-list --count "$@" >expect &&
+	GIT_TRACE="$(pwd)/trace" git rev-list --count --use-bitmap-index "$@" >actual &&
+	grep "using bitmap index" trace &&
+	rm -f trace &&
+	test_cmp expect actual
+}
+
+test_expect_success 'rev-list --count agrees with and without bitmaps' '
+	rev_list_compare --all &&
+	rev_list_compare --objects --all &&
+	rev_list_compare --objects master &&
+	rev_list_compare --objects side ^c5 &&
+	rev_list_compare --objects annotated ^c3 &&
+	rev_list_compare --objects master ^side
+'
+
+test_expect_success 'rev-list lists the same objects with bitmaps' '
+	git rev-list --objects --all | cut -c1-40 | sort >expect &&
+	git rev-list --objects --all --use-bitmap-index | sort >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'bitmaps cover objects outside of the pack' '
+	echo loose >loose &&
+	git add loose &&
+	test_tick &&
+	git commit -m loose &&
+	rev_list_compare --objects --all &&
+	rev_list_compare --objects HEAD ^c5 &&
+	rev_list_compare --objects c5 ^HEAD
+'
+
+test_expect_success 'options the bitmaps cannot answer fall back to a walk' '
+	git rev-list --max-count=3 --all >expect &&
+	git rev-list --max-count=3 --all --use-bitmap-index >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'clone from a repository with bitmaps' '
+	git clone --bare "file://$(pwd)" clone.git &&
+	(
+		cd clone.git &&
+		git fsck --full &&
+		git rev-list --objects --all | cut -c1-40 | sort >../cloned
+	) &&
+	git rev-list --objects --all | cut -c1-40 | sort >expect &&
+	test_cmp expect cloned
+'
+
+test_expect_success 'pack-objects --revs leaves out what the other side has' '
+	printf "master\n--not\nc5\n" |
+	GIT_TRACE="$(pwd)/trace" git pack-objects --revs --stdout >incr.pack &&
+	grep "using bitmap index" trace &&
+	rm -f trace &&
+	git index-pack -o incr.idx incr.pack &&
+	git show-index <incr.idx | cut -d" " -f2 | sort >actual &&
+	git rev-list --objects master ^c5 | cut -c1-40 | sort >expect &&
+	test_cmp expect actual
+'
+
+test_expect_success 'pack.usebitmaps=false ignores the bitmaps' '
+	git config pack.usebitmaps false &&
+	GIT_TRACE="$(pwd)/trace" git pack-objects --revs --stdout \
+		</dev/null --all >no-bitmap.pack &&
+	git config --unset pack.usebitmaps &&
+	! grep "using bitmap index" trace &&
+	rm -f trace &&
+	git index-pack -o no-bitmap.idx no-bitmap.pack &&
+	git show-index <no-bitmap.idx | cut -d" " -f2 | sort >actual &&
+	git rev-list --objects --all | cut -c1-40 | sort >expect &&
+	test_cmp expect actual
+'
+
+test_expect_success 'pack-objects --revs uses the bitmaps' '
+	GIT_TRACE="$(pwd)/trace" git pack-objects --revs --stdout \
+		</dev/null --all >revs.pack &&
+	grep "using bitmap index" trace &&
+	rm -f trace &&
+	git index-pack -o revs.idx revs.pack &&
+	git show-index <revs.idx | cut -d" " -f2 | sort >actual &&
+	git rev-list --objects --all | cut -c1-40 | sort >expect &&
+	test_cmp expect actual
+'
+
+test_expect_success 'a corrupt bitmap is ignored' '
+	bitmap=$(ls .git/objects/pack/*.bitmap) &&
+	chmod +w $bitmap &&
+	echo garbage >$bitmap &&
+	git rev-list --count --objects --all >expect &&
+	git rev-list --count --objects --all --use-bitmap-index >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'repack -a -d replaces the bitmap' '
+	git repack -a -d -b &&
+	rev_list_compare --objects --all &&
+	git repack -a -d &&
+	! ls .git/objects/pack/*.bitmap
+'
+
+test_expect_success 'repack.writebitmaps' '
+	git config repack.writebitmaps true &&
+	git repack -a -d &&
+	test $(ls .git/objects/pack/*.bitmap | wc -l) = 1 &&
+	rev_list_compare --objects --all
+'
+
+test_done
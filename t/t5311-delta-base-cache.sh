@@ -0,0 +1,52 @@
+#!/bin/sh
+
+test_description='delta base cache'
+
+. ./test-lib.sh
+
+test_expect_success 'setup' '
+	for i in 1 2 3 4 5 6 7 8 9 10 11 12 13 14 15 16 17 18 19 20
+	do
+		for j in a b c
+		do
+			echo "line $i of $j" >>file-$j || return 1
+		done &&
+		git add file-a file-b file-c &&
+		test_tick &&
+		git commit -q -m "commit $i" || return 1
+	done &&
+	git repack -a -d -f --depth=50 &&
+	git log -p >expect
+'
+
+test_expect_success 'the trace reports the use of the cache' '
+	GIT_TRACE_DELTA_BASE_CACHE="$(pwd)/trace" git log -p >actual &&
+	test_cmp expect actual &&
+	grep "delta base cache: [1-9][0-9]* hits" trace
+'
+
+test_expect_success 'a single slot holds more than one base' '
+	rm -f trace &&
+	GIT_TRACE_DELTA_BASE_CACHE="$(pwd)/trace" \
+		git log -p >actual &&
+	git config core.deltaBaseCacheSlots 1 &&
+	GIT_TRACE_DELTA_BASE_CACHE="$(pwd)/trace-1" \
+		git log -p >actual-1 &&
+	git config --unset core.deltaBaseCacheSlots &&
+	test_cmp expect actual-1 &&
+	sed -e "s/ in [0-9]* slots//" trace >expect-trace &&
+	sed -e "s/ in [0-9]* slots//" trace-1 >actual-trace &&
+	test_cmp expect-trace actual-trace &&
+	grep " 0 evictions" trace-1
+'
+
+test_expect_success 'the cache stays within its limit' '
+	rm -f trace &&
+	git config core.deltaBaseCacheLimit 100 &&
+	GIT_TRACE_DELTA_BASE_CACHE="$(pwd)/trace" git log -p >actual &&
+	git config --unset core.deltaBaseCacheLimit &&
+	test_cmp expect actual &&
+	! grep " 0 evictions" trace
+'
+
+test_done
@@ -0,0 +1,61 @@
+#!/bin/sh
+
+test_description='delta index cache of pack-objects'
+
+. ./test-lib.sh
+
+test_expect_success 'setup' '
+	perl -e "print \"base line \$_\n\" for 1..2000" >base &&
+	for i in 1 2 3 4 5 6 7 8 9 10
+	do
+		sed -e "s/^base line ${i}00\$/changed line $i/" base >file$i ||
+		return 1
+	done &&
+	git add base file* &&
+	test_tick &&
+	git commit -q -m files &&
+	git rev-list --objects --all >objs &&
+	# do not keep deltas around, so that they are made again
+	git config pack.deltaCacheSize 1
+'
+
+test_expect_success 'indexes are reused while writing the pack' '
+	GIT_TRACE_DELTA_INDEX_CACHE="$(pwd)/trace" \
+		git pack-objects --window=20 test-1 <objs >name &&
+	git verify-pack -v test-1-$(cat name).pack >list &&
+	grep " 1 [0-9a-f]*$" list &&
+	grep "delta index cache: [1-9][0-9]* hits" trace
+'
+
+test_expect_success 'the cache does not change the pack' '
+	git config pack.deltaIndexCacheSize 0 &&
+	rm -f trace &&
+	GIT_TRACE_DELTA_INDEX_CACHE="$(pwd)/trace" \
+		git pack-objects --window=20 test-2 <objs >name-2 &&
+	git config --unset pack.deltaIndexCacheSize &&
+	test_cmp name name-2 &&
+	cmp test-1-$(cat name).pack test-2-$(cat name).pack &&
+	grep "delta index cache: 0 hits" trace
+'
+
+test_expect_success 'the cache stays within its limit' '
+	git config pack.deltaIndexCacheSize 20k &&
+	rm -f trace &&
+	GIT_TRACE_DELTA_INDEX_CACHE="$(pwd)/trace" \
+		git pack-objects --window=20 test-3 <objs >name-3 &&
+	git config --unset pack.deltaIndexCacheSize &&
+	test_cmp name name-3 &&
+	! grep " 0 evictions" trace &&
+	cached=$(sed -e "s/.* \([0-9]*\) bytes.*/\1/" trace) &&
+	test $cached -le 20480
+'
+
+test_expect_success 'threads share the cache' '
+	rm -f trace &&
+	GIT_TRACE_DELTA_INDEX_CACHE="$(pwd)/trace" \
+		git pack-objects --window=20 --threads=4 test-4 <objs >name-4 &&
+	test_cmp name name-4 &&
+	grep "delta index cache: [1-9][0-9]* hits" trace
+'
+
+test_done
@@ -0,0 +1,69 @@
+#!/bin/sh
+
+test_description='reading objects at the end of long delta chains'
+
+. ./test-lib.sh
+
+test_expect_success 'setup' '
+	test-genrandom base 4096 >file &&
+	i=0 &&
+	while test $i -lt 60
+	do
+		i=$(($i + 1)) &&
+		{
+			head -c $((64 * ($i % 50))) file &&
+			echo "change $i" &&
+			test-genrandom "insert $i" 33 &&
+			tail -c $((4000 - 64 * ($i % 50))) file
+		} >file.new &&
+		mv file.new file &&
+		cp file expect-$i &&
+		git add file &&
+		test_tick &&
+		git commit -q -m "commit $i" || return 1
+	done &&
+	git repack -a -d -f --depth=100 --window=100 &&
+	git verify-pack -v .git/objects/pack/pack-*.idx >verify &&
+	grep "chain length = [2-9][0-9]*:" verify
+'
+
+check_revisions () {
+	i=0 &&
+	while test $i -lt 60
+	do
+		i=$(($i + 1)) &&
+		git cat-file blob HEAD~$((60 - $i)):file >actual &&
+		test_cmp expect-$i actual || return 1
+	done
+}
+
+test_expect_success 'objects are rebuilt from composed deltas' '
+	check_revisions &&
+	GIT_TRACE_DELTA_BASE_CACHE="$(pwd)/trace" \
+		git cat-file blob HEAD~30:file >actual &&
+	test_cmp expect-30 actual &&
+	grep "composed deltas: [1-9][0-9]* chains collapsed" trace
+'
+
+test_expect_success 'composed chains are reused' '
+	rm -f trace &&
+	GIT_TRACE_DELTA_BASE_CACHE="$(pwd)/trace" \
+		git log -p >actual &&
+	git log -p >expect &&
+	test_cmp expect actual &&
+	grep "composed deltas: .* [1-9][0-9]* hits" trace
+'
+
+test_expect_success 'tiny caches give the same results' '
+	git config core.deltaBaseCacheLimit 1 &&
+	check_revisions &&
+	git log -p >actual &&
+	git config --unset core.deltaBaseCacheLimit &&
+	test_cmp expect actual
+'
+
+test_expect_success 'fsck checks every object in the chain' '
+	git fsck --full
+'
+
+test_done
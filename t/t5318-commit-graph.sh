@@ -0,0 +1,103 @@
+#!/bin/sh
+
+test_description='commit-graph file'
+
+. ./test-lib.sh
+
+graph=.git/objects/info/commit-graph
+
+test_expect_success 'setup' '
+	test_commit one &&
+	test_commit two &&
+	git checkout -b side one &&
+	test_commit three &&
+	git checkout -b third one &&
+	test_commit four &&
+	git checkout -b fourth one &&
+	test_commit six &&
+	git checkout master &&
+	test_merge merge side &&
+	test_tick &&
+	git merge -m octopus third fourth &&
+	git tag octopus &&
+	test $(git rev-list --parents -1 octopus | wc -w) = 4 &&
+	test_commit five
+'
+
+test_expect_success 'write commit-graph' '
+	git commit-graph write &&
+	test -f $graph &&
+	git commit-graph verify
+'
+
+test_expect_success 'rev-list output is unchanged' '
+	git commit-graph verify -v >out &&
+	grep "2 extra edges" out &&
+	git rev-list --parents --all >with &&
+	git config core.commitgraph false &&
+	git rev-list --parents --all >without &&
+	git config --unset core.commitgraph &&
+	test_cmp without with &&
+	git rev-list --topo-order --parents master >with &&
+	git config core.commitgraph false &&
+	git rev-list --topo-order --parents master >without &&
+	git config --unset core.commitgraph &&
+	test_cmp without with
+'
+
+test_expect_success 'merge-base output is unchanged' '
+	git merge-base --all three four >with &&
+	git merge-base --all octopus two >>with &&
+	git config core.commitgraph false &&
+	git merge-base --all three four >without &&
+	git merge-base --all octopus two >>without &&
+	git config --unset core.commitgraph &&
+	test_cmp without with
+'
+
+test_expect_success 'rev-list does not read commits found in the graph' '
+	commit=$(git rev-parse two) &&
+	file=.git/objects/$(echo $commit | sed -e "s|^..|&/|") &&
+	mv $file saved &&
+	git rev-list master >actual &&
+	grep $commit actual &&
+	test_must_fail git log master >/dev/null &&
+	git config core.commitgraph false &&
+	test_must_fail git rev-list master &&
+	git config --unset core.commitgraph &&
+	mkdir -p $(dirname $file) &&
+	mv saved $file
+'
+
+test_expect_success 'grafts disable the commit-graph' '
+	echo "$(git rev-parse two)" >.git/info/grafts &&
+	test $(git rev-list two | wc -l) = 1 &&
+	rm .git/info/grafts
+'
+
+test_expect_success 'verify notices a corrupt commit-graph' '
+	cp $graph saved-graph &&
+	chmod +w $graph &&
+	size=$(wc -c <$graph) &&
+	printf "\377" |
+	dd of=$graph bs=1 seek=$(($size - 30)) conv=notrunc 2>/dev/null &&
+	test_must_fail git commit-graph verify &&
+	mv saved-graph $graph &&
+	git commit-graph verify
+'
+
+test_expect_success 'gc writes the commit-graph' '
+	rm -f $graph &&
+	git gc &&
+	test -f $graph &&
+	git commit-graph verify
+'
+
+test_expect_success 'gc.commitgraph=false leaves the commit-graph alone' '
+	rm -f $graph &&
+	git config gc.commitgraph false &&
+	git gc &&
+	! test -f $graph
+'
+
+test_done
@@ -0,0 +1,90 @@
+#!/bin/sh
+
+test_description='multi-pack index'
+
+. ./test-lib.sh
+
+test_expect_success 'setup' '
+	for i in 1 2 3 4 5
+	do
+		for j in 1 2 3
+		do
+			echo $i.$j >file$j &&
+			git add file$j || return 1
+		done &&
+		test_commit c$i &&
+		git repack -d -q || return 1
+	done &&
+	test $(ls .git/objects/pack/*.pack | wc -l) = 5 &&
+	git rev-list --objects --all >all
+'
+
+cat_all () {
+	while read sha1 rest
+	do
+		git cat-file -t $sha1 &&
+		git cat-file -s $sha1 || return 1
+	done <all
+}
+
+test_expect_success 'write the multi-pack index' '
+	git multi-pack-index write 2>err &&
+	grep "from 5 packs" err &&
+	test -f .git/objects/pack/multi-pack-index &&
+	git multi-pack-index verify -v >out &&
+	grep "ok$" out
+'
+
+test_expect_success 'objects are found through the multi-pack index' '
+	git rev-list --objects --all >actual-list &&
+	cat_all >actual &&
+	git config core.multipackindex false &&
+	git rev-list --objects --all >expect-list &&
+	cat_all >expect &&
+	git config --unset core.multipackindex &&
+	test_cmp expect-list actual-list &&
+	test_cmp expect actual &&
+	git fsck --full
+'
+
+test_expect_success 'packs added later are still searched' '
+	echo new >new &&
+	git add new &&
+	test_commit c6 &&
+	git repack -d -q &&
+	test $(ls .git/objects/pack/*.pack | wc -l) = 6 &&
+	git rev-list --objects --all >all &&
+	cat_all >/dev/null &&
+	git cat-file -p HEAD:new
+'
+
+test_expect_success 'verify notices a corrupt file' '
+	midx=.git/objects/pack/multi-pack-index &&
+	cp $midx midx.bak &&
+	chmod +w $midx &&
+	printf "\377" |
+	dd of=$midx bs=1 seek=2000 conv=notrunc 2>/dev/null &&
+	test_must_fail git multi-pack-index verify &&
+	mv midx.bak $midx &&
+	git multi-pack-index verify
+'
+
+test_expect_success 'objects of a deleted pack are found in another one' '
+	git repack -a -q &&
+	pack=$(ls -t .git/objects/pack/*.pack | tail -n 1) &&
+	rm -f $pack ${pack%.pack}.idx &&
+	test_must_fail git multi-pack-index verify &&
+	git rev-list --objects --all >all &&
+	cat_all >/dev/null &&
+	git fsck --full
+'
+
+test_expect_success 'repack -a -d removes the multi-pack index' '
+	git repack -a -d -q &&
+	! test -f .git/objects/pack/multi-pack-index &&
+	git rev-list --objects --all | cut -c1-40 | sort >actual &&
+	cut -c1-40 <all | sort >expect &&
+	test_cmp expect actual
+'
+
+test_done
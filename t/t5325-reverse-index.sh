@@ -0,0 +1,69 @@
+#!/bin/sh
+
+test_description='on-disk reverse index of packs'
+
+. ./test-lib.sh
+
+test_expect_success 'setup' '
+	for i in 1 2 3 4 5 6 7 8
+	do
+		content="$content $i" &&
+		echo "$content" >file &&
+		echo $i >file$i &&
+		git add file file$i &&
+		test_commit c$i || return 1
+	done &&
+	git repack -a -d &&
+	pack=$(ls .git/objects/pack/pack-*.pack) &&
+	rev=${pack%.pack}.rev
+'
+
+test_expect_success 'repack writes a reverse index' '
+	test -f $rev &&
+	git verify-pack $pack
+'
+
+test_expect_success 'verify-pack -v agrees with and without it' '
+	git verify-pack -v $pack >with &&
+	mv $rev saved.rev &&
+	git verify-pack -v $pack >without &&
+	mv saved.rev $rev &&
+	test_cmp without with
+'
+
+test_expect_success 'index-pack writes a reverse index' '
+	git index-pack -o copy.idx $pack &&
+	test -f copy.rev &&
+	cmp copy.rev $rev
+'
+
+test_expect_success 'pack.writereverseindex=false' '
+	git config pack.writereverseindex false &&
+	git repack -a -d -f &&
+	git config --unset pack.writereverseindex &&
+	! ls .git/objects/pack/*.rev &&
+	pack=$(ls .git/objects/pack/pack-*.pack) &&
+	git verify-pack $pack &&
+	git repack -a -d -f &&
+	test -f $rev
+'
+
+test_expect_success 'a reverse index of another pack is ignored' '
+	chmod +w $rev &&
+	printf "\377" |
+	dd of=$rev bs=1 seek=$(($(wc -c <$rev) - 30)) conv=notrunc \
+		2>/dev/null &&
+	git verify-pack -v $pack >actual 2>err &&
+	grep "does not match its pack" err &&
+	test_cmp without actual
+'
+
+test_expect_success 'verify-pack notices a corrupt reverse index' '
+	cp copy.rev $rev &&
+	printf "\0\0\0\0\0\0\0\1" |
+	dd of=$rev bs=1 seek=8 conv=notrunc 2>/dev/null &&
+	test_must_fail git verify-pack $pack 2>err &&
+	grep "reverse index does not match" err
+'
+
+test_done
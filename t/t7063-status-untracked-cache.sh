@@ -0,0 +1,192 @@
+#!/bin/sh
+
+test_description='untracked cache'
+
+. ./test-lib.sh
+
+# The repository under test is "wt", so that the files the tests
+# write here do not change its directories.
+trace="$(pwd)/trace"
+
+# Directories changed in the current second are not trusted, so make
+# the ones given (or all) look old before the cache is to be used; a
+# little less old each time, or a changed one would get its old mtime
+# back.
+age=1000
+backdate () {
+	age=$(($age - 1)) &&
+	(
+		cd wt &&
+		if test $# = 0
+		then
+			find . -name .git -prune -o -print
+		else
+			echo "$@" | tr " " "\n"
+		fi | xargs test-chmtime =-$age
+	)
+}
+
+# how many directories the last traced command read and found cached
+dirs_read () {
+	sed -n -e 's/.*"name":"directories-read","value":\([0-9]*\)}.*/\1/p' trace
+}
+
+dirs_cached () {
+	sed -n -e 's/.*"name":"directories-cached","value":\([0-9]*\)}.*/\1/p' trace
+}
+
+traced_status () {
+	rm -f trace &&
+	(
+		cd wt &&
+		GIT_TRACE_PERFORMANCE="$trace" git status >/dev/null
+		test $? -le 1
+	) &&
+	(cd wt && git ls-files -o --exclude-standard) >actual
+}
+
+test_expect_success 'setup' '
+	mkdir wt &&
+	(
+		cd wt &&
+		git init -q &&
+		mkdir -p dir/sub empty &&
+		echo one >dir/one &&
+		echo two >dir/sub/two &&
+		git add dir &&
+		test_tick &&
+		git commit -q -m initial &&
+		echo "*.o" >.gitignore &&
+		echo untracked >dir/untracked &&
+		echo object >dir/sub/file.o &&
+		mkdir new &&
+		echo new >new/file &&
+		git update-index --untracked-cache
+	) &&
+	cat >expect <<-\EOF &&
+	.gitignore
+	dir/untracked
+	new/file
+	EOF
+	backdate
+'
+
+test_expect_success 'first status reads every directory' '
+	traced_status &&
+	test_cmp expect actual &&
+	test $(dirs_read) = 5 &&
+	test $(dirs_cached) = 0
+'
+
+test_expect_success 'second status reads none' '
+	traced_status &&
+	test_cmp expect actual &&
+	test $(dirs_read) = 0 &&
+	test $(dirs_cached) = 5
+'
+
+test_expect_success 'a new file is noticed' '
+	echo more >wt/dir/more &&
+	backdate dir &&
+	traced_status &&
+	cat >expect <<-\EOF &&
+	.gitignore
+	dir/more
+	dir/untracked
+	new/file
+	EOF
+	test_cmp expect actual &&
+	test $(dirs_read) = 1
+'
+
+test_expect_success 'adding to the index needs no rescan' '
+	(cd wt && git add dir/more) &&
+	traced_status &&
+	cat >expect <<-\EOF &&
+	.gitignore
+	dir/untracked
+	new/file
+	EOF
+	test_cmp expect actual &&
+	test $(dirs_read) = 0
+'
+
+test_expect_success 'a changed .gitignore is noticed below it' '
+	echo "untracked" >>wt/.gitignore &&
+	backdate .gitignore &&
+	traced_status &&
+	cat >expect <<-\EOF &&
+	.gitignore
+	new/file
+	EOF
+	test_cmp expect actual &&
+	test $(dirs_read) = 5
+'
+
+test_expect_success 'a new per-directory .gitignore is noticed' '
+	echo "file" >wt/new/.gitignore &&
+	backdate new new/.gitignore &&
+	traced_status &&
+	cat >expect <<-\EOF &&
+	.gitignore
+	new/.gitignore
+	EOF
+	test_cmp expect actual &&
+	test $(dirs_read) = 1
+'
+
+test_expect_success 'removed directories are forgotten' '
+	rm -rf wt/new &&
+	backdate . &&
+	traced_status &&
+	echo .gitignore >expect &&
+	test_cmp expect actual &&
+	test $(dirs_read) = 1 &&
+	test $(dirs_cached) = 3
+'
+
+test_expect_success 'ls-files -o uses the cache from a subdirectory' '
+	echo object >wt/dir/sub/another.o &&
+	echo another >wt/dir/sub/another &&
+	backdate dir/sub &&
+	rm -f trace &&
+	(
+		cd wt/dir &&
+		GIT_TRACE_PERFORMANCE="$trace" \
+			git ls-files -o --exclude-standard
+	) >actual &&
+	echo sub/another >expect &&
+	test_cmp expect actual &&
+	test $(dirs_read) = 1 &&
+	(cd wt && git ls-files -o --exclude-standard --exclude=".*") >actual &&
+	echo dir/sub/another >expect &&
+	test_cmp expect actual
+'
+
+test_expect_success 'the cache is kept with a split index' '
+	(cd wt && git update-index --split-index) &&
+	traced_status &&
+	traced_status &&
+	test $(dirs_read) = 0 &&
+	(cd wt && git update-index --no-split-index)
+'
+
+test_expect_success '--no-untracked-cache drops the cache' '
+	(cd wt && git update-index --no-untracked-cache) &&
+	traced_status &&
+	printf ".gitignore\ndir/sub/another\n" >expect &&
+	test_cmp expect actual &&
+	! grep directories-read trace
+'
+
+test_expect_success 'core.untrackedCache adds a cache' '
+	(cd wt && git config core.untrackedCache true) &&
+	traced_status &&
+	traced_status &&
+	test $(dirs_read) = 0 &&
+	(cd wt && git config core.untrackedCache false) &&
+	traced_status &&
+	! grep directories-read trace
+'
+
+test_done
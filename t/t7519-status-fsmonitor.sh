@@ -0,0 +1,210 @@
+#!/bin/sh
+
+test_description='file system monitor hook'
+
+. ./test-lib.sh
+
+# The repository under test is "wt"; the hook reports the paths
+# listed in "changed", fails if "hook-fail" exists, and logs its
+# arguments to "hook-args".
+root="$(pwd)"
+
+# Changes the hook does not report go unnoticed, so a path that does
+# not show up as modified was not looked at.
+modified () {
+	(cd wt && git diff-files --name-only) >actual
+}
+
+traced_status () {
+	rm -f trace &&
+	(
+		cd wt &&
+		GIT_TRACE_PERFORMANCE="$root/trace" git status >/dev/null
+		test $? -le 1
+	)
+}
+
+counter () {
+	sed -n -e 's/.*"name":"'"$1"'","value":\([0-9]*\)}.*/\1/p' trace
+}
+
+test_expect_success 'setup' '
+	cat >fsmonitor-hook <<-EOF &&
+	#!/bin/sh
+	echo "\$*" >>"$root/hook-args"
+	test -f "$root/hook-fail" && exit 1
+	tr "\\\\n" "\\\\000" <"$root/changed"
+	EOF
+	chmod +x fsmonitor-hook &&
+	: >changed &&
+	mkdir wt &&
+	(
+		cd wt &&
+		git init -q &&
+		mkdir dir1 dir2 &&
+		echo a >dir1/a &&
+		echo b >dir1/b &&
+		echo c >dir2/c &&
+		echo top >top &&
+		git add . &&
+		test_tick &&
+		git commit -q -m initial &&
+		git config core.fsmonitor "$root/fsmonitor-hook"
+	)
+'
+
+test_expect_success 'the first read only records a token' '
+	traced_status &&
+	! test -f hook-args
+'
+
+test_expect_success 'the hook is asked what changed since then' '
+	traced_status &&
+	grep "^1 [0-9][0-9]*\$" hook-args &&
+	test $(counter valid) = 4
+'
+
+test_expect_success 'unreported changes are not looked at' '
+	echo changed >wt/dir1/a &&
+	modified &&
+	test_cmp /dev/null actual
+'
+
+test_expect_success 'reported changes are' '
+	echo dir1/a >changed &&
+	modified &&
+	echo dir1/a >expect &&
+	test_cmp expect actual
+'
+
+test_expect_success 'dirty entries are remembered in the index' '
+	traced_status &&
+	test $(counter paths) = 1 &&
+	: >changed &&
+	traced_status &&
+	test $(counter paths) = 0 &&
+	test $(counter valid) = 3 &&
+	modified &&
+	test_cmp expect actual
+'
+
+test_expect_success 'a reported directory covers what is in it' '
+	(cd wt && git update-index dir1/a) &&
+	echo changed >wt/dir2/c &&
+	echo changed >wt/top &&
+	echo dir2 >changed &&
+	modified &&
+	echo dir2/c >expect &&
+	test_cmp expect actual
+'
+
+test_expect_success '"/" means everything may have changed' '
+	echo / >changed &&
+	traced_status &&
+	test $(counter valid) = 0 &&
+	modified &&
+	printf "dir2/c\ntop\n" >expect &&
+	test_cmp expect actual
+'
+
+test_expect_success 'a failing hook means everything may have changed' '
+	(cd wt && git update-index dir2/c top) &&
+	: >changed &&
+	traced_status &&
+	echo changed again >wt/dir1/b &&
+	modified &&
+	test_cmp /dev/null actual &&
+	: >hook-fail &&
+	modified &&
+	echo dir1/b >expect &&
+	test_cmp expect actual &&
+	rm hook-fail
+'
+
+test_expect_success 'without core.fsmonitor every entry is looked at' '
+	(cd wt && git update-index dir1/b) &&
+	traced_status &&
+	echo unreported >wt/top &&
+	(cd wt && git config --unset core.fsmonitor) &&
+	modified &&
+	echo top >expect &&
+	test_cmp expect actual &&
+	(
+		cd wt &&
+		git update-index top &&
+		git config core.fsmonitor "$root/fsmonitor-hook"
+	)
+'
+
+test_expect_success 'works with a split index' '
+	(cd wt && git update-index --split-index) &&
+	traced_status &&
+	traced_status &&
+	echo split >wt/dir1/b &&
+	modified &&
+	test_cmp /dev/null actual &&
+	echo dir1/b >changed &&
+	modified &&
+	echo dir1/b >expect &&
+	test_cmp expect actual &&
+	(cd wt && git update-index dir1/b --no-split-index) &&
+	: >changed
+'
+
+test_expect_success 'the untracked cache reads only reported directories' '
+	(cd wt && git update-index --untracked-cache) &&
+	echo untracked >wt/dir2/untracked &&
+	(cd wt && find . -name .git -prune -o -print | xargs test-chmtime =-100) &&
+	traced_status &&
+	traced_status &&
+	test $(counter directories-read) = 0 &&
+	echo new >wt/dir1/new &&
+	traced_status &&
+	test $(counter directories-read) = 0 &&
+	(cd wt && git ls-files -o --exclude-standard) >actual &&
+	echo dir2/untracked >expect &&
+	test_cmp expect actual &&
+	echo dir1/new >changed &&
+	test-chmtime =-50 wt/dir1 &&
+	traced_status &&
+	test $(counter directories-read) = 1 &&
+	(cd wt && git ls-files -o --exclude-standard) >actual &&
+	printf "dir1/new\ndir2/untracked\n" >expect &&
+	test_cmp expect actual
+'
+
+untracked () {
+	(cd wt && git ls-files -o --exclude-standard) >actual
+}
+
+test_expect_success 'an untrusted answer checks every directory again' '
+	: >changed &&
+	traced_status &&
+	traced_status &&
+	test $(counter directories-read) = 0 &&
+	echo / >changed &&
+	echo unseen >wt/dir2/unseen &&
+	echo more >>wt/top &&
+	(cd wt && git add top) &&
+	: >changed &&
+	untracked &&
+	printf "dir1/new\ndir2/unseen\ndir2/untracked\n" >expect &&
+	test_cmp expect actual
+'
+
+test_expect_success 'so does turning core.fsmonitor on over an untracked cache' '
+	(cd wt && git config --unset core.fsmonitor) &&
+	traced_status &&
+	echo unseen >wt/dir1/unseen &&
+	(
+		cd wt &&
+		git config core.fsmonitor "$root/fsmonitor-hook" &&
+		echo more >>top &&
+		git add top
+	) &&
+	untracked &&
+	printf "dir1/new\ndir1/unseen\ndir2/unseen\ndir2/untracked\n" >expect &&
+	test_cmp expect actual
+'
+
+test_done
@@ -0,0 +1,114 @@
+#!/bin/sh
+
+test_description='git repack --geometric rolls up only the smallest packs'
+
+. ./test-lib.sh
+
+packdir=.git/objects/pack
+
+# commit a new random file of $2 bytes, named $1, and pack it on its own
+commit_and_pack () {
+	test-genrandom "$1" $2 >"$1" &&
+	git add "$1" &&
+	test_tick &&
+	git commit -q -m "$1" &&
+	git repack -d -q
+}
+
+packs () {
+	ls $packdir/*.pack | sort
+}
+
+check_objects () {
+	git rev-list --objects --all >objects &&
+	while read obj path
+	do
+		git cat-file -e $obj || return 1
+	done <objects &&
+	test "$(git count-objects | sed -e "s/ .*//")" = 0
+}
+
+test_expect_success 'setup' '
+	commit_and_pack big 65536 &&
+	commit_and_pack medium 16384 &&
+	commit_and_pack small 4096 &&
+	commit_and_pack tiny 1024 &&
+	test $(packs | wc -l) = 4
+'
+
+test_expect_success 'packs forming a progression are left alone' '
+	packs >before &&
+	git repack -d -q --geometric=2 &&
+	packs >after &&
+	test_cmp before after
+'
+
+test_expect_success 'small packs and loose objects are rolled up' '
+	big=$(ls -t $packdir/*.pack | tail -n 1) &&
+	test-genrandom a 1000 >a &&
+	test-genrandom b 1000 >b &&
+	git add a b &&
+	test_tick &&
+	git commit -q -m loose &&
+	git repack -d -q --geometric=2 &&
+	test $(packs | wc -l) -lt 4 &&
+	test -f $big &&
+	check_objects &&
+	git fsck --full
+'
+
+test_expect_success 'the result forms a progression' '
+	for p in $packdir/*.pack
+	do
+		echo $(wc -c <$p) || return 1
+	done | sort -n >sizes &&
+	prev= &&
+	while read size
+	do
+		test -z "$prev" || test $size -ge $((2 * $prev)) || return 1
+		prev=$size
+	done <sizes
+'
+
+test_expect_success 'packs with .keep are not rolled up' '
+	commit_and_pack kept 512 &&
+	kept=$(ls -t $packdir/*.pack | head -n 1) &&
+	touch ${kept%.pack}.keep &&
+	commit_and_pack other 512 &&
+	git repack -d -q --geometric=2 &&
+	test -f $kept &&
+	check_objects
+'
+
+test_expect_success 'pack-objects --stdin-packs packs the named packs' '
+	commit_and_pack one 512 &&
+	one=$(ls -t $packdir/*.pack | head -n 1) &&
+	commit_and_pack two 512 &&
+	two=$(ls -t $packdir/*.pack | head -n 1) &&
+	{
+		git show-index <${one%.pack}.idx &&
+		git show-index <${two%.pack}.idx
+	} | cut -d" " -f2 | sort >expect &&
+	name=$({
+		basename $one && basename $two
+	} | git pack-objects --stdin-packs new) &&
+	git show-index <new-$name.idx | cut -d" " -f2 | sort >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success '--geometric rejects bad factors and -a' '
+	test_must_fail git repack -d --geometric=1 &&
+	test_must_fail git repack -d --geometric=x &&
+	test_must_fail git repack -a -d --geometric=2
+'
+
+test_expect_success 'gc --auto repacks geometrically with gc.autoGeometric' '
+	big=$(ls -t $packdir/*.pack | tail -n 1) &&
+	git config gc.autoGeometric 2 &&
+	git config gc.autoPackLimit 3 &&
+	git gc --auto -q &&
+	test -f $big &&
+	check_objects
+'
+
+test_done
@@ -900,7 +900,7 @@ INPUT_END
 test_expect_success \
 	'O: blank lines not necessary after other commands' \
 	'git fast-import <input &&
-	 test 8 = `find .git/objects/pack -type f | wc -l` &&
+	 test 8 = `find .git/objects/pack -type f \! -name "*.rev" | wc -l` &&
 	 test `git rev-parse refs/tags/O3-2nd` = `git rev-parse O3^` &&
 	 git log --reverse --pretty=oneline O3 | sed s/^.*z// >actual &&
 	 test_cmp expect actual'
@@ -1088,4 +1088,80 @@ INPUT_END
 test_expect_success 'P: fail on blob mark in gitlink' '
     test_must_fail git fast-import <input'
 
+###
+### series Q (tiny pack windows)
+###
+
+test_tick
+perl -e "print \"line \$_\n\" for 1..2000" >big
+cat >input <<INPUT_END
+blob
+mark :1
+data <<DATA
+$(cat big)
+DATA
+
+commit refs/heads/tiny1
+committer $GIT_COMMITTER_NAME <$GIT_COMMITTER_EMAIL> $GIT_COMMITTER_DATE
+data <<COMMIT
+first tiny window
+COMMIT
+
+from refs/heads/base^0
+M 644 :1 big
+
+commit refs/heads/tiny2
+committer $GIT_COMMITTER_NAME <$GIT_COMMITTER_EMAIL> $GIT_COMMITTER_DATE
+data <<COMMIT
+second tiny window
+COMMIT
+
+from refs/heads/base^0
+M 644 :1 big2
+
+commit refs/heads/tiny1
+committer $GIT_COMMITTER_NAME <$GIT_COMMITTER_EMAIL> $GIT_COMMITTER_DATE
+data <<COMMIT
+third tiny window
+COMMIT
+
+M 644 inline more
+data <<DATA
+$(cat big)
+more
+DATA
+
+commit refs/heads/tiny3
+committer $GIT_COMMITTER_NAME <$GIT_COMMITTER_EMAIL> $GIT_COMMITTER_DATE
+data <<COMMIT
+fourth tiny window
+COMMIT
+
+from refs/heads/base^0
+M 644 :1 big3
+
+INPUT_END
+
+test_expect_success 'Q: fast-import under a tiny packedGitLimit' '
+	rm -rf tiny &&
+	mkdir tiny &&
+	(
+		cd tiny &&
+		git init -q &&
+		perl -e "print \"base \$_\n\" for 1..2000" >file &&
+		git add file &&
+		git commit -q -m base &&
+		git branch base &&
+		git repack -a -d -q &&
+		git config core.packedGitWindowSize 4096 &&
+		git config core.packedGitLimit 4096 &&
+		git fast-import --active-branches=1 <../input &&
+		git config --unset core.packedGitWindowSize &&
+		git config --unset core.packedGitLimit &&
+		git fsck &&
+		git cat-file blob tiny1:big >actual &&
+		test_cmp ../big actual
+	)
+'
+
 test_done
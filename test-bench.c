@@ -0,0 +1,554 @@
+/*
+ * test-bench.c: microbenchmarks for the primitives most commands
+ * spend their time in.
+ *
+ * Each benchmark runs "count" operations per round (a thousandth of
+ * that for the delta and diff ones, which work on "size" bytes of
+ * data at a time) and reports the best of "rounds" rounds, one
+ * tab-separated line per benchmark:
+ *
+ *   <name>  <ops>  <ns/op>  <allocs/op>  <bytes allocated/op>
+ *
+ * The keys are generated SHA-1s unless --repo is given, in which case
+ * the objects of the current repository's packs, its packs and its
+ * index are used instead.
+ */
+
+#include "cache.h"
+#include "object.h"
+#include "blob.h"
+#include "delta.h"
+#include "hash.h"
+#include "sha1-lookup.h"
+#include "xdiff-interface.h"
+#include "parse-options.h"
+
+/*
+ * Count allocations by interposing the allocator; glibc lets us
+ * reach the real one under another name.  Elsewhere the allocation
+ * columns read "-".
+ */
+#ifdef __GLIBC__
+extern void *__libc_malloc(size_t);
+extern void *__libc_calloc(size_t, size_t);
+extern void *__libc_realloc(void *, size_t);
+
+static unsigned long nr_allocs, alloc_bytes;
+
+void *malloc(size_t size)
+{
+	nr_allocs++;
+	alloc_bytes += size;
+	return __libc_malloc(size);
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+	nr_allocs++;
+	alloc_bytes += nmemb * size;
+	return __libc_calloc(nmemb, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+	nr_allocs++;
+	alloc_bytes += size;
+	return __libc_realloc(ptr, size);
+}
+#define COUNT_ALLOCS 1
+#else
+static unsigned long nr_allocs, alloc_bytes;
+#define COUNT_ALLOCS 0
+#endif
+
+static int count = 100000;
+static int rounds = 5;
+static int data_size = 65536;
+static int use_repo;
+
+static double elapsed(struct timeval *start)
+{
+	struct timeval now;
+	gettimeofday(&now, NULL);
+	return (now.tv_sec - start->tv_sec) +
+		(now.tv_usec - start->tv_usec) / 1e6;
+}
+
+static void measure(const char *name, void (*fn)(void *, unsigned long),
+		    void *data, unsigned long ops)
+{
+	double best = -1;
+	unsigned long allocs = 0, bytes = 0;
+	int i;
+
+	for (i = 0; i < rounds; i++) {
+		struct timeval start;
+		double secs;
+
+		nr_allocs = alloc_bytes = 0;
+		gettimeofday(&start, NULL);
+		fn(data, ops);
+		secs = elapsed(&start);
+		if (best < 0 || secs < best) {
+			best = secs;
+			allocs = nr_allocs;
+			bytes = alloc_bytes;
+		}
+	}
+	if (COUNT_ALLOCS)
+		printf("%s\t%lu\t%.1f\t%.2f\t%.1f\n", name, ops,
+		       best * 1e9 / ops, (double)allocs / ops,
+		       (double)bytes / ops);
+	else
+		printf("%s\t%lu\t%.1f\t-\t-\n", name, ops, best * 1e9 / ops);
+	fflush(stdout);
+}
+
+/* keys to look up, in no particular order, and the same sorted */
+static unsigned char (*keys)[20];
+static unsigned char (*sorted)[20];
+static struct packed_git **key_pack;
+static int nr_keys;
+
+static unsigned long next = 1;
+
+static unsigned long genrandom(void)
+{
+	next = next * 1103515245 + 12345;
+	return (next >> 16) & 0x7fff;
+}
+
+static int sha1_compare(const void *a, const void *b)
+{
+	return hashcmp(a, b);
+}
+
+static void generate_keys(void)
+{
+	int i;
+
+	nr_keys = count;
+	keys = xmalloc(nr_keys * 20);
+	for (i = 0; i < nr_keys; i++) {
+		git_SHA_CTX ctx;
+		char buf[32];
+		int len = sprintf(buf, "bench %d", i);
+
+		git_SHA1_Init(&ctx);
+		git_SHA1_Update(&ctx, buf, len);
+		git_SHA1_Final(keys[i], &ctx);
+	}
+}
+
+static void load_keys(void)
+{
+	struct packed_git *p;
+	int i;
+
+	prepare_packed_git();
+	for (p = packed_git; p; p = p->next)
+		if (!open_pack_index(p))
+			nr_keys += p->num_objects;
+	if (!nr_keys)
+		die("no packed objects in this repository");
+	keys = xmalloc(nr_keys * 20);
+	key_pack = xmalloc(nr_keys * sizeof(*key_pack));
+
+	/* take the objects in a scattered order, not pack by pack */
+	i = 0;
+	for (p = packed_git; p; p = p->next) {
+		uint32_t j;
+		if (!p->index_data)
+			continue;
+		for (j = 0; j < p->num_objects; j++) {
+			hashcpy(keys[i], nth_packed_object_sha1(p, j));
+			key_pack[i++] = p;
+		}
+	}
+	for (i = nr_keys - 1; i > 0; i--) {
+		int j = (genrandom() << 15 | genrandom()) % (i + 1);
+		unsigned char tmp[20];
+		struct packed_git *tp;
+
+		hashcpy(tmp, keys[i]);
+		hashcpy(keys[i], keys[j]);
+		hashcpy(keys[j], tmp);
+		tp = key_pack[i];
+		key_pack[i] = key_pack[j];
+		key_pack[j] = tp;
+	}
+}
+
+static void sort_keys(void)
+{
+	int i, j;
+
+	sorted = xmalloc(nr_keys * 20);
+	memcpy(sorted, keys, nr_keys * 20);
+	qsort(sorted, nr_keys, 20, sha1_compare);
+	for (i = j = 0; i < nr_keys; i++)
+		if (!j || hashcmp(sorted[j - 1], sorted[i]))
+			hashcpy(sorted[j++], sorted[i]);
+	nr_keys = j;
+}
+
+static void run_lookup_object(void *data, unsigned long ops)
+{
+	unsigned long i;
+
+	for (i = 0; i < ops; i++)
+		if (!lookup_object(keys[i % nr_keys]))
+			die("lookup_object lost %s", sha1_to_hex(keys[i % nr_keys]));
+}
+
+static void bench_lookup_object(void)
+{
+	int i;
+
+	for (i = 0; i < nr_keys; i++)
+		lookup_blob(keys[i]);
+	measure("lookup_object", run_lookup_object, NULL, count);
+}
+
+static void run_sha1_entry_pos(void *data, unsigned long ops)
+{
+	unsigned long i;
+
+	for (i = 0; i < ops; i++)
+		if (sha1_entry_pos(sorted, 20, 0, 0, nr_keys, nr_keys,
+				   keys[i % nr_keys]) < 0)
+			die("sha1_entry_pos lost %s",
+			    sha1_to_hex(keys[i % nr_keys]));
+}
+
+static void bench_sha1_entry_pos(void)
+{
+	measure("sha1_entry_pos", run_sha1_entry_pos, NULL, count);
+}
+
+/*
+ * Without --repo, hand find_pack_entry_one() a version 2 pack index
+ * built in core from the sorted keys; it does not need the pack.
+ */
+static struct packed_git *fake_pack(void)
+{
+	struct packed_git *p = xcalloc(1, sizeof(*p) + 1);
+	uint32_t *fanout;
+	unsigned char *idx;
+	size_t size = 8 + 256 * 4 + nr_keys * (20 + 4 + 4) + 40;
+	int i, j;
+
+	idx = xcalloc(1, size);
+	memcpy(idx, "\377tOc\0\0\0\2", 8);
+	fanout = (uint32_t *)(idx + 8);
+	for (i = j = 0; i < 256; i++) {
+		while (j < nr_keys && sorted[j][0] == i)
+			j++;
+		fanout[i] = htonl(j);
+	}
+	memcpy(idx + 8 + 256 * 4, sorted, nr_keys * 20);
+	for (i = 0; i < nr_keys; i++) {
+		uint32_t *ofs = (uint32_t *)(idx + 8 + 256 * 4 +
+					     nr_keys * 24) + i;
+		*ofs = htonl(12 + i * 32);
+	}
+	p->index_data = idx;
+	p->index_size = size;
+	p->index_version = 2;
+	p->num_objects = nr_keys;
+	p->pack_fd = -1;
+	return p;
+}
+
+static void run_find_pack_entry_one(void *data, unsigned long ops)
+{
+	struct packed_git *p = data;
+	unsigned long i;
+
+	for (i = 0; i < ops; i++) {
+		int k = i % nr_keys;
+		if (!find_pack_entry_one(keys[k], p ? p : key_pack[k]))
+			die("find_pack_entry_one lost %s", sha1_to_hex(keys[k]));
+	}
+}
+
+static void bench_find_pack_entry_one(void)
+{
+	measure("find_pack_entry_one", run_find_pack_entry_one,
+		use_repo ? NULL : fake_pack(), count);
+}
+
+static void run_lookup_hash(void *data, unsigned long ops)
+{
+	struct hash_table *table = data;
+	unsigned long i;
+
+	for (i = 0; i < ops; i++) {
+		unsigned char *key = keys[i % nr_keys];
+		if (!lookup_hash(*(unsigned int *)key, table))
+			die("lookup_hash lost %s", sha1_to_hex(key));
+	}
+}
+
+static void bench_lookup_hash(void)
+{
+	struct hash_table table;
+	int i;
+
+	init_hash(&table);
+	for (i = 0; i < nr_keys; i++)
+		insert_hash(*(unsigned int *)keys[i], keys[i], &table);
+	measure("lookup_hash", run_lookup_hash, &table, count);
+	free_hash(&table);
+}
+
+static int ce_compare(const void *a_, const void *b_)
+{
+	const struct cache_entry *a = *(const struct cache_entry **)a_;
+	const struct cache_entry *b = *(const struct cache_entry **)b_;
+	return cache_name_compare(a->name, a->ce_flags, b->name, b->ce_flags);
+}
+
+static void generate_index(struct index_state *istate)
+{
+	int i;
+
+	memset(istate, 0, sizeof(*istate));
+	istate->cache_alloc = istate->cache_nr = count;
+	istate->cache = xcalloc(count, sizeof(*istate->cache));
+	for (i = 0; i < count; i++) {
+		struct cache_entry *ce;
+		char buf[64];
+		int len = sprintf(buf, "d%02d/d%02d/file%06d.c",
+				  i % 10, i / 10 % 10, i);
+
+		ce = xcalloc(1, cache_entry_size(len));
+		memcpy(ce->name, buf, len);
+		ce->ce_flags = create_ce_flags(len, 0);
+		ce->ce_mode = htonl(S_IFREG | 0644);
+		istate->cache[i] = ce;
+	}
+	qsort(istate->cache, count, sizeof(*istate->cache), ce_compare);
+	istate->initialized = 1;
+}
+
+static void run_index_name_pos(void *data, unsigned long ops)
+{
+	struct index_state *istate = data;
+	unsigned long i;
+
+	for (i = 0; i < ops; i++) {
+		/* a stride coprime to most sizes scatters the probes */
+		struct cache_entry *ce =
+			istate->cache[(i * 7919) % istate->cache_nr];
+		if (index_name_pos(istate, ce->name, ce_namelen(ce)) < 0)
+			die("index_name_pos lost %s", ce->name);
+	}
+}
+
+static void bench_index_name_pos(void)
+{
+	struct index_state istate;
+
+	if (use_repo) {
+		if (read_index(&the_index) <= 0) {
+			printf("index_name_pos\t0\t-\t-\t-\n");
+			return;
+		}
+		measure("index_name_pos", run_index_name_pos, &the_index, count);
+		return;
+	}
+	generate_index(&istate);
+	measure("index_name_pos", run_index_name_pos, &istate, count);
+}
+
+/*
+ * Text-like data, 32-byte lines, with every line of the target that
+ * falls on a multiple of "stride" rewritten.
+ */
+static void *generate_text(unsigned long size, int stride, int seed)
+{
+	char *buf = xmalloc(size), *p;
+	unsigned long line;
+
+	next = 1;
+	for (p = buf, line = 0; p + 32 <= buf + size; p += 32, line++) {
+		unsigned long v = genrandom() << 15 | genrandom();
+		char tmp[64];
+
+		if (stride && !(line % stride))
+			v ^= seed;
+		sprintf(tmp, "%06lu %08lx %014lx", line % 1000000, v,
+			line * v);
+		memcpy(p, tmp, 31);
+		p[31] = '\n';
+	}
+	memset(p, '\n', buf + size - p);
+	return buf;
+}
+
+struct delta_data {
+	void *src, *trg, *delta;
+	unsigned long size, delta_size;
+	struct delta_index *index;
+};
+
+static void run_create_delta_index(void *data, unsigned long ops)
+{
+	struct delta_data *d = data;
+	unsigned long i;
+
+	for (i = 0; i < ops; i++)
+		free_delta_index(create_delta_index(d->src, d->size));
+}
+
+static void run_create_delta(void *data, unsigned long ops)
+{
+	struct delta_data *d = data;
+	unsigned long i, size;
+
+	for (i = 0; i < ops; i++)
+		free(create_delta(d->index, d->trg, d->size, &size, 0));
+}
+
+static void run_patch_delta(void *data, unsigned long ops)
+{
+	struct delta_data *d = data;
+	unsigned long i, size;
+
+	for (i = 0; i < ops; i++) {
+		void *out = patch_delta(d->src, d->size, d->delta,
+					d->delta_size, &size);
+		if (!out || size != d->size)
+			die("patch_delta failed");
+		free(out);
+	}
+}
+
+static void bench_delta(void)
+{
+	struct delta_data d;
+	unsigned long ops = count / 1000 ? count / 1000 : 1;
+	void *out;
+	unsigned long size;
+
+	d.size = data_size;
+	d.src = generate_text(d.size, 0, 0);
+	d.trg = generate_text(d.size, 50, 0x5a5a);
+	d.index = create_delta_index(d.src, d.size);
+	d.delta = create_delta(d.index, d.trg, d.size, &d.delta_size, 0);
+	if (!d.delta)
+		die("create_delta failed");
+	out = patch_delta(d.src, d.size, d.delta, d.delta_size, &size);
+	if (!out || size != d.size || memcmp(out, d.trg, size))
+		die("patch_delta does not reproduce the target");
+	free(out);
+
+	measure("create_delta_index", run_create_delta_index, &d, ops);
+	measure("create_delta", run_create_delta, &d, ops);
+	measure("patch_delta", run_patch_delta, &d, ops);
+
+	free_delta_index(d.index);
+	free(d.delta);
+	free(d.src);
+	free(d.trg);
+}
+
+static int count_hunk_lines(void *priv, mmbuffer_t *mb, int nbuf)
+{
+	(*(unsigned long *)priv)++;
+	return 0;
+}
+
+static void run_xdl_diff(void *data, unsigned long ops)
+{
+	mmfile_t *mf = data;
+	unsigned long i;
+
+	for (i = 0; i < ops; i++) {
+		xpparam_t xpp;
+		xdemitconf_t xecfg;
+		xdemitcb_t ecb;
+		unsigned long lines = 0;
+
+		memset(&xpp, 0, sizeof(xpp));
+		memset(&xecfg, 0, sizeof(xecfg));
+		xecfg.ctxlen = 3;
+		ecb.outf = count_hunk_lines;
+		ecb.priv = &lines;
+		if (xdi_diff(&mf[0], &mf[1], &xpp, &xecfg, &ecb) < 0 || !lines)
+			die("xdl_diff failed");
+	}
+}
+
+static void bench_xdl_diff(void)
+{
+	mmfile_t mf[2];
+	unsigned long ops = count / 1000 ? count / 1000 : 1;
+
+	mf[0].size = mf[1].size = data_size;
+	mf[0].ptr = generate_text(data_size, 0, 0);
+	mf[1].ptr = generate_text(data_size, 50, 0x5a5a);
+	measure("xdl_diff", run_xdl_diff, mf, ops);
+	free(mf[0].ptr);
+	free(mf[1].ptr);
+}
+
+static struct benchmark {
+	const char *name;
+	void (*fn)(void);
+} benchmarks[] = {
+	{ "lookup_object", bench_lookup_object },
+	{ "lookup_hash", bench_lookup_hash },
+	{ "sha1_entry_pos", bench_sha1_entry_pos },
+	{ "find_pack_entry_one", bench_find_pack_entry_one },
+	{ "index_name_pos", bench_index_name_pos },
+	{ "delta", bench_delta },
+	{ "xdl_diff", bench_xdl_diff },
+};
+
+int main(int argc, const char **argv)
+{
+	const char *usage[] = {
+		"test-bench [options] [<benchmark>...]",
+		NULL
+	};
+	struct option options[] = {
+		OPT_INTEGER(0, "count", &count, "operations per round"),
+		OPT_INTEGER(0, "rounds", &rounds, "rounds to take the best of"),
+		OPT_INTEGER(0, "size", &data_size, "bytes of data to delta and diff"),
+		OPT_BOOLEAN(0, "repo", &use_repo, "use the current repository"),
+		OPT_END(),
+	};
+	int i, j, run_all;
+
+	argc = parse_options(argc, argv, options, usage, 0);
+	if (count < 1 || rounds < 1 || data_size < 64)
+		usage_with_options(usage, options);
+	for (i = 0; i < argc; i++) {
+		for (j = 0; j < ARRAY_SIZE(benchmarks); j++)
+			if (!strcmp(argv[i], benchmarks[j].name))
+				break;
+		if (j == ARRAY_SIZE(benchmarks))
+			die("unknown benchmark '%s'", argv[i]);
+	}
+
+	if (use_repo) {
+		setup_git_directory();
+		load_keys();
+	} else {
+		generate_keys();
+	}
+	sort_keys();
+
+	printf("# benchmark\tops\tns/op\tallocs/op\tbytes/op\n");
+	run_all = !argc;
+	for (j = 0; j < ARRAY_SIZE(benchmarks); j++) {
+		for (i = 0; !run_all && i < argc; i++)
+			if (!strcmp(argv[i], benchmarks[j].name))
+				break;
+		if (run_all || i < argc)
+			benchmarks[j].fn();
+	}
+	return 0;
+}
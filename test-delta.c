@@ -13,7 +13,77 @@
 #include "cache.h"
 
 static const char usage_str[] =
-	"test-delta (-d|-p) <from_file> <data_file> <out_file>";
+	"test-delta (-d|-p) <from_file> <data_file> <out_file>\n"
+	"   or: test-delta --bench <from_file> <data_file> [<rounds>]";
+
+static double elapsed(struct timeval *start)
+{
+	struct timeval now;
+	gettimeofday(&now, NULL);
+	return (now.tv_sec - start->tv_sec) +
+		(now.tv_usec - start->tv_usec) / 1e6;
+}
+
+static void report(const char *what, unsigned long bytes, double secs)
+{
+	printf("%-12s %8.1f MB/s\n", what,
+	       secs > 0 ? bytes / secs / (1024 * 1024) : 0.0);
+}
+
+/*
+ * Index <from_file>, make a delta against it for <data_file> and
+ * apply that again, "rounds" times each, and report the throughput
+ * of each step over the size of the buffer it works on.  The delta
+ * must of course give <data_file> back.
+ */
+static int bench(void *from_buf, unsigned long from_size,
+		 void *data_buf, unsigned long data_size, int rounds)
+{
+	struct delta_index *index = NULL;
+	void *delta = NULL, *out = NULL;
+	unsigned long delta_size, out_size;
+	struct timeval start;
+	int r;
+
+	if (rounds < 1)
+		rounds = 1;
+	gettimeofday(&start, NULL);
+	for (r = 0; r < rounds; r++) {
+		free_delta_index(index);
+		index = create_delta_index(from_buf, from_size);
+		if (!index)
+			die("create_delta_index failed");
+	}
+	report("index", from_size * rounds, elapsed(&start));
+
+	gettimeofday(&start, NULL);
+	for (r = 0; r < rounds; r++) {
+		free(delta);
+		delta = create_delta(index, data_buf, data_size,
+				     &delta_size, 0);
+		if (!delta)
+			die("create_delta failed");
+	}
+	report("delta", data_size * rounds, elapsed(&start));
+
+	gettimeofday(&start, NULL);
+	for (r = 0; r < rounds; r++) {
+		free(out);
+		out = patch_delta(from_buf, from_size, delta, delta_size,
+				  &out_size);
+		if (!out)
+			die("patch_delta failed");
+	}
+	report("patch", data_size * rounds, elapsed(&start));
+
+	printf("delta size   %lu\n", delta_size);
+	if (out_size != data_size || memcmp(out, data_buf, data_size))
+		die("delta does not give the data back");
+	free_delta_index(index);
+	free(delta);
+	free(out);
+	return 0;
+}
 
 int main(int argc, char *argv[])
 {
@@ -21,8 +91,10 @@ int main(int argc, char *argv[])
 	struct stat st;
 	void *from_buf, *data_buf, *out_buf;
 	unsigned long from_size, data_size, out_size;
+	int benchmark = argc >= 4 && argc <= 5 && !strcmp(argv[1], "--bench");
 
-	if (argc != 5 || (strcmp(argv[1], "-d") && strcmp(argv[1], "-p"))) {
+	if (!benchmark &&
+	    (argc != 5 || (strcmp(argv[1], "-d") && strcmp(argv[1], "-p")))) {
 		fprintf(stderr, "Usage: %s\n", usage_str);
 		return 1;
 	}
@@ -55,6 +127,10 @@ int main(int argc, char *argv[])
 	}
 	close(fd);
 
+	if (benchmark)
+		return bench(from_buf, from_size, data_buf, data_size,
+			     argc == 5 ? atoi(argv[4]) : 10);
+
 	if (argv[1][1] == 'd')
 		out_buf = diff_delta(from_buf, from_size,
 				     data_buf, data_size,
@@ -0,0 +1,174 @@
+/*
+ * Generate a reproducible fast-import stream describing a repository
+ * of a given shape, for the performance tests under t/perf.
+ *
+ * The pseudo-random sequence is the one used by test-genrandom, so
+ * the same seed and options always give the same history.
+ */
+
+#include "cache.h"
+#include "parse-options.h"
+
+static int nr_commits = 100;
+static int nr_files = 1000;
+static int depth = 2;
+static int fanout = 10;
+static int nr_lines = 40;
+static int nr_changes = 10;
+static int nr_refs = 0;
+static const char *seed = "genrepo";
+
+static unsigned long next, seed_base;
+
+static unsigned long genrandom(void)
+{
+	next = next * 1103515245 + 12345;
+	return (next >> 16) & 0x7fff;
+}
+
+static void seed_random(const char *s)
+{
+	const unsigned char *c = (const unsigned char *)s;
+
+	next = 0;
+	do {
+		next = next * 11 + *c;
+	} while (*c++);
+	seed_base = next;
+}
+
+static unsigned long line_value(int file, int line, int version)
+{
+	unsigned long save = next, v;
+
+	next = seed_base * 11 + file;
+	next = next * 11 + line;
+	next = next * 11 + version;
+	v = genrandom() << 15 | genrandom();
+	next = save;
+	return v;
+}
+
+static void file_path(struct strbuf *path, int file)
+{
+	int level, leaf = file, span = 1;
+
+	for (level = 0; level < depth; level++)
+		span *= fanout;
+	leaf %= span;
+	strbuf_reset(path);
+	for (level = 0; level < depth; level++) {
+		span /= fanout;
+		strbuf_addf(path, "d%02d/", (leaf / span) % fanout);
+	}
+	strbuf_addf(path, "file%06d.txt", file);
+}
+
+/*
+ * Each change to a file rewrites the line picked by its version, so
+ * consecutive revisions of a file differ in a couple of lines and
+ * delta well against each other, as real source files do.
+ */
+static void file_contents(struct strbuf *buf, int file, int version)
+{
+	int line, changed = version ? version % nr_lines : -1;
+
+	strbuf_reset(buf);
+	for (line = 0; line < nr_lines; line++)
+		strbuf_addf(buf, "%06d:%04d %08lx %08lx\n", file, line,
+			    line_value(file, line, 0),
+			    line == changed ?
+			    line_value(file, line, version) : 0);
+}
+
+static void emit_file(struct strbuf *path, struct strbuf *buf,
+		      int file, int version)
+{
+	file_path(path, file);
+	file_contents(buf, file, version);
+	printf("M 100644 inline %s\ndata %lu\n", path->buf,
+	       (unsigned long)buf->len);
+	fwrite(buf->buf, 1, buf->len, stdout);
+	putchar('\n');
+}
+
+static void emit_commit(int n, int *version)
+{
+	static struct strbuf path = STRBUF_INIT, buf = STRBUF_INIT;
+	unsigned long date = 1234567890UL + n * 60UL;
+	int i;
+
+	printf("commit refs/heads/master\nmark :%d\n", n + 1);
+	printf("author A U Thor <author@example.com> %lu +0000\n", date);
+	printf("committer C O Mitter <committer@example.com> %lu +0000\n",
+	       date);
+	strbuf_reset(&buf);
+	strbuf_addf(&buf, "commit %d\n", n + 1);
+	printf("data %lu\n%s", (unsigned long)buf.len, buf.buf);
+	if (n)
+		printf("from :%d\n", n);
+
+	if (!n) {
+		for (i = 0; i < nr_files; i++)
+			emit_file(&path, &buf, i, 0);
+	} else {
+		for (i = 0; i < nr_changes; i++) {
+			int file = (genrandom() << 15 | genrandom()) % nr_files;
+			emit_file(&path, &buf, file, ++version[file]);
+		}
+	}
+	putchar('\n');
+}
+
+/*
+ * Spread the refs evenly over the history, alternating between
+ * branches and lightweight tags.
+ */
+static void emit_refs(void)
+{
+	int i;
+
+	for (i = 0; i < nr_refs; i++) {
+		int mark = 1 + (int)((double)i * nr_commits / nr_refs);
+		if (i & 1)
+			printf("reset refs/tags/tag-%06d\n", i);
+		else
+			printf("reset refs/heads/branch-%06d\n", i);
+		printf("from :%d\n\n", mark);
+	}
+}
+
+int main(int argc, const char **argv)
+{
+	const char *usage[] = {
+		"test-genrepo [options] | git fast-import",
+		NULL
+	};
+	struct option options[] = {
+		OPT_INTEGER(0, "commits", &nr_commits, "number of commits"),
+		OPT_INTEGER(0, "files", &nr_files, "number of files"),
+		OPT_INTEGER(0, "depth", &depth, "directory levels above each file"),
+		OPT_INTEGER(0, "fanout", &fanout, "subdirectories per directory"),
+		OPT_INTEGER(0, "lines", &nr_lines, "lines per file"),
+		OPT_INTEGER(0, "changes", &nr_changes, "files changed per commit"),
+		OPT_INTEGER(0, "refs", &nr_refs, "branches and tags to create"),
+		OPT_STRING(0, "seed", &seed, "string", "random seed"),
+		OPT_END(),
+	};
+	int *version, i;
+
+	argc = parse_options(argc, argv, options, usage, 0);
+	if (argc)
+		usage_with_options(usage, options);
+	if (nr_commits < 1 || nr_files < 1 || nr_lines < 1 ||
+	    depth < 0 || fanout < 1 || nr_changes < 0 || nr_refs < 0)
+		die("counts must be positive");
+
+	seed_random(seed);
+	version = xcalloc(nr_files, sizeof(*version));
+	for (i = 0; i < nr_commits; i++)
+		emit_commit(i, version);
+	emit_refs();
+	free(version);
+	return 0;
+}
@@ -3,6 +3,11 @@
 dd if=/dev/zero bs=1048576 count=100 2>/dev/null |
 /usr/bin/time ./test-sha1 >/dev/null
 
+for size in 100 4096 65536
+do
+	./test-sha1 --bench 10 $size >/dev/null || exit 1
+done
+
 while read expect cnt pfx
 do
 	case "$expect" in '#'*) continue ;; esac
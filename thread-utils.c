@@ -1,4 +1,5 @@
 #include "cache.h"
+#include "thread-utils.h"
 
 #ifdef _WIN32
 #  define WIN32_LEAN_AND_MEAN
@@ -46,3 +47,60 @@ int online_cpus(void)
 
 	return 1;
 }
+
+void thread_queue_init(struct thread_queue *q, int size)
+{
+	pthread_mutex_init(&q->mutex, NULL);
+	pthread_cond_init(&q->cond, NULL);
+	q->item = xcalloc(size, sizeof(*q->item));
+	q->size = size;
+	q->head = q->nr = q->closed = 0;
+}
+
+void thread_queue_release(struct thread_queue *q)
+{
+	pthread_mutex_destroy(&q->mutex);
+	pthread_cond_destroy(&q->cond);
+	free(q->item);
+	q->item = NULL;
+}
+
+int thread_queue_push(struct thread_queue *q, void *item)
+{
+	pthread_mutex_lock(&q->mutex);
+	while (q->nr == q->size && !q->closed)
+		pthread_cond_wait(&q->cond, &q->mutex);
+	if (q->closed) {
+		pthread_mutex_unlock(&q->mutex);
+		return -1;
+	}
+	q->item[(q->head + q->nr++) % q->size] = item;
+	pthread_cond_broadcast(&q->cond);
+	pthread_mutex_unlock(&q->mutex);
+	return 0;
+}
+
+void *thread_queue_pop(struct thread_queue *q)
+{
+	void *item = NULL;
+
+	pthread_mutex_lock(&q->mutex);
+	while (!q->nr && !q->closed)
+		pthread_cond_wait(&q->cond, &q->mutex);
+	if (q->nr) {
+		item = q->item[q->head];
+		q->head = (q->head + 1) % q->size;
+		q->nr--;
+		pthread_cond_broadcast(&q->cond);
+	}
+	pthread_mutex_unlock(&q->mutex);
+	return item;
+}
+
+void thread_queue_close(struct thread_queue *q)
+{
+	pthread_mutex_lock(&q->mutex);
+	q->closed = 1;
+	pthread_cond_broadcast(&q->cond);
+	pthread_mutex_unlock(&q->mutex);
+}
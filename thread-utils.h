@@ -1,6 +1,28 @@
 #ifndef THREAD_COMPAT_H
 #define THREAD_COMPAT_H
 
+#include <pthread.h>
+
 extern int online_cpus(void);
 
+/*
+ * A bounded first-in first-out queue of pointers, for handing work
+ * from one thread to another.  thread_queue_push() waits while the
+ * queue is full and thread_queue_pop() while it is empty.  Once the
+ * queue has been closed, pushing fails and popping returns what is
+ * left, then NULL.
+ */
+struct thread_queue {
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	void **item;
+	int size, head, nr, closed;
+};
+
+extern void thread_queue_init(struct thread_queue *q, int size);
+extern void thread_queue_release(struct thread_queue *q);
+extern int thread_queue_push(struct thread_queue *q, void *item);
+extern void *thread_queue_pop(struct thread_queue *q);
+extern void thread_queue_close(struct thread_queue *q);
+
 #endif /* THREAD_COMPAT_H */
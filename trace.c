@@ -25,10 +25,10 @@
 #include "cache.h"
 #include "quote.h"
 
-/* Get a trace file descriptor from GIT_TRACE env variable. */
-static int get_trace_fd(int *need_close)
+/* Get a trace file descriptor from the "key" env variable, e.g. GIT_TRACE. */
+static int get_trace_fd(const char *key, int *need_close)
 {
-	char *trace = getenv("GIT_TRACE");
+	char *trace = getenv(key);
 
 	if (!trace || !strcmp(trace, "") ||
 	    !strcmp(trace, "0") || !strcasecmp(trace, "false"))
@@ -50,37 +50,37 @@ static int get_trace_fd(int *need_close)
 		return fd;
 	}
 
-	fprintf(stderr, "What does '%s' for GIT_TRACE mean?\n", trace);
+	fprintf(stderr, "What does '%s' for %s mean?\n", trace, key);
 	fprintf(stderr, "If you want to trace into a file, "
-		"then please set GIT_TRACE to an absolute pathname "
-		"(starting with /).\n");
+		"then please set %s to an absolute pathname "
+		"(starting with /).\n", key);
 	fprintf(stderr, "Defaulting to tracing on stderr...\n");
 
 	return STDERR_FILENO;
 }
 
 static const char err_msg[] = "Could not trace into fd given by "
-	"GIT_TRACE environment variable";
+	"GIT_TRACE* environment variable";
 
-void trace_printf(const char *fmt, ...)
+static void trace_vprintf(const char *key, const char *fmt, va_list ap)
 {
 	struct strbuf buf;
-	va_list ap;
+	va_list cp;
 	int fd, len, need_close = 0;
 
-	fd = get_trace_fd(&need_close);
+	fd = get_trace_fd(key, &need_close);
 	if (!fd)
 		return;
 
 	strbuf_init(&buf, 64);
-	va_start(ap, fmt);
-	len = vsnprintf(buf.buf, strbuf_avail(&buf), fmt, ap);
-	va_end(ap);
+	va_copy(cp, ap);
+	len = vsnprintf(buf.buf, strbuf_avail(&buf), fmt, cp);
+	va_end(cp);
 	if (len >= strbuf_avail(&buf)) {
 		strbuf_grow(&buf, len - strbuf_avail(&buf) + 128);
-		va_start(ap, fmt);
-		len = vsnprintf(buf.buf, strbuf_avail(&buf), fmt, ap);
-		va_end(ap);
+		va_copy(cp, ap);
+		len = vsnprintf(buf.buf, strbuf_avail(&buf), fmt, cp);
+		va_end(cp);
 		if (len >= strbuf_avail(&buf))
 			die("broken vsnprintf");
 	}
@@ -93,13 +93,41 @@ void trace_printf(const char *fmt, ...)
 		close(fd);
 }
 
+void trace_printf(const char *fmt, ...)
+{
+	va_list ap;
+
+	va_start(ap, fmt);
+	trace_vprintf("GIT_TRACE", fmt, ap);
+	va_end(ap);
+}
+
+void trace_printf_key(const char *key, const char *fmt, ...)
+{
+	va_list ap;
+
+	va_start(ap, fmt);
+	trace_vprintf(key, fmt, ap);
+	va_end(ap);
+}
+
+int trace_want(const char *key)
+{
+	const char *trace = getenv(key);
+
+	if (!trace || !strcmp(trace, "") ||
+	    !strcmp(trace, "0") || !strcasecmp(trace, "false"))
+		return 0;
+	return 1;
+}
+
 void trace_argv_printf(const char **argv, const char *fmt, ...)
 {
 	struct strbuf buf;
 	va_list ap;
 	int fd, len, need_close = 0;
 
-	fd = get_trace_fd(&need_close);
+	fd = get_trace_fd("GIT_TRACE", &need_close);
 	if (!fd)
 		return;
 
@@ -125,3 +153,168 @@ void trace_argv_printf(const char **argv, const char *fmt, ...)
 	if (need_close)
 		close(fd);
 }
+
+/*
+ * GIT_TRACE_PERFORMANCE: regions of a command, which may nest, are
+ * reported with the wall clock and CPU time spent in them, one JSON
+ * object per line, along with counters the code cares to report.
+ * Only the main thread may enter and leave regions.
+ */
+#define PERF_TRACE "GIT_TRACE_PERFORMANCE"
+#define PERF_MAX_DEPTH 32
+
+static int perf_fd = -1;
+static int perf_depth;
+static struct perf_region {
+	const char *category, *label;
+	uint64_t wall, cpu;
+} perf_region[PERF_MAX_DEPTH];
+static uint64_t perf_start_wall, perf_start_cpu;
+
+static uint64_t perf_wall_usec(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return (uint64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+static uint64_t perf_cpu_usec(void)
+{
+	return (uint64_t)clock() * 1000000 / CLOCKS_PER_SEC;
+}
+
+static void perf_quote(struct strbuf *buf, const char *s)
+{
+	strbuf_addch(buf, '"');
+	for (; *s; s++) {
+		unsigned char c = *s;
+		if (c == '"' || c == '\\')
+			strbuf_addf(buf, "\\%c", c);
+		else if (c < 0x20)
+			strbuf_addf(buf, "\\u%04x", c);
+		else
+			strbuf_addch(buf, c);
+	}
+	strbuf_addch(buf, '"');
+}
+
+static int perf_begin(struct strbuf *buf, const char *event)
+{
+	if (perf_fd < 0) {
+		int need_close = 0;
+		perf_fd = get_trace_fd(PERF_TRACE, &need_close);
+		perf_start_wall = perf_wall_usec();
+		perf_start_cpu = perf_cpu_usec();
+	}
+	if (!perf_fd)
+		return 0;
+	strbuf_init(buf, 128);
+	strbuf_addf(buf, "{\"event\":\"%s\",\"pid\":%"PRIuMAX","
+		    "\"time_us\":%"PRIuMAX",\"depth\":%d",
+		    event, (uintmax_t)getpid(),
+		    (uintmax_t)perf_wall_usec(), perf_depth);
+	return 1;
+}
+
+static void perf_end(struct strbuf *buf)
+{
+	strbuf_addstr(buf, "}\n");
+	write_or_whine_pipe(perf_fd, buf->buf, buf->len, err_msg);
+	strbuf_release(buf);
+}
+
+static void perf_add_region(struct strbuf *buf, const char *category,
+			    const char *label)
+{
+	strbuf_addstr(buf, ",\"category\":");
+	perf_quote(buf, category);
+	strbuf_addstr(buf, ",\"label\":");
+	perf_quote(buf, label);
+}
+
+static void trace_performance_exit(void)
+{
+	struct strbuf buf;
+
+	while (perf_depth)
+		trace_region_leave(perf_region[perf_depth - 1].category,
+				   perf_region[perf_depth - 1].label);
+	if (!perf_begin(&buf, "exit"))
+		return;
+	strbuf_addf(&buf, ",\"wall_us\":%"PRIuMAX",\"cpu_us\":%"PRIuMAX,
+		    (uintmax_t)(perf_wall_usec() - perf_start_wall),
+		    (uintmax_t)(perf_cpu_usec() - perf_start_cpu));
+	perf_end(&buf);
+}
+
+void trace_performance_start(const char **argv)
+{
+	struct strbuf buf;
+	int i;
+
+	if (!perf_begin(&buf, "start"))
+		return;
+	strbuf_addstr(&buf, ",\"argv\":[");
+	for (i = 0; argv[i]; i++) {
+		if (i)
+			strbuf_addch(&buf, ',');
+		perf_quote(&buf, argv[i]);
+	}
+	strbuf_addch(&buf, ']');
+	perf_end(&buf);
+	atexit(trace_performance_exit);
+}
+
+void trace_region_enter(const char *category, const char *label)
+{
+	struct strbuf buf;
+	struct perf_region *r;
+
+	if (!perf_begin(&buf, "region_enter"))
+		return;
+	perf_add_region(&buf, category, label);
+	perf_end(&buf);
+	if (perf_depth == PERF_MAX_DEPTH)
+		die("too deeply nested trace regions");
+	r = &perf_region[perf_depth++];
+	r->category = category;
+	r->label = label;
+	r->wall = perf_wall_usec();
+	r->cpu = perf_cpu_usec();
+}
+
+void trace_region_leave(const char *category, const char *label)
+{
+	struct strbuf buf;
+	struct perf_region *r;
+
+	if (!perf_fd || perf_fd < 0 || !perf_depth)
+		return;
+	r = &perf_region[perf_depth - 1];
+	if (strcmp(r->category, category) || strcmp(r->label, label))
+		die("BUG: leaving trace region %s/%s inside %s/%s",
+		    category, label, r->category, r->label);
+	perf_depth--;
+	if (!perf_begin(&buf, "region_leave"))
+		return;
+	perf_add_region(&buf, category, label);
+	strbuf_addf(&buf, ",\"wall_us\":%"PRIuMAX",\"cpu_us\":%"PRIuMAX,
+		    (uintmax_t)(perf_wall_usec() - r->wall),
+		    (uintmax_t)(perf_cpu_usec() - r->cpu));
+	perf_end(&buf);
+}
+
+void trace_counter(const char *category, const char *name, uintmax_t value)
+{
+	struct strbuf buf;
+
+	if (!perf_begin(&buf, "counter"))
+		return;
+	strbuf_addstr(&buf, ",\"category\":");
+	perf_quote(&buf, category);
+	strbuf_addstr(&buf, ",\"name\":");
+	perf_quote(&buf, name);
+	strbuf_addf(&buf, ",\"value\":%"PRIuMAX, value);
+	perf_end(&buf);
+}
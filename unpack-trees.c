@@ -87,6 +87,7 @@ static int check_updates(struct unpack_trees_options *o)
 		cnt = 0;
 	}
 
+	trace_region_enter("unpack_trees", "check_updates");
 	if (o->update)
 		git_attr_set_direction(GIT_ATTR_CHECKOUT, &o->result);
 	for (i = 0; i < index->cache_nr; i++) {
@@ -115,6 +116,8 @@ static int check_updates(struct unpack_trees_options *o)
 	stop_progress(&progress);
 	if (o->update)
 		git_attr_set_direction(GIT_ATTR_CHECKIN, NULL);
+	trace_counter("unpack_trees", "updated", cnt);
+	trace_region_leave("unpack_trees", "check_updates");
 	return errs != 0;
 }
 
@@ -354,6 +357,7 @@ int unpack_trees(unsigned len, struct tree_desc *t, struct unpack_trees_options
 {
 	int ret;
 	static struct cache_entry *dfc;
+	struct index_state *src_index = o->src_index;
 
 	if (len > MAX_UNPACK_TREES)
 		die("unpack_trees takes at most %d trees", MAX_UNPACK_TREES);
@@ -368,6 +372,11 @@ int unpack_trees(unsigned len, struct tree_desc *t, struct unpack_trees_options
 	if (o->src_index) {
 		o->result.timestamp.sec = o->src_index->timestamp.sec;
 		o->result.timestamp.nsec = o->src_index->timestamp.nsec;
+		o->result.fsmonitor_last_update =
+			o->src_index->fsmonitor_last_update;
+		/* so that it can be written against the same shared index */
+		o->result.split_index =
+			share_split_index(o->src_index->split_index);
 	}
 	o->merge_size = len;
 
@@ -401,8 +410,13 @@ int unpack_trees(unsigned len, struct tree_desc *t, struct unpack_trees_options
 
 	o->src_index = NULL;
 	ret = check_updates(o) ? (-2) : 0;
-	if (o->dst_index)
+	if (o->dst_index) {
+		if (o->dst_index == src_index) {
+			release_split_index(src_index->split_index);
+			o->result.untracked = src_index->untracked;
+		}
 		*o->dst_index = o->result;
+	}
 	return ret;
 }
 
@@ -26,7 +26,7 @@ static const char upload_pack_usage[] = "git upload-pack [--strict] [--timeout=n
 
 static unsigned long oldest_have;
 
-static int multi_ack, nr_our_refs;
+static int multi_ack, nr_our_refs, shallow_walk;
 static int use_thin_pack, use_ofs_delta, use_include_tag;
 static int no_progress;
 static struct object_array have_obj;
@@ -142,6 +142,29 @@ static int do_rev_list(int fd, void *create_full_pack)
 	return 0;
 }
 
+/*
+ * Without shallow commits to cut the history at, pack-objects can do
+ * the walk itself, and use the reachability bitmaps when there are.
+ */
+static int feed_pack_objects(int fd, void *create_full_pack)
+{
+	FILE *out = fdopen(fd, "w");
+	int i;
+
+	if (!create_full_pack) {
+		for (i = 0; i < want_obj.nr; i++)
+			fprintf(out, "%s\n",
+				sha1_to_hex(want_obj.objects[i].item->sha1));
+		fputs("--not\n", out);
+		for (i = 0; i < have_obj.nr; i++)
+			fprintf(out, "%s\n",
+				sha1_to_hex(have_obj.objects[i].item->sha1));
+	}
+	if (fclose(out))
+		return error("unable to feed the object list to pack-objects");
+	return 0;
+}
+
 static void create_pack_file(void)
 {
 	struct async rev_list;
@@ -155,7 +178,7 @@ static void create_pack_file(void)
 	const char *argv[10];
 	int arg = 0;
 
-	rev_list.proc = do_rev_list;
+	rev_list.proc = shallow_walk ? do_rev_list : feed_pack_objects;
 	/* .data is just a boolean: any non-NULL value will do */
 	rev_list.data = create_full_pack ? &rev_list : NULL;
 	if (start_async(&rev_list))
@@ -169,6 +192,13 @@ static void create_pack_file(void)
 		argv[arg++] = "--delta-base-offset";
 	if (use_include_tag)
 		argv[arg++] = "--include-tag";
+	if (!shallow_walk) {
+		argv[arg++] = "--revs";
+		if (create_full_pack)
+			argv[arg++] = "--all";
+		else if (use_thin_pack)
+			argv[arg++] = "--thin";
+	}
 	argv[arg++] = NULL;
 
 	memset(&pack_objects, 0, sizeof(pack_objects));
@@ -523,6 +553,7 @@ static void receive_needs(void)
 		write_in_full(debug_fd, "#E\n", 3);
 	if (depth == 0 && shallows.nr == 0)
 		return;
+	shallow_walk = 1;
 	if (depth > 0) {
 		struct commit_list *result, *backup;
 		int i;
@@ -254,6 +254,7 @@ static void wt_status_print_untracked(struct wt_status *s)
 		dir.flags |=
 			DIR_SHOW_OTHER_DIRECTORIES | DIR_HIDE_EMPTY_DIRECTORIES;
 	setup_standard_excludes(&dir);
+	use_untracked_cache(&dir);
 
 	read_directory(&dir, ".", "", 0, NULL);
 	for(i = 0; i < dir.nr; i++) {
@@ -343,13 +344,19 @@ void wt_status_print(struct wt_status *s)
 		color_fprintf_ln(s->fp, color(WT_STATUS_HEADER), "#");
 	}
 
+	trace_region_enter("status", "updated");
 	wt_status_print_updated(s);
+	trace_region_leave("status", "updated");
+	trace_region_enter("status", "changed");
 	wt_status_print_changed(s);
+	trace_region_leave("status", "changed");
 	if (wt_status_submodule_summary)
 		wt_status_print_submodule_summary(s);
-	if (show_untracked_files)
+	if (show_untracked_files) {
+		trace_region_enter("status", "untracked");
 		wt_status_print_untracked(s);
-	else if (s->commitable)
+		trace_region_leave("status", "untracked");
+	} else if (s->commitable)
 		 fprintf(s->fp, "# Untracked files not listed (use -u option to show untracked files)\n");
 
 	if (s->verbose)
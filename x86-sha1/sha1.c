@@ -0,0 +1,390 @@
+/*
+ * SHA-1 implementation for x86 and x86-64.
+ *
+ * Whole blocks are handed to one of three transforms:
+ *
+ *  - sha1_blocks_shani() uses the SHA extensions (SHA-NI) found on
+ *    recent CPUs, and is used for everything when they are present;
+ *
+ *  - sha1_blocks_x4() hashes one block of four independent streams
+ *    at a time in the lanes of SSE2 registers; x86_SHA1_Multi() uses
+ *    it when there are no SHA extensions;
+ *
+ *  - sha1_blocks_c() is portable C for everything else.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "sha1.h"
+
+#if defined(__GNUC__) && (__GNUC__ >= 5 || defined(__clang__)) && \
+	(defined(__x86_64__) || defined(__i386__))
+#define X86_SHA1_SIMD
+#include <cpuid.h>
+#include <immintrin.h>
+#endif
+
+typedef void (*sha1_blocks_fn)(uint32_t *hash, const unsigned char *p,
+			       unsigned long blocks);
+
+static inline uint32_t get_be32(const unsigned char *p)
+{
+	return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 |
+		(uint32_t)p[2] << 8 | (uint32_t)p[3];
+}
+
+static inline uint32_t rol(uint32_t x, int n)
+{
+	return (x << n) | (x >> (32 - n));
+}
+
+static void sha1_blocks_c(uint32_t *hash, const unsigned char *p,
+			  unsigned long blocks)
+{
+	uint32_t W[80], A, B, C, D, E, T;
+	int t;
+
+	while (blocks--) {
+		for (t = 0; t < 16; t++)
+			W[t] = get_be32(p + 4 * t);
+		for (t = 16; t < 80; t++)
+			W[t] = rol(W[t-3] ^ W[t-8] ^ W[t-14] ^ W[t-16], 1);
+
+		A = hash[0];
+		B = hash[1];
+		C = hash[2];
+		D = hash[3];
+		E = hash[4];
+		for (t = 0; t < 80; t++) {
+			T = rol(A, 5) + E + W[t];
+			if (t < 20)
+				T += ((B & C) | (~B & D)) + 0x5a827999;
+			else if (t < 40)
+				T += (B ^ C ^ D) + 0x6ed9eba1;
+			else if (t < 60)
+				T += ((B & C) | (B & D) | (C & D)) + 0x8f1bbcdc;
+			else
+				T += (B ^ C ^ D) + 0xca62c1d6;
+			E = D;
+			D = C;
+			C = rol(B, 30);
+			B = A;
+			A = T;
+		}
+		hash[0] += A;
+		hash[1] += B;
+		hash[2] += C;
+		hash[3] += D;
+		hash[4] += E;
+		p += 64;
+	}
+}
+
+#ifdef X86_SHA1_SIMD
+
+static int have_sse2, have_shani;
+
+/*
+ * GIT_X86_SHA1=c or GIT_X86_SHA1=sse2 in the environment hides the
+ * CPU features the other transforms need, so that they can be
+ * tested and compared on any machine.
+ */
+static void check_cpu(void)
+{
+	const char *force = getenv("GIT_X86_SHA1");
+	unsigned int eax, ebx, ecx, edx;
+
+	if (force && !strcmp(force, "c"))
+		return;
+	if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+		return;
+	have_sse2 = (edx >> 26) & 1;
+	if (force && !strcmp(force, "sse2"))
+		return;
+	/* SHA-NI code also needs SSSE3 and SSE4.1 */
+	if (!((ecx >> 9) & 1) || !((ecx >> 19) & 1))
+		return;
+	if (__get_cpuid_max(0, NULL) < 7)
+		return;
+	__cpuid_count(7, 0, eax, ebx, ecx, edx);
+	have_shani = (ebx >> 29) & 1;
+}
+
+/*
+ * Four rounds, the "i"-th group of 80.  The message schedule for
+ * later groups is computed in msg[] as we go: msg[i % 4] holds
+ * W[4i..4i+3] when group i runs.
+ */
+#define SHANI_ROUNDS4(i) do { \
+	if ((i) < 4) \
+		msg[(i)] = _mm_shuffle_epi8(_mm_loadu_si128( \
+			(const __m128i *)(p + 16 * (i))), bswap); \
+	if ((i) == 0) \
+		e[0] = _mm_add_epi32(e[0], msg[0]); \
+	else \
+		e[(i) % 2] = _mm_sha1nexte_epu32(e[(i) % 2], msg[(i) % 4]); \
+	e[((i) + 1) % 2] = abcd; \
+	if ((i) >= 3 && (i) <= 18) \
+		msg[((i) + 1) % 4] = _mm_sha1msg2_epu32(msg[((i) + 1) % 4], \
+							msg[(i) % 4]); \
+	abcd = _mm_sha1rnds4_epu32(abcd, e[(i) % 2], (i) / 5); \
+	if ((i) >= 1 && (i) <= 16) \
+		msg[((i) + 3) % 4] = _mm_sha1msg1_epu32(msg[((i) + 3) % 4], \
+							msg[(i) % 4]); \
+	if ((i) >= 2 && (i) <= 17) \
+		msg[((i) + 2) % 4] = _mm_xor_si128(msg[((i) + 2) % 4], \
+						   msg[(i) % 4]); \
+} while (0)
+
+__attribute__((target("sha,sse4.1")))
+static void sha1_blocks_shani(uint32_t *hash, const unsigned char *p,
+			      unsigned long blocks)
+{
+	const __m128i bswap = _mm_set_epi64x(0x0001020304050607ULL,
+					     0x08090a0b0c0d0e0fULL);
+	__m128i abcd, abcd_save, e_save, e[2], msg[4];
+
+	abcd = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)hash), 0x1b);
+	e[0] = _mm_set_epi32(hash[4], 0, 0, 0);
+
+	while (blocks--) {
+		abcd_save = abcd;
+		e_save = e[0];
+
+		SHANI_ROUNDS4(0);  SHANI_ROUNDS4(1);
+		SHANI_ROUNDS4(2);  SHANI_ROUNDS4(3);
+		SHANI_ROUNDS4(4);  SHANI_ROUNDS4(5);
+		SHANI_ROUNDS4(6);  SHANI_ROUNDS4(7);
+		SHANI_ROUNDS4(8);  SHANI_ROUNDS4(9);
+		SHANI_ROUNDS4(10); SHANI_ROUNDS4(11);
+		SHANI_ROUNDS4(12); SHANI_ROUNDS4(13);
+		SHANI_ROUNDS4(14); SHANI_ROUNDS4(15);
+		SHANI_ROUNDS4(16); SHANI_ROUNDS4(17);
+		SHANI_ROUNDS4(18); SHANI_ROUNDS4(19);
+
+		e[0] = _mm_sha1nexte_epu32(e[0], e_save);
+		abcd = _mm_add_epi32(abcd, abcd_save);
+		p += 64;
+	}
+
+	_mm_storeu_si128((__m128i *)hash, _mm_shuffle_epi32(abcd, 0x1b));
+	hash[4] = _mm_extract_epi32(e[0], 3);
+}
+
+#define X4_ROL(x, n) \
+	_mm_or_si128(_mm_slli_epi32((x), (n)), _mm_srli_epi32((x), 32 - (n)))
+
+/*
+ * One block of each of four streams: lane "i" of every register
+ * belongs to hash[i] and p[i].
+ */
+__attribute__((target("sse2")))
+static void sha1_blocks_x4(uint32_t **hash, const unsigned char **p)
+{
+	__m128i W[16], A, B, C, D, E, T, F;
+	uint32_t out[5][4];
+	int i, t;
+
+	for (t = 0; t < 16; t++)
+		W[t] = _mm_set_epi32(get_be32(p[3] + 4 * t),
+				     get_be32(p[2] + 4 * t),
+				     get_be32(p[1] + 4 * t),
+				     get_be32(p[0] + 4 * t));
+	A = _mm_set_epi32(hash[3][0], hash[2][0], hash[1][0], hash[0][0]);
+	B = _mm_set_epi32(hash[3][1], hash[2][1], hash[1][1], hash[0][1]);
+	C = _mm_set_epi32(hash[3][2], hash[2][2], hash[1][2], hash[0][2]);
+	D = _mm_set_epi32(hash[3][3], hash[2][3], hash[1][3], hash[0][3]);
+	E = _mm_set_epi32(hash[3][4], hash[2][4], hash[1][4], hash[0][4]);
+
+	for (t = 0; t < 80; t++) {
+		if (t >= 16) {
+			T = _mm_xor_si128(_mm_xor_si128(W[(t - 3) & 15],
+							W[(t - 8) & 15]),
+					  _mm_xor_si128(W[(t - 14) & 15],
+							W[t & 15]));
+			W[t & 15] = X4_ROL(T, 1);
+		}
+		if (t < 20)
+			F = _mm_add_epi32(_mm_or_si128(_mm_and_si128(B, C),
+						       _mm_andnot_si128(B, D)),
+					  _mm_set1_epi32(0x5a827999));
+		else if (t < 40)
+			F = _mm_add_epi32(_mm_xor_si128(B, _mm_xor_si128(C, D)),
+					  _mm_set1_epi32(0x6ed9eba1));
+		else if (t < 60)
+			F = _mm_add_epi32(_mm_or_si128(_mm_and_si128(B, C),
+						       _mm_and_si128(D, _mm_or_si128(B, C))),
+					  _mm_set1_epi32(0x8f1bbcdc));
+		else
+			F = _mm_add_epi32(_mm_xor_si128(B, _mm_xor_si128(C, D)),
+					  _mm_set1_epi32(0xca62c1d6));
+		T = _mm_add_epi32(_mm_add_epi32(X4_ROL(A, 5), F),
+				  _mm_add_epi32(E, W[t & 15]));
+		E = D;
+		D = C;
+		C = X4_ROL(B, 30);
+		B = A;
+		A = T;
+	}
+
+	_mm_storeu_si128((__m128i *)out[0], A);
+	_mm_storeu_si128((__m128i *)out[1], B);
+	_mm_storeu_si128((__m128i *)out[2], C);
+	_mm_storeu_si128((__m128i *)out[3], D);
+	_mm_storeu_si128((__m128i *)out[4], E);
+	for (i = 0; i < 4; i++)
+		for (t = 0; t < 5; t++)
+			hash[i][t] += out[t][i];
+}
+
+#endif
+
+static sha1_blocks_fn sha1_blocks;
+
+static void pick_sha1_blocks(void)
+{
+	sha1_blocks_fn fn = sha1_blocks_c;
+
+#ifdef X86_SHA1_SIMD
+	check_cpu();
+	if (have_shani)
+		fn = sha1_blocks_shani;
+#endif
+	sha1_blocks = fn;
+}
+
+void x86_SHA1_Init(x86_SHA_CTX *c)
+{
+	if (!sha1_blocks)
+		pick_sha1_blocks();
+	c->len = 0;
+	c->hash[0] = 0x67452301;
+	c->hash[1] = 0xefcdab89;
+	c->hash[2] = 0x98badcfe;
+	c->hash[3] = 0x10325476;
+	c->hash[4] = 0xc3d2e1f0;
+}
+
+void x86_SHA1_Update(x86_SHA_CTX *c, const void *data, unsigned long n)
+{
+	const unsigned char *p = data;
+	unsigned int partial = c->len & 0x3f;
+
+	c->len += n;
+	if (partial) {
+		unsigned int fill = 64 - partial;
+		if (n < fill) {
+			memcpy(c->buffer + partial, p, n);
+			return;
+		}
+		memcpy(c->buffer + partial, p, fill);
+		sha1_blocks(c->hash, c->buffer, 1);
+		p += fill;
+		n -= fill;
+	}
+	if (n >= 64) {
+		sha1_blocks(c->hash, p, n / 64);
+		p += n & ~0x3fUL;
+		n &= 0x3f;
+	}
+	if (n)
+		memcpy(c->buffer, p, n);
+}
+
+void x86_SHA1_Final(unsigned char *hash, x86_SHA_CTX *c)
+{
+	static const unsigned char padding[64] = { 0x80, };
+	uint64_t bitlen = c->len << 3;
+	unsigned int i, offset = c->len & 0x3f;
+	unsigned char bits[8];
+
+	for (i = 0; i < 8; i++)
+		bits[i] = bitlen >> (56 - 8 * i);
+	x86_SHA1_Update(c, padding, ((offset < 56) ? 56 : 120) - offset);
+	x86_SHA1_Update(c, bits, 8);
+
+	for (i = 0; i < 5; i++) {
+		hash[4 * i + 0] = c->hash[i] >> 24;
+		hash[4 * i + 1] = c->hash[i] >> 16;
+		hash[4 * i + 2] = c->hash[i] >> 8;
+		hash[4 * i + 3] = c->hash[i];
+	}
+}
+
+#ifdef X86_SHA1_SIMD
+
+/*
+ * Hash the whole blocks of up to four streams together for as long
+ * as at least two of them have one left; an idle lane chews on a
+ * dummy block whose result is thrown away.
+ */
+static void sha1_multi_x4(int nr, x86_SHA_CTX **c,
+			  const unsigned char **p, unsigned long *n)
+{
+	static const unsigned char dummy_block[64];
+	uint32_t dummy_hash[5], *hash[4];
+	const unsigned char *block[4];
+	int i, active;
+
+	for (;;) {
+		active = 0;
+		for (i = 0; i < 4; i++) {
+			if (i < nr && n[i] >= 64) {
+				hash[i] = c[i]->hash;
+				block[i] = p[i];
+				active++;
+			} else {
+				hash[i] = dummy_hash;
+				block[i] = dummy_block;
+			}
+		}
+		if (active < 2)
+			return;
+		sha1_blocks_x4(hash, block);
+		for (i = 0; i < nr; i++) {
+			if (n[i] >= 64) {
+				c[i]->len += 64;
+				p[i] += 64;
+				n[i] -= 64;
+			}
+		}
+	}
+}
+
+#endif
+
+void x86_SHA1_Multi(int nr, x86_SHA_CTX **c,
+		    const void **data, const unsigned long *len)
+{
+#ifdef X86_SHA1_SIMD
+	const unsigned char *p[4];
+	unsigned long n[4];
+	int i, j;
+
+	if (!sha1_blocks)
+		pick_sha1_blocks();
+	if (have_sse2 && !have_shani) {
+		for (i = 0; i < nr; i += 4) {
+			int lanes = nr - i < 4 ? nr - i : 4;
+
+			/* get each stream to a block boundary first */
+			for (j = 0; j < lanes; j++) {
+				unsigned int partial = c[i + j]->len & 0x3f;
+				unsigned long fill = partial ? 64 - partial : 0;
+
+				if (fill > len[i + j])
+					fill = len[i + j];
+				x86_SHA1_Update(c[i + j], data[i + j], fill);
+				p[j] = (const unsigned char *)data[i + j] + fill;
+				n[j] = len[i + j] - fill;
+			}
+			sha1_multi_x4(lanes, c + i, p, n);
+			for (j = 0; j < lanes; j++)
+				x86_SHA1_Update(c[i + j], p[j], n[j]);
+		}
+		return;
+	}
+#endif
+	while (nr--)
+		x86_SHA1_Update(*c++, *data++, *len++);
+}
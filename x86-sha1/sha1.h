@@ -0,0 +1,26 @@
+/*
+ * SHA-1 implementation for x86 and x86-64.
+ *
+ * Uses the SHA extensions when the CPU has them, and portable C
+ * otherwise; the choice is made at run time.
+ */
+
+#include <stdint.h>
+
+typedef struct {
+	uint64_t len;
+	uint32_t hash[5];
+	unsigned char buffer[64];
+} x86_SHA_CTX;
+
+void x86_SHA1_Init(x86_SHA_CTX *c);
+void x86_SHA1_Update(x86_SHA_CTX *c, const void *p, unsigned long n);
+void x86_SHA1_Final(unsigned char *hash, x86_SHA_CTX *c);
+void x86_SHA1_Multi(int nr, x86_SHA_CTX **c,
+		    const void **p, const unsigned long *n);
+
+#define git_SHA_CTX	x86_SHA_CTX
+#define git_SHA1_Init	x86_SHA1_Init
+#define git_SHA1_Update	x86_SHA1_Update
+#define git_SHA1_Final	x86_SHA1_Final
+#define git_SHA1_Multi	x86_SHA1_Multi